@@ -9,6 +9,39 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <cfloat>
+
+// SSE is always there on x64 builds, other targets get the plain glm paths
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE 1
+#include <immintrin.h>
+#endif
+
+// the importer maps model files instead of reading them where the platform allows
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -147,36 +180,499 @@ private:
 
 
 
+// Every buffer, texture, renderbuffer and framebuffer goes through here so there's a running count of what
+// the GPU is holding, by category and by owner. Sizes are what was asked for, the driver pads on top of that.
+// Deleting a name it never handed out (or already deleted) is reported as a double free and skipped, anything
+// still registered at shutdown is reported as a leak.
+class GpuMemory
+{
+public:
+	enum Category
+	{
+		CATEGORY_MESH,			// vertex and index buffers
+		CATEGORY_BUFFER,		// instance data, draw ids, anything else in a buffer
+		CATEGORY_TEXTURE,		// loaded images
+		CATEGORY_RENDER_TARGET,	// shadow maps, scene target, framebuffers
+		CATEGORY_COUNT
+	};
+
+	// called once each time the total goes over the budget
+	typedef void (*BudgetCallback)(size_t usedBytes, size_t budgetBytes);
+
+	GLuint GenBuffer(Category category, const char* owner) { return Gen(OBJECT_BUFFER, category, owner); }
+	GLuint GenTexture(Category category, const char* owner) { return Gen(OBJECT_TEXTURE, category, owner); }
+	GLuint GenRenderbuffer(const char* owner) { return Gen(OBJECT_RENDERBUFFER, CATEGORY_RENDER_TARGET, owner); }
+	GLuint GenFramebuffer(const char* owner) { return Gen(OBJECT_FRAMEBUFFER, CATEGORY_RENDER_TARGET, owner); }
+
+	// after the storage is (re)allocated
+	void SetBufferBytes(GLuint buffer, size_t bytes) { SetBytes(OBJECT_BUFFER, buffer, bytes); }
+	void SetTextureBytes(GLuint texture, size_t bytes) { SetBytes(OBJECT_TEXTURE, texture, bytes); }
+	void SetRenderbufferBytes(GLuint renderbuffer, size_t bytes) { SetBytes(OBJECT_RENDERBUFFER, renderbuffer, bytes); }
+
+	// zero is ignored like glDelete* does, the name is zeroed after
+	void DeleteBuffer(GLuint& buffer) { Delete(OBJECT_BUFFER, buffer); }
+	void DeleteTexture(GLuint& texture) { Delete(OBJECT_TEXTURE, texture); }
+	void DeleteRenderbuffer(GLuint& renderbuffer) { Delete(OBJECT_RENDERBUFFER, renderbuffer); }
+	void DeleteFramebuffer(GLuint& framebuffer) { Delete(OBJECT_FRAMEBUFFER, framebuffer); }
+
+	void SetBudget(size_t bytes, BudgetCallback callback);
+	size_t Bytes(Category category) const;
+	size_t TotalBytes() const;
+	void PrintBreakdown() const;
+	// returns how many objects were never deleted
+	int ReportLeaks() const;
+
+	static const char* CategoryName(Category category);
+	// mip chain of a 2D texture, about a third more than the base level
+	static size_t TextureBytes(int width, int height, int bytesPerTexel, bool mipmapped);
+
+private:
+	// buffers, textures, renderbuffers and framebuffers each have their own GL names
+	enum ObjectType
+	{
+		OBJECT_BUFFER,
+		OBJECT_TEXTURE,
+		OBJECT_RENDERBUFFER,
+		OBJECT_FRAMEBUFFER
+	};
+
+	struct Allocation
+	{
+		ObjectType type;
+		Category category;
+		std::string owner;
+		size_t bytes;
+	};
+
+	static unsigned long long Key(ObjectType type, GLuint name) { return ((unsigned long long)type << 32) | name; }
+	static const char* ObjectName(ObjectType type);
+
+	GLuint Gen(ObjectType type, Category category, const char* owner);
+	void SetBytes(ObjectType type, GLuint name, size_t bytes);
+	void Delete(ObjectType type, GLuint& name);
+
+	// GL calls stay on whichever thread has the context, the lock is for reading the totals from anywhere else
+	mutable std::mutex mutex;
+	std::unordered_map<unsigned long long, Allocation> allocations;
+	size_t categoryBytes[CATEGORY_COUNT] = {};
+	size_t budgetBytes = 0;
+	BudgetCallback budgetCallback = nullptr;
+	bool overBudget = false;
+};
+
+const char* GpuMemory::CategoryName(Category category)
+{
+	switch (category)
+	{
+	case CATEGORY_MESH: return "meshes";
+	case CATEGORY_BUFFER: return "buffers";
+	case CATEGORY_TEXTURE: return "textures";
+	default: return "render targets";
+	}
+}
+
+const char* GpuMemory::ObjectName(ObjectType type)
+{
+	switch (type)
+	{
+	case OBJECT_BUFFER: return "buffer";
+	case OBJECT_TEXTURE: return "texture";
+	case OBJECT_RENDERBUFFER: return "renderbuffer";
+	default: return "framebuffer";
+	}
+}
+
+size_t GpuMemory::TextureBytes(int width, int height, int bytesPerTexel, bool mipmapped)
+{
+	size_t bytes = 0;
+	for (;;)
+	{
+		bytes += (size_t)width * height * bytesPerTexel;
+		if (!mipmapped || (width == 1 && height == 1))
+			return bytes;
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+}
+
+GLuint GpuMemory::Gen(ObjectType type, Category category, const char* owner)
+{
+	GLuint name = 0;
+	switch (type)
+	{
+	case OBJECT_BUFFER: glGenBuffers(1, &name); break;
+	case OBJECT_TEXTURE: glGenTextures(1, &name); break;
+	case OBJECT_RENDERBUFFER: glGenRenderbuffers(1, &name); break;
+	case OBJECT_FRAMEBUFFER: glGenFramebuffers(1, &name); break;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	allocations[Key(type, name)] = { type, category, owner, 0 };
+	return name;
+}
+
+void GpuMemory::SetBytes(ObjectType type, GLuint name, size_t bytes)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto found = allocations.find(Key(type, name));
+	if (found == allocations.end())
+	{
+		std::cout << "ERROR::GPU_MEMORY::UNKNOWN_" << ObjectName(type) << " " << name << std::endl;
+		return;
+	}
+
+	Allocation& allocation = found->second;
+	categoryBytes[allocation.category] -= allocation.bytes;
+	categoryBytes[allocation.category] += bytes;
+	allocation.bytes = bytes;
+
+	size_t total = 0;
+	for (size_t categoryTotal : categoryBytes)
+		total += categoryTotal;
+	bool crossed = budgetBytes && total > budgetBytes && !overBudget;
+	overBudget = budgetBytes && total > budgetBytes;
+	if (!crossed || !budgetCallback)
+		return;
+
+	// outside the lock so the callback can ask for the breakdown
+	BudgetCallback callback = budgetCallback;
+	size_t budget = budgetBytes;
+	lock.unlock();
+	callback(total, budget);
+}
+
+void GpuMemory::Delete(ObjectType type, GLuint& name)
+{
+	if (name == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = allocations.find(Key(type, name));
+		if (found == allocations.end())
+		{
+			std::cout << "ERROR::GPU_MEMORY::DOUBLE_FREE " << ObjectName(type) << " " << name << std::endl;
+			name = 0;
+			return;
+		}
+		categoryBytes[found->second.category] -= found->second.bytes;
+		allocations.erase(found);
+	}
+
+	switch (type)
+	{
+	case OBJECT_BUFFER: glDeleteBuffers(1, &name); break;
+	case OBJECT_TEXTURE: glDeleteTextures(1, &name); break;
+	case OBJECT_RENDERBUFFER: glDeleteRenderbuffers(1, &name); break;
+	case OBJECT_FRAMEBUFFER: glDeleteFramebuffers(1, &name); break;
+	}
+	name = 0;
+}
+
+void GpuMemory::SetBudget(size_t bytes, BudgetCallback callback)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	budgetBytes = bytes;
+	budgetCallback = callback;
+	overBudget = false;
+}
+
+size_t GpuMemory::Bytes(Category category) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return categoryBytes[category];
+}
+
+size_t GpuMemory::TotalBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t total = 0;
+	for (size_t categoryTotal : categoryBytes)
+		total += categoryTotal;
+	return total;
+}
+
+void GpuMemory::PrintBreakdown() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// owners summed within each category, biggest first
+	std::vector<std::pair<std::string, size_t>> owners[CATEGORY_COUNT];
+	size_t total = 0;
+	for (const auto& entry : allocations)
+	{
+		const Allocation& allocation = entry.second;
+		auto& list = owners[allocation.category];
+		auto found = std::find_if(list.begin(), list.end(), [&](const std::pair<std::string, size_t>& owner) { return owner.first == allocation.owner; });
+		if (found == list.end())
+			list.push_back({ allocation.owner, allocation.bytes });
+		else
+			found->second += allocation.bytes;
+		total += allocation.bytes;
+	}
+
+	std::cout << "INFO: GPU memory " << total / 1024 << " KB in " << allocations.size() << " objects";
+	if (budgetBytes)
+		std::cout << ", budget " << budgetBytes / 1024 << " KB";
+	std::cout << std::endl;
+	for (int c = 0; c < CATEGORY_COUNT; c++)
+	{
+		std::cout << "INFO:   " << CategoryName((Category)c) << " " << categoryBytes[c] / 1024 << " KB" << std::endl;
+		std::sort(owners[c].begin(), owners[c].end(), [](const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b) { return a.second > b.second; });
+		for (const auto& owner : owners[c])
+			std::cout << "INFO:     " << owner.first << " " << owner.second / 1024 << " KB" << std::endl;
+	}
+}
+
+int GpuMemory::ReportLeaks() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const auto& entry : allocations)
+	{
+		const Allocation& allocation = entry.second;
+		std::cout << "ERROR::GPU_MEMORY::LEAK " << ObjectName(allocation.type) << " " << (GLuint)entry.first
+			<< " from " << allocation.owner << ", " << allocation.bytes << " bytes" << std::endl;
+	}
+	return (int)allocations.size();
+}
+
+// the classes below allocate through this, it has to exist before any of them
+namespace
+{
+	GpuMemory gGpuMemory;
+}
+
+// Dense pool addressed by 32 bit generational handles, the low 16 bits pick a slot and the high 16 bits are
+// that slot's generation. Items stay packed at the front of one array so walking them is a straight loop,
+// create and destroy are O(1) (destroy moves the last item into the hole) and a handle whose item was
+// destroyed, even if the slot has been reused since, stops resolving instead of finding the new item.
+// 0 is never a live handle. Not synchronized, everything that creates or destroys runs between frames.
+typedef unsigned int ResourceHandle;
+
+template <typename T>
+class ResourcePool
+{
+public:
+	static const unsigned int INDEX_BITS = 16;
+	static const unsigned int INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+	// 0 when all 65536 slots are taken
+	ResourceHandle Create(T item);
+	// false for a stale handle
+	bool Destroy(ResourceHandle handle);
+	// nullptr for a stale handle. Only good until the next Create/Destroy, the items move
+	T* Get(ResourceHandle handle);
+	const T* Get(ResourceHandle handle) const;
+	// destroys everything, every handle handed out goes stale
+	void Clear();
+
+	// the live items, packed, in no particular order
+	int Count() const { return (int)items.size(); }
+	T& At(int dense) { return items[dense]; }
+	const T& At(int dense) const { return items[dense]; }
+
+private:
+	struct Slot
+	{
+		unsigned int generation = 1;	// never 0 so no live handle is 0
+		int dense = -1;					// the item's place in items, -1 while free
+	};
+
+	void Free(unsigned int slot);
+
+	std::vector<T> items;
+	std::vector<unsigned int> itemSlots;	// slot of each item, to fix up the one that moves into a hole
+	std::vector<Slot> slots;
+	std::vector<unsigned int> freeSlots;
+};
+
+typedef ResourceHandle MeshHandle;
+typedef ResourceHandle TextureHandle;
+typedef ResourceHandle ProgramHandle;
+
+template <typename T>
+ResourceHandle ResourcePool<T>::Create(T item)
+{
+	unsigned int slot;
+	if (!freeSlots.empty())
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		if (slots.size() > INDEX_MASK)
+			return 0;
+		slot = (unsigned int)slots.size();
+		slots.push_back(Slot());
+	}
+
+	slots[slot].dense = (int)items.size();
+	items.push_back(std::move(item));
+	itemSlots.push_back(slot);
+	return (slots[slot].generation << INDEX_BITS) | slot;
+}
+
+template <typename T>
+bool ResourcePool<T>::Destroy(ResourceHandle handle)
+{
+	if (!Get(handle))
+		return false;
+
+	unsigned int slot = handle & INDEX_MASK;
+	int dense = slots[slot].dense;
+	int last = (int)items.size() - 1;
+	if (dense != last)
+	{
+		items[dense] = std::move(items[last]);
+		itemSlots[dense] = itemSlots[last];
+		slots[itemSlots[dense]].dense = dense;
+	}
+	items.pop_back();
+	itemSlots.pop_back();
+	Free(slot);
+	return true;
+}
+
+template <typename T>
+void ResourcePool<T>::Free(unsigned int slot)
+{
+	slots[slot].dense = -1;
+	slots[slot].generation = (slots[slot].generation + 1) & INDEX_MASK;
+	if (slots[slot].generation == 0)
+		slots[slot].generation = 1;
+	freeSlots.push_back(slot);
+}
+
+template <typename T>
+T* ResourcePool<T>::Get(ResourceHandle handle)
+{
+	unsigned int slot = handle & INDEX_MASK;
+	if (slot >= slots.size() || slots[slot].dense < 0 || slots[slot].generation != handle >> INDEX_BITS)
+		return nullptr;
+	return &items[slots[slot].dense];
+}
+
+template <typename T>
+const T* ResourcePool<T>::Get(ResourceHandle handle) const
+{
+	return const_cast<ResourcePool<T>*>(this)->Get(handle);
+}
+
+template <typename T>
+void ResourcePool<T>::Clear()
+{
+	for (unsigned int slot : itemSlots)
+		Free(slot);
+	items.clear();
+	itemSlots.clear();
+}
+
+class WorkerPool;
+
+enum Primitive
+{
+	PRIMITIVE_TRIANGLES,
+	PRIMITIVE_TRIANGLE_FAN,
+	PRIMITIVE_TRIANGLE_STRIP
+};
+
 class Meshes
 {
+public:
 	// Stores the GL data relative to a given mesh
 	struct GLMesh
 	{
-		GLuint vao;         // Handle for the vertex array object
-		GLuint vbos[2];     // Handles for the vertex buffer objects
+		GLuint vao = 0;         // Handle for the vertex array object
+		GLuint vbos[2] = {};    // Handles for the vertex buffer objects, [1] stays 0 for meshes without indices
 		GLuint nVertices;	// Number of vertices for the mesh
 		GLuint nIndices;    // Number of indices for the mesh
 		// this class is pretty much the same in every openGL project I have seen.
+
+		// CPU side copy of what got uploaded, interleaved position/normal/uv, for anything that reads the
+		// geometry without a context like the software rasterizer
+		std::vector<GLfloat> vertices;
+		std::vector<GLuint> indices;
+
+		// what drawing the mesh takes, one draw call per range
+		struct Range
+		{
+			unsigned short primitive;	// Primitive
+			bool indexed;
+			int first;		// first vertex, or first index when indexed
+			int count;
+		};
+		std::vector<Range> ranges;
+
+		// cheaper versions from the simplifier, coarsest last. Index ranges into the same buffers after
+		// LOD 0's, error is how far (in mesh units) the surface moved getting there
+		struct Lod
+		{
+			int first;
+			int count;
+			float error;
+		};
+		std::vector<Lod> lods;
+
+		// LOD 0 split up for culling, index ranges after the LODs. A cutoff over 1 means no usable cone
+		struct Meshlet
+		{
+			glm::vec3 center;		// bounding sphere
+			float radius;
+			glm::vec3 coneApex;		// backfacing from anywhere dot(normalize(coneApex - eye), coneAxis) >= coneCutoff
+			glm::vec3 coneAxis;
+			float coneCutoff;
+			int first;
+			int count;
+		};
+		std::vector<Meshlet> meshlets;
+
+		// bounding sphere in mesh units, what the point lights are assigned against
+		glm::vec3 boundsCenter = glm::vec3(0.0f);
+		float boundsRadius = 0.0f;
 	};
 
 public:
-	GLMesh gBoxMesh;
-	GLMesh gConeMesh;
-	GLMesh gCylinderMesh;
-	GLMesh gTaperedCylinderMesh;
-	GLMesh gPlaneMesh;
-	GLMesh gPrismMesh;
-	GLMesh gSphereMesh;
-	GLMesh gPyramid3Mesh;
-	GLMesh gPyramid4Mesh;
-	GLMesh gTorusMesh;
+	// handles into the pool, the ones that are never created stay 0 and don't resolve
+	MeshHandle gBoxMesh = 0;
+	MeshHandle gConeMesh = 0;
+	MeshHandle gCylinderMesh = 0;
+	MeshHandle gTaperedCylinderMesh = 0;
+	MeshHandle gPlaneMesh = 0;
+	MeshHandle gPrismMesh = 0;
+	MeshHandle gSphereMesh = 0;
+	MeshHandle gPyramid3Mesh = 0;
+	MeshHandle gPyramid4Mesh = 0;
+	MeshHandle gTorusMesh = 0;
 	//like before I wanted this meshes built out so I have them whenever I build out my vertex and index data. 
 	// I believe by building out some of the create/destroys and unfinished meshes I was giving myself a lot of problems
 	// I think now with some more time and experience under my belt I have found better ways of handling this
 
 public:
-	void CreateMeshes();
+	// called with a mesh's VAO just before it's deleted, for whatever still holds on to it
+	typedef void (*VaoCallback)(GLuint vao);
+
+	// createBuffers = false only keeps the CPU copies, no GL calls at all
+	void CreateMeshes(bool createBuffers = true);
+	void SetVaoDeletedCallback(VaoCallback callback) { vaoDeleted = callback; }
 	void DestroyMeshes();
+	// frees the GL objects, the handle and every copy of it go stale
+	void DestroyMesh(MeshHandle handle);
+	// indices can carry LODs and meshlets after LOD 0, lods says where LOD 0 ends. Keeps no CPU copy,
+	// so BuildLods and BuildMeshlets pass these by
+	MeshHandle CreateMesh(const GLfloat* verts, size_t floatCount, const GLuint* indices, size_t indexCount,
+		const std::vector<GLMesh::Lod>& lods = std::vector<GLMesh::Lod>(), const std::vector<GLMesh::Meshlet>& meshlets = std::vector<GLMesh::Meshlet>());
+	void BuildLods(WorkerPool& workers, int levels, float ratio, float maxRelativeError);
+	void BuildMeshlets(WorkerPool& workers, int minTriangles);
+	// unindexed triangles of position/normal/uv plus a lightmap uv on attribute 4, what the Lightmap bakes
+	MeshHandle CreateLightmappedMesh(const GLfloat* verts, size_t floatCount);
+
+	const GLMesh* Get(MeshHandle handle) const { return pool.Get(handle); }
+	const ResourcePool<GLMesh>& Pool() const { return pool; }
+
+	// extra meshes the benchmarks build and throw away themselves
+	void UCreateTessellatedSphereMesh(GLMesh& mesh, int stacks, int slices);
+	void UDestroyMesh(GLMesh& mesh);
 
 private:
 	void UCreatePlaneMesh(GLMesh& mesh);
@@ -184,30 +680,171 @@ private:
 	void UCreateCylinderMesh(GLMesh& mesh);
 	void UCreatePyramid4Mesh(GLMesh& mesh);
 	void UCreateSphereMesh(GLMesh& mesh);
-	void UDestroyMesh(GLMesh& mesh);
+	void UKeepCpuCopy(GLMesh& mesh, const GLfloat* verts, size_t floatCount, const GLuint* indices, size_t indexCount);
+	void UComputeBounds(GLMesh& mesh, const GLfloat* verts, size_t floatCount, int floatsPerVertex);
+	void UGenBuffers(GLMesh& mesh, int count);
+	void UUploadIndices(GLMesh& mesh);
+	MeshHandle UPoolMesh(void (Meshes::*create)(GLMesh&));
+
+	ResourcePool<GLMesh> pool;
+	bool createBuffers = true;
+	VaoCallback vaoDeleted = nullptr;
 };
 
 
-void Meshes::CreateMeshes()
+void Meshes::CreateMeshes(bool createGpuBuffers)
 {
-	UCreatePlaneMesh(gPlaneMesh);
-	UCreateBoxMesh(gBoxMesh);
-	UCreateCylinderMesh(gCylinderMesh);
-	UCreatePyramid4Mesh(gPyramid4Mesh);
-	UCreateSphereMesh(gSphereMesh);
+	createBuffers = createGpuBuffers;
+	gPlaneMesh = UPoolMesh(&Meshes::UCreatePlaneMesh);
+	gBoxMesh = UPoolMesh(&Meshes::UCreateBoxMesh);
+	gCylinderMesh = UPoolMesh(&Meshes::UCreateCylinderMesh);
+	gPyramid4Mesh = UPoolMesh(&Meshes::UCreatePyramid4Mesh);
+	gSphereMesh = UPoolMesh(&Meshes::UCreateSphereMesh);
 }
 
+// everything in the pool, whatever created it
 void Meshes::DestroyMeshes()
 {
-	UDestroyMesh(gBoxMesh);
-	UDestroyMesh(gConeMesh);
-	UDestroyMesh(gCylinderMesh);
-	UDestroyMesh(gPlaneMesh);
-	UDestroyMesh(gPyramid3Mesh);
-	UDestroyMesh(gPyramid4Mesh);
-	UDestroyMesh(gPrismMesh);
-	UDestroyMesh(gSphereMesh);
-	UDestroyMesh(gTorusMesh);
+	for (int i = 0; i < pool.Count(); i++)
+		UDestroyMesh(pool.At(i));
+	pool.Clear();
+}
+
+void Meshes::DestroyMesh(MeshHandle handle)
+{
+	GLMesh* mesh = pool.Get(handle);
+	if (!mesh)
+		return;
+	UDestroyMesh(*mesh);
+	pool.Destroy(handle);
+}
+
+// indexed triangles from interleaved position/normal/uv with no CPU copy kept, for geometry that comes and goes
+MeshHandle Meshes::CreateMesh(const GLfloat* verts, size_t floatCount, const GLuint* indices, size_t indexCount,
+	const std::vector<GLMesh::Lod>& lods, const std::vector<GLMesh::Meshlet>& meshlets)
+{
+	const GLuint floatsPerVertex = 3;
+	const GLuint floatsPerNormal = 3;
+	const GLuint floatsPerUV = 2;
+
+	GLMesh mesh;
+	mesh.nVertices = (GLuint)(floatCount / (floatsPerVertex + floatsPerNormal + floatsPerUV));
+	mesh.nIndices = (GLuint)indexCount;
+	int lod0Count = !lods.empty() ? lods[0].first : !meshlets.empty() ? meshlets[0].first : (int)mesh.nIndices;
+	mesh.ranges = { { PRIMITIVE_TRIANGLES, true, 0, lod0Count } };
+	mesh.lods = lods;
+	mesh.meshlets = meshlets;
+	UComputeBounds(mesh, verts, floatCount, floatsPerVertex + floatsPerNormal + floatsPerUV);
+	if (!createBuffers)
+		return pool.Create(std::move(mesh));
+
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+
+	UGenBuffers(mesh, 2);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * floatCount, verts, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(GLfloat) * floatCount);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indexCount, indices, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[1], sizeof(GLuint) * indexCount);
+
+	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+
+	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(0);
+
+	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+	glEnableVertexAttribArray(1);
+
+	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+	glEnableVertexAttribArray(2);
+	glBindVertexArray(0);
+
+	return pool.Create(std::move(mesh));
+}
+
+MeshHandle Meshes::CreateLightmappedMesh(const GLfloat* verts, size_t floatCount)
+{
+	const GLuint floatsPerVertex = 10;
+
+	GLMesh mesh;
+	mesh.nVertices = (GLuint)(floatCount / floatsPerVertex);
+	mesh.nIndices = 0;
+	mesh.ranges = { { PRIMITIVE_TRIANGLES, false, 0, (int)mesh.nVertices } };
+	UComputeBounds(mesh, verts, floatCount, floatsPerVertex);
+
+	// the usual position/normal/uv CPU copy, the baked meshes stand in for the built in ones
+	mesh.vertices.resize((size_t)mesh.nVertices * 8);
+	for (size_t v = 0; v < mesh.nVertices; v++)
+		std::copy(verts + v * floatsPerVertex, verts + v * floatsPerVertex + 8, mesh.vertices.begin() + v * 8);
+
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+
+	UGenBuffers(mesh, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * floatCount, verts, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(GLfloat) * floatCount);
+
+	GLint stride = sizeof(float) * floatsPerVertex;
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 8));
+	glEnableVertexAttribArray(4);
+	glBindVertexArray(0);
+
+	return pool.Create(std::move(mesh));
+}
+
+MeshHandle Meshes::UPoolMesh(void (Meshes::*create)(GLMesh&))
+{
+	GLMesh mesh;
+	(this->*create)(mesh);
+	UComputeBounds(mesh, mesh.vertices.data(), mesh.vertices.size(), 8);
+	return pool.Create(std::move(mesh));
+}
+
+void Meshes::UKeepCpuCopy(GLMesh& mesh, const GLfloat* verts, size_t floatCount, const GLuint* indices, size_t indexCount)
+{
+	mesh.vertices.assign(verts, verts + floatCount);
+	mesh.indices.assign(indices, indices + indexCount);
+}
+
+// center of the box around the positions, radius out to the farthest one. Loose but cheap
+void Meshes::UComputeBounds(GLMesh& mesh, const GLfloat* verts, size_t floatCount, int floatsPerVertex)
+{
+	if (floatCount < (size_t)floatsPerVertex)
+		return;
+
+	glm::vec3 low(verts[0], verts[1], verts[2]), high = low;
+	for (size_t i = floatsPerVertex; i + 2 < floatCount; i += floatsPerVertex)
+	{
+		glm::vec3 position(verts[i], verts[i + 1], verts[i + 2]);
+		low = glm::min(low, position);
+		high = glm::max(high, position);
+	}
+	mesh.boundsCenter = (low + high) * 0.5f;
+
+	float radius2 = 0.0f;
+	for (size_t i = 0; i + 2 < floatCount; i += floatsPerVertex)
+	{
+		glm::vec3 offset = glm::vec3(verts[i], verts[i + 1], verts[i + 2]) - mesh.boundsCenter;
+		radius2 = std::max(radius2, glm::dot(offset, offset));
+	}
+	mesh.boundsRadius = std::sqrt(radius2);
+}
+
+// vertex buffer, plus the index buffer when count is 2
+void Meshes::UGenBuffers(GLMesh& mesh, int count)
+{
+	for (int i = 0; i < count; i++)
+		mesh.vbos[i] = gGpuMemory.GenBuffer(GpuMemory::CATEGORY_MESH, "meshes");
 }
 
 void Meshes::UCreatePlaneMesh(GLMesh& mesh)
@@ -236,17 +873,24 @@ void Meshes::UCreatePlaneMesh(GLMesh& mesh)
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
 	mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
 
+	mesh.ranges = { { PRIMITIVE_TRIANGLES, true, 0, (int)mesh.nIndices } };
+	UKeepCpuCopy(mesh, verts, sizeof(verts) / sizeof(verts[0]), indices, mesh.nIndices);
+	if (!createBuffers)
+		return;
+
 	// Generate the VAO for the mesh
 	glGenVertexArrays(1, &mesh.vao);
 	glBindVertexArray(mesh.vao);	// activate the VAO
 
 	// Create VBOs for the mesh
-	glGenBuffers(2, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends data to the GPU
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(verts));
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[1], sizeof(indices));
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -313,11 +957,17 @@ void Meshes::UCreatePyramid4Mesh(GLMesh& mesh)
 	// Calculate total defined vertices
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
 
+	mesh.ranges = { { PRIMITIVE_TRIANGLE_STRIP, false, 0, (int)mesh.nVertices } };
+	UKeepCpuCopy(mesh, verts, sizeof(verts) / sizeof(verts[0]), nullptr, 0);
+	if (!createBuffers)
+		return;
+
 	glGenVertexArrays(1, &mesh.vao);			// Creates 1 VAO
-	glGenBuffers(1, mesh.vbos);					// Creates 1 VBO
+	UGenBuffers(mesh, 1);					// Creates 1 VBO
 	glBindVertexArray(mesh.vao);				// Activates the VAO
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);	// Activates the VBO
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(verts));
 
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
 
@@ -397,16 +1047,23 @@ void Meshes::UCreateBoxMesh(GLMesh& mesh)
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
 	mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
 
+	mesh.ranges = { { PRIMITIVE_TRIANGLES, true, 0, (int)mesh.nIndices } };
+	UKeepCpuCopy(mesh, verts, sizeof(verts) / sizeof(verts[0]), indices, mesh.nIndices);
+	if (!createBuffers)
+		return;
+
 	glGenVertexArrays(1, &mesh.vao); 
 	glBindVertexArray(mesh.vao);
 
 	// Making 2 buffers here one for the indices and the other for vertex
-	glGenBuffers(2, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); 
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); 
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(verts));
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); 
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[1], sizeof(indices));
 
 
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// https://www.reddit.com/r/opengl/comments/xpplbw/cylinder_modern_opengl/
@@ -660,14 +1317,25 @@ void Meshes::UCreateCylinderMesh(GLMesh& mesh)
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
 	mesh.nIndices = 0;
 
+	// bottom and top fans, then the sides
+	mesh.ranges = {
+		{ PRIMITIVE_TRIANGLE_FAN, false, 0, 36 },
+		{ PRIMITIVE_TRIANGLE_FAN, false, 36, 36 },
+		{ PRIMITIVE_TRIANGLE_STRIP, false, 72, 146 }
+	};
+	UKeepCpuCopy(mesh, verts, sizeof(verts) / sizeof(verts[0]), nullptr, 0);
+	if (!createBuffers)
+		return;
+
 	// Create VAO
 	glGenVertexArrays(1, &mesh.vao); 
 	glBindVertexArray(mesh.vao);
 
 	// Create VBO
-	glGenBuffers(1, mesh.vbos);
+	UGenBuffers(mesh, 1);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); 
 	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); 
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(verts));
 
 
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -1517,6 +2185,11 @@ void Meshes::UCreateSphereMesh(GLMesh& mesh)
 		combined_values.push_back(v);
 	}
 
+	mesh.ranges = { { PRIMITIVE_TRIANGLES, true, 0, (int)mesh.nIndices } };
+	UKeepCpuCopy(mesh, combined_values.data(), combined_values.size(), indices, mesh.nIndices);
+	if (!createBuffers)
+		return;
+
 	// this block of code can pretty much be copy and pasted at the end of each ucreate. You will always need to build out your vao and vbo. Youll always need 
 	// to activate the buffers, send vertex data to the GPU and create you attribute pointers. Very little will change here
 	// and I actually found it easier to just copy/paste this then attempt to remember and misplace or forget something
@@ -1526,13 +2199,15 @@ void Meshes::UCreateSphereMesh(GLMesh& mesh)
 	glBindVertexArray(mesh.vao);
 
 	// Create VBOs
-	glGenBuffers(2, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); 
 	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); 
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(GLfloat) * combined_values.size());
 
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); 
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[1], sizeof(indices));
 
 
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -1548,754 +2223,10225 @@ void Meshes::UCreateSphereMesh(GLMesh& mesh)
 	glEnableVertexAttribArray(2);
 }
 
-void Meshes::UDestroyMesh(GLMesh& mesh)
+// uv sphere with as many stacks/slices as asked for, only used to load up the vertex stage in the benchmarks
+void Meshes::UCreateTessellatedSphereMesh(GLMesh& mesh, int stacks, int slices)
 {
-	glDeleteVertexArrays(1, &mesh.vao);
-	glDeleteBuffers(2, mesh.vbos);
-}
+	std::vector<GLfloat> verts;
+	std::vector<GLuint> indices;
 
+	for (int i = 0; i <= stacks; i++)
+	{
+		float v = (float)i / stacks;
+		float phi = v * (float)M_PI;
+		for (int j = 0; j <= slices; j++)
+		{
+			float u = (float)j / slices;
+			float theta = u * 2.0f * (float)M_PI;
+			glm::vec3 normal(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+			verts.push_back(normal.x);
+			verts.push_back(normal.y);
+			verts.push_back(normal.z);
+			verts.push_back(normal.x);
+			verts.push_back(normal.y);
+			verts.push_back(normal.z);
+			verts.push_back(u);
+			verts.push_back(1.0f - v);
+		}
+	}
 
+	for (int i = 0; i < stacks; i++)
+	{
+		for (int j = 0; j < slices; j++)
+		{
+			GLuint first = i * (slices + 1) + j;
+			GLuint second = first + slices + 1;
+			indices.push_back(first);
+			indices.push_back(second);
+			indices.push_back(first + 1);
+			indices.push_back(second);
+			indices.push_back(second + 1);
+			indices.push_back(first + 1);
+		}
+	}
 
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
+	const GLuint floatsPerVertex = 3;
+	const GLuint floatsPerNormal = 3;
+	const GLuint floatsPerUV = 2;
 
+	mesh.nVertices = verts.size() / (floatsPerVertex + floatsPerNormal + floatsPerUV);
+	mesh.nIndices = indices.size();
 
-namespace
-{
-	const char* const WINDOW_TITLE = "Project Work V2 10/17";
-	const int WINDOW_WIDTH = 800;
-	const int WINDOW_HEIGHT = 600;
-	float gLastX = WINDOW_WIDTH / 2.0f;
-	float gLastY = WINDOW_HEIGHT / 2.0f;
-	float gCameraSpeed = 2.5f;
-	bool gFirstMouse = true;
-	//timing
-	float gDeltaTime = 0.0f; // time between current frame and last frame
-	// was able to pull some of this directly from 3-5 milestone
-	float gLastFrame = 0.0f;
-	struct GLMesh
-	{
-		GLuint vao;         // Handle for the vertex array object
-		GLuint vbos[2];     // Handles for the vertex buffer objects
-		GLuint nIndices;    // Number of indices of the mesh
-	};
-	/// Main GLFW Window
-	GLFWwindow* gWindow = nullptr;
-	// Triangle mesh data
-	GLMesh gMesh;
-	// Texture id
-	GLuint gTextureIdDesk;
-	GLuint gTextureIdMug;
-	GLuint gTextureIdBotCap;
-	GLuint gTextureIdPenBod;
-	GLuint gTextureIdBottl;
-	GLuint gTextureIdCon;
+	mesh.ranges = { { PRIMITIVE_TRIANGLES, true, 0, (int)mesh.nIndices } };
+	UKeepCpuCopy(mesh, verts.data(), verts.size(), indices.data(), indices.size());
+	if (!createBuffers)
+		return;
 
-	Meshes meshes;
-	//Shader Program
-	GLuint gProgramId;
-	//Camera
-	Camera gCamera(glm::vec3(0.0f, 1.0f, 8.0f));
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
 
-	glm::vec3 gCameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
-	glm::vec3 gCameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
-	glm::vec3 gCameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
-	glm::vec3 gCameraRight = glm::vec3(1.0f, 0.0f, 0.0f);
-}
+	UGenBuffers(mesh, 2);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * verts.size(), verts.data(), GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[0], sizeof(GLfloat) * verts.size());
 
-bool UInitialize(int argc, char* argv[], GLFWwindow** window);
-void UResizeWindow(GLFWwindow* window, int width, int height);
-void UProcessInput(GLFWwindow* window);
-void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[1], sizeof(GLuint) * indices.size());
+
+	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+
+	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(0);
+
+	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+	glEnableVertexAttribArray(1);
+
+	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+	glEnableVertexAttribArray(2);
+}
+
+void Meshes::UDestroyMesh(GLMesh& mesh)
+{
+	if (!createBuffers)
+		return;
+	if (vaoDeleted && mesh.vao)
+		vaoDeleted(mesh.vao);
+	glDeleteVertexArrays(1, &mesh.vao);
+	mesh.vao = 0;
+	// only what UGenBuffers made, meshes without indices only have the one buffer
+	gGpuMemory.DeleteBuffer(mesh.vbos[0]);
+	gGpuMemory.DeleteBuffer(mesh.vbos[1]);
+}
+
+
+// Builds shader programs without stalling on the driver. Everything is submitted up front and Poll() checks
+// on them once a frame, using GL_KHR_parallel_shader_compile when it's there so the compiles run on the driver's threads.
+// Until a program is ready the caller just draws with a fallback program.
+class ShaderBuilder
+{
+public:
+	enum BuildStatus
+	{
+		BUILD_PENDING,
+		BUILD_READY,
+		BUILD_FAILED
+	};
+
+	void Initialize();
+	int Submit(const char* name, const char* vtxShaderSource, const char* fragShaderSource);
+	// true if any build finished (either way) during this call
+	bool Poll();
+	void Destroy();
+
+	BuildStatus Status(int build) const { return builds[build].status; }
+	bool IsReady(int build) const { return builds[build].status == BUILD_READY; }
+	bool HasFailed(int build) const { return builds[build].status == BUILD_FAILED; }
+	bool AnyPending() const;
+
+	// the program for a build, or the fallback while it is still compiling (or if it failed)
+	GLuint Get(int build, GLuint fallbackId) const { return IsReady(build) ? builds[build].programId : fallbackId; }
+
+private:
+	struct Build
+	{
+		std::string name;
+		GLuint programId;
+		GLuint vertexShaderId;
+		GLuint fragmentShaderId;
+		BuildStatus status;
+	};
+
+	void Finish(Build& build);
+
+	std::vector<Build> builds;
+	bool parallelCompile = false;
+};
+
+void ShaderBuilder::Initialize()
+{
+	// let the driver use as many compiler threads as it wants
+	if (GLEW_KHR_parallel_shader_compile)
+	{
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+	else if (GLEW_ARB_parallel_shader_compile)
+	{
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+
+	std::cout << "INFO: Parallel shader compile: " << (parallelCompile ? "yes" : "no") << std::endl;
+}
+
+int ShaderBuilder::Submit(const char* name, const char* vtxShaderSource, const char* fragShaderSource)
+{
+	Build build;
+	build.name = name;
+	build.status = BUILD_PENDING;
+
+	build.programId = glCreateProgram();
+	build.vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+	build.fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+
+	glShaderSource(build.vertexShaderId, 1, &vtxShaderSource, nullptr);
+	glShaderSource(build.fragmentShaderId, 1, &fragShaderSource, nullptr);
+
+	// no status checks here, those are what make the driver finish the compile on this thread.
+	// if a shader doesn't compile the link fails too and Finish() picks up the logs
+	glCompileShader(build.vertexShaderId);
+	glCompileShader(build.fragmentShaderId);
+
+	glAttachShader(build.programId, build.vertexShaderId);
+	glAttachShader(build.programId, build.fragmentShaderId);
+	glLinkProgram(build.programId);
+
+	builds.push_back(build);
+	return (int)builds.size() - 1;
+}
+
+bool ShaderBuilder::Poll()
+{
+	bool finishedAny = false;
+	for (Build& build : builds)
+	{
+		if (build.status != BUILD_PENDING)
+			continue;
+
+		if (parallelCompile)
+		{
+			GLint done = GL_FALSE;
+			glGetProgramiv(build.programId, GL_COMPLETION_STATUS_KHR, &done);
+			if (done)
+			{
+				Finish(build);
+				finishedAny = true;
+			}
+		}
+		else
+		{
+			// without the extension asking for the link status blocks, so only finish one program a frame
+			Finish(build);
+			return true;
+		}
+	}
+	return finishedAny;
+}
+
+void ShaderBuilder::Finish(Build& build)
+{
+	int success = 0;
+	char infoLog[512];
+
+	glGetProgramiv(build.programId, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderiv(build.vertexShaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(build.vertexShaderId, sizeof(infoLog), nullptr, infoLog);
+			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED (" << build.name << ")\n" << infoLog << std::endl;
+		}
+
+		glGetShaderiv(build.fragmentShaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(build.fragmentShaderId, sizeof(infoLog), nullptr, infoLog);
+			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED (" << build.name << ")\n" << infoLog << std::endl;
+		}
+
+		glGetProgramInfoLog(build.programId, sizeof(infoLog), nullptr, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED (" << build.name << ")\n" << infoLog << std::endl;
+		build.status = BUILD_FAILED;
+	}
+	else
+	{
+		build.status = BUILD_READY;
+	}
+
+	glDetachShader(build.programId, build.vertexShaderId);   // Detach the shader objects
+	glDetachShader(build.programId, build.fragmentShaderId);
+	glDeleteShader(build.vertexShaderId);   // Delete the shader objects
+	glDeleteShader(build.fragmentShaderId);
+}
+
+bool ShaderBuilder::AnyPending() const
+{
+	for (const Build& build : builds)
+	{
+		if (build.status == BUILD_PENDING)
+			return true;
+	}
+	return false;
+}
+
+void ShaderBuilder::Destroy()
+{
+	for (Build& build : builds)
+	{
+		if (build.status == BUILD_PENDING)
+		{
+			glDeleteShader(build.vertexShaderId);
+			glDeleteShader(build.fragmentShaderId);
+		}
+		glDeleteProgram(build.programId);
+	}
+	builds.clear();
+}
+
+
+// Normal matrix for a model matrix, done once per object on the CPU instead of inverse() per vertex.
+// The inverse transpose of the upper 3x3 is its cofactor matrix over the determinant, and the cofactor
+// columns are just cross products of the model's columns. The fragment shader normalizes Normal anyway,
+// so the 1/det scale can be dropped and only its sign kept (a mirrored object would flip its normals).
+glm::mat3 UNormalMatrix(const glm::mat4& model)
+{
+	const float* m = glm::value_ptr(model);
+	glm::mat3 normalMatrix;
+
+#ifdef USE_SSE
+	// columns 0-2 of the model, w lanes are whatever the matrix has there and get ignored
+	__m128 c0 = _mm_loadu_ps(m);
+	__m128 c1 = _mm_loadu_ps(m + 4);
+	__m128 c2 = _mm_loadu_ps(m + 8);
+
+	// dot of the xyz lanes, plain SSE so it runs on anything x64
+	auto dot3 = [](__m128 a, __m128 b)
+	{
+		__m128 p = _mm_mul_ps(a, b);
+		__m128 sum = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+	};
+
+	// uniform scale (or none) means the upper 3x3 is already a rotation times a constant, no need for the cofactors.
+	// a shear would still need the full path, the desk scene doesn't have any but check the angles anyway
+	float len0 = dot3(c0, c0);
+	float tolerance = len0 * 1e-4f;
+	if (fabs(dot3(c1, c1) - len0) <= tolerance && fabs(dot3(c2, c2) - len0) <= tolerance &&
+		fabs(dot3(c0, c1)) <= tolerance && fabs(dot3(c1, c2)) <= tolerance && fabs(dot3(c2, c0)) <= tolerance)
+		return glm::mat3(model);
+
+	// cross(a, b) = a.yzx * b.zxy - a.zxy * b.yzx
+	auto cross3 = [](__m128 a, __m128 b)
+	{
+		return _mm_sub_ps(
+			_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2))),
+			_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))));
+	};
+	__m128 n0 = cross3(c1, c2);
+	__m128 n1 = cross3(c2, c0);
+	__m128 n2 = cross3(c0, c1);
+
+	// det = dot(c0, cross(c1, c2))
+	if (dot3(c0, n0) < 0.0f)
+	{
+		__m128 sign = _mm_set1_ps(-0.0f);
+		n0 = _mm_xor_ps(n0, sign);
+		n1 = _mm_xor_ps(n1, sign);
+		n2 = _mm_xor_ps(n2, sign);
+	}
+
+	float out[12];
+	_mm_storeu_ps(out, n0);
+	_mm_storeu_ps(out + 4, n1);
+	_mm_storeu_ps(out + 8, n2);
+	normalMatrix[0] = glm::vec3(out[0], out[1], out[2]);
+	normalMatrix[1] = glm::vec3(out[4], out[5], out[6]);
+	normalMatrix[2] = glm::vec3(out[8], out[9], out[10]);
+#else
+	glm::vec3 c0(m[0], m[1], m[2]);
+	glm::vec3 c1(m[4], m[5], m[6]);
+	glm::vec3 c2(m[8], m[9], m[10]);
+
+	float len0 = glm::dot(c0, c0);
+	float tolerance = len0 * 1e-4f;
+	if (fabs(glm::dot(c1, c1) - len0) <= tolerance && fabs(glm::dot(c2, c2) - len0) <= tolerance &&
+		fabs(glm::dot(c0, c1)) <= tolerance && fabs(glm::dot(c1, c2)) <= tolerance && fabs(glm::dot(c2, c0)) <= tolerance)
+		return glm::mat3(model);
+
+	normalMatrix[0] = glm::cross(c1, c2);
+	normalMatrix[1] = glm::cross(c2, c0);
+	normalMatrix[2] = glm::cross(c0, c1);
+	if (glm::dot(c0, normalMatrix[0]) < 0.0f)
+		normalMatrix = normalMatrix * -1.0f;
+#endif
+
+	return normalMatrix;
+}
+
+
+#if defined(USE_SSE) && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+#if defined(USE_SSE) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// true when the CPU (and the OS) can run the AVX2/FMA paths, checked at runtime so one build runs everywhere
+bool UCpuHasAvx2()
+{
+#if defined(USE_SSE) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(USE_SSE) && defined(__GNUC__)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+
+// quaternions as (x, y, z, w) so the transform batch can keep them in plain float arrays
+glm::vec4 UQuatFromAxisAngle(float angle, const glm::vec3& axis)
+{
+	glm::vec3 n = glm::normalize(axis) * (float)sin(angle * 0.5f);
+	return glm::vec4(n.x, n.y, n.z, (float)cos(angle * 0.5f));
+}
+
+glm::vec4 UQuatMultiply(const glm::vec4& a, const glm::vec4& b)
+{
+	return glm::vec4(
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+// Per object data the vertex shader reads out of the instance buffer (std430 layout)
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::mat4 mvp;
+	glm::vec4 normalMatrix[3];	// mat3 columns padded out to vec4
+	glm::vec4 color;			// used when the object isn't textured
+	GLuint flags[4];			// [0] is INSTANCE_TEXTURED | INSTANCE_LIGHTMAPPED, [1] how many point lights and
+								// [2] their indices 4 bits each (see LightAssignment), [3] is padding
+};
+
+const GLuint INSTANCE_TEXTURED = 1;
+const GLuint INSTANCE_LIGHTMAPPED = 2;		// lit from the lightmap instead of the lights
+static_assert(sizeof(InstanceData) == 208, "InstanceData has to match the std430 layout in the shaders");
+
+// SoA transform system. Positions, rotations and scales sit in separate float arrays so the TRS compose
+// and the view-projection multiply run 8 (AVX2) or 4 (SSE) objects at a time, picked at runtime with a
+// scalar fallback. Compose() writes the results straight into this frame's slice of the instance ring.
+class TransformBatch
+{
+public:
+	enum Path
+	{
+		PATH_SCALAR,
+		PATH_SSE,
+		PATH_AVX2
+	};
+
+	void Initialize();
+	void Destroy();
+
+	int Add(const glm::vec3& position, const glm::vec4& rotation, const glm::vec3& scale);
+	void Set(int index, const glm::vec3& position, const glm::vec4& rotation, const glm::vec3& scale);
+	int Count() const { return (int)px.size(); }
+	glm::vec3 Position(int index) const { return glm::vec3(px[index], py[index], pz[index]); }
+	float MaxScale(int index) const { return std::max(std::fabs(sx[index]), std::max(std::fabs(sy[index]), std::fabs(sz[index]))); }
+	glm::mat4 Model(int index) const;
+
+	void Compose(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const;
+
+	// per instance draw id attribute (location 3) so a draw's baseInstance picks its row of the instance buffer.
+	// The VAO is remembered and attached again whenever Add outgrows the buffer, until it's detached
+	void AttachDrawIds(GLuint vao);
+	// before the VAO is deleted, GL hands the name out again and the new owner mustn't get the attribute
+	void DetachDrawIds(GLuint vao);
+	// every draw is instanced once per view (see ViewSet), the id has to hold for all of those instances.
+	// Only affects VAOs attached afterwards
+	void SetViewsPerDraw(int views) { drawIdDivisor = std::max(views, 1); }
+
+	Path ActivePath() const { return path; }
+	void SetPath(Path newPath) { path = newPath; }
+	static const char* PathName(Path path);
+
+private:
+	void ComposeScalar(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const;
+#ifdef USE_SSE
+	void ComposeSse(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const;
+	TARGET_AVX2 void ComposeAvx2(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const;
+#endif
+	void ReserveGpu(int count);
+	void BindDrawIds(GLuint vao) const;
+
+	std::vector<float> px, py, pz;
+	std::vector<float> qx, qy, qz, qw;
+	std::vector<float> sx, sy, sz;
+
+	Path path = PATH_SCALAR;
+	GLuint drawIdBuffer = 0;
+	int gpuCapacity = 0;
+	int drawIdDivisor = 1;
+	std::vector<GLuint> drawIdVaos;
+};
+
+const char* TransformBatch::PathName(Path path)
+{
+	switch (path)
+	{
+	case PATH_AVX2: return "AVX2";
+	case PATH_SSE: return "SSE";
+	default: return "scalar";
+	}
+}
+
+void TransformBatch::Initialize()
+{
+#ifdef USE_SSE
+	path = UCpuHasAvx2() ? PATH_AVX2 : PATH_SSE;
+#else
+	path = PATH_SCALAR;
+#endif
+	std::cout << "INFO: Transform batch path: " << PathName(path) << std::endl;
+
+	drawIdBuffer = gGpuMemory.GenBuffer(GpuMemory::CATEGORY_BUFFER, "draw ids");
+	ReserveGpu(std::max(Count(), 1024));
+}
+
+void TransformBatch::Destroy()
+{
+	gGpuMemory.DeleteBuffer(drawIdBuffer);
+	gpuCapacity = 0;
+	drawIdVaos.clear();
+}
+
+int TransformBatch::Add(const glm::vec3& position, const glm::vec4& rotation, const glm::vec3& scale)
+{
+	px.push_back(0.0f); py.push_back(0.0f); pz.push_back(0.0f);
+	qx.push_back(0.0f); qy.push_back(0.0f); qz.push_back(0.0f); qw.push_back(1.0f);
+	sx.push_back(1.0f); sy.push_back(1.0f); sz.push_back(1.0f);
+
+	int index = Count() - 1;
+	Set(index, position, rotation, scale);
+	// the offline paths add transforms without a GL context, Initialize sizes the buffer for those
+	if (drawIdBuffer)
+		ReserveGpu(Count());
+	return index;
+}
+
+void TransformBatch::Set(int index, const glm::vec3& position, const glm::vec4& rotation, const glm::vec3& scale)
+{
+	px[index] = position.x; py[index] = position.y; pz[index] = position.z;
+	qx[index] = rotation.x; qy[index] = rotation.y; qz[index] = rotation.z; qw[index] = rotation.w;
+	sx[index] = scale.x; sy[index] = scale.y; sz[index] = scale.z;
+}
+
+void TransformBatch::ReserveGpu(int count)
+{
+	if (count <= gpuCapacity)
+		return;
+
+	while (gpuCapacity < count)
+		gpuCapacity = gpuCapacity ? gpuCapacity * 2 : 1024;
+
+	// draw ids never change, instance i just reads i
+	std::vector<GLuint> drawIds(gpuCapacity);
+	for (int i = 0; i < gpuCapacity; i++)
+		drawIds[i] = i;
+	glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * gpuCapacity, drawIds.data(), GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(drawIdBuffer, sizeof(GLuint) * gpuCapacity);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// point every attached VAO at the new storage
+	for (GLuint vao : drawIdVaos)
+		BindDrawIds(vao);
+}
+
+void TransformBatch::AttachDrawIds(GLuint vao)
+{
+	if (std::find(drawIdVaos.begin(), drawIdVaos.end(), vao) == drawIdVaos.end())
+		drawIdVaos.push_back(vao);
+	BindDrawIds(vao);
+}
+
+void TransformBatch::DetachDrawIds(GLuint vao)
+{
+	drawIdVaos.erase(std::remove(drawIdVaos.begin(), drawIdVaos.end(), vao), drawIdVaos.end());
+}
+
+void TransformBatch::BindDrawIds(GLuint vao) const
+{
+	// the offline paths never Initialize, there's nothing to attach
+	if (!drawIdBuffer)
+		return;
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+	glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+	glVertexAttribDivisor(3, drawIdDivisor);
+	glEnableVertexAttribArray(3);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void TransformBatch::Compose(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const
+{
+	switch (path)
+	{
+#ifdef USE_SSE
+	case PATH_AVX2: ComposeAvx2(viewProjection, out, begin, end); break;
+	case PATH_SSE: ComposeSse(viewProjection, out, begin, end); break;
+#endif
+	default: ComposeScalar(viewProjection, out, begin, end); break;
+	}
+}
+
+// one object's model matrix, for the CPU side culling
+glm::mat4 TransformBatch::Model(int index) const
+{
+	InstanceData data;
+	ComposeScalar(glm::mat4(1.0f), &data, index, index + 1);
+	return data.model;
+}
+
+// Every path writes the same 44 floats per object: model (16), mvp (16), then the normal matrix columns (12).
+// The rotation part of the model is the quaternion's matrix with each column scaled, and for a TRS transform
+// the inverse transpose of R * S is R * S^-1, so the normal matrix is the rotation columns divided by the scale.
+void TransformBatch::ComposeScalar(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const
+{
+	const float* vp = glm::value_ptr(viewProjection);
+
+	for (int i = begin; i < end; i++)
+	{
+		float x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+		float r[3][3] = {
+			{ 1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y) },
+			{ 2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x) },
+			{ 2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y) }
+		};
+		float s[3] = { sx[i], sy[i], sz[i] };
+
+		float* dst = (float*)(out + i - begin);
+		for (int c = 0; c < 3; c++)
+		{
+			for (int k = 0; k < 3; k++)
+				dst[c * 4 + k] = r[c][k] * s[c];
+			dst[c * 4 + 3] = 0.0f;
+		}
+		dst[12] = px[i]; dst[13] = py[i]; dst[14] = pz[i]; dst[15] = 1.0f;
+
+		// mvp column j = vp * model column j
+		for (int j = 0; j < 4; j++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				float value = vp[0 * 4 + k] * dst[j * 4 + 0] + vp[1 * 4 + k] * dst[j * 4 + 1] + vp[2 * 4 + k] * dst[j * 4 + 2];
+				if (j == 3)
+					value += vp[3 * 4 + k];
+				dst[16 + j * 4 + k] = value;
+			}
+		}
+
+		for (int c = 0; c < 3; c++)
+		{
+			for (int k = 0; k < 3; k++)
+				dst[32 + c * 4 + k] = r[c][k] / s[c];
+			dst[32 + c * 4 + 3] = 0.0f;
+		}
+	}
+}
+
+#ifdef USE_SSE
+void TransformBatch::ComposeSse(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const
+{
+	const float* vp = glm::value_ptr(viewProjection);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&qx[i]), y = _mm_loadu_ps(&qy[i]), z = _mm_loadu_ps(&qz[i]), w = _mm_loadu_ps(&qw[i]);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		__m128 r[3][3] = {
+			{ _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), _mm_mul_ps(two, _mm_add_ps(xy, wz)), _mm_mul_ps(two, _mm_sub_ps(xz, wy)) },
+			{ _mm_mul_ps(two, _mm_sub_ps(xy, wz)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), _mm_mul_ps(two, _mm_add_ps(yz, wx)) },
+			{ _mm_mul_ps(two, _mm_add_ps(xz, wy)), _mm_mul_ps(two, _mm_sub_ps(yz, wx)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))) }
+		};
+		__m128 s[3] = { _mm_loadu_ps(&sx[i]), _mm_loadu_ps(&sy[i]), _mm_loadu_ps(&sz[i]) };
+
+		// 44 rows of 4 lanes, one lane per object
+		__m128 rows[44];
+		for (int c = 0; c < 3; c++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				rows[c * 4 + k] = _mm_mul_ps(r[c][k], s[c]);
+				rows[32 + c * 4 + k] = _mm_div_ps(r[c][k], s[c]);
+			}
+			rows[c * 4 + 3] = zero;
+			rows[32 + c * 4 + 3] = zero;
+		}
+		rows[12] = _mm_loadu_ps(&px[i]); rows[13] = _mm_loadu_ps(&py[i]); rows[14] = _mm_loadu_ps(&pz[i]); rows[15] = one;
+
+		for (int j = 0; j < 4; j++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				__m128 value = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(vp[0 * 4 + k]), rows[j * 4 + 0]),
+					_mm_mul_ps(_mm_set1_ps(vp[1 * 4 + k]), rows[j * 4 + 1])),
+					_mm_mul_ps(_mm_set1_ps(vp[2 * 4 + k]), rows[j * 4 + 2]));
+				if (j == 3)
+					value = _mm_add_ps(value, _mm_set1_ps(vp[3 * 4 + k]));
+				rows[16 + j * 4 + k] = value;
+			}
+		}
+
+		// transpose 4x4 blocks so each object's 44 floats go out as contiguous stores
+		float* dst[4];
+		for (int l = 0; l < 4; l++)
+			dst[l] = (float*)(out + i + l - begin);
+		for (int block = 0; block < 44; block += 4)
+		{
+			__m128 a = rows[block], b = rows[block + 1], c = rows[block + 2], d = rows[block + 3];
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+			_mm_storeu_ps(dst[0] + block, a);
+			_mm_storeu_ps(dst[1] + block, b);
+			_mm_storeu_ps(dst[2] + block, c);
+			_mm_storeu_ps(dst[3] + block, d);
+		}
+	}
+
+	if (i < end)
+		ComposeScalar(viewProjection, out + (i - begin), i, end);
+}
+
+TARGET_AVX2 void TransformBatch::ComposeAvx2(const glm::mat4& viewProjection, InstanceData* out, int begin, int end) const
+{
+	const float* vp = glm::value_ptr(viewProjection);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&qx[i]), y = _mm256_loadu_ps(&qy[i]), z = _mm256_loadu_ps(&qz[i]), w = _mm256_loadu_ps(&qw[i]);
+		__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+		__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+		__m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+		__m256 r[3][3] = {
+			{ _mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), _mm256_mul_ps(two, _mm256_add_ps(xy, wz)), _mm256_mul_ps(two, _mm256_sub_ps(xz, wy)) },
+			{ _mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), _mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), _mm256_mul_ps(two, _mm256_add_ps(yz, wx)) },
+			{ _mm256_mul_ps(two, _mm256_add_ps(xz, wy)), _mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), _mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one) }
+		};
+		__m256 s[3] = { _mm256_loadu_ps(&sx[i]), _mm256_loadu_ps(&sy[i]), _mm256_loadu_ps(&sz[i]) };
+
+		// 44 rows of 8 lanes, one lane per object
+		__m256 rows[48];
+		for (int c = 0; c < 3; c++)
+		{
+			__m256 invScale = _mm256_div_ps(one, s[c]);
+			for (int k = 0; k < 3; k++)
+			{
+				rows[c * 4 + k] = _mm256_mul_ps(r[c][k], s[c]);
+				rows[32 + c * 4 + k] = _mm256_mul_ps(r[c][k], invScale);
+			}
+			rows[c * 4 + 3] = zero;
+			rows[32 + c * 4 + 3] = zero;
+		}
+		rows[12] = _mm256_loadu_ps(&px[i]); rows[13] = _mm256_loadu_ps(&py[i]); rows[14] = _mm256_loadu_ps(&pz[i]); rows[15] = one;
+
+		for (int j = 0; j < 4; j++)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				__m256 value = _mm256_mul_ps(_mm256_set1_ps(vp[0 * 4 + k]), rows[j * 4 + 0]);
+				value = _mm256_fmadd_ps(_mm256_set1_ps(vp[1 * 4 + k]), rows[j * 4 + 1], value);
+				value = _mm256_fmadd_ps(_mm256_set1_ps(vp[2 * 4 + k]), rows[j * 4 + 2], value);
+				if (j == 3)
+					value = _mm256_add_ps(value, _mm256_set1_ps(vp[3 * 4 + k]));
+				rows[16 + j * 4 + k] = value;
+			}
+		}
+		rows[44] = rows[45] = rows[46] = rows[47] = zero;
+
+		// 8x8 transposes, 6 blocks cover the 44 floats (the last block only stores its first 4 columns)
+		float* dst[8];
+		for (int l = 0; l < 8; l++)
+			dst[l] = (float*)(out + i + l - begin);
+		for (int block = 0; block < 48; block += 8)
+		{
+			__m256 t0 = _mm256_unpacklo_ps(rows[block + 0], rows[block + 1]);
+			__m256 t1 = _mm256_unpackhi_ps(rows[block + 0], rows[block + 1]);
+			__m256 t2 = _mm256_unpacklo_ps(rows[block + 2], rows[block + 3]);
+			__m256 t3 = _mm256_unpackhi_ps(rows[block + 2], rows[block + 3]);
+			__m256 t4 = _mm256_unpacklo_ps(rows[block + 4], rows[block + 5]);
+			__m256 t5 = _mm256_unpackhi_ps(rows[block + 4], rows[block + 5]);
+			__m256 t6 = _mm256_unpacklo_ps(rows[block + 6], rows[block + 7]);
+			__m256 t7 = _mm256_unpackhi_ps(rows[block + 6], rows[block + 7]);
+			__m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+			__m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+			__m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+			__m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+			__m256 columns[8] = {
+				_mm256_permute2f128_ps(u0, u4, 0x20), _mm256_permute2f128_ps(u1, u5, 0x20),
+				_mm256_permute2f128_ps(u2, u6, 0x20), _mm256_permute2f128_ps(u3, u7, 0x20),
+				_mm256_permute2f128_ps(u0, u4, 0x31), _mm256_permute2f128_ps(u1, u5, 0x31),
+				_mm256_permute2f128_ps(u2, u6, 0x31), _mm256_permute2f128_ps(u3, u7, 0x31)
+			};
+
+			for (int l = 0; l < 8; l++)
+			{
+				if (block + 8 <= 44)
+					_mm256_storeu_ps(dst[l] + block, columns[l]);
+				else
+					_mm_storeu_ps(dst[l] + block, _mm256_castps256_ps128(columns[l]));
+			}
+		}
+	}
+
+	if (i < end)
+		ComposeScalar(viewProjection, out + (i - begin), i, end);
+}
+#endif
+
+// Persistent mapped ring for per frame GPU data. One buffer split into FRAMES slices, mapped once for good
+// (persistent + coherent) so writing is just a memcpy with no map/unmap and no driver sync. Each slice is
+// fenced after its draws, BeginFrame only waits if the GPU still hasn't finished with the slice FRAMES frames
+// back, so normally the CPU fills frame N+1 while the GPU reads frame N.
+class PersistentRing
+{
+public:
+	static const int FRAMES = 3;
+
+	void Initialize(GLenum bindTarget, size_t frameBytes);
+	void Destroy();
+
+	// mapped memory for this frame's slice, at least bytes long
+	void* BeginFrame(size_t bytes);
+	// bind the part of this frame's slice that BeginFrame handed out
+	void BindRange(GLuint index) const;
+	// for the non indexed targets (indirect draws), offsets into the buffer start at SliceOffset()
+	void Bind() const { glBindBuffer(target, buffer); }
+	size_t SliceOffset() const { return sliceSize * slice; }
+	// fence the slice once everything reading it has been submitted
+	void EndFrame();
+
+private:
+	void Allocate(size_t frameBytes);
+	void WaitForSlice(int slice);
+
+	GLenum target = GL_SHADER_STORAGE_BUFFER;
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;
+	size_t sliceSize = 0;
+	size_t usedBytes = 0;
+	int slice = 0;
+	GLsync fences[FRAMES] = {};
+};
+
+void PersistentRing::Initialize(GLenum bindTarget, size_t frameBytes)
+{
+	target = bindTarget;
+	Allocate(frameBytes);
+}
+
+void PersistentRing::Allocate(size_t frameBytes)
+{
+	// every slice has to start on a legal offset for glBindBufferRange
+	GLint alignment = 256;
+	glGetIntegerv(target == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT : GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	sliceSize = (frameBytes + alignment - 1) / alignment * alignment;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	buffer = gGpuMemory.GenBuffer(GpuMemory::CATEGORY_BUFFER, target == GL_DRAW_INDIRECT_BUFFER ? "indirect ring" : "instance ring");
+	glBindBuffer(target, buffer);
+	glBufferStorage(target, sliceSize * FRAMES, nullptr, flags);
+	gGpuMemory.SetBufferBytes(buffer, sliceSize * FRAMES);
+	mapped = (unsigned char*)glMapBufferRange(target, 0, sliceSize * FRAMES, flags);
+	glBindBuffer(target, 0);
+
+	if (!mapped)
+		std::cout << "ERROR::RING::MAP_FAILED" << std::endl;
+}
+
+void PersistentRing::Destroy()
+{
+	for (int i = 0; i < FRAMES; i++)
+		WaitForSlice(i);
+
+	if (buffer)
+	{
+		glBindBuffer(target, buffer);
+		glUnmapBuffer(target);
+		glBindBuffer(target, 0);
+		gGpuMemory.DeleteBuffer(buffer);
+	}
+	buffer = 0;
+	mapped = nullptr;
+	sliceSize = 0;
+}
+
+void PersistentRing::WaitForSlice(int index)
+{
+	if (!fences[index])
+		return;
+
+	// flush on the first try so the fence can't sit in an unsubmitted command buffer forever
+	GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	for (;;)
+	{
+		GLenum result = glClientWaitSync(fences[index], waitFlags, 1000000);	// 1ms
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+			break;
+		waitFlags = 0;
+	}
+	glDeleteSync(fences[index]);
+	fences[index] = nullptr;
+}
+
+void* PersistentRing::BeginFrame(size_t bytes)
+{
+	// outgrew the slices, drain everything and start over with a bigger buffer. only happens when the scene grows
+	if (bytes > sliceSize)
+	{
+		GLenum bindTarget = target;
+		Destroy();
+		Initialize(bindTarget, bytes * 2);
+		slice = 0;
+	}
+
+	WaitForSlice(slice);
+	usedBytes = bytes;
+	return mapped ? mapped + sliceSize * slice : nullptr;
+}
+
+void PersistentRing::BindRange(GLuint index) const
+{
+	if (usedBytes > 0)
+		glBindBufferRange(target, index, buffer, sliceSize * slice, usedBytes);
+}
+
+void PersistentRing::EndFrame()
+{
+	fences[slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slice = (slice + 1) % FRAMES;
+}
+
+// Cascaded shadow maps for the directional light. The camera frustum is cut into CASCADE_COUNT slices, each
+// slice gets its own square depth map at its own resolution. Static casters are rendered into a cached map
+// that is only redrawn when the light, the static scene or the cascade's placement changes. Cascades are fit to
+// a bounding sphere of their slice and the center snaps to a coarse light space grid, so moving or turning the
+// camera a little doesn't move them. Dynamic casters get composited on top of a copy of the cache every frame.
+class ShadowCascades
+{
+public:
+	static const int CASCADE_COUNT = 3;
+
+	void Initialize(const int resolutions[CASCADE_COUNT], float shadowDistance);
+	void Destroy();
+
+	// refit the cascades for this frame's camera, marks a cascade's cache stale if it has to be redrawn
+	void Update(const Camera& camera, float fovY, float aspect, const glm::vec3& lightDirection, int staticSceneVersion);
+
+	bool NeedsStaticPass(int cascade) const { return cascades[cascade].staticDirty; }
+	void BeginStaticPass(int cascade);
+	void BeginDynamicPass(int cascade);
+	void EndPasses();
+
+	const glm::mat4& LightViewProjection(int cascade) const { return cascades[cascade].lightViewProjection; }
+	float SplitDistance(int cascade) const { return cascades[cascade].splitFar; }
+	// the composited map if dynamic casters were drawn this frame, otherwise the static cache as is
+	GLuint SampledMap(int cascade) const { return cascades[cascade].composited ? cascades[cascade].compositeMap : cascades[cascade].staticMap; }
+
+private:
+	// how far the practical split scheme leans towards logarithmic splits
+	static constexpr float SPLIT_LAMBDA = 0.75f;
+	// cascade centers snap to this fraction of the cascade radius
+	static constexpr float SNAP_FRACTION = 0.25f;
+	// extra depth towards the light so casters outside the slice still land in the map
+	static constexpr float CASTER_PADDING = 20.0f;
+
+	struct Cascade
+	{
+		int resolution = 0;
+		GLuint staticMap = 0;
+		GLuint compositeMap = 0;
+		glm::mat4 lightViewProjection = glm::mat4(1.0f);
+		glm::vec3 center = glm::vec3(0.0f);
+		float extent = 0.0f;
+		float splitFar = 0.0f;
+		bool staticDirty = true;
+		bool composited = false;
+	};
+
+	GLuint CreateDepthMap(int resolution);
+	void Attach(GLuint map, int resolution);
+
+	Cascade cascades[CASCADE_COUNT];
+	GLuint framebuffer = 0;
+	float maxDistance = 20.0f;
+	glm::vec3 lightDirection = glm::vec3(0.0f);
+	int staticVersion = -1;
+};
+
+void ShadowCascades::Initialize(const int resolutions[CASCADE_COUNT], float shadowDistance)
+{
+	maxDistance = shadowDistance;
+	framebuffer = gGpuMemory.GenFramebuffer("shadow cascades");
+
+	size_t bytes = 0;
+	for (int c = 0; c < CASCADE_COUNT; c++)
+	{
+		Cascade& cascade = cascades[c];
+		cascade.resolution = resolutions[c];
+		cascade.staticMap = CreateDepthMap(cascade.resolution);
+		cascade.compositeMap = CreateDepthMap(cascade.resolution);
+		bytes += (size_t)cascade.resolution * cascade.resolution * sizeof(float) * 2;
+	}
+	std::cout << "INFO: Shadow cascades use " << bytes / (1024 * 1024) << " MB" << std::endl;
+}
+
+GLuint ShadowCascades::CreateDepthMap(int resolution)
+{
+	GLuint map = gGpuMemory.GenTexture(GpuMemory::CATEGORY_RENDER_TARGET, "shadow cascades");
+	glBindTexture(GL_TEXTURE_2D, map);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, resolution, resolution);
+	gGpuMemory.SetTextureBytes(map, GpuMemory::TextureBytes(resolution, resolution, sizeof(float), false));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	const float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	// hardware PCF through sampler2DShadow
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return map;
+}
+
+void ShadowCascades::Destroy()
+{
+	for (Cascade& cascade : cascades)
+	{
+		gGpuMemory.DeleteTexture(cascade.staticMap);
+		gGpuMemory.DeleteTexture(cascade.compositeMap);
+	}
+	gGpuMemory.DeleteFramebuffer(framebuffer);
+}
+
+void ShadowCascades::Update(const Camera& camera, float fovY, float aspect, const glm::vec3& newLightDirection, int staticSceneVersion)
+{
+	glm::vec3 direction = glm::normalize(newLightDirection);
+	bool staticChanged = direction != lightDirection || staticSceneVersion != staticVersion;
+	lightDirection = direction;
+	staticVersion = staticSceneVersion;
+
+	glm::vec3 up = fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+	const float nearPlane = 0.1f;
+	float tanHalfY = tan(fovY * 0.5f);
+	float tanHalfX = tanHalfY * aspect;
+	float sliceNear = nearPlane;
+
+	for (int c = 0; c < CASCADE_COUNT; c++)
+	{
+		Cascade& cascade = cascades[c];
+		cascade.composited = false;
+
+		// practical split scheme, a blend of logarithmic and uniform splits
+		float ratio = (float)(c + 1) / CASCADE_COUNT;
+		float logSplit = nearPlane * pow(maxDistance / nearPlane, ratio);
+		float uniformSplit = nearPlane + (maxDistance - nearPlane) * ratio;
+		float sliceFar = SPLIT_LAMBDA * logSplit + (1.0f - SPLIT_LAMBDA) * uniformSplit;
+
+		// bounding sphere of the slice's corners. Its radius only depends on the slice and the fov so it
+		// stays the same size however the camera turns
+		glm::vec3 corners[8];
+		float distances[2] = { sliceNear, sliceFar };
+		glm::vec3 center(0.0f);
+		for (int i = 0; i < 8; i++)
+		{
+			float d = distances[i >> 2];
+			float sx = (i & 1) ? 1.0f : -1.0f;
+			float sy = (i & 2) ? 1.0f : -1.0f;
+			corners[i] = camera.Position + camera.Front * d + camera.Right * (sx * d * tanHalfX) + camera.Up * (sy * d * tanHalfY);
+			center += corners[i];
+		}
+		center /= 8.0f;
+
+		float radius = 0.0f;
+		for (int i = 0; i < 8; i++)
+			radius = std::max(radius, glm::length(corners[i] - center));
+		radius = ceil(radius * 16.0f) / 16.0f;
+
+		// snap in light space, growing the cascade by a grid step keeps the slice covered wherever it sits in the cell
+		float step = radius * SNAP_FRACTION;
+		glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+		lightCenter = glm::vec3(floor(lightCenter.x / step) * step, floor(lightCenter.y / step) * step, floor(lightCenter.z / step) * step);
+		float extent = radius + step;
+
+		if (staticChanged || lightCenter != cascade.center || extent != cascade.extent)
+		{
+			cascade.center = lightCenter;
+			cascade.extent = extent;
+			cascade.staticDirty = true;
+
+			// light looks down -z, casters between the light and the slice have a larger z
+			glm::mat4 projection = glm::ortho(
+				lightCenter.x - extent, lightCenter.x + extent,
+				lightCenter.y - extent, lightCenter.y + extent,
+				-(lightCenter.z + extent + CASTER_PADDING), -(lightCenter.z - extent));
+			cascade.lightViewProjection = projection * lightView;
+		}
+
+		cascade.splitFar = sliceFar;
+		sliceNear = sliceFar;
+	}
+}
+
+void ShadowCascades::Attach(GLuint map, int resolution)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, map, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glViewport(0, 0, resolution, resolution);
+}
+
+void ShadowCascades::BeginStaticPass(int c)
+{
+	Cascade& cascade = cascades[c];
+	Attach(cascade.staticMap, cascade.resolution);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	cascade.staticDirty = false;
+}
+
+void ShadowCascades::BeginDynamicPass(int c)
+{
+	// start from the cached static depth and draw the moving casters over it
+	Cascade& cascade = cascades[c];
+	glCopyImageSubData(cascade.staticMap, GL_TEXTURE_2D, 0, 0, 0, 0,
+		cascade.compositeMap, GL_TEXTURE_2D, 0, 0, 0, 0,
+		cascade.resolution, cascade.resolution, 1);
+	Attach(cascade.compositeMap, cascade.resolution);
+	cascade.composited = true;
+}
+
+void ShadowCascades::EndPasses()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+// Single producer / single consumer ring, lock free. The GLFW callbacks push on the main thread and the
+// simulation thread pops, so input never waits on a frame. Capacity has to be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+	bool Push(const T& item)
+	{
+		size_t head = writeIndex.load(std::memory_order_relaxed);
+		if (head - readIndex.load(std::memory_order_acquire) == Capacity)
+			return false;	// full, the consumer has fallen way behind
+		items[head & (Capacity - 1)] = item;
+		writeIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		size_t tail = readIndex.load(std::memory_order_relaxed);
+		if (tail == writeIndex.load(std::memory_order_acquire))
+			return false;
+		item = items[tail & (Capacity - 1)];
+		readIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T items[Capacity];
+	std::atomic<size_t> writeIndex{ 0 };
+	std::atomic<size_t> readIndex{ 0 };
+};
+
+// Lock free triple buffer. The writer always has a slot of its own to fill, Publish() swaps it with the
+// shared middle slot, and the reader swaps the middle into its own slot only when something new is there.
+// Neither side ever waits on the other and the reader always sees a complete snapshot.
+template <typename T>
+class TripleBuffer
+{
+public:
+	T& WriteSlot() { return slots[back]; }
+
+	void Publish()
+	{
+		int previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+		back = previous & INDEX_MASK;
+	}
+
+	const T& Read()
+	{
+		if (middle.load(std::memory_order_relaxed) & FRESH)
+		{
+			int previous = middle.exchange(front, std::memory_order_acq_rel);
+			front = previous & INDEX_MASK;
+		}
+		return slots[front];
+	}
+
+private:
+	static const int INDEX_MASK = 3;
+	static const int FRESH = 4;
+
+	T slots[3];
+	int back = 0;	// writer only
+	int front = 1;	// reader only
+	std::atomic<int> middle{ 2 };
+};
+
+// Sticky wake up flag for a thread that sleeps until there's work. Notify() from anywhere, the sleeping thread
+// waits on it and Consume()s it once it has handled whatever woke it. A notify that lands while nobody is
+// waiting isn't lost, the next wait returns straight away.
+class WakeSignal
+{
+public:
+	void Notify()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			signaled = true;
+		}
+		wake.notify_all();
+	}
+
+	// returns early when notified, the flag stays set
+	void WaitFor(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		wake.wait_for(lock, timeout, [this] { return signaled; });
+	}
+
+	bool Pending()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return signaled;
+	}
+
+	// clears the flag, true if it was set
+	bool Consume()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bool wasSignaled = signaled;
+		signaled = false;
+		return wasSignaled;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool signaled = false;
+};
+
+// what the GLFW callbacks hand over to the simulation thread
+struct InputEvent
+{
+	enum Type
+	{
+		KEY,
+		MOUSE_MOVE,
+		SCROLL,
+		MOUSE_BUTTON	// x and y are the cursor, 0 to 1 across the window
+	};
+
+	Type type;
+	int key;
+	int action;
+	double x;
+	double y;
+	double time;	// glfwGetTime() when the callback fired
+};
+
+// what URender submitted last frame, for --gl-stats and the golden baselines
+struct RenderStats
+{
+	int meshletsTested = 0;
+	int meshletsCulled = 0;
+	int drawCalls = 0;
+	long long triangles = 0;
+	int objects = 0;
+	int pointLights = 0;	// summed over the objects, what the light lists left them
+};
+
+// snapshot of everything the render thread needs from the simulation, published once per tick
+struct FrameState
+{
+	Camera camera;
+	unsigned long long simTick = 0;
+	double inputTime = 0.0;		// newest input this state reflects, for latency measurement
+	unsigned int pickSerial = 0;	// bumped by every click, the render side picks once per new value
+	glm::vec2 pickCursor = glm::vec2(0.0f);
+};
+
+// Small fixed pool of worker threads. ParallelFor splits [0, count) into one chunk per thread, the calling
+// thread takes chunk 0 and everything is done by the time it returns. With no workers it all runs inline.
+// Callers on different threads take turns, a job can't call ParallelFor on its own pool
+class WorkerPool
+{
+public:
+	void Initialize(int workerCount);
+	void Destroy();
+
+	int ThreadCount() const { return (int)workers.size() + 1; }
+
+	// job(begin, end, threadIndex), threadIndex is 0 for the caller
+	void ParallelFor(int count, const std::function<void(int, int, int)>& job);
+
+private:
+	void WorkerLoop(int threadIndex);
+	// where threadIndex's chunk of [0, count) starts, the next one's start is where it ends
+	static int SliceStart(int count, int threadIndex, int threads) { return (int)((long long)count * threadIndex / threads); }
+
+	std::vector<std::thread> workers;
+	std::mutex callerMutex;		// held for a whole ParallelFor, there's only the one job slot
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	const std::function<void(int, int, int)>* currentJob = nullptr;
+	int currentCount = 0;
+	int generation = 0;
+	int pending = 0;
+	bool stopping = false;
+};
+
+void WorkerPool::Initialize(int workerCount)
+{
+	stopping = false;
+	for (int i = 0; i < workerCount; i++)
+		workers.emplace_back(&WorkerPool::WorkerLoop, this, i + 1);
+}
+
+void WorkerPool::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+void WorkerPool::ParallelFor(int count, const std::function<void(int, int, int)>& job)
+{
+	int threads = ThreadCount();
+	if (threads == 1 || count < 2)
+	{
+		job(0, count, 0);
+		return;
+	}
+
+	std::lock_guard<std::mutex> caller(callerMutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &job;
+		currentCount = count;
+		pending = threads - 1;
+		generation++;
+	}
+	wake.notify_all();
+
+	int end = SliceStart(count, 1, threads);
+	if (end > 0)
+		job(0, end, 0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this] { return pending == 0; });
+	currentJob = nullptr;
+}
+
+void WorkerPool::WorkerLoop(int threadIndex)
+{
+	int seenGeneration = 0;
+	for (;;)
+	{
+		const std::function<void(int, int, int)>* job;
+		int count;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping)
+				return;
+			seenGeneration = generation;
+			job = currentJob;
+			count = currentCount;
+		}
+
+		int threads = ThreadCount();
+		int begin = SliceStart(count, threadIndex, threads);
+		int end = SliceStart(count, threadIndex + 1, threads);
+		if (begin < end)
+			(*job)(begin, end, threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending--;
+		}
+		finished.notify_one();
+	}
+}
+
+// Quadric error simplification (Garland and Heckbert) by half edge collapses, so every LOD only references
+// vertices the mesh already has and they all share its vertex buffer. A position that shows up in more than
+// one vertex is a UV seam or a hard normal edge, those and open borders are locked so seams, creases and
+// the outline of open surfaces stay exactly where they were. Everything else collapses cheapest first, in
+// passes of collapses that don't touch each other, as long as no triangle flips over and the error stays
+// under the bound. Quadrics are area weighted and normalized so the error is a distance in mesh units, the
+// root mean square distance of the collapsed region to its original planes, with a term for how far the
+// normal and uv jump along the collapsed edge
+class MeshSimplifier
+{
+public:
+	// triangles into interleaved position/normal/uv vertices, simplified towards targetIndexCount without
+	// going over maxError. Returns the error of the result
+	float Simplify(const std::vector<GLfloat>& vertices, const GLuint* indices, size_t indexCount, size_t targetIndexCount, float maxError, std::vector<GLuint>& out);
+
+	// up to levels LODs, each about ratio of the triangles of the one before, appended to indices after LOD 0
+	// (its first baseIndexCount). maxRelativeError is the bound as a fraction of the mesh's bounding box
+	// diagonal, each level's error includes the ones before it. Stops once a level barely gets smaller
+	void BuildLodChain(const std::vector<GLfloat>& vertices, std::vector<GLuint>& indices, size_t baseIndexCount, int levels, float ratio, float maxRelativeError, std::vector<Meshes::GLMesh::Lod>& lods);
+
+private:
+	// symmetric 4x4 plane quadric, xx xy xz xw yy yz yw zz zw ww, and the area it was built from
+	struct Quadric
+	{
+		double q[10];
+		double area;
+	};
+
+	struct Collapse
+	{
+		GLuint from;
+		GLuint to;
+		float cost;
+	};
+
+	static double Evaluate(const Quadric& quadric, const glm::vec3& p);
+	float Cost(const std::vector<GLfloat>& vertices, GLuint from, GLuint to) const;
+
+	std::vector<Quadric> quadrics;
+	std::vector<unsigned char> flags;
+	std::vector<GLuint> adjacencyOffsets;
+	std::vector<GLuint> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<GLuint> remap;
+	std::vector<bool> touched;
+};
+
+namespace
+{
+	const unsigned char SIMPLIFY_LOCKED = 1;	// seam or border, never moves
+	const unsigned char SIMPLIFY_SEAM = 2;		// more than one vertex at its position, nothing collapses onto it either
+}
+
+double MeshSimplifier::Evaluate(const Quadric& m, const glm::vec3& p)
+{
+	const double* q = m.q;
+	double x = p.x, y = p.y, z = p.z;
+	double value = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+		q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+		q[7] * z * z + 2.0 * q[8] * z + q[9];
+	return value > 0.0 ? value : 0.0;
+}
+
+float MeshSimplifier::Cost(const std::vector<GLfloat>& vertices, GLuint from, GLuint to) const
+{
+	const float ATTRIBUTE_WEIGHT = 0.5f;
+	const GLfloat* a = &vertices[(size_t)from * 8];
+	const GLfloat* b = &vertices[(size_t)to * 8];
+	glm::vec3 target(b[0], b[1], b[2]);
+
+	const Quadric& q0 = quadrics[from];
+	const Quadric& q1 = quadrics[to];
+	double area = q0.area + q1.area;
+	double distance = area > 0.0 ? (Evaluate(q0, target) + Evaluate(q1, target)) / area : 0.0;
+
+	// the moved vertex takes on the target's normal and uv, scaled by the edge so it's a distance too
+	float edge = glm::dot(target - glm::vec3(a[0], a[1], a[2]), target - glm::vec3(a[0], a[1], a[2]));
+	float normalJump = (a[3] - b[3]) * (a[3] - b[3]) + (a[4] - b[4]) * (a[4] - b[4]) + (a[5] - b[5]) * (a[5] - b[5]);
+	float uvJump = (a[6] - b[6]) * (a[6] - b[6]) + (a[7] - b[7]) * (a[7] - b[7]);
+	return (float)distance + ATTRIBUTE_WEIGHT * (normalJump + uvJump) * edge;
+}
+
+float MeshSimplifier::Simplify(const std::vector<GLfloat>& vertices, const GLuint* indices, size_t indexCount, size_t targetIndexCount, float maxError, std::vector<GLuint>& out)
+{
+	size_t vertexCount = vertices.size() / 8;
+	out.assign(indices, indices + indexCount / 3 * 3);
+	auto position = [&vertices](GLuint vertex) { return glm::make_vec3(&vertices[(size_t)vertex * 8]); };
+
+	// seams: sort the vertices by position, any run longer than one is a seam
+	flags.assign(vertexCount, 0);
+	std::vector<GLuint> order(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+		order[i] = (GLuint)i;
+	auto samePosition = [&vertices](GLuint a, GLuint b) { return memcmp(&vertices[(size_t)a * 8], &vertices[(size_t)b * 8], sizeof(GLfloat) * 3) == 0; };
+	std::sort(order.begin(), order.end(), [&vertices](GLuint a, GLuint b) { return memcmp(&vertices[(size_t)a * 8], &vertices[(size_t)b * 8], sizeof(GLfloat) * 3) < 0; });
+	std::vector<GLuint> welded(vertexCount);
+	for (size_t i = 0; i < vertexCount; )
+	{
+		size_t run = i + 1;
+		while (run < vertexCount && samePosition(order[i], order[run]))
+			run++;
+		for (size_t j = i; j < run; j++)
+		{
+			welded[order[j]] = order[i];
+			if (run - i > 1)
+				flags[order[j]] = SIMPLIFY_LOCKED | SIMPLIFY_SEAM;
+		}
+		i = run;
+	}
+
+	// borders: welded edges that aren't shared by exactly two triangles
+	std::vector<unsigned long long> edges;
+	edges.reserve(out.size());
+	for (size_t i = 0; i < out.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			unsigned long long a = welded[out[i + e]], b = welded[out[i + (e + 1) % 3]];
+			edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); )
+	{
+		size_t run = i + 1;
+		while (run < edges.size() && edges[run] == edges[i])
+			run++;
+		if (run - i != 2)
+		{
+			flags[(GLuint)(edges[i] >> 32)] |= SIMPLIFY_LOCKED;
+			flags[(GLuint)(edges[i] & 0xFFFFFFFFu)] |= SIMPLIFY_LOCKED;
+		}
+		i = run;
+	}
+	// the welded representative stands in for the whole seam, lock the rest of the run too
+	for (size_t i = 0; i < vertexCount; i++)
+		flags[i] |= flags[welded[i]] & SIMPLIFY_LOCKED;
+
+	// plane quadrics of the original triangles, area weighted
+	quadrics.assign(vertexCount, Quadric());
+	for (size_t i = 0; i < out.size(); i += 3)
+	{
+		glm::vec3 a = position(out[i]), b = position(out[i + 1]), c = position(out[i + 2]);
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length <= 0.0f)
+			continue;
+		double area = 0.5 * length;
+		glm::vec3 n = normal / length;
+		double plane[4] = { n.x, n.y, n.z, -((double)n.x * a.x + (double)n.y * a.y + (double)n.z * a.z) };
+		Quadric triangle;
+		int k = 0;
+		for (int row = 0; row < 4; row++)
+			for (int column = row; column < 4; column++)
+				triangle.q[k++] = plane[row] * plane[column] * area;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			Quadric& quadric = quadrics[out[i + corner]];
+			for (int j = 0; j < 10; j++)
+				quadric.q[j] += triangle.q[j];
+			quadric.area += area;
+		}
+	}
+
+	remap.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+		remap[i] = (GLuint)i;
+
+	float maxCost = maxError * maxError;
+	float worstCost = 0.0f;
+	size_t targetTriangles = targetIndexCount / 3;
+	while (out.size() / 3 > targetTriangles)
+	{
+		size_t triangleCount = out.size() / 3;
+
+		// triangles around each vertex
+		adjacencyOffsets.assign(vertexCount + 1, 0);
+		for (GLuint index : out)
+			adjacencyOffsets[index + 1]++;
+		for (size_t i = 0; i < vertexCount; i++)
+			adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+		adjacency.resize(out.size());
+		std::vector<GLuint> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < out.size(); i++)
+			adjacency[fill[out[i]]++] = (GLuint)(i / 3);
+
+		// cheapest edge out of every vertex that can move
+		collapses.clear();
+		for (size_t from = 0; from < vertexCount; from++)
+		{
+			if (flags[from] & SIMPLIFY_LOCKED)
+				continue;
+			Collapse best = { (GLuint)from, 0, FLT_MAX };
+			for (GLuint t = adjacencyOffsets[from]; t < adjacencyOffsets[from + 1]; t++)
+			{
+				const GLuint* triangle = &out[adjacency[t] * 3];
+				for (int corner = 0; corner < 3; corner++)
+				{
+					GLuint to = triangle[corner];
+					if (to == from || (flags[to] & SIMPLIFY_SEAM))
+						continue;
+					float cost = Cost(vertices, (GLuint)from, to);
+					if (cost < best.cost)
+					{
+						best.to = to;
+						best.cost = cost;
+					}
+				}
+			}
+			if (best.cost <= maxCost)
+				collapses.push_back(best);
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		touched.assign(vertexCount, false);
+		size_t removed = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (triangleCount - removed <= targetTriangles)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// the triangles that stay have to keep facing the same way
+			glm::vec3 target = position(collapse.to);
+			bool flips = false;
+			size_t degenerate = 0;
+			for (GLuint t = adjacencyOffsets[collapse.from]; t < adjacencyOffsets[collapse.from + 1] && !flips; t++)
+			{
+				const GLuint* triangle = &out[adjacency[t] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					degenerate++;
+					continue;
+				}
+				glm::vec3 corners[3], moved[3];
+				for (int corner = 0; corner < 3; corner++)
+				{
+					corners[corner] = position(triangle[corner]);
+					moved[corner] = triangle[corner] == collapse.from ? target : corners[corner];
+				}
+				glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+			}
+			if (flips || degenerate == 0)
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			Quadric& into = quadrics[collapse.to];
+			for (int j = 0; j < 10; j++)
+				into.q[j] += quadrics[collapse.from].q[j];
+			into.area += quadrics[collapse.from].area;
+			for (GLuint t = adjacencyOffsets[collapse.from]; t < adjacencyOffsets[collapse.from + 1]; t++)
+			{
+				const GLuint* triangle = &out[adjacency[t] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+			}
+			removed += degenerate;
+			worstCost = std::max(worstCost, collapse.cost);
+		}
+		if (removed == 0)
+			break;
+
+		// apply the pass and drop the triangles that collapsed away
+		size_t kept = 0;
+		for (size_t i = 0; i < out.size(); i += 3)
+		{
+			GLuint a = remap[out[i]], b = remap[out[i + 1]], c = remap[out[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			out[kept++] = a;
+			out[kept++] = b;
+			out[kept++] = c;
+		}
+		out.resize(kept);
+	}
+	return std::sqrt(worstCost);
+}
+
+void MeshSimplifier::BuildLodChain(const std::vector<GLfloat>& vertices, std::vector<GLuint>& indices, size_t baseIndexCount, int levels, float ratio, float maxRelativeError, std::vector<Meshes::GLMesh::Lod>& lods)
+{
+	glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+	for (size_t i = 0; i < vertices.size(); i += 8)
+	{
+		low = glm::min(low, glm::make_vec3(&vertices[i]));
+		high = glm::max(high, glm::make_vec3(&vertices[i]));
+	}
+	float maxError = vertices.empty() ? 0.0f : maxRelativeError * glm::length(high - low);
+
+	lods.clear();
+	indices.resize(baseIndexCount);
+	std::vector<GLuint> source(indices), result;
+	float error = 0.0f;
+	for (int level = 0; level < levels; level++)
+	{
+		size_t target = (size_t)(source.size() / 3 * ratio) * 3;
+		if (target < 3)
+			break;
+		float levelError = Simplify(vertices, source.data(), source.size(), target, maxError - error, result);
+
+		// not worth drawing if it's barely any cheaper than the one before
+		if (result.empty() || result.size() * 10 > source.size() * 9)
+			break;
+		error += levelError;
+		lods.push_back({ (int)indices.size(), (int)result.size(), error });
+		indices.insert(indices.end(), result.begin(), result.end());
+		source.swap(result);
+	}
+}
+
+// LOD chains for every mesh in the pool that draws as a single indexed triangle list off a CPU copy. The
+// simplification runs across meshes on the pool, the longer index buffers go up after on this thread
+void Meshes::BuildLods(WorkerPool& workers, int levels, float ratio, float maxRelativeError)
+{
+	std::vector<GLMesh*> candidates;
+	for (int i = 0; i < pool.Count(); i++)
+	{
+		GLMesh& mesh = pool.At(i);
+		if (mesh.lods.empty() && !mesh.indices.empty() && mesh.ranges.size() == 1 && mesh.ranges[0].primitive == PRIMITIVE_TRIANGLES &&
+			mesh.ranges[0].indexed && mesh.ranges[0].first == 0 && mesh.ranges[0].count == (int)mesh.indices.size())
+			candidates.push_back(&mesh);
+	}
+
+	workers.ParallelFor((int)candidates.size(), [&](int begin, int end, int /*threadIndex*/)
+	{
+		MeshSimplifier simplifier;
+		for (int i = begin; i < end; i++)
+		{
+			GLMesh& mesh = *candidates[i];
+			simplifier.BuildLodChain(mesh.vertices, mesh.indices, mesh.indices.size(), levels, ratio, maxRelativeError, mesh.lods);
+		}
+	});
+
+	for (GLMesh* mesh : candidates)
+	{
+		if (!mesh->lods.empty())
+			UUploadIndices(*mesh);
+	}
+	if (createBuffers)
+		glBindVertexArray(0);
+}
+
+// Splits count indices from first (a triangle list) into meshlets of up to 64 vertices and 124 triangles,
+// appended to indices in meshlet order. Each meshlet grows from a seed triangle through its neighbours,
+// taking the one that adds the fewest new vertices and then the one closest to the meshlet's average normal,
+// so the normal cones stay narrow enough to cull. Bounds are a sphere around the meshlet and, when all its
+// triangles face roughly the same way, a cone: seen from anywhere inside it (apex, axis, cutoff), the
+// whole meshlet faces away. Nothing is back face culled in GL, so a triangle wound against its vertex
+// normals (seen from its back on purpose) leaves its meshlet without a cone
+void UBuildMeshlets(const std::vector<GLfloat>& vertices, std::vector<GLuint>& indices, size_t first, size_t count, std::vector<Meshes::GLMesh::Meshlet>& meshlets)
+{
+	const size_t MAX_VERTICES = 64;
+	const size_t MAX_TRIANGLES = 124;
+
+	std::vector<GLuint> triangles(indices.begin() + first, indices.begin() + first + count / 3 * 3);
+	size_t triangleCount = triangles.size() / 3;
+	size_t vertexCount = vertices.size() / 8;
+	auto position = [&vertices](GLuint vertex) { return glm::make_vec3(&vertices[(size_t)vertex * 8]); };
+
+	auto normal = [&vertices](GLuint vertex) { return glm::make_vec3(&vertices[(size_t)vertex * 8 + 3]); };
+
+	std::vector<glm::vec3> faceNormals(triangleCount);
+	std::vector<bool> windingAgrees(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		GLuint i0 = triangles[t * 3], i1 = triangles[t * 3 + 1], i2 = triangles[t * 3 + 2];
+		glm::vec3 a = position(i0), b = position(i1), c = position(i2);
+		glm::vec3 face = glm::cross(b - a, c - a);
+		float length = glm::length(face);
+		faceNormals[t] = length > 0.0f ? face / length : glm::vec3(0.0f);
+		windingAgrees[t] = glm::dot(face, normal(i0) + normal(i1) + normal(i2)) > 0.0f;
+	}
+
+	// triangles around each vertex
+	std::vector<GLuint> offsets(vertexCount + 1, 0);
+	for (GLuint index : triangles)
+		offsets[index + 1]++;
+	for (size_t i = 0; i < vertexCount; i++)
+		offsets[i + 1] += offsets[i];
+	std::vector<GLuint> adjacency(triangles.size());
+	std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < triangles.size(); i++)
+		adjacency[fill[triangles[i]]++] = (GLuint)(i / 3);
+
+	std::vector<bool> used(triangleCount, false);
+	std::vector<int> owner(vertexCount, -1);		// last meshlet that took the vertex
+	std::vector<GLuint> members, memberVertices, candidates;
+	size_t seed = 0;
+	for (;;)
+	{
+		while (seed < triangleCount && used[seed])
+			seed++;
+		if (seed == triangleCount)
+			break;
+
+		int id = (int)meshlets.size();
+		members.clear();
+		memberVertices.clear();
+		candidates.clear();
+		glm::vec3 normalSum(0.0f);
+		size_t next = seed;
+		for (;;)
+		{
+			used[next] = true;
+			members.push_back((GLuint)next);
+			normalSum += faceNormals[next];
+			for (int corner = 0; corner < 3; corner++)
+			{
+				GLuint vertex = triangles[next * 3 + corner];
+				if (owner[vertex] == id)
+					continue;
+				owner[vertex] = id;
+				memberVertices.push_back(vertex);
+				for (GLuint t = offsets[vertex]; t < offsets[vertex + 1]; t++)
+				{
+					if (!used[adjacency[t]])
+						candidates.push_back(adjacency[t]);
+				}
+			}
+			if (members.size() == MAX_TRIANGLES)
+				break;
+
+			float length = glm::length(normalSum);
+			glm::vec3 axis = length > 0.0f ? normalSum / length : glm::vec3(0.0f);
+			float bestScore = FLT_MAX;
+			size_t best = 0;
+			for (size_t k = 0; k < candidates.size(); )
+			{
+				GLuint t = candidates[k];
+				if (used[t])
+				{
+					candidates[k] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+				size_t added = 0;
+				for (int corner = 0; corner < 3; corner++)
+					added += owner[triangles[t * 3 + corner]] != id;
+				float score = added + (1.0f - glm::dot(faceNormals[t], axis));
+				if (memberVertices.size() + added <= MAX_VERTICES && score < bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+				k++;
+			}
+			if (bestScore == FLT_MAX)
+				break;
+			next = best;
+		}
+
+		Meshes::GLMesh::Meshlet meshlet;
+		meshlet.first = (int)indices.size();
+		meshlet.count = (int)members.size() * 3;
+		for (GLuint t : members)
+			indices.insert(indices.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+
+		glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+		for (GLuint vertex : memberVertices)
+		{
+			low = glm::min(low, position(vertex));
+			high = glm::max(high, position(vertex));
+		}
+		meshlet.center = 0.5f * (low + high);
+		meshlet.radius = 0.0f;
+		for (GLuint vertex : memberVertices)
+			meshlet.radius = std::max(meshlet.radius, glm::length(position(vertex) - meshlet.center));
+
+		// the cone only exists when every triangle is within 90 degrees of the average normal (a little less
+		// so the apex doesn't run off), a cutoff over 1 never culls
+		float length = glm::length(normalSum);
+		meshlet.coneAxis = length > 0.0f ? normalSum / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		float minDot = length > 0.0f ? 1.0f : -1.0f;
+		for (GLuint t : members)
+			minDot = std::min(minDot, windingAgrees[t] ? glm::dot(faceNormals[t], meshlet.coneAxis) : -1.0f);
+		if (minDot <= 0.1f)
+		{
+			meshlet.coneApex = meshlet.center;
+			meshlet.coneCutoff = 2.0f;
+		}
+		else
+		{
+			// pull the apex back along the axis until it's behind every triangle's plane
+			float maxT = 0.0f;
+			for (GLuint t : members)
+			{
+				glm::vec3 corner = position(triangles[t * 3]);
+				float along = glm::dot(faceNormals[t], meshlet.coneAxis);
+				maxT = std::max(maxT, glm::dot(meshlet.center - corner, faceNormals[t]) / along);
+			}
+			meshlet.coneApex = meshlet.center - meshlet.coneAxis * maxT;
+			meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+		meshlets.push_back(meshlet);
+	}
+}
+
+// meshlets for every pool mesh drawn as one indexed triangle list of at least minTriangles, on the pool,
+// then the longer index buffers go up on this thread
+void Meshes::BuildMeshlets(WorkerPool& workers, int minTriangles)
+{
+	std::vector<GLMesh*> candidates;
+	for (int i = 0; i < pool.Count(); i++)
+	{
+		GLMesh& mesh = pool.At(i);
+		if (mesh.meshlets.empty() && !mesh.indices.empty() && mesh.ranges.size() == 1 && mesh.ranges[0].primitive == PRIMITIVE_TRIANGLES &&
+			mesh.ranges[0].indexed && mesh.ranges[0].count >= minTriangles * 3)
+			candidates.push_back(&mesh);
+	}
+
+	workers.ParallelFor((int)candidates.size(), [&](int begin, int end, int /*threadIndex*/)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			GLMesh& mesh = *candidates[i];
+			UBuildMeshlets(mesh.vertices, mesh.indices, mesh.ranges[0].first, mesh.ranges[0].count, mesh.meshlets);
+		}
+	});
+
+	for (GLMesh* mesh : candidates)
+		UUploadIndices(*mesh);
+	if (createBuffers)
+		glBindVertexArray(0);
+}
+
+// the whole CPU copy of the indices again, after LODs or meshlets were appended to it. Leaves the VAO bound
+void Meshes::UUploadIndices(GLMesh& mesh)
+{
+	if (!createBuffers || !mesh.vbos[1])
+		return;
+	glBindVertexArray(mesh.vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.indices.size(), mesh.indices.data(), GL_STATIC_DRAW);
+	gGpuMemory.SetBufferBytes(mesh.vbos[1], sizeof(GLuint) * mesh.indices.size());
+}
+
+// Render commands. Recording only deals in these ids and handles and never touches GL, so it can run on any
+// thread, the GL thread turns them into real objects when it executes the sorted list.
+enum ProgramId
+{
+	PROGRAM_SCENE
+};
+
+struct DrawPacket
+{
+	unsigned long long key;
+	unsigned short program;
+	unsigned short material;
+	unsigned short primitive;
+	MeshHandle mesh;
+	bool indexed;
+	int first;			// first vertex, or first index when indexed
+	int count;
+	int instance;		// row in the instance buffer
+	bool indirect;		// meshlet culled, draws indirectCount commands from indirectFirst instead of first/count
+	int indirectFirst;
+	int indirectCount;
+};
+
+// glMultiDrawElementsIndirect's layout
+struct DrawIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// sort key, most significant first: program | material | mesh | depth. Everything sharing a program ends
+// up together, then everything sharing a material and so on, and the low bits draw front to back
+inline unsigned long long UMakeSortKey(int program, int material, int mesh, float viewDepth, float farPlane)
+{
+	const unsigned int DEPTH_MAX = (1u << 24) - 1;
+	float depth = viewDepth / farPlane;
+	depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+
+	return ((unsigned long long)(program & 0xFF) << 56) |
+		((unsigned long long)(material & 0xFFFF) << 40) |
+		((unsigned long long)(mesh & 0xFFFF) << 24) |
+		(unsigned long long)(depth * DEPTH_MAX);
+}
+
+// one per recording thread so nothing is shared while recording
+class CommandBuffer
+{
+public:
+	void Reset() { packets.clear(); indirect.clear(); meshletsTested = meshletsCulled = 0; }
+	void Record(const DrawPacket& packet) { packets.push_back(packet); }
+	const std::vector<DrawPacket>& Packets() const { return packets; }
+
+	// indirect commands the packets point into, renumbered once every buffer's are merged into the frame's
+	void RecordIndirect(const DrawIndirectCommand& command) { indirect.push_back(command); }
+	void ExtendIndirect(GLuint count) { indirect.back().count += count; }
+	std::vector<DrawIndirectCommand>& Indirect() { return indirect; }
+	std::vector<DrawPacket>& Packets() { return packets; }
+
+	void CountMeshlets(int tested, int culled) { meshletsTested += tested; meshletsCulled += culled; }
+	int MeshletsTested() const { return meshletsTested; }
+	int MeshletsCulled() const { return meshletsCulled; }
+
+private:
+	std::vector<DrawPacket> packets;
+	std::vector<DrawIndirectCommand> indirect;
+	int meshletsTested = 0;
+	int meshletsCulled = 0;
+};
+
+// LSD radix sort of the packets by key, a byte per pass. Passes where every key has the same byte are
+// skipped, which is most of them with only a handful of programs and materials
+void URadixSortPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch)
+{
+	size_t count = packets.size();
+	scratch.resize(count);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t histogram[256] = {};
+		for (size_t i = 0; i < count; i++)
+			histogram[(packets[i].key >> shift) & 0xFF]++;
+
+		if (count == 0 || histogram[(packets[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		size_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++)
+		{
+			size_t bucketSize = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketSize;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			scratch[histogram[(packets[i].key >> shift) & 0xFF]++] = packets[i];
+
+		packets.swap(scratch);
+	}
+}
+
+// CPU side shadow of the GL state the renderer touches. Every call compares against what GL already has
+// and only goes through when something changed. Counts issued vs filtered calls so redundant state is visible.
+// Anything that changes GL state behind its back has to call Invalidate().
+class GLStateCache
+{
+public:
+	struct FrameStats
+	{
+		int issued = 0;
+		int filtered = 0;
+	};
+
+	GLStateCache() { Invalidate(); }
+
+	void Invalidate();
+	void BeginFrame();
+	const FrameStats& LastFrame() const { return lastFrame; }
+
+	void UseProgram(GLuint program);
+	void BindVertexArray(GLuint vao);
+	void BindTexture(GLuint unit, GLuint texture);
+	void Enable(GLenum capability);
+	void Disable(GLenum capability);
+	void ClearColor(const glm::vec4& color);
+
+	// uniform locations are looked up once per program and name, values are shadowed per location.
+	// glUniform works on the current program so setting one makes its program current
+	GLint Location(GLuint program, const char* name);
+	void SetUniform1i(GLuint program, const char* name, int value);
+	void SetUniform1f(GLuint program, const char* name, float value);
+	void SetUniform3f(GLuint program, const char* name, const glm::vec3& value);
+	void SetUniform4f(GLuint program, const char* name, const glm::vec4& value);
+	void SetUniformMatrix4f(GLuint program, const char* name, const glm::mat4& value);
+
+private:
+	static const GLuint UNKNOWN = 0xFFFFFFFF;
+	static const int MAX_TEXTURE_UNITS = 16;
+
+	struct ShadowedCapability
+	{
+		GLenum capability;
+		int enabled;	// -1 until the first call
+	};
+
+	struct ShadowedUniform
+	{
+		float value[16];
+		bool known = false;
+	};
+
+	bool Filter(bool changed);
+	int& CapabilityState(GLenum capability);
+	bool UniformChanged(GLuint program, GLint location, const float* value, int components);
+
+	GLuint program = UNKNOWN;
+	GLuint vao = UNKNOWN;
+	GLuint activeUnit = UNKNOWN;
+	GLuint textures[MAX_TEXTURE_UNITS];
+	std::vector<ShadowedCapability> capabilities;
+	glm::vec4 clearColor;
+	bool clearColorKnown = false;
+
+	std::unordered_map<GLuint, std::unordered_map<std::string, GLint>> locations;
+	std::unordered_map<unsigned long long, ShadowedUniform> uniforms;
+
+	FrameStats current;
+	FrameStats lastFrame;
+};
+
+void GLStateCache::Invalidate()
+{
+	program = vao = activeUnit = UNKNOWN;
+	for (GLuint& texture : textures)
+		texture = UNKNOWN;
+	for (ShadowedCapability& shadow : capabilities)
+		shadow.enabled = -1;
+	clearColorKnown = false;
+	uniforms.clear();
+}
+
+void GLStateCache::BeginFrame()
+{
+	lastFrame = current;
+	current = FrameStats();
+}
+
+bool GLStateCache::Filter(bool changed)
+{
+	if (changed)
+		current.issued++;
+	else
+		current.filtered++;
+	return changed;
+}
+
+void GLStateCache::UseProgram(GLuint newProgram)
+{
+	if (Filter(newProgram != program))
+	{
+		glUseProgram(newProgram);
+		program = newProgram;
+	}
+}
+
+void GLStateCache::BindVertexArray(GLuint newVao)
+{
+	if (Filter(newVao != vao))
+	{
+		glBindVertexArray(newVao);
+		vao = newVao;
+	}
+}
+
+void GLStateCache::BindTexture(GLuint unit, GLuint texture)
+{
+	if (!Filter(textures[unit] != texture))
+		return;
+
+	if (activeUnit != unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		activeUnit = unit;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	textures[unit] = texture;
+}
+
+int& GLStateCache::CapabilityState(GLenum capability)
+{
+	for (ShadowedCapability& shadow : capabilities)
+	{
+		if (shadow.capability == capability)
+			return shadow.enabled;
+	}
+	capabilities.push_back({ capability, -1 });
+	return capabilities.back().enabled;
+}
+
+void GLStateCache::Enable(GLenum capability)
+{
+	int& enabled = CapabilityState(capability);
+	if (Filter(enabled != 1))
+	{
+		glEnable(capability);
+		enabled = 1;
+	}
+}
+
+void GLStateCache::Disable(GLenum capability)
+{
+	int& enabled = CapabilityState(capability);
+	if (Filter(enabled != 0))
+	{
+		glDisable(capability);
+		enabled = 0;
+	}
+}
+
+void GLStateCache::ClearColor(const glm::vec4& color)
+{
+	if (Filter(!clearColorKnown || color != clearColor))
+	{
+		glClearColor(color.x, color.y, color.z, color.w);
+		clearColor = color;
+		clearColorKnown = true;
+	}
+}
+
+GLint GLStateCache::Location(GLuint program, const char* name)
+{
+	std::unordered_map<std::string, GLint>& programLocations = locations[program];
+	auto found = programLocations.find(name);
+	if (found != programLocations.end())
+		return found->second;
+
+	GLint location = glGetUniformLocation(program, name);
+	programLocations.emplace(name, location);
+	return location;
+}
+
+bool GLStateCache::UniformChanged(GLuint program, GLint location, const float* value, int components)
+{
+	ShadowedUniform& shadow = uniforms[((unsigned long long)program << 32) | (unsigned int)location];
+	if (shadow.known && memcmp(shadow.value, value, components * sizeof(float)) == 0)
+		return false;
+
+	memcpy(shadow.value, value, components * sizeof(float));
+	shadow.known = true;
+	return true;
+}
+
+void GLStateCache::SetUniform1i(GLuint program, const char* name, int value)
+{
+	GLint location = Location(program, name);
+	float bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if (location >= 0 && Filter(UniformChanged(program, location, &bits, 1)))
+	{
+		if (program != this->program)
+			UseProgram(program);
+		glUniform1i(location, value);
+	}
+}
+
+void GLStateCache::SetUniform1f(GLuint program, const char* name, float value)
+{
+	GLint location = Location(program, name);
+	if (location >= 0 && Filter(UniformChanged(program, location, &value, 1)))
+	{
+		if (program != this->program)
+			UseProgram(program);
+		glUniform1f(location, value);
+	}
+}
+
+void GLStateCache::SetUniform3f(GLuint program, const char* name, const glm::vec3& value)
+{
+	GLint location = Location(program, name);
+	if (location >= 0 && Filter(UniformChanged(program, location, &value[0], 3)))
+	{
+		if (program != this->program)
+			UseProgram(program);
+		glUniform3fv(location, 1, &value[0]);
+	}
+}
+
+void GLStateCache::SetUniform4f(GLuint program, const char* name, const glm::vec4& value)
+{
+	GLint location = Location(program, name);
+	if (location >= 0 && Filter(UniformChanged(program, location, &value[0], 4)))
+	{
+		if (program != this->program)
+			UseProgram(program);
+		glUniform4fv(location, 1, &value[0]);
+	}
+}
+
+void GLStateCache::SetUniformMatrix4f(GLuint program, const char* name, const glm::mat4& value)
+{
+	GLint location = Location(program, name);
+	if (location >= 0 && Filter(UniformChanged(program, location, glm::value_ptr(value), 16)))
+	{
+		if (program != this->program)
+			UseProgram(program);
+		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+}
+
+// Cameras drawn together in one pass, split screen or stereo, each owning a rectangle of the scene target.
+// Draws go out once with an instance per view: the vertex shader picks its view from gl_InstanceID, clips to
+// that view's frustum with gl_ClipDistance and squeezes the result into the view's rectangle, so nothing
+// past the vertex shader needs viewport arrays. Culling and LOD selection test all the views at once, an
+// object or meshlet is recorded once when any of them sees it
+class ViewSet
+{
+public:
+	static const int MAX_VIEWS = 4;
+
+	enum Layout
+	{
+		LAYOUT_SINGLE,		// just the camera
+		LAYOUT_OVERVIEW,	// the camera on the left, a fixed view over the desk on the right
+		LAYOUT_STEREO		// left and right eye side by side, eyeSeparation apart along the camera's right
+	};
+
+	struct View
+	{
+		Camera camera;
+		glm::vec4 rect;		// x, y, width, height as fractions of the target, y up like GL
+		glm::mat4 viewProjection;
+		glm::vec4 planes[6];	// inside when dot(plane.xyz, p) + plane.w >= 0
+		float fovY;
+		float aspect;
+	};
+
+	void SetLayout(Layout newLayout, float newEyeSeparation);
+	// rebuilds every view around the camera, aspect is the whole target's
+	void Update(const Camera& camera, float fovY, float aspect, float nearPlane, float farPlane);
+
+	int Count() const { return count; }
+	const View& Get(int view) const { return views[view]; }
+	// xy scale and offset that move the view's clip space into its rectangle
+	glm::vec4 ClipRect(int view) const;
+	// the view under a cursor given 0 to 1 across the target from the top left, local is where in that view
+	int ViewAt(const glm::vec2& cursor, glm::vec2& local) const;
+
+	// in the union of the view frustums
+	bool SphereVisible(const glm::vec3& center, float radius) const;
+	// distance along the forward axis of the closest view that has it in front, what picks the LOD every view can
+	// live with. Behind every view it's the straight distance to the nearest camera instead
+	float NearestDepth(const glm::vec3& position) const;
+
+private:
+	void SetView(int view, const Camera& camera, const glm::vec4& rect, float fovY, float aspect, float nearPlane, float farPlane);
+
+	Layout layout = LAYOUT_SINGLE;
+	float eyeSeparation = 0.25f;
+	View views[MAX_VIEWS];
+	int count = 1;
+};
+
+void ViewSet::SetLayout(Layout newLayout, float newEyeSeparation)
+{
+	layout = newLayout;
+	eyeSeparation = newEyeSeparation;
+	count = layout == LAYOUT_SINGLE ? 1 : 2;
+}
+
+void ViewSet::Update(const Camera& camera, float fovY, float aspect, float nearPlane, float farPlane)
+{
+	switch (layout)
+	{
+	case LAYOUT_OVERVIEW:
+	{
+		// looking down at the desk from above its front edge
+		Camera overview(glm::vec3(0.0f, 14.0f, 14.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, -45.0f);
+		SetView(0, camera, glm::vec4(0.0f, 0.0f, 0.5f, 1.0f), fovY, aspect, nearPlane, farPlane);
+		SetView(1, overview, glm::vec4(0.5f, 0.0f, 0.5f, 1.0f), fovY, aspect, nearPlane, farPlane);
+		break;
+	}
+	case LAYOUT_STEREO:
+	{
+		// parallel eyes, the same projection for both
+		Camera left = camera, right = camera;
+		left.Position -= camera.Right * (eyeSeparation * 0.5f);
+		right.Position += camera.Right * (eyeSeparation * 0.5f);
+		SetView(0, left, glm::vec4(0.0f, 0.0f, 0.5f, 1.0f), fovY, aspect, nearPlane, farPlane);
+		SetView(1, right, glm::vec4(0.5f, 0.0f, 0.5f, 1.0f), fovY, aspect, nearPlane, farPlane);
+		break;
+	}
+	default:
+		SetView(0, camera, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), fovY, aspect, nearPlane, farPlane);
+		break;
+	}
+}
+
+void ViewSet::SetView(int view, const Camera& camera, const glm::vec4& rect, float fovY, float aspect, float nearPlane, float farPlane)
+{
+	View& target = views[view];
+	target.camera = camera;
+	target.rect = rect;
+	target.fovY = fovY;
+	target.aspect = aspect * rect.z / rect.w;
+	target.viewProjection = glm::perspective(fovY, target.aspect, nearPlane, farPlane) * camera.GetViewMatrix();
+
+	// frustum planes (Gribb/Hartmann)
+	const glm::mat4& m = target.viewProjection;
+	glm::vec4 last(m[0][3], m[1][3], m[2][3], m[3][3]);
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+		target.planes[i * 2] = last + row;
+		target.planes[i * 2 + 1] = last - row;
+	}
+	for (glm::vec4& plane : target.planes)
+		plane = plane / glm::length(glm::vec3(plane));
+}
+
+glm::vec4 ViewSet::ClipRect(int view) const
+{
+	const glm::vec4& rect = views[view].rect;
+	return glm::vec4(rect.z, rect.w, 2.0f * rect.x + rect.z - 1.0f, 2.0f * rect.y + rect.w - 1.0f);
+}
+
+int ViewSet::ViewAt(const glm::vec2& cursor, glm::vec2& local) const
+{
+	// rects go bottom up like GL
+	glm::vec2 point(cursor.x, 1.0f - cursor.y);
+	for (int view = 0; view < count; view++)
+	{
+		const glm::vec4& rect = views[view].rect;
+		if (point.x >= rect.x && point.x <= rect.x + rect.z && point.y >= rect.y && point.y <= rect.y + rect.w)
+		{
+			local = glm::vec2((point.x - rect.x) / rect.z, 1.0f - (point.y - rect.y) / rect.w);
+			return view;
+		}
+	}
+	local = cursor;
+	return 0;
+}
+
+bool ViewSet::SphereVisible(const glm::vec3& center, float radius) const
+{
+	for (int view = 0; view < count; view++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+			inside = glm::dot(glm::vec3(views[view].planes[p]), center) + views[view].planes[p].w >= -radius;
+		if (inside)
+			return true;
+	}
+	return false;
+}
+
+float ViewSet::NearestDepth(const glm::vec3& position) const
+{
+	float nearest = FLT_MAX, nearestDistance = FLT_MAX;
+	for (int view = 0; view < count; view++)
+	{
+		glm::vec3 offset = position - views[view].camera.Position;
+		float depth = glm::dot(offset, views[view].camera.Front);
+		if (depth > 0.0f)
+			nearest = std::min(nearest, depth);
+		nearestDistance = std::min(nearestDistance, glm::length(offset));
+	}
+	return nearest < FLT_MAX ? nearest : nearestDistance;
+}
+
+// Dynamic resolution. The scene is drawn into an offscreen target at some fraction of the window size, then
+// upscaled and sharpened into the window. The fraction follows GPU frame time (GL_TIME_ELAPSED) towards a
+// budget, shrinking when a frame runs over and growing back once there's headroom. The target is allocated
+// at full size and only the scaled corner of it is used, so changing the scale never reallocates anything.
+class DynamicResolution
+{
+public:
+	static constexpr float MIN_SCALE = 0.5f;
+
+	void Initialize(float budgetMilliseconds);
+	void Destroy();
+	void Resize(int width, int height);
+
+	// GPU timing brackets everything the frame submits
+	void BeginFrame();
+	// bind the offscreen target at the current scale and clear it
+	void BeginScene();
+	// upscale + sharpen into the window, closes the frame's timer
+	void Present(GLStateCache& state, GLuint upscaleProgram);
+
+	float Scale() const { return scale; }
+	double GpuMilliseconds() const { return smoothedMs; }
+
+private:
+	// timer queries are read a few frames late so nothing waits on the GPU
+	static const int QUERY_COUNT = 4;
+	static constexpr float MAX_STEP = 0.05f;
+	static constexpr float SHARPEN_STRENGTH = 0.6f;
+
+	void ReadTimers();
+	void Adapt(double gpuMilliseconds);
+
+	GLuint framebuffer = 0;
+	GLuint colorTarget = 0;
+	GLuint depthTarget = 0;
+	GLuint emptyVao = 0;
+	int width = 0;
+	int height = 0;
+	int sceneWidth = 0;
+	int sceneHeight = 0;
+
+	GLuint queries[QUERY_COUNT] = {};
+	bool queryPending[QUERY_COUNT] = {};
+	int nextQuery = 0;
+	bool timing = false;
+
+	float budgetMs = 8.3f;
+	double smoothedMs = 0.0;
+	float scale = 1.0f;
+};
+
+void DynamicResolution::Initialize(float budgetMilliseconds)
+{
+	budgetMs = budgetMilliseconds;
+	framebuffer = gGpuMemory.GenFramebuffer("scene target");
+	glGenQueries(QUERY_COUNT, queries);
+	// the fullscreen triangle comes from gl_VertexID, core profile still wants a VAO bound
+	glGenVertexArrays(1, &emptyVao);
+}
+
+void DynamicResolution::Destroy()
+{
+	gGpuMemory.DeleteFramebuffer(framebuffer);
+	gGpuMemory.DeleteTexture(colorTarget);
+	gGpuMemory.DeleteRenderbuffer(depthTarget);
+	glDeleteQueries(QUERY_COUNT, queries);
+	glDeleteVertexArrays(1, &emptyVao);
+	emptyVao = 0;
+}
+
+void DynamicResolution::Resize(int newWidth, int newHeight)
+{
+	width = newWidth;
+	height = newHeight;
+
+	gGpuMemory.DeleteTexture(colorTarget);
+	colorTarget = gGpuMemory.GenTexture(GpuMemory::CATEGORY_RENDER_TARGET, "scene target");
+	glBindTexture(GL_TEXTURE_2D, colorTarget);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	gGpuMemory.SetTextureBytes(colorTarget, GpuMemory::TextureBytes(width, height, 4, false));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	gGpuMemory.DeleteRenderbuffer(depthTarget);
+	depthTarget = gGpuMemory.GenRenderbuffer("scene target");
+	glBindRenderbuffer(GL_RENDERBUFFER, depthTarget);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	gGpuMemory.SetRenderbufferBytes(depthTarget, (size_t)width * height * 4);	// 24 bit depth is padded to 32
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorTarget, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthTarget);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::FRAMEBUFFER::SCENE_TARGET_INCOMPLETE" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::ReadTimers()
+{
+	for (int i = 0; i < QUERY_COUNT; i++)
+	{
+		if (!queryPending[i])
+			continue;
+
+		GLint available = 0;
+		glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+		queryPending[i] = false;
+		Adapt(elapsed / 1000000.0);
+	}
+}
+
+void DynamicResolution::Adapt(double gpuMilliseconds)
+{
+	smoothedMs = smoothedMs <= 0.0 ? gpuMilliseconds : smoothedMs * 0.9 + gpuMilliseconds * 0.1;
+
+	// cost goes with pixel count, the square of the scale, so aim at 90% of the budget through a sqrt.
+	// small steps keep it from oscillating
+	float wanted = scale * (float)sqrt(budgetMs * 0.9 / std::max(smoothedMs, 0.01));
+	float step = std::min(std::max(wanted - scale, -MAX_STEP), MAX_STEP);
+	scale = std::min(std::max(scale + step, MIN_SCALE), 1.0f);
+}
+
+void DynamicResolution::BeginFrame()
+{
+	ReadTimers();
+
+	// skip timing this frame if every query is still in flight
+	timing = !queryPending[nextQuery];
+	if (timing)
+		glBeginQuery(GL_TIME_ELAPSED, queries[nextQuery]);
+}
+
+void DynamicResolution::BeginScene()
+{
+	sceneWidth = std::max((int)(width * scale + 0.5f), 1);
+	sceneHeight = std::max((int)(height * scale + 0.5f), 1);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, sceneWidth, sceneHeight);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DynamicResolution::Present(GLStateCache& state, GLuint upscaleProgram)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+
+	state.Disable(GL_DEPTH_TEST);
+	state.UseProgram(upscaleProgram);
+	state.BindVertexArray(emptyVao);
+	state.BindTexture(0, colorTarget);
+	state.SetUniform1i(upscaleProgram, "sceneColor", 0);
+	state.SetUniform3f(upscaleProgram, "uvScale", glm::vec3((float)sceneWidth / width, (float)sceneHeight / height, 0.0f));
+	// no sharpening at native size, more the further it's stretched
+	state.SetUniform1f(upscaleProgram, "sharpness", SHARPEN_STRENGTH * (1.0f - scale) / (1.0f - MIN_SCALE));
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	state.BindVertexArray(0);
+
+	if (timing)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		queryPending[nextQuery] = true;
+		nextQuery = (nextQuery + 1) % QUERY_COUNT;
+	}
+}
+
+// Fixed width histogram of millisecond samples, printed as bars with a few percentiles
+class Histogram
+{
+public:
+	Histogram(const char* histogramName, double bucketWidthMs, int bucketCount)
+		: name(histogramName), bucketWidth(bucketWidthMs), buckets(bucketCount + 1, 0) {}
+
+	void Add(double milliseconds)
+	{
+		int bucket = (int)(std::max(milliseconds, 0.0) / bucketWidth);
+		buckets[std::min(bucket, (int)buckets.size() - 1)]++;	// last bucket catches everything above
+		samples++;
+	}
+
+	// upper edge of the bucket the percentile lands in
+	double Percentile(double fraction) const
+	{
+		long long target = (long long)ceil(samples * fraction);
+		long long seen = 0;
+		for (size_t i = 0; i < buckets.size(); i++)
+		{
+			seen += buckets[i];
+			if (seen >= target)
+				return (i + 1) * bucketWidth;
+		}
+		return buckets.size() * bucketWidth;
+	}
+
+	void Print() const
+	{
+		std::cout << "INFO: " << name << " (ms), " << samples << " samples";
+		if (samples == 0)
+		{
+			std::cout << std::endl;
+			return;
+		}
+		std::cout << ", p50 " << Percentile(0.5) << " p95 " << Percentile(0.95) << " p99 " << Percentile(0.99) << std::endl;
+
+		long long largest = *std::max_element(buckets.begin(), buckets.end());
+		for (size_t i = 0; i < buckets.size(); i++)
+		{
+			if (buckets[i] == 0)
+				continue;
+			// lower edge of each bucket, the last one is open ended
+			int bar = (int)std::max(1LL, buckets[i] * 40 / largest);
+			std::cout << "\t" << i * bucketWidth << (i + 1 == buckets.size() ? "+" : "")
+				<< "\t| " << std::string(bar, '#') << " " << buckets[i] << std::endl;
+		}
+	}
+
+private:
+	const char* name;
+	double bucketWidth;
+	std::vector<long long> buckets;
+	long long samples = 0;
+};
+
+// Frame pacing. Holds frames to a target rate by sleeping until just short of the deadline and spinning
+// the rest, since a plain sleep on most platforms overshoots by a millisecond or more. Late input mode waits
+// before the frame is built instead of before the swap, so the newest input goes into what gets presented.
+// Input to present latency is estimated with a GL_TIMESTAMP query right after the swap, mapped onto the CPU
+// clock, against the time of the newest input event the frame was built from.
+class FramePacer
+{
+public:
+	FramePacer() : jitter("frame time jitter", 0.25, 80), latency("input to present latency", 2.0, 50) {}
+
+	void Initialize(float targetFps, bool lateInputSampling);
+	void Destroy();
+
+	bool LateInput() const { return lateInput; }
+
+	// blocks until the next frame deadline (no wait when uncapped) and records jitter
+	void Wait();
+	// right after the swap, inputTime is glfwGetTime() of the newest input in the presented frame
+	void MarkPresent(double inputTime);
+	void Report() const;
+
+private:
+	// how long before the deadline to stop sleeping and start spinning
+	static constexpr double SPIN_MARGIN = 0.0015;
+	static const int QUERY_COUNT = 8;
+
+	void Collect();
+	void Calibrate();
+
+	Histogram jitter;
+	Histogram latency;
+
+	bool lateInput = false;
+	double period = 0.0;
+	std::chrono::steady_clock::time_point deadline;
+	std::chrono::steady_clock::time_point lastFrame;
+	double lastInterval = -1.0;
+
+	GLuint queries[QUERY_COUNT] = {};
+	double queryInputTime[QUERY_COUNT] = {};
+	bool queryPending[QUERY_COUNT] = {};
+	int nextQuery = 0;
+	double lastMeasuredInput = 0.0;
+
+	// gpu timestamp (seconds) + offset = glfwGetTime()
+	double clockOffset = 0.0;
+	double lastCalibration = 0.0;
+};
+
+void FramePacer::Initialize(float targetFps, bool lateInputSampling)
+{
+	period = targetFps > 0.0f ? 1.0 / targetFps : 0.0;
+	lateInput = lateInputSampling;
+	deadline = lastFrame = std::chrono::steady_clock::now();
+
+	glGenQueries(QUERY_COUNT, queries);
+	Calibrate();
+}
+
+void FramePacer::Destroy()
+{
+	glDeleteQueries(QUERY_COUNT, queries);
+}
+
+void FramePacer::Calibrate()
+{
+	GLint64 gpuNow = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+	double cpuNow = glfwGetTime();
+	clockOffset = cpuNow - gpuNow * 1e-9;
+	lastCalibration = cpuNow;
+}
+
+void FramePacer::Wait()
+{
+	using clock = std::chrono::steady_clock;
+
+	if (period > 0.0)
+	{
+		deadline += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(period));
+
+		// more than a frame behind, start counting from now instead of rushing to catch up
+		clock::time_point now = clock::now();
+		if (now - deadline > std::chrono::duration<double>(period))
+			deadline = now;
+
+		std::this_thread::sleep_until(deadline - std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(SPIN_MARGIN)));
+		while (clock::now() < deadline)
+			std::this_thread::yield();
+	}
+
+	// jitter is how much each frame interval differs from the one before it
+	clock::time_point now = clock::now();
+	double interval = std::chrono::duration<double>(now - lastFrame).count();
+	if (lastInterval >= 0.0)
+		jitter.Add(fabs(interval - lastInterval) * 1000.0);
+	lastInterval = interval;
+	lastFrame = now;
+}
+
+void FramePacer::MarkPresent(double inputTime)
+{
+	Collect();
+
+	// only frames that carry new input say anything about latency
+	if (inputTime <= lastMeasuredInput || queryPending[nextQuery])
+		return;
+
+	glQueryCounter(queries[nextQuery], GL_TIMESTAMP);
+	queryInputTime[nextQuery] = inputTime;
+	queryPending[nextQuery] = true;
+	nextQuery = (nextQuery + 1) % QUERY_COUNT;
+	lastMeasuredInput = inputTime;
+}
+
+void FramePacer::Collect()
+{
+	for (int i = 0; i < QUERY_COUNT; i++)
+	{
+		if (!queryPending[i])
+			continue;
+
+		GLint available = 0;
+		glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+
+		GLuint64 gpuTime = 0;
+		glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &gpuTime);
+		queryPending[i] = false;
+		latency.Add((gpuTime * 1e-9 + clockOffset - queryInputTime[i]) * 1000.0);
+	}
+
+	// the two clocks drift apart slowly
+	if (glfwGetTime() - lastCalibration > 5.0)
+		Calibrate();
+}
+
+void FramePacer::Report() const
+{
+	jitter.Print();
+	latency.Print();
+}
+
+
+
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+
+// CPU copy of a texture for the software renderer, the same file UCreateTexture uploads
+struct SoftwareTexture
+{
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	std::vector<unsigned char> texels;
+
+	glm::vec3 Sample(float u, float v) const;
+};
+
+// bilinear with GL_REPEAT wrapping, like the GL textures minus the mipmaps
+glm::vec3 SoftwareTexture::Sample(float u, float v) const
+{
+	float x = (u - std::floor(u)) * width - 0.5f;
+	float y = (v - std::floor(v)) * height - 0.5f;
+	int x0 = (int)std::floor(x);
+	int y0 = (int)std::floor(y);
+	float fx = x - x0;
+	float fy = y - y0;
+
+	auto texel = [this](int tx, int ty)
+	{
+		tx = ((tx % width) + width) % width;
+		ty = ((ty % height) + height) % height;
+		const unsigned char* p = &texels[((size_t)ty * width + tx) * channels];
+		return glm::vec3(p[0], p[1], p[2]) * (1.0f / 255.0f);
+	};
+
+	glm::vec3 bottom = glm::mix(texel(x0, y0), texel(x0 + 1, y0), fx);
+	glm::vec3 top = glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), fx);
+	return glm::mix(bottom, top, fy);
+}
+
+// binary PPM from tightly packed RGB8, top row first
+bool UWritePpm(const char* filename, int width, int height, const std::vector<unsigned char>& rgb)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	fwrite(rgb.data(), 1, rgb.size(), file);
+	return fclose(file) == 0;
+}
+
+// reads back what UWritePpm writes
+bool UReadPpm(const char* filename, int& width, int& height, std::vector<unsigned char>& rgb)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	int maxValue = 0;
+	bool ok = fscanf(file, "P6 %d %d %d", &width, &height, &maxValue) == 3 && maxValue == 255 && width > 0 && height > 0 && fgetc(file) != EOF;
+	if (ok)
+	{
+		rgb.resize((size_t)width * height * 3);
+		ok = fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+	}
+	fclose(file);
+	return ok;
+}
+
+// mean SSIM of the luma of two RGB8 images the same size, over 8x8 windows every 4 pixels. 1 is identical,
+// unlike a plain pixel diff it shrugs off tiny shifts in edges and noise but not structural changes
+float UImageSsim(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b, int width, int height)
+{
+	const int WINDOW = 8;
+	const int STEP = 4;
+	const float C1 = (0.01f * 255.0f) * (0.01f * 255.0f);
+	const float C2 = (0.03f * 255.0f) * (0.03f * 255.0f);
+
+	if (width < WINDOW || height < WINDOW)
+		return a == b ? 1.0f : 0.0f;
+
+	auto luma = [](const std::vector<unsigned char>& image, size_t pixel)
+	{
+		return 0.299f * image[pixel * 3] + 0.587f * image[pixel * 3 + 1] + 0.114f * image[pixel * 3 + 2];
+	};
+
+	double total = 0.0;
+	int windows = 0;
+	for (int y = 0; y + WINDOW <= height; y += STEP)
+	{
+		for (int x = 0; x + WINDOW <= width; x += STEP)
+		{
+			float sumA = 0.0f, sumB = 0.0f, sumAA = 0.0f, sumBB = 0.0f, sumAB = 0.0f;
+			for (int wy = 0; wy < WINDOW; wy++)
+			{
+				for (int wx = 0; wx < WINDOW; wx++)
+				{
+					size_t pixel = (size_t)(y + wy) * width + x + wx;
+					float la = luma(a, pixel);
+					float lb = luma(b, pixel);
+					sumA += la;
+					sumB += lb;
+					sumAA += la * la;
+					sumBB += lb * lb;
+					sumAB += la * lb;
+				}
+			}
+
+			const float n = WINDOW * WINDOW;
+			float meanA = sumA / n;
+			float meanB = sumB / n;
+			float varianceA = sumAA / n - meanA * meanA;
+			float varianceB = sumBB / n - meanB * meanB;
+			float covariance = sumAB / n - meanA * meanB;
+			total += ((2.0f * meanA * meanB + C1) * (2.0f * covariance + C2)) /
+				((meanA * meanA + meanB * meanB + C1) * (varianceA + varianceB + C2));
+			windows++;
+		}
+	}
+	return (float)(total / windows);
+}
+
+// lights for the lit scene program as plain data, URender uploads them and the software renderer shades with them
+struct DirectionalLight
+{
+	glm::vec3 direction;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float intensity;
+};
+
+struct PointLight
+{
+	glm::vec3 position;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float constant;
+	float linear;
+	float quadratic;
+	float intensity;
+};
+
+const int POINT_LIGHT_COUNT = 5;
+const float MATERIAL_SHININESS = 32.0f;
+
+// Point lights as spheres for per object light lists. A light's radius is where its attenuation leaves even the
+// brightest channel (ambient + diffuse + specular, all at full strength) under threshold, past that it can't
+// move the result. Positions and radii sit in separate arrays padded to a multiple of 4 so an object's
+// bounding sphere is tested against 4 lights per SSE compare
+class LightAssignment
+{
+public:
+	static const int MAX_OBJECT_LIGHTS = 8;		// 4 bit indices, all of them fit in one uint
+
+	void SetLights(const PointLight* lights, int lightCount, float threshold);
+
+	// lights whose sphere touches the bounding sphere, at most maxLights of them (the brightest at its center
+	// when more touch). Indices are packed 4 bits each into packed, the return is how many
+	int Assign(const glm::vec3& center, float radius, int maxLights, GLuint& packed) const;
+
+	// every light, in order, for when nothing is culled
+	static GLuint AllLights(int lightCount, GLuint& packed)
+	{
+		packed = 0;
+		for (int i = 0; i < lightCount && i < MAX_OBJECT_LIGHTS; i++)
+			packed |= (GLuint)i << (4 * i);
+		return (GLuint)std::min(lightCount, MAX_OBJECT_LIGHTS);
+	}
+
+private:
+	std::vector<float> x, y, z, radii;
+	std::vector<float> constant, linear, quadratic, brightness;	// for ranking when there are too many
+};
+
+void LightAssignment::SetLights(const PointLight* lights, int lightCount, float threshold)
+{
+	int count = std::min(lightCount, 16);
+	int padded = (count + 3) & ~3;
+	x.assign(padded, 0.0f);
+	y.assign(padded, 0.0f);
+	z.assign(padded, 0.0f);
+	radii.assign(padded, -FLT_MAX);		// padding never touches anything
+	constant.assign(padded, 1.0f);
+	linear.assign(padded, 0.0f);
+	quadratic.assign(padded, 0.0f);
+	brightness.assign(padded, 0.0f);
+
+	for (int i = 0; i < count; i++)
+	{
+		const PointLight& light = lights[i];
+		glm::vec3 peak = (light.ambient + light.diffuse + light.specular) * light.intensity;
+		float bright = std::max(peak.x, std::max(peak.y, peak.z));
+		x[i] = light.position.x;
+		y[i] = light.position.y;
+		z[i] = light.position.z;
+		constant[i] = light.constant;
+		linear[i] = light.linear;
+		quadratic[i] = light.quadratic;
+		brightness[i] = bright;
+
+		// bright / (constant + linear * d + quadratic * d^2) = threshold, the larger root
+		float limit = threshold > 0.0f ? bright / threshold : FLT_MAX;
+		float c = light.constant - limit;
+		if (bright <= 0.0f || c >= 0.0f)
+			radii[i] = -FLT_MAX;
+		else if (light.quadratic > 0.0f)
+			radii[i] = (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+		else if (light.linear > 0.0f)
+			radii[i] = -c / light.linear;
+		else
+			radii[i] = FLT_MAX;
+	}
+}
+
+int LightAssignment::Assign(const glm::vec3& center, float radius, int maxLights, GLuint& packed) const
+{
+	int hits[16];
+	int hitCount = 0;
+	int padded = (int)radii.size();
+	for (int i = 0; i < padded; i += 4)
+	{
+#ifdef USE_SSE
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[i]), _mm_set1_ps(center.x));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[i]), _mm_set1_ps(center.y));
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[i]), _mm_set1_ps(center.z));
+		__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 reach = _mm_add_ps(_mm_loadu_ps(&radii[i]), _mm_set1_ps(radius));
+		// a negative reach is a light that touches nothing, squaring would flip it
+		__m128 touching = _mm_and_ps(_mm_cmpge_ps(reach, _mm_setzero_ps()), _mm_cmple_ps(distance2, _mm_mul_ps(reach, reach)));
+		int mask = _mm_movemask_ps(touching);
+#else
+		int mask = 0;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			float dx = x[i + lane] - center.x, dy = y[i + lane] - center.y, dz = z[i + lane] - center.z;
+			float reach = radii[i + lane] + radius;
+			if (reach >= 0.0f && dx * dx + dy * dy + dz * dz <= reach * reach)
+				mask |= 1 << lane;
+		}
+#endif
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (mask & (1 << lane))
+				hits[hitCount++] = i + lane;
+		}
+	}
+
+	// over the cap, keep the ones that are brightest at the center
+	maxLights = std::min(std::max(maxLights, 0), MAX_OBJECT_LIGHTS);
+	if (hitCount > maxLights)
+	{
+		auto strength = [&](int light)
+		{
+			float d = std::sqrt((x[light] - center.x) * (x[light] - center.x) + (y[light] - center.y) * (y[light] - center.y) +
+				(z[light] - center.z) * (z[light] - center.z));
+			return brightness[light] / (constant[light] + linear[light] * d + quadratic[light] * d * d);
+		};
+		std::stable_sort(hits, hits + hitCount, [&](int a, int b) { return strength(a) > strength(b); });
+		hitCount = maxLights;
+	}
+
+	packed = 0;
+	for (int i = 0; i < hitCount; i++)
+		packed |= (GLuint)hits[i] << (4 * i);
+	return hitCount;
+}
+
+// CPU rasterizer for the same draw packets URender executes, no GL context anywhere. Every pool thread sets up
+// and bins its share of the triangles into 64x64 tiles (each thread keeps its own bins so submission order
+// survives), then the tiles are rasterized in parallel. Coverage and depth go 4 pixels at a time through SSE
+// edge functions, attributes are interpolated perspective correct and shaded with a port of
+// CalcDirLight/CalcPointLight. Shadows aren't ported, the directional light is unshadowed here.
+class SoftwareRasterizer
+{
+public:
+	static const int TILE_SIZE = 64;
+
+	struct FrameStats
+	{
+		long long triangles;	// assembled from the packets, before clipping
+		long long fragments;	// passed the depth test and got shaded
+	};
+
+	void Resize(int newWidth, int newHeight);
+	void SetMeshes(const ResourcePool<Meshes::GLMesh>* pool) { meshPool = pool; }
+	void SetTexture(int material, const SoftwareTexture* texture);
+	void SetLights(const DirectionalLight& directional, const PointLight* points);
+
+	void Render(const std::vector<DrawPacket>& drawPackets, const InstanceData* frameInstances, const glm::vec3& cameraPosition, WorkerPool& workers);
+	bool WritePpm(const char* filename) const;
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+	const FrameStats& LastFrame() const { return stats; }
+
+private:
+	static const int ATTRIBUTE_COUNT = 8;	// world position, normal, uv
+	static const int SUBPIXEL_STEPS = 256;	// vertices snap to 1/256 of a pixel
+
+	struct ClipVertex
+	{
+		glm::vec4 position;
+		float attributes[ATTRIBUTE_COUNT];
+	};
+
+	struct Triangle
+	{
+		float edgeA[3];		// edge i is the one opposite vertex i, A*x + B*y + C >= 0 inside
+		float edgeB[3];
+		float edgeC[3];
+		bool topLeft[3];	// owns pixel centers exactly on the edge, exactly one of two neighbours does
+		float invArea;
+		float depth[3];
+		float invW[3];
+		float attributes[3][ATTRIBUTE_COUNT];	// already divided by w
+		int minX, minY, maxX, maxY;
+		int instance;
+		int material;
+	};
+
+	struct ThreadBins
+	{
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<int>> tiles;	// indices into triangles, per tile
+		long long fragments;
+	};
+
+	void AssembleTriangle(const DrawPacket& packet, int triangle, ClipVertex* out) const;
+	void ClipAndBin(const ClipVertex* vertices, const DrawPacket& packet, ThreadBins& bins) const;
+	void SetupAndBin(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, const DrawPacket& packet, ThreadBins& bins) const;
+	void RasterTile(int tile, long long& fragments);
+	void RasterTriangle(const Triangle& tri, int tileX0, int tileY0, int tileX1, int tileY1, long long& fragments);
+	int CoverBlock(const Triangle& tri, int x, float py, float* depthBlock, int laneMask, float weights[3][4]) const;
+	unsigned int ShadePixel(const Triangle& tri, float b0, float b1, float b2) const;
+	glm::vec3 CalcDirLight(const glm::vec3& normal, const glm::vec3& viewDir, const glm::vec3& texColor) const;
+	glm::vec3 CalcPointLight(const PointLight& light, const glm::vec3& normal, const glm::vec3& fragPos, const glm::vec3& viewDir, const glm::vec3& texColor) const;
+
+	int width = 0;
+	int height = 0;
+	int stride = 0;		// rows padded to a multiple of 4 so a 4 wide block never reads past the end
+	int tilesX = 0;
+	int tilesY = 0;
+	std::vector<unsigned int> color;	// RGBA8, bottom row first like GL
+	std::vector<float> depth;
+	std::vector<ThreadBins> threadBins;
+	std::vector<int> firstTriangle;		// where each packet's triangles start this frame
+
+	const ResourcePool<Meshes::GLMesh>* meshPool = nullptr;
+	std::vector<const SoftwareTexture*> textures;
+	DirectionalLight dirLight = {};
+	PointLight pointLights[POINT_LIGHT_COUNT] = {};
+
+	const std::vector<DrawPacket>* packets = nullptr;
+	const InstanceData* instances = nullptr;
+	glm::vec3 viewPos;
+	FrameStats stats = {};
+};
+
+inline int UPrimitiveTriangleCount(int primitive, int count)
+{
+	if (primitive == PRIMITIVE_TRIANGLES)
+		return count / 3;
+	return count > 2 ? count - 2 : 0;
+}
+
+// vertex numbers of one triangle of a packet, fans and strips unrolled the way GL walks them
+inline void UPacketTriangleVertices(const DrawPacket& packet, const Meshes::GLMesh& mesh, int triangle, GLuint* out)
+{
+	int corners[3];
+	switch (packet.primitive)
+	{
+	case PRIMITIVE_TRIANGLE_FAN:
+		corners[0] = 0;
+		corners[1] = triangle + 1;
+		corners[2] = triangle + 2;
+		break;
+	case PRIMITIVE_TRIANGLE_STRIP:
+		// every other strip triangle flips its first two corners
+		corners[0] = triangle + (triangle & 1);
+		corners[1] = triangle + 1 - (triangle & 1);
+		corners[2] = triangle + 2;
+		break;
+	default:
+		corners[0] = triangle * 3;
+		corners[1] = triangle * 3 + 1;
+		corners[2] = triangle * 3 + 2;
+		break;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		int element = packet.first + corners[i];
+		out[i] = packet.indexed ? mesh.indices[element] : (GLuint)element;
+	}
+}
+
+void SoftwareRasterizer::Resize(int newWidth, int newHeight)
+{
+	width = newWidth;
+	height = newHeight;
+	stride = (width + 3) & ~3;
+	tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	color.assign((size_t)stride * height, 0xFF000000u);
+	depth.assign((size_t)stride * height, 1.0f);
+}
+
+void SoftwareRasterizer::SetTexture(int material, const SoftwareTexture* texture)
+{
+	if (material >= (int)textures.size())
+		textures.resize(material + 1, nullptr);
+	textures[material] = texture;
+}
+
+void SoftwareRasterizer::SetLights(const DirectionalLight& directional, const PointLight* points)
+{
+	dirLight = directional;
+	for (int i = 0; i < POINT_LIGHT_COUNT; i++)
+		pointLights[i] = points[i];
+}
+
+void SoftwareRasterizer::Render(const std::vector<DrawPacket>& drawPackets, const InstanceData* frameInstances, const glm::vec3& cameraPosition, WorkerPool& workers)
+{
+	packets = &drawPackets;
+	instances = frameInstances;
+	viewPos = cameraPosition;
+
+	int total = 0;
+	firstTriangle.resize(drawPackets.size() + 1);
+	for (size_t i = 0; i < drawPackets.size(); i++)
+	{
+		firstTriangle[i] = total;
+		total += UPrimitiveTriangleCount(drawPackets[i].primitive, drawPackets[i].count);
+	}
+	firstTriangle[drawPackets.size()] = total;
+
+	int threads = workers.ThreadCount();
+	threadBins.resize(threads);
+	for (ThreadBins& bins : threadBins)
+	{
+		bins.triangles.clear();
+		bins.tiles.resize(tilesX * tilesY);
+		for (std::vector<int>& tile : bins.tiles)
+			tile.clear();
+		bins.fragments = 0;
+	}
+
+	// front end: assemble, transform, clip, set up and bin. ParallelFor hands out contiguous ranges in thread
+	// order, so walking the bins thread by thread afterwards replays the triangles in submission order
+	workers.ParallelFor(total, [this](int begin, int end, int threadIndex)
+	{
+		ThreadBins& bins = threadBins[threadIndex];
+		int packet = (int)(std::upper_bound(firstTriangle.begin(), firstTriangle.end(), begin) - firstTriangle.begin()) - 1;
+		for (int triangle = begin; triangle < end; triangle++)
+		{
+			while (triangle >= firstTriangle[packet + 1])
+				packet++;
+
+			ClipVertex vertices[3];
+			AssembleTriangle((*packets)[packet], triangle - firstTriangle[packet], vertices);
+			ClipAndBin(vertices, (*packets)[packet], bins);
+		}
+	});
+
+	// back end: tiles get handed out one at a time to whichever thread is free, each clears and owns its tile
+	std::atomic<int> nextTile{ 0 };
+	int tileCount = tilesX * tilesY;
+	workers.ParallelFor(threads, [this, &nextTile, tileCount](int /*begin*/, int /*end*/, int threadIndex)
+	{
+		long long fragments = 0;
+		for (int tile = nextTile++; tile < tileCount; tile = nextTile++)
+			RasterTile(tile, fragments);
+		threadBins[threadIndex].fragments = fragments;
+	});
+
+	stats.triangles = total;
+	stats.fragments = 0;
+	for (const ThreadBins& bins : threadBins)
+		stats.fragments += bins.fragments;
+}
+
+// the vertex shader: fetch the three corners of one triangle of the packet and transform them by its instance
+void SoftwareRasterizer::AssembleTriangle(const DrawPacket& packet, int triangle, ClipVertex* out) const
+{
+	const Meshes::GLMesh& mesh = *meshPool->Get(packet.mesh);
+	const InstanceData& instance = instances[packet.instance];
+	GLuint vertices[3];
+	UPacketTriangleVertices(packet, mesh, triangle, vertices);
+	for (int i = 0; i < 3; i++)
+	{
+		const GLfloat* source = &mesh.vertices[(size_t)vertices[i] * ATTRIBUTE_COUNT];
+
+		glm::vec4 position(source[0], source[1], source[2], 1.0f);
+		glm::vec3 worldPos(instance.model * position);
+		glm::vec3 normal(instance.normalMatrix[0] * source[3] + instance.normalMatrix[1] * source[4] + instance.normalMatrix[2] * source[5]);
+
+		out[i].position = instance.mvp * position;
+		out[i].attributes[0] = worldPos.x;
+		out[i].attributes[1] = worldPos.y;
+		out[i].attributes[2] = worldPos.z;
+		out[i].attributes[3] = normal.x;
+		out[i].attributes[4] = normal.y;
+		out[i].attributes[5] = normal.z;
+		out[i].attributes[6] = source[6];
+		out[i].attributes[7] = source[7];
+	}
+}
+
+// rejects triangles fully outside a frustum plane and clips against the near plane only. Everything else that
+// hangs off screen is handled by clamping the bounding box
+void SoftwareRasterizer::ClipAndBin(const ClipVertex* vertices, const DrawPacket& packet, ThreadBins& bins) const
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int above = 0;
+		int below = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			above += vertices[i].position[axis] > vertices[i].position.w;
+			below += vertices[i].position[axis] < -vertices[i].position.w;
+		}
+		if (above == 3 || below == 3)
+			return;
+	}
+
+	ClipVertex polygon[4];
+	int count = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const ClipVertex& a = vertices[i];
+		const ClipVertex& b = vertices[(i + 1) % 3];
+		float distanceA = a.position.z + a.position.w;
+		float distanceB = b.position.z + b.position.w;
+
+		if (distanceA >= 0.0f)
+			polygon[count++] = a;
+		if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+		{
+			// always step from the inside corner so a neighbour sharing the edge gets the identical point
+			const ClipVertex& inside = distanceA >= 0.0f ? a : b;
+			const ClipVertex& outside = distanceA >= 0.0f ? b : a;
+			float insideDistance = distanceA >= 0.0f ? distanceA : distanceB;
+			float outsideDistance = distanceA >= 0.0f ? distanceB : distanceA;
+			float t = insideDistance / (insideDistance - outsideDistance);
+
+			ClipVertex& clipped = polygon[count++];
+			clipped.position = inside.position + (outside.position - inside.position) * t;
+			for (int k = 0; k < ATTRIBUTE_COUNT; k++)
+				clipped.attributes[k] = inside.attributes[k] + (outside.attributes[k] - inside.attributes[k]) * t;
+		}
+	}
+
+	for (int i = 1; i + 1 < count; i++)
+		SetupAndBin(polygon[0], polygon[i], polygon[i + 1], packet, bins);
+}
+
+void SoftwareRasterizer::SetupAndBin(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, const DrawPacket& packet, ThreadBins& bins) const
+{
+	const ClipVertex* corners[3] = { &v0, &v1, &v2 };
+	float x[3], y[3], z[3], invW[3];
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec4& position = corners[i]->position;
+		invW[i] = 1.0f / position.w;
+		x[i] = std::floor(((position.x * invW[i]) * 0.5f + 0.5f) * width * SUBPIXEL_STEPS + 0.5f) / SUBPIXEL_STEPS;
+		y[i] = std::floor(((position.y * invW[i]) * 0.5f + 0.5f) * height * SUBPIXEL_STEPS + 0.5f) / SUBPIXEL_STEPS;
+		z[i] = (position.z * invW[i]) * 0.5f + 0.5f;
+	}
+
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (!(area != 0.0f))
+		return;
+
+	// nothing gets culled in the GL path either, clockwise triangles just get their corners swapped
+	int order[3] = { 0, 1, 2 };
+	if (area < 0.0f)
+	{
+		std::swap(order[1], order[2]);
+		area = -area;
+	}
+
+	Triangle tri;
+	float minX = (float)width;
+	float minY = (float)height;
+	float maxX = 0.0f;
+	float maxY = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		int a = order[(i + 1) % 3];
+		int b = order[(i + 2) % 3];
+		tri.edgeA[i] = y[a] - y[b];
+		tri.edgeB[i] = x[b] - x[a];
+		tri.edgeC[i] = x[a] * y[b] - y[a] * x[b];
+		tri.topLeft[i] = tri.edgeA[i] > 0.0f || (tri.edgeA[i] == 0.0f && tri.edgeB[i] > 0.0f);
+
+		int v = order[i];
+		tri.depth[i] = z[v];
+		tri.invW[i] = invW[v];
+		for (int k = 0; k < ATTRIBUTE_COUNT; k++)
+			tri.attributes[i][k] = corners[v]->attributes[k] * invW[v];
+
+		minX = std::min(minX, x[v]);
+		minY = std::min(minY, y[v]);
+		maxX = std::max(maxX, x[v]);
+		maxY = std::max(maxY, y[v]);
+	}
+	tri.invArea = 1.0f / area;
+	tri.instance = packet.instance;
+	tri.material = packet.material;
+
+	// clamp while still float, off screen corners can be far outside int range
+	tri.minX = (int)std::floor(std::max(minX, 0.0f));
+	tri.minY = (int)std::floor(std::max(minY, 0.0f));
+	tri.maxX = (int)std::ceil(std::min(maxX, (float)(width - 1)));
+	tri.maxY = (int)std::ceil(std::min(maxY, (float)(height - 1)));
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		return;
+
+	int index = (int)bins.triangles.size();
+	bins.triangles.push_back(tri);
+
+	for (int tileY = tri.minY / TILE_SIZE; tileY <= tri.maxY / TILE_SIZE; tileY++)
+	{
+		for (int tileX = tri.minX / TILE_SIZE; tileX <= tri.maxX / TILE_SIZE; tileX++)
+		{
+			// skip tiles the bounding box touches but the triangle misses: some edge is negative even at the
+			// tile corner furthest along its normal
+			float cornerX0 = tileX * TILE_SIZE + 0.5f;
+			float cornerY0 = tileY * TILE_SIZE + 0.5f;
+			float cornerX1 = cornerX0 + TILE_SIZE - 1.0f;
+			float cornerY1 = cornerY0 + TILE_SIZE - 1.0f;
+			bool missed = false;
+			for (int i = 0; i < 3 && !missed; i++)
+			{
+				float cornerX = tri.edgeA[i] > 0.0f ? cornerX1 : cornerX0;
+				float cornerY = tri.edgeB[i] > 0.0f ? cornerY1 : cornerY0;
+				missed = tri.edgeA[i] * cornerX + tri.edgeB[i] * cornerY + tri.edgeC[i] < 0.0f;
+			}
+
+			if (!missed)
+				bins.tiles[tileY * tilesX + tileX].push_back(index);
+		}
+	}
+}
+
+void SoftwareRasterizer::RasterTile(int tile, long long& fragments)
+{
+	int tileX0 = (tile % tilesX) * TILE_SIZE;
+	int tileY0 = (tile / tilesX) * TILE_SIZE;
+	int tileX1 = std::min(tileX0 + TILE_SIZE, width) - 1;
+	int tileY1 = std::min(tileY0 + TILE_SIZE, height) - 1;
+
+	for (int y = tileY0; y <= tileY1; y++)
+	{
+		size_t row = (size_t)y * stride;
+		std::fill(color.begin() + row + tileX0, color.begin() + row + tileX1 + 1, 0xFF000000u);
+		std::fill(depth.begin() + row + tileX0, depth.begin() + row + tileX1 + 1, 1.0f);
+	}
+
+	for (const ThreadBins& bins : threadBins)
+	{
+		for (int index : bins.tiles[tile])
+			RasterTriangle(bins.triangles[index], tileX0, tileY0, tileX1, tileY1, fragments);
+	}
+}
+
+void SoftwareRasterizer::RasterTriangle(const Triangle& tri, int tileX0, int tileY0, int tileX1, int tileY1, long long& fragments)
+{
+	// blocks of 4 stay aligned, tiles are a multiple of 4 wide so a block never crosses into the next tile
+	int x0 = std::max(tri.minX, tileX0) & ~3;
+	int x1 = std::min(tri.maxX, tileX1);
+	int y0 = std::max(tri.minY, tileY0);
+	int y1 = std::min(tri.maxY, tileY1);
+
+	for (int y = y0; y <= y1; y++)
+	{
+		float py = y + 0.5f;
+		float* depthRow = &depth[(size_t)y * stride];
+		unsigned int* colorRow = &color[(size_t)y * stride];
+
+		for (int x = x0; x <= x1; x += 4)
+		{
+			// lanes past the right edge of the framebuffer belong to nobody
+			int laneMask = x + 4 > width ? (1 << (width - x)) - 1 : 0xF;
+
+			float weights[3][4];
+			int mask = CoverBlock(tri, x, py, depthRow + x, laneMask, weights);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (mask & (1 << lane))
+				{
+					colorRow[x + lane] = ShadePixel(tri, weights[0][lane], weights[1][lane], weights[2][lane]);
+					fragments++;
+				}
+			}
+		}
+	}
+}
+
+// coverage and depth test for 4 pixels of a row. Returns a bit per lane that passed, after writing its depth,
+// with the lane's barycentric weights in weights[corner][lane]
+int SoftwareRasterizer::CoverBlock(const Triangle& tri, int x, float py, float* depthBlock, int laneMask, float weights[3][4]) const
+{
+	float z[4];
+	int mask;
+
+#ifdef USE_SSE
+	__m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+	__m128 vy = _mm_set1_ps(py);
+	__m128 zero = _mm_setzero_ps();
+	__m128 invArea = _mm_set1_ps(tri.invArea);
+	__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	__m128 b[3];
+	for (int i = 0; i < 3; i++)
+	{
+		// A*x + B*y + C in this order, the neighbour across a shared edge then gets exactly the negated value
+		__m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[i]), px), _mm_mul_ps(_mm_set1_ps(tri.edgeB[i]), vy)), _mm_set1_ps(tri.edgeC[i]));
+		inside = _mm_and_ps(inside, tri.topLeft[i] ? _mm_cmpge_ps(e, zero) : _mm_cmpgt_ps(e, zero));
+		b[i] = _mm_mul_ps(e, invArea);
+	}
+
+	mask = _mm_movemask_ps(inside) & laneMask;
+	if (!mask)
+		return 0;
+
+	__m128 depthValue = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[0], _mm_set1_ps(tri.depth[0])), _mm_mul_ps(b[1], _mm_set1_ps(tri.depth[1]))), _mm_mul_ps(b[2], _mm_set1_ps(tri.depth[2])));
+	mask &= _mm_movemask_ps(_mm_cmplt_ps(depthValue, _mm_loadu_ps(depthBlock)));
+	if (!mask)
+		return 0;
+
+	_mm_storeu_ps(z, depthValue);
+	for (int i = 0; i < 3; i++)
+		_mm_storeu_ps(weights[i], b[i]);
+#else
+	mask = 0;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		float px = x + lane + 0.5f;
+		bool inside = (laneMask & (1 << lane)) != 0;
+		for (int i = 0; i < 3; i++)
+		{
+			float e = tri.edgeA[i] * px + tri.edgeB[i] * py + tri.edgeC[i];
+			inside = inside && (tri.topLeft[i] ? e >= 0.0f : e > 0.0f);
+			weights[i][lane] = e * tri.invArea;
+		}
+		z[lane] = weights[0][lane] * tri.depth[0] + weights[1][lane] * tri.depth[1] + weights[2][lane] * tri.depth[2];
+		if (inside && z[lane] < depthBlock[lane])
+			mask |= 1 << lane;
+	}
+#endif
+
+	for (int lane = 0; lane < 4; lane++)
+	{
+		if (mask & (1 << lane))
+			depthBlock[lane] = z[lane];
+	}
+	return mask;
+}
+
+// the fragment shader
+unsigned int SoftwareRasterizer::ShadePixel(const Triangle& tri, float b0, float b1, float b2) const
+{
+	// perspective correct: attribute/w and 1/w interpolate linearly on screen, divide them back out
+	float w0 = b0 * tri.invW[0];
+	float w1 = b1 * tri.invW[1];
+	float w2 = b2 * tri.invW[2];
+	float invSum = 1.0f / (w0 + w1 + w2);
+	w0 *= invSum;
+	w1 *= invSum;
+	w2 *= invSum;
+
+	float a[ATTRIBUTE_COUNT];
+	for (int k = 0; k < ATTRIBUTE_COUNT; k++)
+		a[k] = w0 * tri.attributes[0][k] + w1 * tri.attributes[1][k] + w2 * tri.attributes[2][k];
+
+	glm::vec3 fragPos(a[0], a[1], a[2]);
+	glm::vec3 norm = glm::normalize(glm::vec3(a[3], a[4], a[5]));
+	glm::vec3 viewDir = glm::normalize(viewPos - fragPos);
+
+	// a texture that failed to load falls back to the object's color instead of sampling nothing
+	const InstanceData& instance = instances[tri.instance];
+	const SoftwareTexture* texture = tri.material < (int)textures.size() ? textures[tri.material] : nullptr;
+	glm::vec3 texColor;
+	if ((instance.flags[0] & INSTANCE_TEXTURED) && texture && texture->width > 0)
+		texColor = texture->Sample(a[6], a[7]);
+	else
+		texColor = glm::vec3(instance.color);
+
+	// the instance's light list like the shader, indices past the table can't come from UWriteInstances
+	glm::vec3 result = CalcDirLight(norm, viewDir, texColor);
+	for (GLuint i = 0; i < instance.flags[1]; i++)
+	{
+		GLuint light = (instance.flags[2] >> (4 * i)) & 15;
+		if (light < (GLuint)POINT_LIGHT_COUNT)
+			result += CalcPointLight(pointLights[light], norm, fragPos, viewDir, texColor);
+	}
+
+	result = glm::clamp(result, 0.0f, 1.0f);
+	return 0xFF000000u |
+		((unsigned int)(result.z * 255.0f + 0.5f) << 16) |
+		((unsigned int)(result.y * 255.0f + 0.5f) << 8) |
+		(unsigned int)(result.x * 255.0f + 0.5f);
+}
+
+// same math as CalcDirLight in the fragment shader, minus the shadow factor
+glm::vec3 SoftwareRasterizer::CalcDirLight(const glm::vec3& normal, const glm::vec3& viewDir, const glm::vec3& texColor) const
+{
+	glm::vec3 lightDir = glm::normalize(-dirLight.direction);
+	float diff = std::max(glm::dot(normal, lightDir), 0.0f);
+	glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+	float spec = std::pow(std::max(glm::dot(viewDir, reflectDir), 0.0f), MATERIAL_SHININESS);
+
+	glm::vec3 ambient = dirLight.ambient * texColor;
+	glm::vec3 diffuse = dirLight.diffuse * diff * texColor;
+	glm::vec3 specular = glm::vec3(0.5f, 0.5f, 0.5f) * spec;
+	return (ambient + diffuse + specular) * dirLight.intensity;
+}
+
+// same math as CalcPointLight in the fragment shader
+glm::vec3 SoftwareRasterizer::CalcPointLight(const PointLight& light, const glm::vec3& normal, const glm::vec3& fragPos, const glm::vec3& viewDir, const glm::vec3& texColor) const
+{
+	glm::vec3 lightDir = glm::normalize(light.position - fragPos);
+	float diff = std::max(glm::dot(normal, lightDir), 0.0f);
+	glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+	float spec = std::pow(std::max(glm::dot(viewDir, reflectDir), 0.0f), MATERIAL_SHININESS);
+	float distance = glm::length(light.position - fragPos);
+	float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+	glm::vec3 ambient = light.ambient * texColor * attenuation;
+	glm::vec3 diffuse = light.diffuse * diff * texColor * attenuation;
+	glm::vec3 specular = light.specular * spec * attenuation;
+	return (ambient + diffuse + specular) * light.intensity;
+}
+
+// top row first
+bool SoftwareRasterizer::WritePpm(const char* filename) const
+{
+	std::vector<unsigned char> rgb((size_t)width * height * 3);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned int* row = &color[(size_t)(height - 1 - y) * stride];
+		for (int x = 0; x < width; x++)
+		{
+			unsigned char* out = &rgb[((size_t)y * width + x) * 3];
+			out[0] = (unsigned char)(row[x] & 0xFF);
+			out[1] = (unsigned char)((row[x] >> 8) & 0xFF);
+			out[2] = (unsigned char)((row[x] >> 16) & 0xFF);
+		}
+	}
+	return UWritePpm(filename, width, height, rgb);
+}
+
+// bounding volume hierarchy over a triangle soup. Built as a binary tree with binned SAH, then collapsed into
+// 4 wide nodes so a single SSE slab test checks all four children of a node at once. Anything that needs
+// rays against the scene on the CPU goes through this
+class Bvh
+{
+public:
+	struct Hit
+	{
+		int triangle;	// index of the triangle in the corners the tree was built from
+		float t;
+		float u;		// barycentric weights of the triangle's second and third corners
+		float v;
+	};
+
+	// three corners per triangle
+	void Build(const std::vector<glm::vec3>& corners);
+	bool Intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit& hit) const;
+	bool Occluded(const glm::vec3& origin, const glm::vec3& direction, float tMax) const;
+
+	// the same tree over boxes instead of triangles, for Walk. Intersect and Occluded mean nothing on it
+	void BuildBoxes(const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax);
+	// visit(slot, closest) for every primitive in the leaves the ray reaches before closest, nearest leaf first.
+	// Primitive(slot) is the index it was built with, visit lowers closest on a hit and returns true to stop
+	template <typename Visit>
+	void Walk(const glm::vec3& origin, const glm::vec3& direction, float& closest, Visit visit) const;
+	int Primitive(int slot) const { return triangles[slot].index; }
+
+	int NodeCount() const { return (int)nodes.size(); }
+	int TriangleCount() const { return (int)triangles.size(); }
+
+private:
+	static const int LEAF_SIZE = 4;			// always a leaf at or below this
+	static const int MAX_LEAF_SIZE = 16;	// SAH may stop splitting up to here
+	static const int SAH_BINS = 16;
+	static const int STACK_SIZE = 128;		// on the call's own stack, deeper trees (see stackNeeded) go on the heap
+
+	struct BuildNode
+	{
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		int left;		// -1 on leaves
+		int right;
+		int first;		// triangle range, leaves only
+		int count;
+	};
+
+	struct Node
+	{
+		float boundsMin[3][4];	// [axis][child]
+		float boundsMax[3][4];
+		int child[4];			// node index, first triangle when count > 0, -1 for an empty slot
+		int count[4];
+	};
+
+	struct Triangle
+	{
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+		int index;
+	};
+
+	int BuildRecursive(std::vector<BuildNode>& buildNodes, std::vector<int>& order, const std::vector<glm::vec3>& corners, const std::vector<glm::vec3>& centroids, int first, int count);
+	int Flatten(const std::vector<BuildNode>& buildNodes, int buildIndex, int depth);
+	bool Traverse(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit* hit) const;
+	static bool IntersectTriangle(const Triangle& tri, const glm::vec3& origin, const glm::vec3& direction, float tMax, float& t, float& u, float& v);
+	static float SurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles;
+	int stackNeeded = 1;	// what Walk can push at most, each level down leaves up to 3 siblings behind
+};
+
+float Bvh::SurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 size = boundsMax - boundsMin;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void Bvh::Build(const std::vector<glm::vec3>& corners)
+{
+	int triangleCount = (int)corners.size() / 3;
+	nodes.clear();
+	triangles.clear();
+	stackNeeded = 1;
+	if (triangleCount == 0)
+		return;
+
+	std::vector<int> order(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		order[i] = i;
+		centroids[i] = (corners[i * 3] + corners[i * 3 + 1] + corners[i * 3 + 2]) * (1.0f / 3.0f);
+	}
+
+	std::vector<BuildNode> buildNodes;
+	buildNodes.reserve(triangleCount * 2);
+	BuildRecursive(buildNodes, order, corners, centroids, 0, triangleCount);
+
+	// leaves point into the triangles in build order
+	triangles.resize(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		const glm::vec3* corner = &corners[order[i] * 3];
+		triangles[i] = { corner[0], corner[1] - corner[0], corner[2] - corner[0], order[i] };
+	}
+
+	Flatten(buildNodes, 0, 1);
+}
+
+// min, max and center as the three corners: the bounds come out as the box and the centroid as its center
+void Bvh::BuildBoxes(const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax)
+{
+	std::vector<glm::vec3> corners(boxMin.size() * 3);
+	for (size_t i = 0; i < boxMin.size(); i++)
+	{
+		corners[i * 3] = boxMin[i];
+		corners[i * 3 + 1] = boxMax[i];
+		corners[i * 3 + 2] = (boxMin[i] + boxMax[i]) * 0.5f;
+	}
+	Build(corners);
+}
+
+int Bvh::BuildRecursive(std::vector<BuildNode>& buildNodes, std::vector<int>& order, const std::vector<glm::vec3>& corners, const std::vector<glm::vec3>& centroids, int first, int count)
+{
+	BuildNode node;
+	node.boundsMin = glm::vec3(1e30f);
+	node.boundsMax = glm::vec3(-1e30f);
+	glm::vec3 centroidMin(1e30f);
+	glm::vec3 centroidMax(-1e30f);
+	for (int i = first; i < first + count; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			node.boundsMin = glm::min(node.boundsMin, corners[order[i] * 3 + c]);
+			node.boundsMax = glm::max(node.boundsMax, corners[order[i] * 3 + c]);
+		}
+		centroidMin = glm::min(centroidMin, centroids[order[i]]);
+		centroidMax = glm::max(centroidMax, centroids[order[i]]);
+	}
+	node.left = -1;
+	node.right = -1;
+	node.first = first;
+	node.count = count;
+
+	int index = (int)buildNodes.size();
+	buildNodes.push_back(node);
+	if (count <= LEAF_SIZE)
+		return index;
+
+	// binned SAH over every axis. Cost is relative to intersecting every triangle in a leaf
+	const float TRAVERSAL_COST = 1.0f;
+	float parentArea = SurfaceArea(node.boundsMin, node.boundsMax);
+	float bestCost = (float)count;
+	int bestAxis = -1;
+	int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		int binCount[SAH_BINS] = {};
+		glm::vec3 binMin[SAH_BINS];
+		glm::vec3 binMax[SAH_BINS];
+		for (int b = 0; b < SAH_BINS; b++)
+		{
+			binMin[b] = glm::vec3(1e30f);
+			binMax[b] = glm::vec3(-1e30f);
+		}
+
+		float binScale = SAH_BINS / extent;
+		for (int i = first; i < first + count; i++)
+		{
+			int b = std::min((int)((centroids[order[i]][axis] - centroidMin[axis]) * binScale), SAH_BINS - 1);
+			binCount[b]++;
+			for (int c = 0; c < 3; c++)
+			{
+				binMin[b] = glm::min(binMin[b], corners[order[i] * 3 + c]);
+				binMax[b] = glm::max(binMax[b], corners[order[i] * 3 + c]);
+			}
+		}
+
+		// sweep from the right for the area and count right of every split, then from the left to price it
+		float rightArea[SAH_BINS];
+		int rightCount[SAH_BINS];
+		glm::vec3 sweepMin(1e30f);
+		glm::vec3 sweepMax(-1e30f);
+		int sweepCount = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--)
+		{
+			sweepMin = glm::min(sweepMin, binMin[b]);
+			sweepMax = glm::max(sweepMax, binMax[b]);
+			sweepCount += binCount[b];
+			rightArea[b] = sweepCount ? SurfaceArea(sweepMin, sweepMax) : 0.0f;
+			rightCount[b] = sweepCount;
+		}
+
+		sweepMin = glm::vec3(1e30f);
+		sweepMax = glm::vec3(-1e30f);
+		sweepCount = 0;
+		for (int split = 1; split < SAH_BINS; split++)
+		{
+			sweepMin = glm::min(sweepMin, binMin[split - 1]);
+			sweepMax = glm::max(sweepMax, binMax[split - 1]);
+			sweepCount += binCount[split - 1];
+			if (sweepCount == 0 || rightCount[split] == 0)
+				continue;
+
+			float cost = TRAVERSAL_COST + (SurfaceArea(sweepMin, sweepMax) * sweepCount + rightArea[split] * rightCount[split]) / parentArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	int middle;
+	if (bestAxis >= 0)
+	{
+		float extent = centroidMax[bestAxis] - centroidMin[bestAxis];
+		float binScale = SAH_BINS / extent;
+		float axisMin = centroidMin[bestAxis];
+		middle = (int)(std::partition(order.begin() + first, order.begin() + first + count, [&](int triangle)
+		{
+			return std::min((int)((centroids[triangle][bestAxis] - axisMin) * binScale), SAH_BINS - 1) < bestSplit;
+		}) - order.begin());
+	}
+	else if (count <= MAX_LEAF_SIZE)
+	{
+		return index;
+	}
+	else
+	{
+		// nothing worth it (or every centroid in one spot) but too many for a leaf, just halve it
+		middle = first + count / 2;
+	}
+
+	int left = BuildRecursive(buildNodes, order, corners, centroids, first, middle - first);
+	int right = BuildRecursive(buildNodes, order, corners, centroids, middle, first + count - middle);
+	buildNodes[index].left = left;
+	buildNodes[index].right = right;
+	return index;
+}
+
+// pulls grandchildren up into one 4 wide node, always opening the biggest inner child first
+int Bvh::Flatten(const std::vector<BuildNode>& buildNodes, int buildIndex, int depth)
+{
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(Node());
+	stackNeeded = std::max(stackNeeded, 3 * (depth - 1) + 4);
+
+	int children[4];
+	int childCount = 0;
+	const BuildNode& root = buildNodes[buildIndex];
+	if (root.left < 0)
+		children[childCount++] = buildIndex;
+	else
+	{
+		children[childCount++] = root.left;
+		children[childCount++] = root.right;
+	}
+
+	while (childCount < 4)
+	{
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (int i = 0; i < childCount; i++)
+		{
+			const BuildNode& child = buildNodes[children[i]];
+			float area = SurfaceArea(child.boundsMin, child.boundsMax);
+			if (child.left >= 0 && area > largestArea)
+			{
+				largest = i;
+				largestArea = area;
+			}
+		}
+		if (largest < 0)
+			break;
+
+		const BuildNode& opened = buildNodes[children[largest]];
+		children[largest] = opened.left;
+		children[childCount++] = opened.right;
+	}
+
+	Node node;
+	for (int i = 0; i < 4; i++)
+	{
+		node.child[i] = -1;
+		node.count[i] = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.boundsMin[axis][i] = 1e30f;
+			node.boundsMax[axis][i] = -1e30f;
+		}
+	}
+
+	for (int i = 0; i < childCount; i++)
+	{
+		const BuildNode& child = buildNodes[children[i]];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.boundsMin[axis][i] = child.boundsMin[axis];
+			node.boundsMax[axis][i] = child.boundsMax[axis];
+		}
+
+		if (child.left < 0)
+		{
+			node.child[i] = child.first;
+			node.count[i] = child.count;
+		}
+		else
+			node.child[i] = Flatten(buildNodes, children[i], depth + 1);
+	}
+
+	nodes[nodeIndex] = node;
+	return nodeIndex;
+}
+
+bool Bvh::Intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit& hit) const
+{
+	return Traverse(origin, direction, tMax, &hit);
+}
+
+// any hit, stops at the first one
+bool Bvh::Occluded(const glm::vec3& origin, const glm::vec3& direction, float tMax) const
+{
+	return Traverse(origin, direction, tMax, nullptr);
+}
+
+template <typename Visit>
+void Bvh::Walk(const glm::vec3& origin, const glm::vec3& direction, float& closest, Visit visit) const
+{
+	if (nodes.empty())
+		return;
+
+	glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	// SAH can leave a lopsided tree deeper than STACK_SIZE covers, nothing may get dropped off the stack
+	int localStack[STACK_SIZE];
+	std::vector<int> heapStack;
+	int* stack = localStack;
+	if (stackNeeded > STACK_SIZE)
+	{
+		heapStack.resize(stackNeeded);
+		stack = heapStack.data();
+	}
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+#ifdef USE_SSE
+	__m128 originX = _mm_set1_ps(origin.x);
+	__m128 originY = _mm_set1_ps(origin.y);
+	__m128 originZ = _mm_set1_ps(origin.z);
+	__m128 invX = _mm_set1_ps(invDirection.x);
+	__m128 invY = _mm_set1_ps(invDirection.y);
+	__m128 invZ = _mm_set1_ps(invDirection.z);
+#endif
+
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+
+		// slab test against all four child boxes
+		float entry[4];
+		int hitMask;
+#ifdef USE_SSE
+		__m128 nearX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMin[0]), originX), invX);
+		__m128 farX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMax[0]), originX), invX);
+		__m128 nearY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMin[1]), originY), invY);
+		__m128 farY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMax[1]), originY), invY);
+		__m128 nearZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMin[2]), originZ), invZ);
+		__m128 farZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMax[2]), originZ), invZ);
+
+		__m128 tEnter = _mm_max_ps(_mm_max_ps(_mm_min_ps(nearX, farX), _mm_min_ps(nearY, farY)), _mm_max_ps(_mm_min_ps(nearZ, farZ), _mm_setzero_ps()));
+		__m128 tExit = _mm_min_ps(_mm_min_ps(_mm_max_ps(nearX, farX), _mm_max_ps(nearY, farY)), _mm_min_ps(_mm_max_ps(nearZ, farZ), _mm_set1_ps(closest)));
+		hitMask = _mm_movemask_ps(_mm_cmple_ps(tEnter, tExit));
+		_mm_storeu_ps(entry, tEnter);
+#else
+		hitMask = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			float tEnter = 0.0f;
+			float tExit = closest;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float t0 = (node.boundsMin[axis][i] - origin[axis]) * invDirection[axis];
+				float t1 = (node.boundsMax[axis][i] - origin[axis]) * invDirection[axis];
+				tEnter = std::max(tEnter, std::min(t0, t1));
+				tExit = std::min(tExit, std::max(t0, t1));
+			}
+			entry[i] = tEnter;
+			if (tEnter <= tExit)
+				hitMask |= 1 << i;
+		}
+#endif
+
+		// children nearest first
+		int sorted[4];
+		int sortedCount = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			if (!(hitMask & (1 << i)) || node.child[i] < 0)
+				continue;
+			int at = sortedCount++;
+			while (at > 0 && entry[sorted[at - 1]] > entry[i])
+			{
+				sorted[at] = sorted[at - 1];
+				at--;
+			}
+			sorted[at] = i;
+		}
+
+		// leaves get tested right away, inner nodes go on the stack furthest first so the nearest pops next
+		for (int k = 0; k < sortedCount; k++)
+		{
+			int i = sorted[k];
+			if (node.count[i] == 0 || entry[i] > closest)
+				continue;
+
+			for (int t = node.child[i]; t < node.child[i] + node.count[i]; t++)
+			{
+				if (visit(t, closest))
+					return;
+			}
+		}
+
+		for (int k = sortedCount - 1; k >= 0; k--)
+		{
+			int i = sorted[k];
+			if (node.count[i] == 0)
+				stack[stackSize++] = node.child[i];
+		}
+	}
+}
+
+bool Bvh::Traverse(const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit* hit) const
+{
+	bool found = false;
+	float closest = tMax;
+	Walk(origin, direction, closest, [&](int t, float& nearest)
+	{
+		float distance, u, v;
+		if (!IntersectTriangle(triangles[t], origin, direction, nearest, distance, u, v))
+			return false;
+		found = true;
+		if (!hit)
+			return true;
+
+		nearest = distance;
+		hit->triangle = triangles[t].index;
+		hit->t = distance;
+		hit->u = u;
+		hit->v = v;
+		return false;
+	});
+	return found;
+}
+
+// Moller-Trumbore, both sides count
+bool Bvh::IntersectTriangle(const Triangle& tri, const glm::vec3& origin, const glm::vec3& direction, float tMax, float& t, float& u, float& v)
+{
+	glm::vec3 p = glm::cross(direction, tri.edge2);
+	float determinant = glm::dot(tri.edge1, p);
+	if (std::fabs(determinant) < 1e-12f)
+		return false;
+
+	float invDeterminant = 1.0f / determinant;
+	glm::vec3 s = origin - tri.v0;
+	u = glm::dot(s, p) * invDeterminant;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	glm::vec3 q = glm::cross(s, tri.edge1);
+	v = glm::dot(direction, q) * invDeterminant;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	t = glm::dot(tri.edge2, q) * invDeterminant;
+	return t > 0.0f && t < tMax;
+}
+
+// small PCG hash, every pixel and pass gets its own reproducible random stream
+inline unsigned int UHashPcg(unsigned int value)
+{
+	unsigned int state = value * 747796405u + 2891336453u;
+	unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+inline float URandomFloat(unsigned int& state)
+{
+	state = UHashPcg(state);
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// tangent and bitangent around a unit normal without any branches on its direction (Duff et al. 2017)
+inline void UOrthonormalBasis(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent)
+{
+	float sign = normal.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + normal.z);
+	float b = normal.x * normal.y * a;
+	tangent = glm::vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+	bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+}
+
+// offline reference renderer for the same packets, textures and lights as the software rasterizer. Traces
+// full paths against a Bvh of the world space scene on every pool thread, a row at a time, and accumulates one
+// sample per pixel per pass so the image can be written out progressively. Direct light is the shader's
+// CalcDirLight/CalcPointLight diffuse and specular behind shadow rays. The shader's ambient terms are its
+// stand-in for bounced light, here that's traced for real with cosine weighted diffuse bounces
+class PathTracer
+{
+public:
+	struct PassStats
+	{
+		long long rays;		// camera, bounce and shadow rays
+		double seconds;
+	};
+
+	void Resize(int newWidth, int newHeight);
+	void SetMeshes(const ResourcePool<Meshes::GLMesh>* pool) { meshPool = pool; }
+	void SetTexture(int material, const SoftwareTexture* texture);
+	void SetLights(const DirectionalLight& directional, const PointLight* points);
+	void SetCamera(const Camera& camera, float fovY);
+
+	// bakes the packets into world space triangles and builds the tree
+	void BuildScene(const std::vector<DrawPacket>& packets, const InstanceData* frameInstances);
+	void RenderPass(WorkerPool& workers, int maxBounces);
+	// what the shader multiplies the albedo by at a surface point, for the Lightmap baker. Diffuse only, the
+	// specular depends on the view. Direct light behind shadow rays plus samples traced cosine weighted bounces
+	glm::vec3 Irradiance(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& geometricNormal, int samples, int maxBounces,
+		unsigned int& random, long long& rays) const;
+	void Reset();
+	bool WritePpm(const char* filename) const;
+
+	int Passes() const { return passes; }
+	const PassStats& LastPass() const { return stats; }
+	const Bvh& Tree() const { return bvh; }
+
+private:
+	static constexpr float RAY_OFFSET = 1e-4f;
+	static constexpr float RAY_FAR = 1e30f;
+
+	struct ShadingTriangle
+	{
+		glm::vec3 normal[3];
+		glm::vec2 uv[3];
+		glm::vec3 geometricNormal;
+		int instance;
+		int material;
+	};
+
+	glm::vec3 TracePath(glm::vec3 origin, glm::vec3 direction, int maxBounces, unsigned int& random, long long& rays) const;
+	glm::vec3 DirectLight(const glm::vec3& origin, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& viewDir, const glm::vec3& albedo, long long& rays,
+		bool specular = true) const;
+	static glm::vec3 CosineDirection(const glm::vec3& normal, unsigned int& random);
+
+	int width = 0;
+	int height = 0;
+	int passes = 0;
+	std::vector<glm::vec3> accumulation;	// bottom row first like GL
+	std::vector<long long> threadRays;
+
+	Bvh bvh;
+	std::vector<ShadingTriangle> shading;
+	const ResourcePool<Meshes::GLMesh>* meshPool = nullptr;
+	std::vector<const SoftwareTexture*> textures;
+	const InstanceData* instances = nullptr;
+	DirectionalLight dirLight = {};
+	PointLight pointLights[POINT_LIGHT_COUNT] = {};
+
+	glm::vec3 cameraPosition;
+	glm::vec3 cameraFront;
+	glm::vec3 cameraRight;
+	glm::vec3 cameraUp;
+	float tanHalfFov = 0.0f;
+	PassStats stats = {};
+};
+
+void PathTracer::Resize(int newWidth, int newHeight)
+{
+	width = newWidth;
+	height = newHeight;
+	Reset();
+}
+
+void PathTracer::Reset()
+{
+	accumulation.assign((size_t)width * height, glm::vec3(0.0f));
+	passes = 0;
+}
+
+void PathTracer::SetTexture(int material, const SoftwareTexture* texture)
+{
+	if (material >= (int)textures.size())
+		textures.resize(material + 1, nullptr);
+	textures[material] = texture;
+}
+
+void PathTracer::SetLights(const DirectionalLight& directional, const PointLight* points)
+{
+	dirLight = directional;
+	for (int i = 0; i < POINT_LIGHT_COUNT; i++)
+		pointLights[i] = points[i];
+}
+
+void PathTracer::SetCamera(const Camera& camera, float fovY)
+{
+	cameraPosition = camera.Position;
+	cameraFront = camera.Front;
+	cameraRight = camera.Right;
+	cameraUp = camera.Up;
+	tanHalfFov = std::tan(fovY * 0.5f);
+}
+
+void PathTracer::BuildScene(const std::vector<DrawPacket>& packets, const InstanceData* frameInstances)
+{
+	instances = frameInstances;
+	shading.clear();
+	std::vector<glm::vec3> corners;
+
+	for (const DrawPacket& packet : packets)
+	{
+		const Meshes::GLMesh& mesh = *meshPool->Get(packet.mesh);
+		const InstanceData& instance = instances[packet.instance];
+		int triangleCount = UPrimitiveTriangleCount(packet.primitive, packet.count);
+
+		for (int triangle = 0; triangle < triangleCount; triangle++)
+		{
+			GLuint vertices[3];
+			UPacketTriangleVertices(packet, mesh, triangle, vertices);
+
+			ShadingTriangle tri;
+			for (int i = 0; i < 3; i++)
+			{
+				const GLfloat* source = &mesh.vertices[(size_t)vertices[i] * 8];
+				corners.push_back(glm::vec3(instance.model * glm::vec4(source[0], source[1], source[2], 1.0f)));
+				tri.normal[i] = glm::vec3(instance.normalMatrix[0] * source[3] + instance.normalMatrix[1] * source[4] + instance.normalMatrix[2] * source[5]);
+				tri.uv[i] = glm::vec2(source[6], source[7]);
+			}
+
+			const glm::vec3* corner = &corners[corners.size() - 3];
+			glm::vec3 faceNormal = glm::cross(corner[1] - corner[0], corner[2] - corner[0]);
+			float faceArea = glm::length(faceNormal);
+			tri.geometricNormal = faceArea > 0.0f ? faceNormal / faceArea : glm::vec3(0.0f, 1.0f, 0.0f);
+			tri.instance = packet.instance;
+			tri.material = packet.material;
+			shading.push_back(tri);
+		}
+	}
+
+	bvh.Build(corners);
+}
+
+void PathTracer::RenderPass(WorkerPool& workers, int maxBounces)
+{
+	int threads = workers.ThreadCount();
+	threadRays.assign(threads, 0);
+	float aspect = (float)width / (float)height;
+	unsigned int passSeed = UHashPcg((unsigned int)passes * 0x9E3779B9u);
+
+	auto start = std::chrono::steady_clock::now();
+
+	// rows handed out one at a time, the cost per row varies a lot with what's in it
+	std::atomic<int> nextRow{ 0 };
+	workers.ParallelFor(threads, [&](int /*begin*/, int /*end*/, int threadIndex)
+	{
+		long long rays = 0;
+		for (int y = nextRow++; y < height; y = nextRow++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				unsigned int random = UHashPcg((unsigned int)(y * width + x) ^ passSeed);
+
+				// jittered inside the pixel, same frustum as glm::perspective
+				float ndcX = ((x + URandomFloat(random)) / width) * 2.0f - 1.0f;
+				float ndcY = ((y + URandomFloat(random)) / height) * 2.0f - 1.0f;
+				glm::vec3 direction = glm::normalize(cameraFront + cameraRight * (ndcX * tanHalfFov * aspect) + cameraUp * (ndcY * tanHalfFov));
+
+				accumulation[(size_t)y * width + x] += TracePath(cameraPosition, direction, maxBounces, random, rays);
+			}
+		}
+		threadRays[threadIndex] = rays;
+	});
+
+	passes++;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stats.rays = 0;
+	for (long long rays : threadRays)
+		stats.rays += rays;
+}
+
+glm::vec3 PathTracer::TracePath(glm::vec3 origin, glm::vec3 direction, int maxBounces, unsigned int& random, long long& rays) const
+{
+	glm::vec3 radiance(0.0f);
+	glm::vec3 throughput(1.0f);
+
+	for (int bounce = 0; bounce <= maxBounces; bounce++)
+	{
+		// misses see the black clear color
+		Bvh::Hit hit;
+		rays++;
+		if (!bvh.Intersect(origin, direction, RAY_FAR, hit))
+			break;
+
+		const ShadingTriangle& tri = shading[hit.triangle];
+		float w = 1.0f - hit.u - hit.v;
+		glm::vec3 position = origin + direction * hit.t;
+		glm::vec3 normal = glm::normalize(tri.normal[0] * w + tri.normal[1] * hit.u + tri.normal[2] * hit.v);
+		glm::vec2 uv = tri.uv[0] * w + tri.uv[1] * hit.u + tri.uv[2] * hit.v;
+
+		// nothing is culled in the GL path, so both sides are front faces here too
+		glm::vec3 geometric = tri.geometricNormal;
+		if (glm::dot(geometric, direction) > 0.0f)
+			geometric = -geometric;
+		if (glm::dot(normal, geometric) < 0.0f)
+			normal = -normal;
+
+		const InstanceData& instance = instances[tri.instance];
+		const SoftwareTexture* texture = tri.material < (int)textures.size() ? textures[tri.material] : nullptr;
+		glm::vec3 albedo;
+		if ((instance.flags[0] & INSTANCE_TEXTURED) && texture && texture->width > 0)
+			albedo = texture->Sample(uv.x, uv.y);
+		else
+			albedo = glm::vec3(instance.color);
+
+		glm::vec3 offsetOrigin = position + geometric * RAY_OFFSET;
+		radiance += throughput * DirectLight(offsetOrigin, position, normal, -direction, albedo, rays);
+
+		// cosine weighted bounce, the lambert pdf cancels and leaves just the albedo
+		throughput *= albedo;
+		if (bounce >= 2)
+		{
+			// russian roulette once the path has had a couple of bounces
+			float survive = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.95f);
+			if (URandomFloat(random) >= survive)
+				break;
+			throughput *= 1.0f / survive;
+		}
+
+		origin = offsetOrigin;
+		direction = CosineDirection(normal, random);
+	}
+
+	return radiance;
+}
+
+glm::vec3 PathTracer::CosineDirection(const glm::vec3& normal, unsigned int& random)
+{
+	float r = std::sqrt(URandomFloat(random));
+	float phi = 2.0f * (float)M_PI * URandomFloat(random);
+	glm::vec3 tangent, bitangent;
+	UOrthonormalBasis(normal, tangent, bitangent);
+	return glm::normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - r * r)));
+}
+
+// the lambert pdf cancels against the cosine again, the bounced part is just the mean of what the rays bring back
+glm::vec3 PathTracer::Irradiance(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& geometricNormal, int samples, int maxBounces,
+	unsigned int& random, long long& rays) const
+{
+	glm::vec3 origin = position + geometricNormal * RAY_OFFSET;
+	glm::vec3 result = DirectLight(origin, position, normal, normal, glm::vec3(1.0f), rays, false);
+	if (maxBounces <= 0 || samples <= 0)
+		return result;
+
+	glm::vec3 bounced(0.0f);
+	for (int sample = 0; sample < samples; sample++)
+		bounced += TracePath(origin, CosineDirection(normal, random), maxBounces - 1, random, rays);
+	return result + bounced * (1.0f / samples);
+}
+
+// CalcDirLight + CalcPointLight without the ambient parts, each behind a shadow ray
+glm::vec3 PathTracer::DirectLight(const glm::vec3& origin, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& viewDir, const glm::vec3& albedo, long long& rays,
+	bool specular) const
+{
+	glm::vec3 result(0.0f);
+
+	glm::vec3 lightDir = glm::normalize(-dirLight.direction);
+	float diff = glm::dot(normal, lightDir);
+	if (diff > 0.0f)
+	{
+		rays++;
+		if (!bvh.Occluded(origin, lightDir, RAY_FAR))
+		{
+			float spec = specular ? std::pow(std::max(glm::dot(viewDir, glm::reflect(-lightDir, normal)), 0.0f), MATERIAL_SHININESS) : 0.0f;
+			result += (dirLight.diffuse * diff * albedo + glm::vec3(0.5f, 0.5f, 0.5f) * spec) * dirLight.intensity;
+		}
+	}
+
+	for (int i = 0; i < POINT_LIGHT_COUNT; i++)
+	{
+		const PointLight& light = pointLights[i];
+		glm::vec3 toLight = light.position - position;
+		float distance = glm::length(toLight);
+		lightDir = toLight / distance;
+		diff = glm::dot(normal, lightDir);
+		if (diff <= 0.0f)
+			continue;
+
+		rays++;
+		if (bvh.Occluded(origin, lightDir, distance))
+			continue;
+
+		float spec = specular ? std::pow(std::max(glm::dot(viewDir, glm::reflect(-lightDir, normal)), 0.0f), MATERIAL_SHININESS) : 0.0f;
+		float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+		result += (light.diffuse * diff * albedo + light.specular * spec) * (attenuation * light.intensity);
+	}
+
+	return result;
+}
+
+// average of the passes so far, clamped like the GL framebuffer
+bool PathTracer::WritePpm(const char* filename) const
+{
+	std::vector<unsigned char> rgb((size_t)width * height * 3);
+	float scale = passes > 0 ? 1.0f / passes : 0.0f;
+	for (int y = 0; y < height; y++)
+	{
+		const glm::vec3* row = &accumulation[(size_t)(height - 1 - y) * width];
+		for (int x = 0; x < width; x++)
+		{
+			glm::vec3 value = glm::clamp(row[x] * scale, 0.0f, 1.0f);
+			unsigned char* out = &rgb[((size_t)y * width + x) * 3];
+			out[0] = (unsigned char)(value.x * 255.0f + 0.5f);
+			out[1] = (unsigned char)(value.y * 255.0f + 0.5f);
+			out[2] = (unsigned char)(value.z * 255.0f + 0.5f);
+		}
+	}
+	return UWritePpm(filename, width, height, rgb);
+}
+
+// Static lighting for the objects that never move, baked offline by --bake-lightmap and drawn with --lightmap.
+// Every static object gets its own copy of its triangles with a second uv set. Triangles are grown into charts
+// across shared edges while they face within about 37 degrees of the chart's first triangle, each chart is
+// projected onto that triangle's plane at texelsPerUnit and the charts are shelf packed into a square atlas with
+// PADDING texels around each. Covered texels get the PathTracer's Irradiance at their surface point on every
+// pool thread, the padding is then grown out of its covered neighbours so bilinear filtering at the chart
+// edges doesn't pull in black
+class Lightmap
+{
+public:
+	struct Settings
+	{
+		float texelsPerUnit;
+		int samples;		// bounce rays per texel
+		int bounces;
+		int maxSize;		// texelsPerUnit comes down until the atlas fits
+	};
+
+	struct Stats
+	{
+		int charts;
+		int texels;			// covered ones, the rest is padding and unused atlas
+		float texelsPerUnit;
+		long long rays;
+		double seconds;
+	};
+
+	// an object's triangles, unindexed position/normal/uv/lightmap uv in object space. sourceTriangles is
+	// what it was baked from, a mesh that changed since can be told apart
+	struct BakedObject
+	{
+		int object;
+		int sourceTriangles;
+		std::vector<GLfloat> vertices;
+	};
+
+	static const int FLOATS_PER_VERTEX = 10;
+
+	// packets of the static objects only, the tracer built from the same ones. False when the charts don't fit
+	// in maxSize even at one texel each
+	bool Bake(WorkerPool& workers, const PathTracer& tracer, const std::vector<DrawPacket>& packets, const InstanceData* instances,
+		const ResourcePool<Meshes::GLMesh>& meshPool, const Settings& settings);
+	bool Write(const char* filename) const;
+	bool Read(const char* filename);
+
+	int Size() const { return size; }
+	const std::vector<glm::vec3>& Texels() const { return texels; }
+	const std::vector<BakedObject>& Objects() const { return objects; }
+	const Stats& LastBake() const { return stats; }
+
+private:
+	static const int PADDING = 2;
+
+	struct BakeTriangle
+	{
+		int object;
+		GLfloat vertices[3][8];		// as the mesh has them
+		glm::vec3 world[3];
+		glm::vec3 normal[3];
+		glm::vec3 faceNormal;
+		glm::vec3 chartNormal;		// mean of the vertex normals, the winding isn't consistent in every mesh
+		glm::vec2 projected[3];		// on the chart's plane, world units
+		glm::vec2 texel[3];			// in the atlas once packed
+	};
+
+	struct Chart
+	{
+		std::vector<int> triangles;
+		glm::vec2 low;
+		glm::vec2 high;
+		int width;		// texels, padding included
+		int height;
+		int x;
+		int y;
+	};
+
+	void GatherTriangles(const std::vector<DrawPacket>& packets, const InstanceData* instances, const ResourcePool<Meshes::GLMesh>& meshPool);
+	void BuildCharts();
+	bool Pack(float texelsPerUnit, int atlasSize);
+
+	int size = 0;
+	std::vector<glm::vec3> texels;		// size * size, row 0 at v = 0
+	std::vector<BakedObject> objects;
+	std::vector<BakeTriangle> triangles;
+	std::vector<Chart> charts;
+	Stats stats = {};
+};
+
+void Lightmap::GatherTriangles(const std::vector<DrawPacket>& packets, const InstanceData* instances, const ResourcePool<Meshes::GLMesh>& meshPool)
+{
+	triangles.clear();
+	for (const DrawPacket& packet : packets)
+	{
+		const Meshes::GLMesh& mesh = *meshPool.Get(packet.mesh);
+		const InstanceData& instance = instances[packet.instance];
+		int triangleCount = UPrimitiveTriangleCount(packet.primitive, packet.count);
+		for (int triangle = 0; triangle < triangleCount; triangle++)
+		{
+			GLuint vertices[3];
+			UPacketTriangleVertices(packet, mesh, triangle, vertices);
+
+			BakeTriangle tri;
+			tri.object = packet.instance;
+			for (int i = 0; i < 3; i++)
+			{
+				const GLfloat* source = &mesh.vertices[(size_t)vertices[i] * 8];
+				std::copy(source, source + 8, tri.vertices[i]);
+				tri.world[i] = glm::vec3(instance.model * glm::vec4(source[0], source[1], source[2], 1.0f));
+				glm::vec3 normal = glm::vec3(instance.normalMatrix[0] * source[3] + instance.normalMatrix[1] * source[4] + instance.normalMatrix[2] * source[5]);
+				float length = glm::length(normal);
+				tri.normal[i] = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			}
+			glm::vec3 face = glm::cross(tri.world[1] - tri.world[0], tri.world[2] - tri.world[0]);
+			float area = glm::length(face);
+			tri.faceNormal = area > 0.0f ? face / area : glm::vec3(0.0f);
+			glm::vec3 mean = tri.normal[0] + tri.normal[1] + tri.normal[2];
+			float length = glm::length(mean);
+			tri.chartNormal = length > 0.0f ? mean / length : tri.faceNormal;
+			triangles.push_back(tri);
+		}
+	}
+}
+
+// flood fill over shared edges by the vertex normals (an inside and an outside wall never share a chart), corners matched by position on a 1e-4 grid since the meshes split their
+// vertices wherever the normals or uvs change
+void Lightmap::BuildCharts()
+{
+	const float MIN_CHART_DOT = 0.8f;
+
+	std::unordered_map<unsigned long long, int> cornerIds;
+	auto cornerId = [&cornerIds](const glm::vec3& p)
+	{
+		unsigned long long key = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			long long cell = (long long)std::floor(p[axis] * 1e4f + 0.5f) + (1 << 20);
+			key = (key << 21) | ((unsigned long long)std::min(std::max(cell, 0ll), (1ll << 21) - 1));
+		}
+		return cornerIds.emplace(key, (int)cornerIds.size()).first->second;
+	};
+
+	// (edge, triangle) pairs sorted by edge, the triangles sharing an edge end up next to each other
+	std::vector<std::pair<unsigned long long, int>> edges;
+	edges.reserve(triangles.size() * 3);
+	for (size_t t = 0; t < triangles.size(); t++)
+	{
+		int ids[3];
+		for (int i = 0; i < 3; i++)
+			ids[i] = cornerId(triangles[t].world[i]);
+		for (int i = 0; i < 3; i++)
+		{
+			unsigned long long a = (unsigned long long)std::min(ids[i], ids[(i + 1) % 3]);
+			unsigned long long b = (unsigned long long)std::max(ids[i], ids[(i + 1) % 3]);
+			edges.push_back(std::make_pair((a << 32) | b, (int)t));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	std::vector<int> neighbourOffsets(triangles.size() + 1, 0);
+	std::vector<int> neighbours;
+	{
+		std::vector<std::vector<int>> lists(triangles.size());
+		for (size_t i = 0; i < edges.size(); )
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j].first == edges[i].first)
+				j++;
+			for (size_t a = i; a < j; a++)
+			{
+				for (size_t b = i; b < j; b++)
+				{
+					if (a != b)
+						lists[edges[a].second].push_back(edges[b].second);
+				}
+			}
+			i = j;
+		}
+		for (size_t t = 0; t < triangles.size(); t++)
+		{
+			neighbourOffsets[t + 1] = neighbourOffsets[t] + (int)lists[t].size();
+			neighbours.insert(neighbours.end(), lists[t].begin(), lists[t].end());
+		}
+	}
+
+	charts.clear();
+	std::vector<int> chartOf(triangles.size(), -1);
+	std::vector<int> queue;
+	for (size_t seed = 0; seed < triangles.size(); seed++)
+	{
+		if (chartOf[seed] >= 0)
+			continue;
+
+		int id = (int)charts.size();
+		charts.emplace_back();
+		Chart& chart = charts.back();
+		glm::vec3 axis = triangles[seed].chartNormal;
+		chartOf[seed] = id;
+		queue.assign(1, (int)seed);
+		for (size_t head = 0; head < queue.size(); head++)
+		{
+			int t = queue[head];
+			chart.triangles.push_back(t);
+			for (int n = neighbourOffsets[t]; n < neighbourOffsets[t + 1]; n++)
+			{
+				int other = neighbours[n];
+				if (chartOf[other] < 0 && triangles[other].object == triangles[t].object && glm::dot(triangles[other].chartNormal, axis) > MIN_CHART_DOT)
+				{
+					chartOf[other] = id;
+					queue.push_back(other);
+				}
+			}
+		}
+
+		// a degenerate seed gets a chart of its own with any basis at all
+		glm::vec3 tangent, bitangent;
+		UOrthonormalBasis(glm::length(axis) > 0.0f ? axis : glm::vec3(0.0f, 0.0f, 1.0f), tangent, bitangent);
+		chart.low = glm::vec2(FLT_MAX);
+		chart.high = glm::vec2(-FLT_MAX);
+		for (int t : chart.triangles)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				glm::vec2 p(glm::dot(triangles[t].world[i], tangent), glm::dot(triangles[t].world[i], bitangent));
+				triangles[t].projected[i] = p;
+				chart.low = glm::min(chart.low, p);
+				chart.high = glm::max(chart.high, p);
+			}
+		}
+	}
+}
+
+// tallest charts first onto shelves, fails when they don't all fit in atlasSize
+bool Lightmap::Pack(float texelsPerUnit, int atlasSize)
+{
+	std::vector<int> order(charts.size());
+	for (size_t i = 0; i < charts.size(); i++)
+	{
+		Chart& chart = charts[i];
+		glm::vec2 extent = (chart.high - chart.low) * texelsPerUnit;
+		chart.width = (int)std::ceil(extent.x) + 1 + PADDING * 2;
+		chart.height = (int)std::ceil(extent.y) + 1 + PADDING * 2;
+		order[i] = (int)i;
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return charts[a].height > charts[b].height; });
+
+	int x = 0, y = 0, shelfHeight = 0;
+	for (int index : order)
+	{
+		Chart& chart = charts[index];
+		if (x + chart.width > atlasSize)
+		{
+			x = 0;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+		if (x + chart.width > atlasSize || y + chart.height > atlasSize)
+			return false;
+		chart.x = x;
+		chart.y = y;
+		x += chart.width;
+		shelfHeight = std::max(shelfHeight, chart.height);
+	}
+
+	for (const Chart& chart : charts)
+	{
+		glm::vec2 corner((float)(chart.x + PADDING), (float)(chart.y + PADDING));
+		for (int t : chart.triangles)
+		{
+			for (int i = 0; i < 3; i++)
+				triangles[t].texel[i] = corner + (triangles[t].projected[i] - chart.low) * texelsPerUnit + 0.5f;
+		}
+	}
+	return true;
+}
+
+bool Lightmap::Bake(WorkerPool& workers, const PathTracer& tracer, const std::vector<DrawPacket>& packets, const InstanceData* instances,
+	const ResourcePool<Meshes::GLMesh>& meshPool, const Settings& settings)
+{
+	auto start = std::chrono::steady_clock::now();
+	GatherTriangles(packets, instances, meshPool);
+	BuildCharts();
+
+	// every chart is at least one texel plus its padding however low the density goes, at the density where the
+	// largest one is down to that if they don't pack into the biggest power of two atlas within maxSize they never will
+	int sizeLimit = 1;
+	while (sizeLimit * 2 <= settings.maxSize)
+		sizeLimit *= 2;
+	float largest = 0.0f;
+	for (const Chart& chart : charts)
+		largest = std::max(largest, std::max(chart.high.x - chart.low.x, chart.high.y - chart.low.y));
+	float minTexelsPerUnit = largest > 0.0f ? std::min(1.0f / largest, settings.texelsPerUnit) : settings.texelsPerUnit;
+	stats.charts = (int)charts.size();
+	if (!Pack(minTexelsPerUnit, sizeLimit))
+	{
+		triangles.clear();
+		charts.clear();
+		return false;
+	}
+
+	// smallest power of two atlas the charts pack into, the density drops a quarter at a time past maxSize
+	float texelsPerUnit = settings.texelsPerUnit;
+	for (;;)
+	{
+		double area = 0.0;
+		for (const Chart& chart : charts)
+		{
+			glm::vec2 extent = (chart.high - chart.low) * texelsPerUnit;
+			area += (std::ceil(extent.x) + 1 + PADDING * 2) * (std::ceil(extent.y) + 1 + PADDING * 2);
+		}
+		size = 1;
+		while ((double)size * size < area)
+			size *= 2;
+		while (size <= settings.maxSize && !Pack(texelsPerUnit, size))
+			size *= 2;
+		if (size <= settings.maxSize)
+			break;
+		texelsPerUnit = std::max(texelsPerUnit * 0.75f, minTexelsPerUnit);
+	}
+
+	// the surface point under every texel center, first triangle to cover it wins
+	size_t texelCount = (size_t)size * size;
+	std::vector<glm::vec3> positions(texelCount), normals(texelCount), geometric(texelCount);
+	std::vector<unsigned char> covered(texelCount, 0);
+	for (const BakeTriangle& tri : triangles)
+	{
+		glm::vec2 low = glm::min(tri.texel[0], glm::min(tri.texel[1], tri.texel[2]));
+		glm::vec2 high = glm::max(tri.texel[0], glm::max(tri.texel[1], tri.texel[2]));
+		float area = (tri.texel[1].x - tri.texel[0].x) * (tri.texel[2].y - tri.texel[0].y) - (tri.texel[2].x - tri.texel[0].x) * (tri.texel[1].y - tri.texel[0].y);
+		if (std::fabs(area) < 1e-8f)
+			continue;
+
+		for (int y = std::max((int)low.y, 0); y <= std::min((int)high.y, size - 1); y++)
+		{
+			for (int x = std::max((int)low.x, 0); x <= std::min((int)high.x, size - 1); x++)
+			{
+				size_t index = (size_t)y * size + x;
+				if (covered[index])
+					continue;
+
+				glm::vec2 p(x + 0.5f, y + 0.5f);
+				float w1 = ((p.x - tri.texel[0].x) * (tri.texel[2].y - tri.texel[0].y) - (tri.texel[2].x - tri.texel[0].x) * (p.y - tri.texel[0].y)) / area;
+				float w2 = ((tri.texel[1].x - tri.texel[0].x) * (p.y - tri.texel[0].y) - (p.x - tri.texel[0].x) * (tri.texel[1].y - tri.texel[0].y)) / area;
+				float w0 = 1.0f - w1 - w2;
+				if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+					continue;
+
+				glm::vec3 normal = tri.normal[0] * w0 + tri.normal[1] * w1 + tri.normal[2] * w2;
+				float length = glm::length(normal);
+				normal = length > 0.0f ? normal / length : tri.faceNormal;
+				covered[index] = 1;
+				positions[index] = tri.world[0] * w0 + tri.world[1] * w1 + tri.world[2] * w2;
+				normals[index] = normal;
+				geometric[index] = glm::dot(tri.faceNormal, normal) < 0.0f ? -tri.faceNormal : tri.faceNormal;
+			}
+		}
+	}
+
+	// rows handed out one at a time like the path tracer's, the empty parts of the atlas cost nothing
+	texels.assign(texelCount, glm::vec3(0.0f));
+	std::vector<long long> threadRays(workers.ThreadCount(), 0);
+	std::atomic<int> nextRow{ 0 };
+	workers.ParallelFor(workers.ThreadCount(), [&](int /*begin*/, int /*end*/, int threadIndex)
+	{
+		long long rays = 0;
+		for (int y = nextRow++; y < size; y = nextRow++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				size_t index = (size_t)y * size + x;
+				if (!covered[index])
+					continue;
+				unsigned int random = UHashPcg((unsigned int)index * 0x9E3779B9u);
+				texels[index] = tracer.Irradiance(positions[index], normals[index], geometric[index], settings.samples, settings.bounces, random, rays);
+			}
+		}
+		threadRays[threadIndex] = rays;
+	});
+
+	// grow the charts out into their padding
+	stats.texels = 0;
+	for (unsigned char texel : covered)
+		stats.texels += texel;
+	std::vector<unsigned char> filled = covered, next;
+	for (int pass = 0; pass < PADDING * 2; pass++)
+	{
+		next = filled;
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				if (filled[(size_t)y * size + x])
+					continue;
+				glm::vec3 sum(0.0f);
+				int count = 0;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int nx = x + dx, ny = y + dy;
+						if (nx >= 0 && ny >= 0 && nx < size && ny < size && filled[(size_t)ny * size + nx])
+						{
+							sum += texels[(size_t)ny * size + nx];
+							count++;
+						}
+					}
+				}
+				if (count > 0)
+				{
+					texels[(size_t)y * size + x] = sum * (1.0f / count);
+					next[(size_t)y * size + x] = 1;
+				}
+			}
+		}
+		filled.swap(next);
+	}
+
+	// every object's triangles with their atlas uvs, in the order the packets had them
+	objects.clear();
+	for (const BakeTriangle& tri : triangles)
+	{
+		if (objects.empty() || objects.back().object != tri.object)
+			objects.push_back({ tri.object, 0, std::vector<GLfloat>() });
+		BakedObject& baked = objects.back();
+		baked.sourceTriangles++;
+		for (int i = 0; i < 3; i++)
+		{
+			baked.vertices.insert(baked.vertices.end(), tri.vertices[i], tri.vertices[i] + 8);
+			baked.vertices.push_back(tri.texel[i].x / size);
+			baked.vertices.push_back(tri.texel[i].y / size);
+		}
+	}
+
+	stats.charts = (int)charts.size();
+	stats.texelsPerUnit = texelsPerUnit;
+	stats.rays = 0;
+	for (long long rays : threadRays)
+		stats.rays += rays;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	triangles.clear();
+	charts.clear();
+	return true;
+}
+
+// "LMAP", version, atlas size, object count, then per object its index, source triangle count and vertex float
+// count followed by the floats, then the atlas as RGB floats. Little endian as written, like the chunks
+const unsigned int LIGHTMAP_VERSION = 1;
+
+bool Lightmap::Write(const char* filename) const
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	unsigned int header[4] = { 0x50414D4C, LIGHTMAP_VERSION, (unsigned int)size, (unsigned int)objects.size() };
+	fwrite(header, sizeof(header), 1, file);
+	for (const BakedObject& baked : objects)
+	{
+		unsigned int objectHeader[3] = { (unsigned int)baked.object, (unsigned int)baked.sourceTriangles, (unsigned int)baked.vertices.size() };
+		fwrite(objectHeader, sizeof(objectHeader), 1, file);
+		fwrite(baked.vertices.data(), sizeof(GLfloat), baked.vertices.size(), file);
+	}
+	fwrite(texels.data(), sizeof(glm::vec3), texels.size(), file);
+	return fclose(file) == 0;
+}
+
+bool Lightmap::Read(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	// a damaged header can't ask for more than the file holds, every size is checked against what's left
+	// before anything gets allocated for it
+	fseek(file, 0, SEEK_END);
+	long remaining = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	unsigned int header[4];
+	bool ok = remaining >= (long)sizeof(header) && fread(header, sizeof(header), 1, file) == 1 && header[0] == 0x50414D4C &&
+		header[1] == LIGHTMAP_VERSION && header[2] > 0 && header[2] <= 16384 && header[3] <= 4096;
+	remaining -= (long)sizeof(header);
+	objects.clear();
+	for (unsigned int i = 0; ok && i < header[3]; i++)
+	{
+		unsigned int objectHeader[3];
+		ok = remaining >= (long)sizeof(objectHeader) && fread(objectHeader, sizeof(objectHeader), 1, file) == 1 &&
+			objectHeader[2] % (FLOATS_PER_VERTEX * 3) == 0;
+		remaining -= (long)sizeof(objectHeader);
+		if (!ok || (unsigned long long)objectHeader[2] * sizeof(GLfloat) > (unsigned long long)remaining)
+		{
+			ok = false;
+			break;
+		}
+		objects.push_back({ (int)objectHeader[0], (int)objectHeader[1], std::vector<GLfloat>(objectHeader[2]) });
+		ok = fread(objects.back().vertices.data(), sizeof(GLfloat), objectHeader[2], file) == objectHeader[2];
+		remaining -= (long)(objectHeader[2] * sizeof(GLfloat));
+	}
+	if (ok && (unsigned long long)header[2] * header[2] * sizeof(glm::vec3) > (unsigned long long)remaining)
+		ok = false;
+	if (ok)
+	{
+		size = (int)header[2];
+		texels.resize((size_t)size * size);
+		ok = fread(texels.data(), sizeof(glm::vec3), texels.size(), file) == texels.size();
+	}
+	fclose(file);
+	return ok;
+}
+
+// Ray queries against the scene, for clicking on things. Two levels: a BLAS per mesh, a Bvh over its LOD 0
+// triangles in mesh space built once from the Meshes CPU copy, and a TLAS, a Bvh over every object's world
+// box rebuilt by Update. A ray walks the TLAS and each object it reaches traces the ray, moved into mesh
+// space, through its mesh's BLAS. The transform is affine so t comes back the same in both spaces. Meshes
+// without a CPU copy (imports, streamed chunks) only get their bounding sphere hit
+class ScenePicker
+{
+public:
+	struct Ray
+	{
+		glm::vec3 origin;
+		glm::vec3 direction;
+	};
+
+	struct Hit
+	{
+		int object;			// -1 on a miss
+		int triangle;		// the mesh's LOD 0 triangles across its ranges, -1 when it was the bounding sphere
+		float t;
+		glm::vec3 position;
+	};
+
+	struct Stats
+	{
+		int meshes;			// BLASes cached
+		int triangles;		// in those
+		int objects;		// in the TLAS
+		double buildMs;		// last Update
+	};
+
+	// through cursor (0 to 1 across the view, top left first like the window) from the camera
+	static Ray CameraRay(const Camera& camera, float fovY, float aspect, const glm::vec2& cursor);
+
+	// objectMeshes and models per object. BLASes are kept by handle, only meshes not seen before get one and
+	// the ones whose handle went stale (a streamed chunk evicted or uploaded again) are dropped
+	void Update(const ResourcePool<Meshes::GLMesh>& meshPool, const std::vector<MeshHandle>& objectMeshes, const std::vector<glm::mat4>& models);
+
+	Hit Intersect(const Ray& ray, float tMax = FLT_MAX) const;
+	// hover previews and the like, the rays split across the pool
+	void IntersectBatch(const Ray* rays, Hit* hits, int count, WorkerPool& workers, float tMax = FLT_MAX) const;
+
+	const Stats& LastUpdate() const { return stats; }
+
+private:
+	struct MeshBvh
+	{
+		Bvh bvh;				// empty when the mesh has no CPU copy
+		glm::vec3 boundsMin;	// mesh space
+		glm::vec3 boundsMax;
+	};
+
+	struct Instance
+	{
+		const MeshBvh* mesh;
+		glm::mat4 model;
+		glm::mat4 inverseModel;
+		glm::vec3 center;		// world space bounding sphere, for the meshes without a BLAS
+		float radius;
+	};
+
+	const MeshBvh* BuildMesh(const Meshes::GLMesh& mesh, MeshHandle handle);
+
+	std::unordered_map<MeshHandle, MeshBvh> blas;
+	std::vector<Instance> instances;
+	Bvh tlas;
+	std::vector<int> tlasObjects;	// object of each TLAS box, objects with no mesh have none
+	Stats stats = {};
+};
+
+ScenePicker::Ray ScenePicker::CameraRay(const Camera& camera, float fovY, float aspect, const glm::vec2& cursor)
+{
+	float tanHalfFov = std::tan(fovY * 0.5f);
+	float x = (cursor.x * 2.0f - 1.0f) * tanHalfFov * aspect;
+	float y = (1.0f - cursor.y * 2.0f) * tanHalfFov;
+	return { camera.Position, glm::normalize(camera.Front + camera.Right * x + camera.Up * y) };
+}
+
+const ScenePicker::MeshBvh* ScenePicker::BuildMesh(const Meshes::GLMesh& mesh, MeshHandle handle)
+{
+	auto found = blas.find(handle);
+	if (found != blas.end())
+		return &found->second;
+
+	// every range of LOD 0, fans and strips unrolled the way they're drawn
+	const int floatsPerVertex = 8;
+	std::vector<glm::vec3> corners;
+	if (!mesh.vertices.empty())
+	{
+		for (const Meshes::GLMesh::Range& range : mesh.ranges)
+		{
+			if (range.indexed && mesh.indices.empty())
+				continue;
+			DrawPacket packet = {};
+			packet.primitive = range.primitive;
+			packet.indexed = range.indexed;
+			packet.first = range.first;
+			packet.count = range.count;
+			for (int triangle = 0; triangle < UPrimitiveTriangleCount(packet.primitive, packet.count); triangle++)
+			{
+				GLuint vertices[3];
+				UPacketTriangleVertices(packet, mesh, triangle, vertices);
+				for (GLuint vertex : vertices)
+				{
+					const GLfloat* position = &mesh.vertices[vertex * floatsPerVertex];
+					corners.push_back(glm::vec3(position[0], position[1], position[2]));
+				}
+			}
+		}
+	}
+
+	MeshBvh& built = blas[handle];
+	built.boundsMin = mesh.boundsCenter - glm::vec3(mesh.boundsRadius);
+	built.boundsMax = mesh.boundsCenter + glm::vec3(mesh.boundsRadius);
+	if (!corners.empty())
+	{
+		built.boundsMin = built.boundsMax = corners[0];
+		for (const glm::vec3& corner : corners)
+		{
+			built.boundsMin = glm::min(built.boundsMin, corner);
+			built.boundsMax = glm::max(built.boundsMax, corner);
+		}
+		built.bvh.Build(corners);
+		stats.meshes++;
+		stats.triangles += built.bvh.TriangleCount();
+	}
+	return &built;
+}
+
+void ScenePicker::Update(const ResourcePool<Meshes::GLMesh>& meshPool, const std::vector<MeshHandle>& objectMeshes, const std::vector<glm::mat4>& models)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto cached = blas.begin(); cached != blas.end();)
+	{
+		if (meshPool.Get(cached->first))
+		{
+			++cached;
+			continue;
+		}
+		if (cached->second.bvh.TriangleCount() > 0)
+		{
+			stats.meshes--;
+			stats.triangles -= cached->second.bvh.TriangleCount();
+		}
+		cached = blas.erase(cached);
+	}
+
+	instances.clear();
+	std::vector<glm::vec3> boxMin, boxMax;
+	std::vector<int> boxObjects;
+	for (size_t object = 0; object < objectMeshes.size(); object++)
+	{
+		Instance instance = {};
+		instance.model = models[object];
+		instance.inverseModel = glm::inverse(models[object]);
+		const Meshes::GLMesh* mesh = meshPool.Get(objectMeshes[object]);
+		if (mesh)
+		{
+			instance.mesh = BuildMesh(*mesh, objectMeshes[object]);
+			glm::vec3 axisScale(glm::length(glm::vec3(instance.model[0])), glm::length(glm::vec3(instance.model[1])), glm::length(glm::vec3(instance.model[2])));
+			instance.center = glm::vec3(instance.model * glm::vec4(mesh->boundsCenter, 1.0f));
+			instance.radius = mesh->boundsRadius * std::max(axisScale.x, std::max(axisScale.y, axisScale.z));
+		}
+		instances.push_back(instance);
+		if (!mesh)
+			continue;
+
+		// world box around the mesh box's eight corners
+		glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 local((corner & 1) ? instance.mesh->boundsMax.x : instance.mesh->boundsMin.x,
+				(corner & 2) ? instance.mesh->boundsMax.y : instance.mesh->boundsMin.y,
+				(corner & 4) ? instance.mesh->boundsMax.z : instance.mesh->boundsMin.z);
+			glm::vec3 world = glm::vec3(instance.model * glm::vec4(local, 1.0f));
+			low = glm::min(low, world);
+			high = glm::max(high, world);
+		}
+		boxMin.push_back(low);
+		boxMax.push_back(high);
+		boxObjects.push_back((int)object);
+	}
+
+	// the TLAS numbers its boxes, fold the objects without a mesh back out through boxObjects
+	tlas.BuildBoxes(boxMin, boxMax);
+	tlasObjects.swap(boxObjects);
+
+	stats.objects = (int)tlasObjects.size();
+	stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+ScenePicker::Hit ScenePicker::Intersect(const Ray& ray, float tMax) const
+{
+	Hit hit = { -1, -1, tMax, glm::vec3(0.0f) };
+	float closest = tMax;
+	tlas.Walk(ray.origin, ray.direction, closest, [&](int slot, float& nearest)
+	{
+		int object = tlasObjects[tlas.Primitive(slot)];
+		const Instance& instance = instances[object];
+		if (instance.mesh->bvh.TriangleCount() > 0)
+		{
+			glm::vec3 origin = glm::vec3(instance.inverseModel * glm::vec4(ray.origin, 1.0f));
+			glm::vec3 direction = glm::mat3(instance.inverseModel) * ray.direction;
+			Bvh::Hit meshHit;
+			if (instance.mesh->bvh.Intersect(origin, direction, nearest, meshHit))
+			{
+				nearest = meshHit.t;
+				hit.object = object;
+				hit.triangle = meshHit.triangle;
+			}
+		}
+		else
+		{
+			// nearest of the sphere's two crossings that's in front of the origin
+			glm::vec3 offset = ray.origin - instance.center;
+			float b = glm::dot(offset, ray.direction);
+			float a = glm::dot(ray.direction, ray.direction);
+			float discriminant = b * b - a * (glm::dot(offset, offset) - instance.radius * instance.radius);
+			if (discriminant >= 0.0f)
+			{
+				float root = std::sqrt(discriminant);
+				float t = (-b - root) / a;
+				if (t < 0.0f)
+					t = (-b + root) / a;
+				if (t >= 0.0f && t < nearest)
+				{
+					nearest = t;
+					hit.object = object;
+					hit.triangle = -1;
+				}
+			}
+		}
+		return false;
+	});
+
+	if (hit.object >= 0)
+	{
+		hit.t = closest;
+		hit.position = ray.origin + ray.direction * closest;
+	}
+	return hit;
+}
+
+void ScenePicker::IntersectBatch(const Ray* rays, Hit* hits, int count, WorkerPool& workers, float tMax) const
+{
+	workers.ParallelFor(count, [&](int begin, int end, int /*threadIndex*/)
+	{
+		for (int i = begin; i < end; i++)
+			hits[i] = Intersect(rays[i], tMax);
+	});
+}
+
+// streamed geometry on disk: "CHNK", vertex float count, index count, then interleaved position/normal/uv
+// floats and the indices, all little endian as written
+bool UWriteChunk(const char* filename, const std::vector<GLfloat>& vertices, const std::vector<GLuint>& indices)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	unsigned int header[3] = { 0x4B4E4843, (unsigned int)vertices.size(), (unsigned int)indices.size() };
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(vertices.data(), sizeof(GLfloat), vertices.size(), file);
+	fwrite(indices.data(), sizeof(GLuint), indices.size(), file);
+	return fclose(file) == 0;
+}
+
+bool UReadChunk(const char* filename, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	// like Lightmap::Read the counts have to fit in what's left of the file before anything is allocated, and a
+	// chunk has whole vertices and no index past the last one, a bad one never reaches the GL upload
+	fseek(file, 0, SEEK_END);
+	long remaining = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	unsigned int header[3];
+	bool ok = remaining >= (long)sizeof(header) && fread(header, sizeof(header), 1, file) == 1 && header[0] == 0x4B4E4843 &&
+		header[1] % 8 == 0 &&
+		(unsigned long long)header[1] * sizeof(GLfloat) + (unsigned long long)header[2] * sizeof(GLuint) <= (unsigned long long)(remaining - (long)sizeof(header));
+	if (ok)
+	{
+		vertices.resize(header[1]);
+		indices.resize(header[2]);
+		ok = fread(vertices.data(), sizeof(GLfloat), vertices.size(), file) == vertices.size() &&
+			fread(indices.data(), sizeof(GLuint), indices.size(), file) == indices.size();
+	}
+	fclose(file);
+
+	for (size_t i = 0; ok && i < indices.size(); i++)
+		ok = indices[i] < header[1] / 8;
+	return ok;
+}
+
+// Out of core geometry. Chunks sit on disk until the camera gets within loadDistance of them, then the loader
+// threads read them in, closest (and highest priority) first. The GL thread uploads finished loads in Update
+// within uploadBudget bytes a frame and evicts the least recently wanted chunks once more than residentBudget
+// bytes are resident. Nothing ever waits on the disk, a chunk that isn't resident draws its fallback, a
+// coarse proxy that stays resident the whole time.
+class GeometryStreamer
+{
+public:
+	struct Stats
+	{
+		int queued;				// waiting for a loader thread
+		int loading;			// being read right now
+		int awaitingUpload;		// read, waiting for upload budget
+		int resident;
+		size_t residentBytes;
+		size_t uploadedBytes;	// this frame
+		int uploads;			// this frame
+		int evictions;			// total
+		int fallbacks;			// wanted chunks drawn with their fallback this frame
+		double loadMs;			// average disk read
+		double latencyMs;		// average request to resident
+	};
+
+	void Initialize(Meshes* meshPool, TransformBatch* transformBatch, int loaderThreads, float loadDistance, size_t uploadBudgetBytes, size_t residentBudgetBytes);
+	void Destroy();
+
+	// before Initialize or between frames on the GL thread, returns the chunk's index
+	int AddChunk(const std::string& file, const glm::vec3& center, float radius, MeshHandle fallback, int priority = 0);
+	int ChunkCount() const { return (int)chunks.size(); }
+
+	// GL thread, once a frame before recording. True when what's resident changed
+	bool Update(const glm::vec3& cameraPosition);
+	// resident mesh or the fallback, only reads so it's safe from the recording workers
+	MeshHandle Resolve(int chunk) const { return chunks[chunk].mesh ? chunks[chunk].mesh : chunks[chunk].fallback; }
+	const Stats& LastFrame() const { return stats; }
+
+private:
+	enum State
+	{
+		STATE_ON_DISK,
+		STATE_REQUESTED,	// queued or being read
+		STATE_LOADED,		// read, waiting for upload
+		STATE_RESIDENT
+	};
+
+	struct Chunk
+	{
+		std::string file;
+		glm::vec3 center;
+		float radius;
+		MeshHandle fallback;
+		int priority;
+		State state = STATE_ON_DISK;
+		MeshHandle mesh = 0;
+		size_t bytes = 0;
+		float distance = 0.0f;
+		unsigned long long lastWanted = 0;
+		std::chrono::steady_clock::time_point requested;
+	};
+
+	struct Request
+	{
+		int chunk;
+		float score;	// lower loads first
+	};
+
+	struct Load
+	{
+		int chunk;
+		bool ok;
+		double milliseconds;
+		std::vector<GLfloat> vertices;
+		std::vector<GLuint> indices;
+	};
+
+	void LoaderLoop();
+	float Score(const Chunk& chunk) const { return chunk.distance - chunk.priority * 1000.0f; }
+	void Upload(Load& load);
+	void Evict(int chunk);
+
+	Meshes* meshes = nullptr;
+	TransformBatch* transforms = nullptr;
+	float loadDistance = 40.0f;
+	size_t uploadBudget = 0;
+	size_t residentBudget = 0;
+
+	// written by the GL thread, the loaders only read file names under the lock
+	std::vector<Chunk> chunks;
+	std::vector<Load> awaitingUpload;
+	unsigned long long frame = 0;
+	size_t residentBytes = 0;
+	int residentCount = 0;
+	int evictions = 0;
+	int completedLoads = 0;
+	double totalLoadMs = 0.0;
+	double totalLatencyMs = 0.0;
+	Stats stats = {};
+
+	// shared with the loaders
+	std::vector<std::thread> loaders;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<Request> queue;
+	std::vector<Load> finished;
+	int loading = 0;
+	bool stopping = false;
+};
+
+void GeometryStreamer::Initialize(Meshes* meshPool, TransformBatch* transformBatch, int loaderThreads, float distance, size_t uploadBudgetBytes, size_t residentBudgetBytes)
+{
+	meshes = meshPool;
+	transforms = transformBatch;
+	loadDistance = distance;
+	uploadBudget = uploadBudgetBytes;
+	residentBudget = residentBudgetBytes;
+	stopping = false;
+	for (int i = 0; i < loaderThreads; i++)
+		loaders.emplace_back(&GeometryStreamer::LoaderLoop, this);
+}
+
+void GeometryStreamer::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		queue.clear();
+	}
+	wake.notify_all();
+	for (std::thread& loader : loaders)
+		loader.join();
+	loaders.clear();
+
+	for (int c = 0; c < (int)chunks.size(); c++)
+	{
+		if (chunks[c].state == STATE_RESIDENT)
+			Evict(c);
+	}
+	chunks.clear();
+	awaitingUpload.clear();
+	finished.clear();
+}
+
+int GeometryStreamer::AddChunk(const std::string& file, const glm::vec3& center, float radius, MeshHandle fallback, int priority)
+{
+	Chunk chunk;
+	chunk.file = file;
+	chunk.center = center;
+	chunk.radius = radius;
+	chunk.fallback = fallback;
+	chunk.priority = priority;
+
+	// the loaders read file names out of the table
+	std::lock_guard<std::mutex> lock(mutex);
+	chunks.push_back(chunk);
+	return (int)chunks.size() - 1;
+}
+
+void GeometryStreamer::LoaderLoop()
+{
+	for (;;)
+	{
+		Load load;
+		std::string file;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (stopping)
+				return;
+
+			// best score first, the GL thread rescores the queue every frame as the camera moves
+			auto best = std::min_element(queue.begin(), queue.end(), [](const Request& a, const Request& b) { return a.score < b.score; });
+			load.chunk = best->chunk;
+			file = chunks[load.chunk].file;
+			*best = queue.back();
+			queue.pop_back();
+			loading++;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		load.ok = UReadChunk(file.c_str(), load.vertices, load.indices);
+		load.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		loading--;
+		finished.push_back(std::move(load));
+	}
+}
+
+bool GeometryStreamer::Update(const glm::vec3& cameraPosition)
+{
+	frame++;
+	bool changed = false;
+	stats.uploadedBytes = 0;
+	stats.uploads = 0;
+	stats.fallbacks = 0;
+
+	// what the camera wants this frame
+	std::vector<int> wanted;
+	for (int c = 0; c < (int)chunks.size(); c++)
+	{
+		Chunk& chunk = chunks[c];
+		chunk.distance = std::max(glm::length(chunk.center - cameraPosition) - chunk.radius, 0.0f);
+		if (chunk.distance > loadDistance)
+			continue;
+		chunk.lastWanted = frame;
+		if (chunk.state != STATE_RESIDENT)
+			stats.fallbacks++;
+		if (chunk.state == STATE_ON_DISK)
+			wanted.push_back(c);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// drop requests that went out of range before a loader got to them, rescore the rest
+		for (size_t i = 0; i < queue.size();)
+		{
+			Chunk& chunk = chunks[queue[i].chunk];
+			if (chunk.lastWanted != frame)
+			{
+				chunk.state = STATE_ON_DISK;
+				queue[i] = queue.back();
+				queue.pop_back();
+				continue;
+			}
+			queue[i].score = Score(chunk);
+			i++;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		for (int c : wanted)
+		{
+			chunks[c].state = STATE_REQUESTED;
+			chunks[c].requested = now;
+			queue.push_back({ c, Score(chunks[c]) });
+		}
+
+		for (Load& load : finished)
+		{
+			chunks[load.chunk].state = STATE_LOADED;
+			awaitingUpload.push_back(std::move(load));
+		}
+		finished.clear();
+
+		stats.queued = (int)queue.size();
+		stats.loading = loading;
+	}
+	if (!wanted.empty())
+		wake.notify_all();
+
+	// uploads, nearest first, within the frame's byte budget. The first one always goes so a chunk bigger
+	// than the budget can't get stuck
+	std::sort(awaitingUpload.begin(), awaitingUpload.end(), [this](const Load& a, const Load& b) { return Score(chunks[a.chunk]) < Score(chunks[b.chunk]); });
+	size_t uploaded = 0;
+	int uploads = 0;
+	size_t next = 0;
+	for (; next < awaitingUpload.size(); next++)
+	{
+		Load& load = awaitingUpload[next];
+		Chunk& chunk = chunks[load.chunk];
+		size_t bytes = load.vertices.size() * sizeof(GLfloat) + load.indices.size() * sizeof(GLuint);
+		if (uploaded > 0 && uploaded + bytes > uploadBudget)
+			break;
+
+		// read fine but no longer wanted, or unreadable: back to disk, it's asked for again if it comes back in range
+		if (!load.ok || chunk.lastWanted != frame)
+		{
+			if (!load.ok)
+				std::cout << "ERROR::STREAMING::LOAD_FAILED " << chunk.file << std::endl;
+			chunk.state = STATE_ON_DISK;
+			continue;
+		}
+
+		Upload(load);
+		uploaded += bytes;
+		uploads++;
+		changed = true;
+	}
+	awaitingUpload.erase(awaitingUpload.begin(), awaitingUpload.begin() + next);
+	stats.uploadedBytes = uploaded;
+	stats.uploads = uploads;
+
+	// over the cap: least recently wanted goes first, never anything wanted this frame
+	while (residentBytes > residentBudget)
+	{
+		int oldest = -1;
+		for (int c = 0; c < (int)chunks.size(); c++)
+		{
+			const Chunk& chunk = chunks[c];
+			if (chunk.state == STATE_RESIDENT && chunk.lastWanted != frame && (oldest < 0 || chunk.lastWanted < chunks[oldest].lastWanted))
+				oldest = c;
+		}
+		if (oldest < 0)
+			break;
+		Evict(oldest);
+		evictions++;
+		changed = true;
+	}
+
+	stats.awaitingUpload = (int)awaitingUpload.size();
+	stats.resident = residentCount;
+	stats.residentBytes = residentBytes;
+	stats.evictions = evictions;
+	stats.loadMs = completedLoads ? totalLoadMs / completedLoads : 0.0;
+	stats.latencyMs = completedLoads ? totalLatencyMs / completedLoads : 0.0;
+	return changed;
+}
+
+void GeometryStreamer::Upload(Load& load)
+{
+	Chunk& chunk = chunks[load.chunk];
+	chunk.mesh = meshes->CreateMesh(load.vertices.data(), load.vertices.size(), load.indices.data(), load.indices.size());
+	transforms->AttachDrawIds(meshes->Get(chunk.mesh)->vao);
+	chunk.bytes = load.vertices.size() * sizeof(GLfloat) + load.indices.size() * sizeof(GLuint);
+	chunk.state = STATE_RESIDENT;
+	residentBytes += chunk.bytes;
+	residentCount++;
+
+	completedLoads++;
+	totalLoadMs += load.milliseconds;
+	totalLatencyMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - chunk.requested).count();
+}
+
+void GeometryStreamer::Evict(int c)
+{
+	Chunk& chunk = chunks[c];
+	meshes->DestroyMesh(chunk.mesh);
+	chunk.mesh = 0;
+	chunk.state = STATE_ON_DISK;
+	residentBytes -= chunk.bytes;
+	residentCount--;
+}
+
+// read only view of a whole file. Mapped where the platform has it, so the OS pages the file in as the
+// parsers walk it and nothing gets copied, read in one go everywhere else
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	bool Open(const char* filename);
+	void Close();
+
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#elif defined(USE_MMAP)
+	bool mapped = false;
+#endif
+	std::vector<char> copy;		// the fallback, and empty files which can't be mapped
+};
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+#if defined(_WIN32)
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0)
+		return true;
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+#elif defined(USE_MMAP)
+	int descriptor = open(filename, O_RDONLY);
+	if (descriptor < 0)
+		return false;
+	struct stat info;
+	if (fstat(descriptor, &info) != 0)
+	{
+		close(descriptor);
+		return false;
+	}
+	size = (size_t)info.st_size;
+	if (size > 0)
+	{
+		void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (view != MAP_FAILED)
+		{
+			madvise(view, size, MADV_SEQUENTIAL);
+			data = (const char*)view;
+			mapped = true;
+		}
+	}
+	close(descriptor);
+	if (size > 0 && !mapped)
+	{
+		size = 0;
+		return false;
+	}
+	return true;
+#else
+	FILE* stream = fopen(filename, "rb");
+	if (!stream)
+		return false;
+	fseek(stream, 0, SEEK_END);
+	long length = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+	copy.resize(length > 0 ? (size_t)length : 0);
+	bool ok = length >= 0 && fread(copy.data(), 1, copy.size(), stream) == copy.size();
+	fclose(stream);
+	if (!ok)
+	{
+		copy.clear();
+		return false;
+	}
+	data = copy.data();
+	size = copy.size();
+	return true;
+#endif
+}
+
+void MappedFile::Close()
+{
+#if defined(_WIN32)
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+#elif defined(USE_MMAP)
+	if (mapped)
+		munmap((void*)data, size);
+	mapped = false;
+#endif
+	copy.clear();
+	data = nullptr;
+	size = 0;
+}
+
+// numbers for the importers without strtod, which wants a terminated string, depends on the locale and is
+// most of the time a naive OBJ parser spends. Exact for anything a mesh file realistically holds
+double UParseNumber(const char*& p, const char* end)
+{
+	static const double POWERS[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negativeExponent = *p++ == '-';
+		int value = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			value = std::min(value * 10 + (*p - '0'), 10000);
+		exponent += negativeExponent ? -value : value;
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0)
+		result = exponent >= -22 ? result / POWERS[-exponent] : result * std::pow(10.0, exponent);
+	else if (exponent > 0)
+		result = exponent <= 22 ? result * POWERS[exponent] : result * std::pow(10.0, exponent);
+	return negative ? -result : result;
+}
+
+// just enough JSON for glTF. Objects keep their keys in order next to the values
+struct JsonValue
+{
+	enum Type
+	{
+		JSON_NULL,
+		JSON_BOOL,
+		JSON_NUMBER,
+		JSON_STRING,
+		JSON_ARRAY,
+		JSON_OBJECT
+	};
+
+	Type type = JSON_NULL;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<std::string> keys;	// objects only, one per item
+	std::vector<JsonValue> items;
+
+	// missing keys and indices come back as null so lookups can chain
+	const JsonValue& operator[](const char* key) const;
+	const JsonValue& operator[](size_t index) const;
+
+	bool IsNull() const { return type == JSON_NULL; }
+	size_t Size() const { return type == JSON_ARRAY || type == JSON_OBJECT ? items.size() : 0; }
+	double Number(double fallback = 0.0) const { return type == JSON_NUMBER ? number : fallback; }
+	int Int(int fallback = 0) const { return type == JSON_NUMBER ? (int)number : fallback; }
+	size_t Bytes(size_t fallback = 0) const { return type == JSON_NUMBER && number >= 0.0 ? (size_t)number : fallback; }
+};
+
+const JsonValue& JsonValue::operator[](const char* key) const
+{
+	static const JsonValue missing;
+	if (type == JSON_OBJECT)
+	{
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			if (keys[i] == key)
+				return items[i];
+		}
+	}
+	return missing;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const
+{
+	static const JsonValue missing;
+	return type == JSON_ARRAY && index < items.size() ? items[index] : missing;
+}
+
+inline const char* USkipJsonSpace(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+	return p;
+}
+
+bool UParseJsonString(const char*& p, const char* end, std::string& out)
+{
+	if (p >= end || *p != '"')
+		return false;
+	out.clear();
+	for (p++; p < end; p++)
+	{
+		if (*p == '"')
+		{
+			p++;
+			return true;
+		}
+		if (*p != '\\')
+		{
+			out += *p;
+			continue;
+		}
+		if (++p >= end)
+			return false;
+		switch (*p)
+		{
+		case 'b': out += '\b'; break;
+		case 'f': out += '\f'; break;
+		case 'n': out += '\n'; break;
+		case 'r': out += '\r'; break;
+		case 't': out += '\t'; break;
+		case 'u':
+		{
+			// basic plane only, surrogate pairs come out as two 3 byte sequences
+			if (end - p < 5)
+				return false;
+			unsigned int code = 0;
+			for (int i = 1; i <= 4; i++)
+			{
+				char c = p[i];
+				code = code * 16 + (c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : 0);
+			}
+			p += 4;
+			if (code < 0x80)
+				out += (char)code;
+			else if (code < 0x800)
+			{
+				out += (char)(0xC0 | (code >> 6));
+				out += (char)(0x80 | (code & 0x3F));
+			}
+			else
+			{
+				out += (char)(0xE0 | (code >> 12));
+				out += (char)(0x80 | ((code >> 6) & 0x3F));
+				out += (char)(0x80 | (code & 0x3F));
+			}
+			break;
+		}
+		default: out += *p; break;	// \" \\ \/
+		}
+	}
+	return false;
+}
+
+bool UParseJson(const char*& p, const char* end, JsonValue& value, int depth = 0)
+{
+	p = USkipJsonSpace(p, end);
+	if (p >= end || depth > 64)
+		return false;
+
+	if (*p == '{' || *p == '[')
+	{
+		bool object = *p == '{';
+		char close = object ? '}' : ']';
+		value.type = object ? JsonValue::JSON_OBJECT : JsonValue::JSON_ARRAY;
+		p = USkipJsonSpace(p + 1, end);
+		if (p < end && *p == close)
+		{
+			p++;
+			return true;
+		}
+		for (;;)
+		{
+			if (object)
+			{
+				value.keys.emplace_back();
+				p = USkipJsonSpace(p, end);
+				if (!UParseJsonString(p, end, value.keys.back()))
+					return false;
+				p = USkipJsonSpace(p, end);
+				if (p >= end || *p++ != ':')
+					return false;
+			}
+			value.items.emplace_back();
+			if (!UParseJson(p, end, value.items.back(), depth + 1))
+				return false;
+			p = USkipJsonSpace(p, end);
+			if (p >= end)
+				return false;
+			if (*p == ',')
+			{
+				p++;
+				continue;
+			}
+			return *p++ == close;
+		}
+	}
+
+	if (*p == '"')
+	{
+		value.type = JsonValue::JSON_STRING;
+		return UParseJsonString(p, end, value.string);
+	}
+
+	static const char* const LITERALS[] = { "true", "false", "null" };
+	for (int i = 0; i < 3; i++)
+	{
+		size_t length = strlen(LITERALS[i]);
+		if ((size_t)(end - p) >= length && strncmp(p, LITERALS[i], length) == 0)
+		{
+			value.type = i == 2 ? JsonValue::JSON_NULL : JsonValue::JSON_BOOL;
+			value.boolean = i == 0;
+			p += length;
+			return true;
+		}
+	}
+
+	const char* start = p;
+	value.type = JsonValue::JSON_NUMBER;
+	value.number = UParseNumber(p, end);
+	return p != start;
+}
+
+// Wavefront OBJ and glTF 2.0 (.gltf with its buffers, or .glb) into the interleaved position/normal/uv
+// layout and indices Meshes::CreateMesh takes. Files are mapped rather than read and OBJ is parsed in one
+// chunk of lines per pool thread, then deduplicated per chunk, so a vertex shared across a chunk boundary
+// can come out twice. glTF only has the JSON to parse, the pool does the conversion of each primitive.
+// Every primitive of every mesh the default scene places ends up in the one triangle list, baked into
+// world space, since each scene object draws with a single material
+class MeshImporter
+{
+public:
+	struct Stats
+	{
+		size_t bytes;		// read from disk
+		size_t vertices;	// after deduplication
+		long long triangles;
+		double ms;
+	};
+
+	bool Load(const char* filename, WorkerPool& workers, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices);
+
+	const std::string& Error() const { return error; }
+	const Stats& LastLoad() const { return stats; }
+
+private:
+	// one line aligned piece of an OBJ. Faces are fan triangulated as they're read, corners are
+	// position/uv/normal triplets of 0 based indices, -1 where the face leaves one out
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> uvs;
+		std::vector<glm::vec3> normals;
+		std::vector<int> corners;
+		std::vector<size_t> relative;	// corners written relative to this chunk's counts, fixed up once those are known
+		size_t positionBase, uvBase, normalBase;
+		std::vector<GLfloat> vertices;
+		std::vector<int> unlit;			// position index of each vertex without a normal, -1 for the rest
+		std::vector<GLuint> indices;
+		size_t vertexBase, indexBase;
+		bool failed;
+	};
+
+	struct GltfBuffer
+	{
+		const unsigned char* data;
+		size_t size;
+	};
+
+	bool LoadObj(const MappedFile& file, WorkerPool& workers, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices);
+	bool LoadGltf(const std::string& filename, const MappedFile& file, WorkerPool& workers, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices);
+	void ParseObjChunk(ObjChunk& chunk);
+	void BuildObjVertices(ObjChunk& chunk, const std::vector<glm::vec3>& positions, const std::vector<glm::vec2>& uvs, const std::vector<glm::vec3>& normals);
+	void CollectNodes(const JsonValue& json, int node, const glm::mat4& parent, int depth, std::vector<std::pair<int, glm::mat4>>& placed);
+	bool ReadAccessor(const JsonValue& json, const std::vector<GltfBuffer>& buffers, int accessor, int components, std::vector<float>& out);
+	bool ReadIndices(const JsonValue& json, const std::vector<GltfBuffer>& buffers, int accessor, std::vector<GLuint>& out);
+	bool Fail(const std::string& message) { error = message; return false; }
+
+	std::string error;
+	Stats stats = {};
+};
+
+bool MeshImporter::Load(const char* filename, WorkerPool& workers, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+{
+	auto start = std::chrono::steady_clock::now();
+	error.clear();
+	stats = {};
+	vertices.clear();
+	indices.clear();
+
+	MappedFile file;
+	if (!file.Open(filename))
+		return Fail(std::string("can't open ") + filename);
+	stats.bytes = file.Size();
+
+	std::string name = filename;
+	std::string extension = name.substr(name.find_last_of('.') + 1);
+	for (char& c : extension)
+		c = (char)tolower(c);
+
+	bool ok;
+	if (extension == "obj")
+		ok = LoadObj(file, workers, vertices, indices);
+	else if (extension == "gltf" || extension == "glb")
+		ok = LoadGltf(name, file, workers, vertices, indices);
+	else
+		ok = Fail("unknown format " + extension);
+
+	if (ok && indices.empty())
+		ok = Fail("no triangles");
+	if (!ok)
+	{
+		vertices.clear();
+		indices.clear();
+		return false;
+	}
+
+	stats.vertices = vertices.size() / 8;
+	stats.triangles = (long long)indices.size() / 3;
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+bool MeshImporter::LoadObj(const MappedFile& file, WorkerPool& workers, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+{
+	// a chunk per thread, but not so many that the per chunk duplicates matter on small files
+	const size_t MIN_CHUNK_BYTES = 64 * 1024;
+	const char* data = file.Data();
+	size_t size = file.Size();
+	int chunkCount = (int)std::max<size_t>(std::min<size_t>((size_t)workers.ThreadCount(), size / MIN_CHUNK_BYTES), 1);
+
+	std::vector<ObjChunk> chunks(chunkCount);
+	const char* previous = data;
+	for (int i = 0; i < chunkCount; i++)
+	{
+		const char* end = data + size * (i + 1) / chunkCount;
+		if (i + 1 < chunkCount)
+		{
+			const char* newline = (const char*)memchr(end, '\n', data + size - end);
+			end = newline ? newline + 1 : data + size;
+		}
+		chunks[i].begin = previous;
+		chunks[i].end = std::max(end, previous);
+		chunks[i].failed = false;
+		previous = chunks[i].end;
+	}
+
+	workers.ParallelFor(chunkCount, [this, &chunks](int begin, int end, int /*threadIndex*/)
+	{
+		for (int i = begin; i < end; i++)
+			ParseObjChunk(chunks[i]);
+	});
+
+	// faces can point at anything before them, so the attributes have to be gathered before any chunk can
+	// build its vertices
+	size_t positionCount = 0, uvCount = 0, normalCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionBase = positionCount;
+		chunk.uvBase = uvCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.positions.size();
+		uvCount += chunk.uvs.size();
+		normalCount += chunk.normals.size();
+	}
+	std::vector<glm::vec3> positions(positionCount);
+	std::vector<glm::vec2> uvs(uvCount);
+	std::vector<glm::vec3> normals(normalCount);
+	workers.ParallelFor(chunkCount, [&](int begin, int end, int /*threadIndex*/)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + chunk.uvBase);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+			std::vector<glm::vec3>().swap(chunk.positions);
+			std::vector<glm::vec2>().swap(chunk.uvs);
+			std::vector<glm::vec3>().swap(chunk.normals);
+		}
+	});
+
+	workers.ParallelFor(chunkCount, [&](int begin, int end, int /*threadIndex*/)
+	{
+		for (int i = begin; i < end; i++)
+			BuildObjVertices(chunks[i], positions, uvs, normals);
+	});
+
+	size_t vertexCount = 0, indexCount = 0;
+	bool missingNormals = false;
+	for (ObjChunk& chunk : chunks)
+	{
+		if (chunk.failed)
+			return Fail("face index out of range");
+		chunk.vertexBase = vertexCount;
+		chunk.indexBase = indexCount;
+		vertexCount += chunk.vertices.size() / 8;
+		indexCount += chunk.indices.size();
+		missingNormals = missingNormals || std::any_of(chunk.unlit.begin(), chunk.unlit.end(), [](int position) { return position >= 0; });
+	}
+	if (vertexCount > 0xFFFFFFFFull)
+		return Fail("too many vertices");
+
+	vertices.resize(vertexCount * 8);
+	indices.resize(indexCount);
+	std::vector<int> unlit(missingNormals ? vertexCount : 0);
+	workers.ParallelFor(chunkCount, [&](int begin, int end, int /*threadIndex*/)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.vertices.begin(), chunk.vertices.end(), vertices.begin() + chunk.vertexBase * 8);
+			GLuint* out = indices.data() + chunk.indexBase;
+			for (size_t j = 0; j < chunk.indices.size(); j++)
+				out[j] = chunk.indices[j] + (GLuint)chunk.vertexBase;
+			if (missingNormals)
+				std::copy(chunk.unlit.begin(), chunk.unlit.end(), unlit.begin() + chunk.vertexBase);
+		}
+	});
+
+	// faces without normals get smooth ones, area weighted over every face sharing the position
+	if (missingNormals)
+	{
+		std::vector<glm::vec3> smooth(positionCount, glm::vec3(0.0f));
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			const GLfloat* a = &vertices[(size_t)indices[i] * 8];
+			const GLfloat* b = &vertices[(size_t)indices[i + 1] * 8];
+			const GLfloat* c = &vertices[(size_t)indices[i + 2] * 8];
+			glm::vec3 face = glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+			for (int corner = 0; corner < 3; corner++)
+			{
+				int position = unlit[indices[i + corner]];
+				if (position >= 0)
+					smooth[position] += face;
+			}
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			if (unlit[v] < 0)
+				continue;
+			glm::vec3 normal = smooth[unlit[v]];
+			float length = glm::length(normal);
+			normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			vertices[v * 8 + 3] = normal.x;
+			vertices[v * 8 + 4] = normal.y;
+			vertices[v * 8 + 5] = normal.z;
+		}
+	}
+	return true;
+}
+
+void MeshImporter::ParseObjChunk(ObjChunk& chunk)
+{
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	int face[3 * 64];	// up to 64 corners a polygon, the rest of a bigger one is dropped
+	bool faceRelative[3 * 64];
+
+	while (p < end)
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		if (!lineEnd)
+			lineEnd = end;
+		while (p < lineEnd && (*p == ' ' || *p == '\t'))
+			p++;
+
+		if (lineEnd - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p++;
+			glm::vec3 position;
+			for (int i = 0; i < 3; i++)
+			{
+				while (p < lineEnd && (*p == ' ' || *p == '\t'))
+					p++;
+				position[i] = (float)UParseNumber(p, lineEnd);
+			}
+			chunk.positions.push_back(position);
+		}
+		else if (lineEnd - p > 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			p += 2;
+			glm::vec2 uv;
+			for (int i = 0; i < 2; i++)
+			{
+				while (p < lineEnd && (*p == ' ' || *p == '\t'))
+					p++;
+				uv[i] = (float)UParseNumber(p, lineEnd);
+			}
+			chunk.uvs.push_back(uv);
+		}
+		else if (lineEnd - p > 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			p += 2;
+			glm::vec3 normal;
+			for (int i = 0; i < 3; i++)
+			{
+				while (p < lineEnd && (*p == ' ' || *p == '\t'))
+					p++;
+				normal[i] = (float)UParseNumber(p, lineEnd);
+			}
+			chunk.normals.push_back(normal);
+		}
+		else if (lineEnd - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p++;
+			int cornerCount = 0;
+			for (;;)
+			{
+				while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+					p++;
+				if (p >= lineEnd || !(*p == '-' || (*p >= '0' && *p <= '9')))
+					break;
+
+				// v, v/vt, v//vn or v/vt/vn, negative counts back from the last one read so far
+				int* corner = &face[3 * std::min(cornerCount, 63)];
+				bool* relative = &faceRelative[3 * std::min(cornerCount, 63)];
+				const int counts[3] = { (int)chunk.positions.size(), (int)chunk.uvs.size(), (int)chunk.normals.size() };
+				for (int component = 0; component < 3; component++)
+				{
+					corner[component] = -1;
+					relative[component] = false;
+					if (component > 0)
+					{
+						if (p >= lineEnd || *p != '/')
+							continue;
+						p++;
+					}
+					if (p < lineEnd && (*p == '-' || (*p >= '0' && *p <= '9')))
+					{
+						long long index = (long long)UParseNumber(p, lineEnd);
+						if (index > 0)
+							corner[component] = (int)(index - 1);
+						else if (index < 0)
+						{
+							corner[component] = (int)(counts[component] + index);
+							relative[component] = true;
+						}
+					}
+				}
+				if (cornerCount < 64)
+					cornerCount++;
+			}
+
+			for (int i = 2; i < cornerCount; i++)
+			{
+				const int fan[3] = { 0, i - 1, i };
+				for (int j = 0; j < 3; j++)
+				{
+					for (int component = 0; component < 3; component++)
+					{
+						if (faceRelative[3 * fan[j] + component])
+							chunk.relative.push_back(chunk.corners.size());
+						chunk.corners.push_back(face[3 * fan[j] + component]);
+					}
+				}
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+void MeshImporter::BuildObjVertices(ObjChunk& chunk, const std::vector<glm::vec3>& positions, const std::vector<glm::vec2>& uvs, const std::vector<glm::vec3>& normals)
+{
+	const size_t bases[3] = { chunk.positionBase, chunk.uvBase, chunk.normalBase };
+	for (size_t slot : chunk.relative)
+		chunk.corners[slot] += (int)bases[slot % 3];
+
+	// open addressing on the position/uv/normal triplet, the table holds vertex numbers
+	size_t cornerCount = chunk.corners.size() / 3;
+	size_t capacity = 16;
+	while (capacity < cornerCount * 2)
+		capacity *= 2;
+	std::vector<int> table(capacity, -1);
+	std::vector<int> keys;
+	keys.reserve(cornerCount);	// rough, most meshes share every vertex a few times
+	chunk.indices.reserve(cornerCount);
+
+	for (size_t i = 0; i < cornerCount; i++)
+	{
+		const int* corner = &chunk.corners[i * 3];
+		if (corner[0] < 0 || (size_t)corner[0] >= positions.size() || corner[1] < -1 || corner[1] >= (int)uvs.size() ||
+			corner[2] < -1 || corner[2] >= (int)normals.size())
+		{
+			chunk.failed = true;
+			return;
+		}
+
+		size_t hash = ((size_t)corner[0] * 73856093u ^ (size_t)(corner[1] + 1) * 19349663u ^ (size_t)(corner[2] + 1) * 83492791u) & (capacity - 1);
+		for (;;)
+		{
+			int vertex = table[hash];
+			if (vertex < 0)
+			{
+				vertex = (int)(keys.size() / 3);
+				table[hash] = vertex;
+				keys.insert(keys.end(), corner, corner + 3);
+
+				const glm::vec3& position = positions[corner[0]];
+				glm::vec2 uv = corner[1] >= 0 ? uvs[corner[1]] : glm::vec2(0.0f);
+				glm::vec3 normal = corner[2] >= 0 ? normals[corner[2]] : glm::vec3(0.0f);
+				GLfloat out[] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, uv.x, uv.y };
+				chunk.vertices.insert(chunk.vertices.end(), out, out + 8);
+				chunk.unlit.push_back(corner[2] >= 0 ? -1 : corner[0]);
+				chunk.indices.push_back((GLuint)vertex);
+				break;
+			}
+			if (keys[vertex * 3] == corner[0] && keys[vertex * 3 + 1] == corner[1] && keys[vertex * 3 + 2] == corner[2])
+			{
+				chunk.indices.push_back((GLuint)vertex);
+				break;
+			}
+			hash = (hash + 1) & (capacity - 1);
+		}
+	}
+	std::vector<int>().swap(chunk.corners);
+}
+
+bool MeshImporter::LoadGltf(const std::string& filename, const MappedFile& file, WorkerPool& workers, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+{
+	const unsigned int GLB_MAGIC = 0x46546C67;		// "glTF"
+	const unsigned int GLB_JSON = 0x4E4F534A;
+	const unsigned int GLB_BIN = 0x004E4942;
+
+	// .glb is a 12 byte header and chunks of length, type and data, the JSON first and then the binary buffer
+	const char* text = file.Data();
+	const char* textEnd = text + file.Size();
+	GltfBuffer embedded = { nullptr, 0 };
+	unsigned int header[3] = {};
+	if (file.Size() >= 12)
+		memcpy(header, file.Data(), sizeof(header));
+	if (header[0] == GLB_MAGIC)
+	{
+		if (header[1] != 2)
+			return Fail("glb version " + std::to_string(header[1]));
+		text = textEnd = nullptr;
+		size_t offset = 12;
+		size_t length = std::min((size_t)header[2], file.Size());
+		while (offset + 8 <= length)
+		{
+			unsigned int chunk[2];
+			memcpy(chunk, file.Data() + offset, sizeof(chunk));
+			const char* chunkData = file.Data() + offset + 8;
+			if (chunk[0] > length - offset - 8)
+				return Fail("truncated glb");
+			if (chunk[1] == GLB_JSON && !text)
+			{
+				text = chunkData;
+				textEnd = chunkData + chunk[0];
+			}
+			else if (chunk[1] == GLB_BIN && !embedded.data)
+				embedded = { (const unsigned char*)chunkData, chunk[0] };
+			offset += 8 + ((chunk[0] + 3) & ~3u);
+		}
+		if (!text)
+			return Fail("glb without JSON");
+	}
+
+	JsonValue json;
+	const char* p = text;
+	if (!UParseJson(p, textEnd, json) || json.type != JsonValue::JSON_OBJECT)
+		return Fail("bad JSON");
+	if (json["asset"]["version"].string.compare(0, 2, "2.") != 0)
+		return Fail("not glTF 2.0");
+	if (json["extensionsRequired"].Size() > 0)
+		return Fail("requires extension " + json["extensionsRequired"][(size_t)0].string);
+
+	// buffers: the glb's own, base64 data URIs, or files next to the .gltf
+	std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+	std::vector<GltfBuffer> buffers;
+	std::vector<std::vector<unsigned char>> decoded;
+	std::vector<std::unique_ptr<MappedFile>> external;
+	decoded.reserve(json["buffers"].Size());
+	for (size_t i = 0; i < json["buffers"].Size(); i++)
+	{
+		const JsonValue& buffer = json["buffers"][i];
+		const std::string& uri = buffer["uri"].string;
+		size_t byteLength = buffer["byteLength"].Bytes();
+		if (buffer["uri"].IsNull())
+		{
+			if (i != 0 || !embedded.data)
+				return Fail("buffer " + std::to_string(i) + " has no data");
+			buffers.push_back({ embedded.data, std::min(byteLength, embedded.size) });
+		}
+		else if (uri.compare(0, 5, "data:") == 0)
+		{
+			size_t comma = uri.find(',');
+			if (comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos)
+				return Fail("buffer " + std::to_string(i) + " isn't base64");
+			decoded.emplace_back();
+			std::vector<unsigned char>& bytes = decoded.back();
+			unsigned int bits = 0;
+			int bitCount = 0;
+			for (size_t c = comma + 1; c < uri.size(); c++)
+			{
+				char ch = uri[c];
+				int value = ch >= 'A' && ch <= 'Z' ? ch - 'A' : ch >= 'a' && ch <= 'z' ? ch - 'a' + 26 :
+					ch >= '0' && ch <= '9' ? ch - '0' + 52 : ch == '+' ? 62 : ch == '/' ? 63 : -1;
+				if (value < 0)
+					continue;
+				bits = (bits << 6) | value;
+				bitCount += 6;
+				if (bitCount >= 8)
+				{
+					bitCount -= 8;
+					bytes.push_back((unsigned char)(bits >> bitCount));
+				}
+			}
+			buffers.push_back({ bytes.data(), std::min(byteLength, bytes.size()) });
+		}
+		else
+		{
+			external.emplace_back(new MappedFile());
+			if (!external.back()->Open((directory + uri).c_str()))
+				return Fail("can't open buffer " + directory + uri);
+			stats.bytes += external.back()->Size();
+			buffers.push_back({ (const unsigned char*)external.back()->Data(), std::min(byteLength, external.back()->Size()) });
+		}
+	}
+
+	// what the default scene places where, every mesh once in place when there is no scene
+	std::vector<std::pair<int, glm::mat4>> placed;
+	const JsonValue& scenes = json["scenes"];
+	if (scenes.Size() > 0)
+	{
+		const JsonValue& roots = scenes[(size_t)json["scene"].Int(0)]["nodes"];
+		for (size_t i = 0; i < roots.Size(); i++)
+			CollectNodes(json, roots[i].Int(-1), glm::mat4(1.0f), 0, placed);
+	}
+	else
+	{
+		for (size_t i = 0; i < json["meshes"].Size(); i++)
+			placed.push_back(std::make_pair((int)i, glm::mat4(1.0f)));
+	}
+
+	std::vector<float> positions, normals, uvs;
+	std::vector<GLuint> primitiveIndices;
+	for (const std::pair<int, glm::mat4>& instance : placed)
+	{
+		const JsonValue& primitives = json["meshes"][(size_t)instance.first]["primitives"];
+		glm::mat3 normalMatrix = UNormalMatrix(instance.second);
+		bool mirrored = glm::determinant(glm::mat3(instance.second)) < 0.0f;
+
+		for (size_t i = 0; i < primitives.Size(); i++)
+		{
+			const JsonValue& primitive = primitives[i];
+			const JsonValue& attributes = primitive["attributes"];
+			int mode = primitive["mode"].Int(4);
+			if (mode < 4 || attributes["POSITION"].IsNull())
+				continue;	// points and lines
+
+			if (!ReadAccessor(json, buffers, attributes["POSITION"].Int(-1), 3, positions))
+				return false;
+			size_t count = positions.size() / 3;
+			bool hasNormals = !attributes["NORMAL"].IsNull();
+			if (hasNormals && !ReadAccessor(json, buffers, attributes["NORMAL"].Int(-1), 3, normals))
+				return false;
+			bool hasUvs = !attributes["TEXCOORD_0"].IsNull();
+			if (hasUvs && !ReadAccessor(json, buffers, attributes["TEXCOORD_0"].Int(-1), 2, uvs))
+				return false;
+			if ((hasNormals && normals.size() != count * 3) || (hasUvs && uvs.size() != count * 2))
+				return Fail("attribute counts don't match");
+
+			if (!primitive["indices"].IsNull())
+			{
+				if (!ReadIndices(json, buffers, primitive["indices"].Int(-1), primitiveIndices))
+					return false;
+			}
+			else
+			{
+				primitiveIndices.resize(count);
+				for (size_t v = 0; v < count; v++)
+					primitiveIndices[v] = (GLuint)v;
+			}
+
+			// strips and fans become a plain list, winding flips with mirroring transforms
+			std::vector<GLuint> triangles;
+			if (mode == 4)
+				triangles.swap(primitiveIndices);
+			else
+			{
+				for (size_t t = 2; t < primitiveIndices.size(); t++)
+				{
+					GLuint a = mode == 5 ? primitiveIndices[t - 2] : primitiveIndices[0];
+					GLuint b = primitiveIndices[t - 1];
+					GLuint c = primitiveIndices[t];
+					if (mode == 5 && (t & 1))
+						std::swap(a, b);
+					GLuint triangle[] = { a, b, c };
+					triangles.insert(triangles.end(), triangle, triangle + 3);
+				}
+			}
+			triangles.resize(triangles.size() / 3 * 3);
+			for (GLuint index : triangles)
+			{
+				if (index >= count)
+					return Fail("index out of range");
+			}
+			if (mirrored)
+			{
+				for (size_t t = 0; t < triangles.size(); t += 3)
+					std::swap(triangles[t + 1], triangles[t + 2]);
+			}
+
+			// smooth normals the same way the OBJ path makes them when the file has none
+			if (!hasNormals)
+			{
+				normals.assign(count * 3, 0.0f);
+				for (size_t t = 0; t < triangles.size(); t += 3)
+				{
+					glm::vec3 a = glm::make_vec3(&positions[triangles[t] * 3]);
+					glm::vec3 b = glm::make_vec3(&positions[triangles[t + 1] * 3]);
+					glm::vec3 c = glm::make_vec3(&positions[triangles[t + 2] * 3]);
+					glm::vec3 face = glm::cross(b - a, c - a);
+					for (int corner = 0; corner < 3; corner++)
+					{
+						float* normal = &normals[triangles[t + corner] * 3];
+						normal[0] += face.x;
+						normal[1] += face.y;
+						normal[2] += face.z;
+					}
+				}
+			}
+
+			size_t vertexBase = vertices.size() / 8;
+			if (vertexBase + count > 0xFFFFFFFFull)
+				return Fail("too many vertices");
+			vertices.resize((vertexBase + count) * 8);
+			GLfloat* out = vertices.data() + vertexBase * 8;
+			const glm::mat4& model = instance.second;
+			workers.ParallelFor((int)count, [&](int begin, int end, int /*threadIndex*/)
+			{
+				for (int v = begin; v < end; v++)
+				{
+					glm::vec3 position = glm::vec3(model * glm::vec4(glm::make_vec3(&positions[v * 3]), 1.0f));
+					glm::vec3 normal = normalMatrix * glm::make_vec3(&normals[v * 3]);
+					float length = glm::length(normal);
+					normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+					GLfloat* vertex = out + (size_t)v * 8;
+					vertex[0] = position.x;
+					vertex[1] = position.y;
+					vertex[2] = position.z;
+					vertex[3] = normal.x;
+					vertex[4] = normal.y;
+					vertex[5] = normal.z;
+					// glTF puts the uv origin top left, GL bottom left
+					vertex[6] = hasUvs ? uvs[v * 2] : 0.0f;
+					vertex[7] = hasUvs ? 1.0f - uvs[v * 2 + 1] : 0.0f;
+				}
+			});
+
+			size_t indexBase = indices.size();
+			indices.resize(indexBase + triangles.size());
+			for (size_t t = 0; t < triangles.size(); t++)
+				indices[indexBase + t] = triangles[t] + (GLuint)vertexBase;
+		}
+	}
+	return true;
+}
+
+void MeshImporter::CollectNodes(const JsonValue& json, int node, const glm::mat4& parent, int depth, std::vector<std::pair<int, glm::mat4>>& placed)
+{
+	const JsonValue& nodes = json["nodes"];
+	if (node < 0 || (size_t)node >= nodes.Size() || depth > 64)
+		return;
+
+	// matrix, or translation * rotation * scale with the rotation an (x, y, z, w) quaternion
+	const JsonValue& value = nodes[(size_t)node];
+	glm::mat4 local(1.0f);
+	if (value["matrix"].Size() == 16)
+	{
+		for (int i = 0; i < 16; i++)
+			local[i / 4][i % 4] = (float)value["matrix"][(size_t)i].Number();
+	}
+	else
+	{
+		const JsonValue& t = value["translation"];
+		const JsonValue& r = value["rotation"];
+		const JsonValue& s = value["scale"];
+		glm::vec4 q((float)r[(size_t)0].Number(0.0), (float)r[1].Number(0.0), (float)r[2].Number(0.0), (float)r[3].Number(1.0));
+		glm::mat4 rotation(1.0f);
+		rotation[0] = glm::vec4(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.z * q.w), 2.0f * (q.x * q.z - q.y * q.w), 0.0f);
+		rotation[1] = glm::vec4(2.0f * (q.x * q.y - q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.x * q.w), 0.0f);
+		rotation[2] = glm::vec4(2.0f * (q.x * q.z + q.y * q.w), 2.0f * (q.y * q.z - q.x * q.w), 1.0f - 2.0f * (q.x * q.x + q.y * q.y), 0.0f);
+		local = glm::translate(glm::vec3((float)t[(size_t)0].Number(), (float)t[1].Number(), (float)t[2].Number())) * rotation *
+			glm::scale(glm::vec3((float)s[(size_t)0].Number(1.0), (float)s[1].Number(1.0), (float)s[2].Number(1.0)));
+	}
+
+	glm::mat4 world = parent * local;
+	if (!value["mesh"].IsNull())
+		placed.push_back(std::make_pair(value["mesh"].Int(), world));
+	for (size_t i = 0; i < value["children"].Size(); i++)
+		CollectNodes(json, value["children"][i].Int(-1), world, depth + 1, placed);
+}
+
+// an accessor as floats, normalized integers mapped to 0..1 (or -1..1 signed) like the GL would
+bool MeshImporter::ReadAccessor(const JsonValue& json, const std::vector<GltfBuffer>& buffers, int index, int components, std::vector<float>& out)
+{
+	const JsonValue& accessor = json["accessors"][(size_t)std::max(index, 0)];
+	if (index < 0 || accessor.IsNull())
+		return Fail("missing accessor " + std::to_string(index));
+	if (!accessor["sparse"].IsNull())
+		return Fail("sparse accessors aren't supported");
+
+	static const char* const TYPES[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+	if (accessor["type"].string != TYPES[components - 1])
+		return Fail("accessor " + std::to_string(index) + " is " + accessor["type"].string);
+
+	size_t count = accessor["count"].Bytes();
+	int componentType = accessor["componentType"].Int();
+	size_t componentSize = componentType == 5126 || componentType == 5125 ? 4 : componentType == 5122 || componentType == 5123 ? 2 : 1;
+	bool normalized = accessor["normalized"].boolean;
+	if (componentType != 5126 && !normalized)
+		return Fail("accessor " + std::to_string(index) + " isn't float or normalized");
+
+	out.assign(count * components, 0.0f);
+	if (accessor["bufferView"].IsNull())
+		return true;	// all zeros
+
+	const JsonValue& view = json["bufferViews"][accessor["bufferView"].Bytes()];
+	size_t buffer = view["buffer"].Bytes();
+	if (view.IsNull() || buffer >= buffers.size())
+		return Fail("accessor " + std::to_string(index) + " has no buffer");
+	size_t elementSize = componentSize * components;
+	size_t stride = view["byteStride"].Bytes(elementSize);
+	size_t offset = view["byteOffset"].Bytes() + accessor["byteOffset"].Bytes();
+	if (count > 0 && (offset + stride * (count - 1) + elementSize > buffers[buffer].size ||
+		accessor["byteOffset"].Bytes() + stride * (count - 1) + elementSize > view["byteLength"].Bytes()))
+		return Fail("accessor " + std::to_string(index) + " runs past its buffer");
+
+	const unsigned char* source = buffers[buffer].data + offset;
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char* element = source + i * stride;
+		for (int c = 0; c < components; c++)
+		{
+			const unsigned char* value = element + c * componentSize;
+			float result = 0.0f;
+			switch (componentType)
+			{
+			case 5126: memcpy(&result, value, 4); break;
+			case 5120: result = std::max((signed char)value[0] / 127.0f, -1.0f); break;
+			case 5121: result = value[0] / 255.0f; break;
+			case 5122: { short s; memcpy(&s, value, 2); result = std::max(s / 32767.0f, -1.0f); break; }
+			case 5123: { unsigned short s; memcpy(&s, value, 2); result = s / 65535.0f; break; }
+			case 5125: { unsigned int u; memcpy(&u, value, 4); result = (float)(u / 4294967295.0); break; }
+			}
+			out[i * components + c] = result;
+		}
+	}
+	return true;
+}
+
+bool MeshImporter::ReadIndices(const JsonValue& json, const std::vector<GltfBuffer>& buffers, int index, std::vector<GLuint>& out)
+{
+	const JsonValue& accessor = json["accessors"][(size_t)std::max(index, 0)];
+	if (index < 0 || accessor.IsNull() || accessor["bufferView"].IsNull())
+		return Fail("missing index accessor " + std::to_string(index));
+	if (!accessor["sparse"].IsNull())
+		return Fail("sparse accessors aren't supported");
+
+	size_t count = accessor["count"].Bytes();
+	int componentType = accessor["componentType"].Int();
+	size_t componentSize = componentType == 5125 ? 4 : componentType == 5123 ? 2 : componentType == 5121 ? 1 : 0;
+	if (componentSize == 0 || accessor["type"].string != "SCALAR")
+		return Fail("bad index accessor " + std::to_string(index));
+
+	const JsonValue& view = json["bufferViews"][accessor["bufferView"].Bytes()];
+	size_t buffer = view["buffer"].Bytes();
+	if (view.IsNull() || buffer >= buffers.size())
+		return Fail("index accessor " + std::to_string(index) + " has no buffer");
+	size_t stride = view["byteStride"].Bytes(componentSize);
+	size_t offset = view["byteOffset"].Bytes() + accessor["byteOffset"].Bytes();
+	if (count > 0 && (offset + stride * (count - 1) + componentSize > buffers[buffer].size ||
+		accessor["byteOffset"].Bytes() + stride * (count - 1) + componentSize > view["byteLength"].Bytes()))
+		return Fail("index accessor " + std::to_string(index) + " runs past its buffer");
+
+	const unsigned char* source = buffers[buffer].data + offset;
+	out.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char* value = source + i * stride;
+		if (componentSize == 4)
+			memcpy(&out[i], value, 4);
+		else if (componentSize == 2)
+		{
+			unsigned short s;
+			memcpy(&s, value, 2);
+			out[i] = s;
+		}
+		else
+			out[i] = value[0];
+	}
+	return true;
+}
+
+// writers for the import benchmark's generated models, nothing else saves meshes in these formats
+bool UWriteObj(const char* filename, const std::vector<GLfloat>& vertices, const std::vector<GLuint>& indices)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	for (size_t i = 0; i < vertices.size(); i += 8)
+		fprintf(file, "v %g %g %g\n", vertices[i], vertices[i + 1], vertices[i + 2]);
+	for (size_t i = 0; i < vertices.size(); i += 8)
+		fprintf(file, "vt %g %g\n", vertices[i + 6], vertices[i + 7]);
+	for (size_t i = 0; i < vertices.size(); i += 8)
+		fprintf(file, "vn %g %g %g\n", vertices[i + 3], vertices[i + 4], vertices[i + 5]);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", indices[i] + 1, indices[i] + 1, indices[i] + 1,
+			indices[i + 1] + 1, indices[i + 1] + 1, indices[i + 1] + 1, indices[i + 2] + 1, indices[i + 2] + 1, indices[i + 2] + 1);
+	}
+	return fclose(file) == 0;
+}
+
+// one interleaved vertex view and an index view in the binary chunk
+bool UWriteGlb(const char* filename, const std::vector<GLfloat>& vertices, const std::vector<GLuint>& indices)
+{
+	glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+	for (size_t i = 0; i < vertices.size(); i += 8)
+	{
+		low = glm::min(low, glm::make_vec3(&vertices[i]));
+		high = glm::max(high, glm::make_vec3(&vertices[i]));
+	}
+
+	size_t vertexBytes = vertices.size() * sizeof(GLfloat);
+	size_t indexBytes = indices.size() * sizeof(GLuint);
+	size_t vertexCount = vertices.size() / 8;
+	char bounds[160];
+	snprintf(bounds, sizeof(bounds), "\"min\":[%g,%g,%g],\"max\":[%g,%g,%g]", low.x, low.y, low.z, high.x, high.y, high.z);
+	std::string json = "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+		"\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2},\"indices\":3}]}],"
+		"\"buffers\":[{\"byteLength\":" + std::to_string(vertexBytes + indexBytes) + "}],"
+		"\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" + std::to_string(vertexBytes) + ",\"byteStride\":32,\"target\":34962},"
+		"{\"buffer\":0,\"byteOffset\":" + std::to_string(vertexBytes) + ",\"byteLength\":" + std::to_string(indexBytes) + ",\"target\":34963}],"
+		"\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":" + std::to_string(vertexCount) + ",\"type\":\"VEC3\"," + bounds + "},"
+		"{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":" + std::to_string(vertexCount) + ",\"type\":\"VEC3\"},"
+		"{\"bufferView\":0,\"byteOffset\":24,\"componentType\":5126,\"count\":" + std::to_string(vertexCount) + ",\"type\":\"VEC2\"},"
+		"{\"bufferView\":1,\"componentType\":5125,\"count\":" + std::to_string(indices.size()) + ",\"type\":\"SCALAR\"}]}";
+	json.resize((json.size() + 3) & ~(size_t)3, ' ');
+
+	// the writer's uvs are GL's, glTF wants them flipped
+	std::vector<GLfloat> flipped(vertices);
+	for (size_t i = 0; i < flipped.size(); i += 8)
+		flipped[i + 7] = 1.0f - flipped[i + 7];
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	unsigned int header[5] = { 0x46546C67, 2, (unsigned int)(12 + 8 + json.size() + 8 + vertexBytes + indexBytes), (unsigned int)json.size(), 0x4E4F534A };
+	unsigned int binHeader[2] = { (unsigned int)(vertexBytes + indexBytes), 0x004E4942 };
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(json.data(), 1, json.size(), file);
+	fwrite(binHeader, sizeof(binHeader), 1, file);
+	fwrite(flipped.data(), 1, vertexBytes, file);
+	fwrite(indices.data(), 1, indexBytes, file);
+	return fclose(file) == 0;
+}
+
+// A texture's whole mip chain on the CPU, in the image's own channel count (3 or 4). Levels follow GL's sizes,
+// each dimension halved and rounded down but never under 1
+struct MipChain
+{
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	std::vector<std::vector<unsigned char>> levels;
+
+	int LevelWidth(int level) const { return std::max(width >> level, 1); }
+	int LevelHeight(int level) const { return std::max(height >> level, 1); }
+};
+
+// FNV-1a, what the mip cache keys the source file on
+unsigned long long UHashBytes(const char* data, size_t size)
+{
+	unsigned long long hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ (unsigned char)data[i]) * 0x100000001B3ull;
+	return hash;
+}
+
+// sRGB to linear for every byte, and linear back to sRGB through a table fine enough that the darks round right
+float UDecodeSrgb(unsigned char value)
+{
+	static const std::vector<float> table = []
+	{
+		std::vector<float> decoded(256);
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			decoded[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return decoded;
+	}();
+	return table[value];
+}
+
+unsigned char UEncodeSrgb(float value)
+{
+	const int STEPS = 16384;
+	static const std::vector<unsigned char> table = []
+	{
+		std::vector<unsigned char> encoded(STEPS + 1);
+		for (int i = 0; i <= STEPS; i++)
+		{
+			float c = (float)i / STEPS;
+			float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+			encoded[i] = (unsigned char)(srgb * 255.0f + 0.5f);
+		}
+		return encoded;
+	}();
+	return table[(int)(std::min(std::max(value, 0.0f), 1.0f) * STEPS + 0.5f)];
+}
+
+// Kaiser windowed sinc, radius 3 destination texels, alpha 4. Sharper than the box filter drivers tend to
+// use for glGenerateMipmap without the ringing a plain Lanczos shows on hard edges
+float UKaiserSinc(float t)
+{
+	const float RADIUS = 3.0f;
+	const float ALPHA = 4.0f;
+	if (std::fabs(t) >= RADIUS)
+		return 0.0f;
+
+	// zeroth order modified Bessel function, the series converges long before 20 terms for these arguments
+	auto bessel = [](float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 20; k++)
+		{
+			term *= (x * 0.5f / k) * (x * 0.5f / k);
+			sum += term;
+		}
+		return sum;
+	};
+
+	float ratio = t / RADIUS;
+	float window = bessel(ALPHA * std::sqrt(1.0f - ratio * ratio)) / bessel(ALPHA);
+	float x = (float)M_PI * t;
+	return (t == 0.0f ? 1.0f : std::sin(x) / x) * window;
+}
+
+// every destination texel's taps along one axis, source indices already wrapped like GL_REPEAT
+struct MipTaps
+{
+	int count = 0;
+	std::vector<int> indices;		// count per destination texel
+	std::vector<float> weights;
+};
+
+void UBuildMipTaps(int sourceSize, int destinationSize, MipTaps& taps)
+{
+	const float RADIUS = 3.0f;
+	float scale = (float)sourceSize / destinationSize;
+	taps.count = (int)std::ceil(2.0f * RADIUS * scale) + 1;
+	taps.indices.resize((size_t)destinationSize * taps.count);
+	taps.weights.resize((size_t)destinationSize * taps.count);
+
+	for (int x = 0; x < destinationSize; x++)
+	{
+		float center = (x + 0.5f) * scale;
+		int first = (int)std::floor(center - RADIUS * scale);
+		float sum = 0.0f;
+		for (int k = 0; k < taps.count; k++)
+		{
+			int source = first + k;
+			float weight = UKaiserSinc((source + 0.5f - center) / scale);
+			taps.indices[(size_t)x * taps.count + k] = ((source % sourceSize) + sourceSize) % sourceSize;
+			taps.weights[(size_t)x * taps.count + k] = weight;
+			sum += weight;
+		}
+		for (int k = 0; k < taps.count; k++)
+			taps.weights[(size_t)x * taps.count + k] /= sum;
+	}
+}
+
+// Mip chain for an 8 bit image, filtered in linear light. Texels are widened to four floats (color premultiplied
+// by alpha so transparent texels don't bleed their color in) so both passes are one SSE multiply add per tap.
+// Each level is filtered from the one before it, so the levels go in order and the pool splits each pass by rows
+void UBuildMipChain(WorkerPool& workers, const unsigned char* image, int width, int height, int channels, MipChain& chain)
+{
+	chain.width = width;
+	chain.height = height;
+	chain.channels = channels;
+	chain.levels.clear();
+	chain.levels.emplace_back(image, image + (size_t)width * height * channels);
+
+	int levelCount = 1;
+	while ((width >> levelCount) > 0 || (height >> levelCount) > 0)
+		levelCount++;
+
+	std::vector<float> current((size_t)width * height * 4);
+	workers.ParallelFor(height, [&](int begin, int end, int /*threadIndex*/)
+	{
+		for (size_t i = (size_t)begin * width; i < (size_t)end * width; i++)
+		{
+			const unsigned char* texel = image + i * channels;
+			float alpha = channels == 4 ? texel[3] / 255.0f : 1.0f;
+			current[i * 4] = UDecodeSrgb(texel[0]) * alpha;
+			current[i * 4 + 1] = UDecodeSrgb(texel[1]) * alpha;
+			current[i * 4 + 2] = UDecodeSrgb(texel[2]) * alpha;
+			current[i * 4 + 3] = alpha;
+		}
+	});
+
+	std::vector<float> rows, next;
+	MipTaps horizontal, vertical;
+	int sourceWidth = width, sourceHeight = height;
+	for (int level = 1; level < levelCount; level++)
+	{
+		int levelWidth = chain.LevelWidth(level);
+		int levelHeight = chain.LevelHeight(level);
+		UBuildMipTaps(sourceWidth, levelWidth, horizontal);
+		UBuildMipTaps(sourceHeight, levelHeight, vertical);
+
+		// horizontal pass, every source row down to the new width
+		rows.resize((size_t)levelWidth * sourceHeight * 4);
+		workers.ParallelFor(sourceHeight, [&](int begin, int end, int /*threadIndex*/)
+		{
+			for (int y = begin; y < end; y++)
+			{
+				const float* source = &current[(size_t)y * sourceWidth * 4];
+				float* destination = &rows[(size_t)y * levelWidth * 4];
+				for (int x = 0; x < levelWidth; x++)
+				{
+					const int* indices = &horizontal.indices[(size_t)x * horizontal.count];
+					const float* weights = &horizontal.weights[(size_t)x * horizontal.count];
+#ifdef USE_SSE
+					__m128 sum = _mm_setzero_ps();
+					for (int k = 0; k < horizontal.count; k++)
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(source + indices[k] * 4)));
+					_mm_storeu_ps(destination + x * 4, sum);
+#else
+					float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+					for (int k = 0; k < horizontal.count; k++)
+					{
+						for (int c = 0; c < 4; c++)
+							sum[c] += weights[k] * source[indices[k] * 4 + c];
+					}
+					std::copy(sum, sum + 4, destination + x * 4);
+#endif
+				}
+			}
+		});
+
+		// vertical pass, each destination row a weighted sum of whole filtered rows
+		next.assign((size_t)levelWidth * levelHeight * 4, 0.0f);
+		size_t rowFloats = (size_t)levelWidth * 4;
+		workers.ParallelFor(levelHeight, [&](int begin, int end, int /*threadIndex*/)
+		{
+			for (int y = begin; y < end; y++)
+			{
+				float* destination = &next[y * rowFloats];
+				for (int k = 0; k < vertical.count; k++)
+				{
+					const float* source = &rows[vertical.indices[(size_t)y * vertical.count + k] * rowFloats];
+					float weight = vertical.weights[(size_t)y * vertical.count + k];
+#ifdef USE_SSE
+					__m128 w = _mm_set1_ps(weight);
+					for (size_t i = 0; i < rowFloats; i += 4)
+						_mm_storeu_ps(destination + i, _mm_add_ps(_mm_loadu_ps(destination + i), _mm_mul_ps(w, _mm_loadu_ps(source + i))));
+#else
+					for (size_t i = 0; i < rowFloats; i++)
+						destination[i] += weight * source[i];
+#endif
+				}
+			}
+		});
+
+		// back to 8 bit sRGB, the negative lobes can overshoot so everything gets clamped on the way
+		std::vector<unsigned char>& bytes = chain.levels.emplace_back((size_t)levelWidth * levelHeight * channels);
+		workers.ParallelFor(levelHeight, [&](int begin, int end, int /*threadIndex*/)
+		{
+			for (size_t i = (size_t)begin * levelWidth; i < (size_t)end * levelWidth; i++)
+			{
+				const float* texel = &next[i * 4];
+				float alpha = std::min(std::max(texel[3], 0.0f), 1.0f);
+				float unpremultiply = channels == 4 ? (alpha > 0.0f ? 1.0f / alpha : 0.0f) : 1.0f;
+				for (int c = 0; c < 3; c++)
+					bytes[i * channels + c] = UEncodeSrgb(texel[c] * unpremultiply);
+				if (channels == 4)
+					bytes[i * channels + 3] = (unsigned char)(alpha * 255.0f + 0.5f);
+			}
+		});
+
+		current.swap(next);
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+	}
+}
+
+// the baked chain next to the source image: "MIPC", version, the source file's hash, width, height, channels
+// and level count, then every level's texels. A different source or filter version just misses
+const unsigned int MIP_CACHE_VERSION = 1;
+
+bool UWriteMipCache(const char* filename, unsigned long long sourceHash, const MipChain& chain)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	unsigned int header[8] = { 0x4350494D, MIP_CACHE_VERSION, (unsigned int)sourceHash, (unsigned int)(sourceHash >> 32),
+		(unsigned int)chain.width, (unsigned int)chain.height, (unsigned int)chain.channels, (unsigned int)chain.levels.size() };
+	fwrite(header, sizeof(header), 1, file);
+	for (const std::vector<unsigned char>& level : chain.levels)
+		fwrite(level.data(), 1, level.size(), file);
+	return fclose(file) == 0;
+}
+
+bool UReadMipCache(const char* filename, unsigned long long sourceHash, MipChain& chain)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	unsigned int header[8];
+	bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == 0x4350494D && header[1] == MIP_CACHE_VERSION &&
+		header[2] == (unsigned int)sourceHash && header[3] == (unsigned int)(sourceHash >> 32) &&
+		(header[6] == 3 || header[6] == 4) && header[7] > 0 && header[7] <= 32;
+	if (ok)
+	{
+		chain.width = (int)header[4];
+		chain.height = (int)header[5];
+		chain.channels = (int)header[6];
+		chain.levels.resize(header[7]);
+		for (size_t level = 0; level < chain.levels.size() && ok; level++)
+		{
+			chain.levels[level].resize((size_t)chain.LevelWidth((int)level) * chain.LevelHeight((int)level) * chain.channels);
+			ok = fread(chain.levels[level].data(), 1, chain.levels[level].size(), file) == chain.levels[level].size();
+		}
+	}
+	fclose(file);
+	return ok;
+}
+
+namespace
+{
+	const char* const WINDOW_TITLE = "Project Work V2 10/17";
+	const int WINDOW_WIDTH = 800;
+	const int WINDOW_HEIGHT = 600;
+	float gLastX = WINDOW_WIDTH / 2.0f;
+	float gLastY = WINDOW_HEIGHT / 2.0f;
+	float gCameraSpeed = 2.5f;
+	bool gFirstMouse = true;
+	/// Main GLFW Window
+	GLFWwindow* gWindow = nullptr;
+	// textures and the standalone programs live in pools, everything else holds handles to them
+	ResourcePool<GLuint> gTexturePool;
+	ResourcePool<GLuint> gProgramPool;
+	// Texture handles
+	TextureHandle gTextureDesk = 0;
+	TextureHandle gTextureMug = 0;
+	TextureHandle gTextureBotCap = 0;
+	TextureHandle gTexturePenBod = 0;
+	TextureHandle gTextureBottl = 0;
+	TextureHandle gTextureCon = 0;
+	TextureHandle gLightmapTexture = 0;		// --lightmap, on the unit after the shadow cascades
+
+	Meshes meshes;
+	//Shader Programs
+	ShaderBuilder gShaderBuilder;
+	int gSceneProgram;			// build index of the lit scene program
+	ProgramHandle gFallbackProgram = 0;	// cheap flat program drawn with until the scene program is ready
+	//Camera
+	Camera gCamera(glm::vec3(0.0f, 1.0f, 8.0f));
+
+	// every object on the desk, also its row in the transform batch / instance buffer
+	enum SceneObject
+	{
+		OBJECT_DESK,
+		OBJECT_MUG,
+		OBJECT_PEN_TOP,
+		OBJECT_BOTTLE_CAP,
+		OBJECT_PEN_BODY,
+		OBJECT_BOTTLE,
+		OBJECT_CONTAINER,
+		OBJECT_COUNT
+	};
+	const char* const OBJECT_NAMES[OBJECT_COUNT] = { "desk", "mug", "pen-top", "bottle-cap", "pen-body", "bottle", "container" };
+	TransformBatch gTransforms;
+	PersistentRing gInstanceRing;	// per frame InstanceData, bound to SSBO binding 0
+	int gStaticSceneVersion = 0;	// bumped whenever a static object changes, invalidates cached shadows
+
+	// directional light and its shadows. Resolution per cascade, nearest first, is the memory budget
+	DirectionalLight gDirLight = {
+		glm::vec3(-0.2f, -1.0f, -0.3f),		// direction
+		glm::vec3(0.05f, 0.05f, 0.05f),		// ambient
+		glm::vec3(0.4f, 0.4f, 0.4f),		// diffuse
+		glm::vec3(0.5f, 0.5f, 0.5f),		// specular
+		1.0f								// intensity
+	};
+	const int SHADOW_RESOLUTIONS[ShadowCascades::CASCADE_COUNT] = { 2048, 1024, 1024 };
+	const float SHADOW_DISTANCE = 20.0f;
+	ShadowCascades gShadows;
+	ProgramHandle gShadowProgram = 0;
+
+	// position, ambient, diffuse, specular, constant, linear, quadratic, intensity
+	PointLight gPointLights[POINT_LIGHT_COUNT] = {
+		{ glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f, 1.0f },		// point light 1
+		{ glm::vec3(-8.0f, 3.0f, -8.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(0.8f, 0.8f, 0.0f), 1.0f, 0.09f, 0.032f, 1.0f },	// point light 2
+		{ glm::vec3(8.0f, 3.0f, -8.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.0f, 0.0f, 0.8f), glm::vec3(0.0f, 0.0f, 0.8f), 1.0f, 0.09f, 0.032f, 1.0f },		// point light 3
+		{ glm::vec3(-8.0f, 3.0f, 8.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.0f, 0.8f, 0.0f), glm::vec3(0.0f, 0.8f, 0.0f), 1.0f, 0.09f, 0.032f, 1.0f },		// point light 4
+		{ glm::vec3(8.0f, 3.0f, 8.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.0f, 0.0f), glm::vec3(0.8f, 0.0f, 0.0f), 1.0f, 0.09f, 0.032f, 1.0f }		// point light 5
+	};
+
+	// offscreen scene target whose resolution follows the GPU frame time budget
+	DynamicResolution gDynamicResolution;
+	ProgramHandle gUpscaleProgram = 0;
+	float gFrameBudgetMs = 8.3f;
+
+	// what each scene object is drawn with, filled in once the textures are loaded
+	enum MaterialId
+	{
+		MATERIAL_DESK,
+		MATERIAL_MUG,
+		MATERIAL_PEN_TOP,
+		MATERIAL_BOTTLE_CAP,
+		MATERIAL_PEN_BODY,
+		MATERIAL_BOTTLE,
+		MATERIAL_CONTAINER,
+		MATERIAL_COUNT
+	};
+
+	struct Material
+	{
+		TextureHandle texture;
+		bool hasTexture;
+		glm::vec3 color;
+	};
+
+	struct SceneDrawable
+	{
+		MeshHandle mesh;
+		MaterialId material;
+		bool dynamic;	// moves every frame, drawn over the cached shadow maps instead of into them
+		int chunk = -1;	// streamed, drawn with whatever gStreamer has resident for the chunk
+		bool lightmapped = false;	// mesh swapped for its baked copy by ULoadLightmap
+	};
+
+	Material gMaterials[MATERIAL_COUNT];
+	// the files main loads, per material for the software renderer which keeps its own CPU copies
+	const char* const MATERIAL_TEXTURE_FILES[MATERIAL_COUNT] = {
+		"Textures/table-wood.jpg",
+		"Textures/cracked-white.jpg",
+		"Textures/cracked-white.jpg",
+		"Textures/black-pin.jpg",
+		"Textures/pink-dot.jpg",
+		"Textures/sup-reme.jpg",
+		"Textures/aspire-logo.jpg"
+	};
+	std::vector<SceneDrawable> gSceneDrawables;	// OBJECT_COUNT of them, then anything streamed
+	GeometryStreamer gStreamer;
+
+	// render command recording, one command buffer per pool thread
+	WorkerPool gWorkers;
+	std::vector<CommandBuffer> gCommandBuffers;
+	std::vector<DrawPacket> gDrawPackets;
+	std::vector<DrawPacket> gSortScratch;
+
+	// shadowed GL state, only touched on the thread that owns the context
+	GLStateCache gGLState;
+	bool gPrintGLStats = false;
+	bool gCpuMips = true;		// --no-cpu-mips, glGenerateMipmap instead of UBuildMipChain and its cache
+
+	// LOD selection: the coarsest LOD whose error projects to at most gLodPixelError pixels (--lod-error) is
+	// drawn. gLodProjection is pixels per unit at distance 1, set each frame, 0 keeps everything at LOD 0
+	float gLodPixelError = 1.0f;
+	float gLodProjection = 0.0f;
+
+	// meshlet culling (--no-meshlets turns it off): the surviving clusters of LOD 0 are drawn with one
+	// multi draw indirect per packet, the commands for the frame go through gIndirectRing
+	bool gMeshletCulling = true;
+	bool gMeshletCones = true;		// --no-meshlet-cones keeps back facing clusters, frustum only
+	std::vector<DrawIndirectCommand> gIndirectCommands;
+	PersistentRing gIndirectRing;
+	int gFrameCount = 0;
+	RenderStats gRenderStats;
+
+	// the cameras URender draws in one pass, --views overview or stereo (--eye-separation apart), culled against
+	// all of them together
+	ViewSet gViewSet;
+
+	// per object point light lists (--no-light-culling shades every light everywhere). A light stops at the
+	// distance where it's worth less than --light-threshold and an object keeps at most --max-object-lights of
+	// the ones that reach it. The desk lights are attenuated for a much bigger room, at one 8 bit step they'd
+	// reach 120 units and nothing would go. At 0.25 (of the light's summed peak, what actually lands is well
+	// under that) they reach about 12 units, the far corners drop off the small objects and a light only ever
+	// comes or goes for a whole object at once
+	bool gLightCulling = true;
+	float gLightThreshold = 0.25f;
+	int gMaxObjectLights = LightAssignment::MAX_OBJECT_LIGHTS;
+	LightAssignment gLightAssignment;
+
+	// threading. gCamera, gLastX/Y and gCameraSpeed belong to the simulation step, the render side
+	// only ever sees the FrameState snapshots
+	const double SIMULATION_STEP = 1.0 / 120.0;
+	bool gThreaded = true;
+	std::atomic<bool> gQuit{ false };
+	std::atomic<int> gExitCode{ EXIT_SUCCESS };
+	SpscQueue<InputEvent, 1024> gInputQueue;
+	std::vector<InputEvent> gInputBacklog;	// main thread only, what didn't fit in gInputQueue yet
+	TripleBuffer<FrameState> gFrameStates;
+	bool gHeldKeys[GLFW_KEY_LAST + 1] = {};
+	unsigned long long gSimTick = 0;
+	double gLatestInputTime = 0.0;
+	unsigned int gPickSerial = 0;		// clicks so far, the simulation stamps them into the snapshots
+	glm::vec2 gPickCursor(0.0f);
+	std::atomic<int> gFramebufferWidth{ WINDOW_WIDTH };
+	std::atomic<int> gFramebufferHeight{ WINDOW_HEIGHT };
+	int gViewportWidth = 0;		// 0 until the render side has sized its targets
+	int gViewportHeight = 0;
+
+	// --on-demand: only redraw when something marked the frame dirty, and let the simulation sleep while no
+	// input is coming in. gRedrawSignal wakes the render side, gInputSignal the simulation
+	bool gOnDemand = false;
+	WakeSignal gRedrawSignal;
+	WakeSignal gInputSignal;
+	glm::vec3 gPublishedPosition;
+	glm::vec3 gPublishedFront;
+	unsigned int gPublishedPickSerial = 0;
+
+	// clicking on the scene, see UPick. Only the render side touches the picker
+	ScenePicker gPicker;
+	unsigned int gHandledPickSerial = 0;
+
+	// frame pacing, --fps caps the rate, --late-input waits before building the frame instead of before the swap
+	FramePacer gPacer;
+	bool gPrintPacingStats = false;
+}
+
+bool UInitialize(int argc, char* argv[], GLFWwindow** window);
+void UResizeWindow(GLFWwindow* window, int width, int height);
+void UProcessInput(float deltaTime);
+void URender(const FrameState& frame);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void UDestroyShaderProgram(GLuint programId);
+bool UCreateProgram(const char* vtxShaderSource, const char* fragShaderSource, ProgramHandle& program);
+void UDestroyProgram(ProgramHandle& program);
+GLuint UProgramId(ProgramHandle program);
+void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
+void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UPick(const FrameState& frame);
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void UQueueInput(const InputEvent& event);
+bool UFlushInput();
+void USimulationThread();
+void URenderThread();
+void URenderFrame();
+void UInvalidate();
+bool UAnyKeyHeld();
+void UWindowRefreshCallback(GLFWwindow* window);
+bool UCreateTexture(const char* filename, TextureHandle& texture);
+void UDestroyTexture(TextureHandle& texture);
+GLuint UTextureId(TextureHandle texture);
+void UGpuBudgetExceeded(size_t usedBytes, size_t budgetBytes);
+void UDetachDrawIds(GLuint vao);
+bool UHasArg(int argc, char* argv[], const char* flag);
+float UArgFloat(int argc, char* argv[], const char* flag, float fallback);
+const char* UArgString(int argc, char* argv[], const char* flag, const char* fallback);
+void UBenchmarkNormalMatrix();
+void USetupSceneTransforms();
+void USetupMaterials();
+void UWriteInstances(const glm::mat4& viewProjection, InstanceData* instances, int objectCount);
+bool ULoadSoftwareTexture(const char* filename, SoftwareTexture& texture);
+void USetupOfflineScene(const Camera& camera, float aspect, SoftwareTexture* textures, std::vector<InstanceData>& instances, std::vector<DrawPacket>& packets);
+int USoftwareRender(int argc, char* argv[]);
+int UPathTrace(int argc, char* argv[]);
+int URunGoldenTests(const char* directory, int argc, char* argv[]);
+void URecordObjects(CommandBuffer& commands, const glm::mat4& view, int begin, int end);
+void UExecuteCommands(const std::vector<DrawPacket>& packets, GLuint programId);
+void UIssueDraw(const DrawPacket& packet, int views = 1);
+void URecordMeshlets(CommandBuffer& commands, const Meshes::GLMesh& mesh, int object, DrawPacket& packet);
+void URenderShadows();
+void UBenchmarkTransforms();
+float UTerrainHeight(float x, float z);
+void UBuildTerrainTile(float centerX, float centerZ, float size, int quads, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices);
+bool USetupStreaming(const char* directory, int argc, char* argv[]);
+bool UImportProp(const char* filename, const char* objectName, int lodLevels, float lodRatio, float lodMaxError);
+int UBenchmarkImport(int argc, char* argv[]);
+int UBakeLightmap(int argc, char* argv[]);
+bool ULoadLightmap(const char* filename);
+int UBenchmarkPicking(int argc, char* argv[]);
+int UBenchmarkStreaming(int argc, char* argv[]);
 // my favorite part. the part where we destroy it all
 
-const GLchar* vertexShaderSource = GLSL(440,
-	// https://stackoverflow.com/questions/43029936/how-to-write-basic-shader-in-glsl
-	layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec2 aTexCoords;
+const GLchar* vertexShaderSource = GLSL(440,
+	// https://stackoverflow.com/questions/43029936/how-to-write-basic-shader-in-glsl
+	layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 3) in uint aDrawId;	// picks this draw's row out of the instance buffer
+layout(location = 4) in vec2 aLightmapCoords;	// only the lightmapped meshes have it
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec2 LightmapCoords;
+flat out vec3 MeshColor;
+flat out uint InstanceFlags;
+flat out uvec2 InstanceLights;	// point light count, then the indices 4 bits each
+flat out int ViewIndex;
+
+// several views in one pass, see ViewSet. 1 (or unset) draws with the instance's mvp, more picks
+// viewProjections[gl_InstanceID] and moves it into viewRects[gl_InstanceID] (xy scale, zw offset)
+uniform int viewCount;
+uniform mat4 viewProjections[4];
+uniform vec4 viewRects[4];
+out float gl_ClipDistance[4];
+
+// written by TransformBatch, the normal matrix is computed once per object on the CPU instead of inverse() per vertex
+struct InstanceData {
+	mat4 model;
+	mat4 mvp;
+	vec4 normalMatrix[3];
+	vec4 color;
+	uvec4 flags;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+	InstanceData instances[];
+};
+
+void main()
+{
+	InstanceData instance = instances[aDrawId];
+
+	FragPos = vec3(instance.model * vec4(aPos, 1.0));
+	Normal = mat3(instance.normalMatrix[0].xyz, instance.normalMatrix[1].xyz, instance.normalMatrix[2].xyz) * aNormal;
+	TexCoords = aTexCoords;
+	LightmapCoords = aLightmapCoords;
+	MeshColor = instance.color.rgb;
+	InstanceFlags = instance.flags.x;
+	InstanceLights = instance.flags.yz;
+
+	if (viewCount > 1)
+	{
+		// clip to the view's own frustum first, its neighbours share the target
+		vec4 position = viewProjections[gl_InstanceID] * vec4(FragPos, 1.0);
+		gl_ClipDistance[0] = position.w + position.x;
+		gl_ClipDistance[1] = position.w - position.x;
+		gl_ClipDistance[2] = position.w + position.y;
+		gl_ClipDistance[3] = position.w - position.y;
+		position.xy = position.xy * viewRects[gl_InstanceID].xy + position.w * viewRects[gl_InstanceID].zw;
+		gl_Position = position;
+		ViewIndex = gl_InstanceID;
+	}
+	else
+	{
+		gl_Position = instance.mvp * vec4(aPos, 1.0);
+		ViewIndex = 0;
+	}
+}
+); // https://learnopengl.com/code_viewer_gh.php?code=src/2.lighting/6.multiple_lights/6.multiple_lights.vs
+
+// this was essentially a mixture of multiple rescources, though my last resource fixed a lot of the issues I was having
+
+/* Fragment Shader Source Code */
+const GLchar* fragmentShaderSource = GLSL(440,
+	out vec4 FragColor;
+
+struct Material {
+	sampler2D diffuse;
+	sampler2D specular;
+	float shininess;
+};
+
+struct DirLight {
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	float intensity;
+};
+
+struct PointLight {
+	vec3 position;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	float intensity;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+in vec2 LightmapCoords;
+
+uniform vec3 viewPos;
+uniform DirLight dirLight;
+uniform PointLight pointLights[5];
+uniform Material material;
+
+// directional light shadows, see ShadowCascades
+uniform sampler2DShadow shadowMaps[3];
+uniform mat4 lightSpace[3];
+uniform vec3 cascadeSplits;
+uniform vec3 viewForward;
+
+flat in vec3 MeshColor;
+flat in uint InstanceFlags;
+flat in uvec2 InstanceLights;
+flat in int ViewIndex;
+
+// each view's eye for the specular, viewPos stays the camera the shadow cascades were fitted to
+uniform vec3 viewPositions[4];
+
+uniform bool hasTextureTransparency;
+
+// baked lighting for the static objects, see Lightmap
+uniform sampler2D lightmap;
+
+// per object, filled in from the instance data at the top of main
+bool hasTexture;
+vec3 meshColor;
+
+// function prototypes
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+float ShadowFactor(vec3 fragPos);
+float SampleShadow(sampler2DShadow shadowMap, mat4 lightMatrix, vec3 fragPos);
+
+
+void main()
+{
+	hasTexture = (InstanceFlags & 1u) != 0u;
+	meshColor = MeshColor;
+
+	// baked objects: every light's diffuse part is already in the lightmap, one fetch instead of the light loop
+	if ((InstanceFlags & 2u) != 0u)
+	{
+		vec3 albedo = hasTexture ? vec3(texture(material.diffuse, TexCoords)) : meshColor;
+		FragColor = vec4(albedo * texture(lightmap, LightmapCoords).rgb, 1.0);
+		return;
+	}
+
+	vec3 norm = normalize(Normal);
+	vec3 viewDir = normalize(viewPositions[ViewIndex] - FragPos);
+
+
+	// only the point lights that reach this object, see LightAssignment
+	vec3 result = CalcDirLight(dirLight, norm, viewDir);
+	for (uint i = 0u; i < InstanceLights.x; i++)
+	{
+		result += CalcPointLight(pointLights[(InstanceLights.y >> (4u * i)) & 15u], norm, FragPos, viewDir);
+	}
+
+	if (hasTextureTransparency)
+		FragColor = vec4(result, texture(material.diffuse, TexCoords).a);
+	else
+		FragColor = vec4(result, 1.0);
+
+}
+// calculates the color when using a directional light.
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+{
+	vec3 lightDir = normalize(-light.direction);
+	// diffuse shading
+	float diff = max(dot(normal, lightDir), 0.0);
+	// specular shading
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+	// combine results
+
+	vec3 texColor;
+
+	if (hasTexture)
+		texColor = vec3(texture(material.diffuse, TexCoords));
+	else
+		texColor = meshColor;
+
+	vec3 ambient = light.ambient * texColor;
+	vec3 diffuse = light.diffuse * diff * texColor;
+	vec3 specular = light.specular * spec * vec3(0.5, 0.5, 0.5);
+
+	// only the direct part is shadowed
+	float lit = ShadowFactor(FragPos);
+	return (ambient + lit * (diffuse + specular)) * light.intensity;
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+	vec3 lightDir = normalize(light.position - fragPos);
+	// diffuse shading
+	float diff = max(dot(normal, lightDir), 0.0);
+	// specular shading
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+	// attenuation
+	float distance = length(light.position - fragPos);
+	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+	vec3 texColor;
+
+	if (hasTexture)
+		texColor = vec3(texture(material.diffuse, TexCoords));
+	else
+		texColor = meshColor;
+
+	// combine results
+	vec3 ambient = light.ambient * texColor;
+	vec3 diffuse = light.diffuse * diff * texColor;
+	vec3 specular = light.specular * spec;
+	ambient *= attenuation;
+	diffuse *= attenuation;
+	specular *= attenuation;
+	return (ambient + diffuse + specular) * light.intensity;
+}
+
+// picks the cascade by view depth and does a 3x3 PCF lookup, 1 is fully lit
+float ShadowFactor(vec3 fragPos)
+{
+	float depth = dot(fragPos - viewPos, viewForward);
+	if (depth < cascadeSplits.x)
+		return SampleShadow(shadowMaps[0], lightSpace[0], fragPos);
+	if (depth < cascadeSplits.y)
+		return SampleShadow(shadowMaps[1], lightSpace[1], fragPos);
+	if (depth < cascadeSplits.z)
+		return SampleShadow(shadowMaps[2], lightSpace[2], fragPos);
+	return 1.0;
+}
+
+float SampleShadow(sampler2DShadow shadowMap, mat4 lightMatrix, vec3 fragPos)
+{
+	vec4 lightPos = lightMatrix * vec4(fragPos, 1.0);
+	vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+	if (coords.x < 0.0 || coords.x > 1.0 || coords.y < 0.0 || coords.y > 1.0 || coords.z > 1.0)
+		return 1.0;
+
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0));
+	float lit = 0.0;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+			lit += texture(shadowMap, vec3(coords.xy + vec2(x, y) * texel, coords.z - 0.0005));
+	}
+	return lit / 9.0;
+}
+);
+
+// tiny program that gets compiled synchronously at startup so there's always something to draw with
+const GLchar* fallbackVertexShaderSource = GLSL(440,
+	layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 3) in uint aDrawId;
+
+out vec3 Normal;
+
+struct InstanceData {
+	mat4 model;
+	mat4 mvp;
+	vec4 normalMatrix[3];
+	vec4 color;
+	uvec4 flags;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+	InstanceData instances[];
+};
+
+void main()
+{
+	InstanceData instance = instances[aDrawId];
+	Normal = mat3(instance.normalMatrix[0].xyz, instance.normalMatrix[1].xyz, instance.normalMatrix[2].xyz) * aNormal;
+	gl_Position = instance.mvp * vec4(aPos, 1.0);
+}
+);
+
+const GLchar* fallbackFragmentShaderSource = GLSL(440,
+	out vec4 FragColor;
+
+in vec3 Normal;
+
+void main()
+{
+	// plain grey with a fixed light so the shapes still read
+	float diff = max(dot(normalize(Normal), normalize(vec3(0.2, 1.0, 0.3))), 0.0);
+	FragColor = vec4(vec3(0.5) * (0.4 + 0.6 * diff), 1.0);
+}
+);
+
+// depth only program for the shadow cascades, built at startup with the fallback
+const GLchar* shadowVertexShaderSource = GLSL(440,
+	layout(location = 0) in vec3 aPos;
+layout(location = 3) in uint aDrawId;
+
+struct InstanceData {
+	mat4 model;
+	mat4 mvp;
+	vec4 normalMatrix[3];
+	vec4 color;
+	uvec4 flags;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+	InstanceData instances[];
+};
+
+uniform mat4 lightViewProjection;
+
+void main()
+{
+	gl_Position = lightViewProjection * instances[aDrawId].model * vec4(aPos, 1.0);
+}
+);
+
+const GLchar* shadowFragmentShaderSource = GLSL(440,
+	void main()
+{
+}
+);
+
+// fullscreen upscale of the dynamic resolution target with a light unsharp mask
+const GLchar* upscaleVertexShaderSource = GLSL(440,
+	out vec2 uv;
+
+void main()
+{
+	// one triangle that covers the screen, no vertex buffer needed
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	uv = position;
+	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
+);
+
+const GLchar* upscaleFragmentShaderSource = GLSL(440,
+	out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D sceneColor;
+uniform vec3 uvScale;	// xy is the part of the target that was rendered this frame
+uniform float sharpness;
+
+vec3 Tap(vec2 coords)
+{
+	// stay inside the rendered corner so the unused part of the target never bleeds in
+	vec2 texel = 1.0 / vec2(textureSize(sceneColor, 0));
+	return texture(sceneColor, clamp(coords, texel * 0.5, uvScale.xy - texel * 0.5)).rgb;
+}
+
+void main()
+{
+	vec2 texel = 1.0 / vec2(textureSize(sceneColor, 0));
+	vec2 coords = uv * uvScale.xy;
+
+	vec3 center = Tap(coords);
+	vec3 blur = (Tap(coords + vec2(texel.x, 0.0)) + Tap(coords - vec2(texel.x, 0.0)) +
+		Tap(coords + vec2(0.0, texel.y)) + Tap(coords - vec2(0.0, texel.y))) * 0.25;
+
+	FragColor = vec4(clamp(center + (center - blur) * sharpness, 0.0, 1.0), 1.0);
+}
+);
+
+int main(int argc, char* argv[])
+{
+	// UWriteInstances builds the light lists for every renderer, so these come before the CPU only paths
+	gLightCulling = !UHasArg(argc, argv, "--no-light-culling");
+	gLightThreshold = std::max(UArgFloat(argc, argv, "--light-threshold", gLightThreshold), 0.0f);
+	gMaxObjectLights = std::min(std::max((int)UArgFloat(argc, argv, "--max-object-lights", (float)gMaxObjectLights), 0), LightAssignment::MAX_OBJECT_LIGHTS);
+
+	// CPU only, never opens a window
+	if (UHasArg(argc, argv, "--software-render"))
+		return USoftwareRender(argc, argv);
+	if (UHasArg(argc, argv, "--path-trace"))
+		return UPathTrace(argc, argv);
+	if (UHasArg(argc, argv, "--bench-import"))
+		return UBenchmarkImport(argc, argv);
+	if (UHasArg(argc, argv, "--bake-lightmap"))
+		return UBakeLightmap(argc, argv);
+	if (UHasArg(argc, argv, "--bench-picking"))
+		return UBenchmarkPicking(argc, argv);
+	if (UHasArg(argc, argv, "--bench-streaming"))
+		return UBenchmarkStreaming(argc, argv);
+
+	if (!UInitialize(argc, argv, &gWindow))
+		return EXIT_FAILURE;
+
+	glfwSetCursorPosCallback(gWindow, UMousePositionCallback);
+
+	// Set the mouse scroll callback
+	glfwSetScrollCallback(gWindow, UMouseScrollCallback);
+	glfwSetKeyCallback(gWindow, UKeyCallback);
+	glfwSetMouseButtonCallback(gWindow, UMouseButtonCallback);
+	glfwSetWindowRefreshCallback(gWindow, UWindowRefreshCallback);
+	glfwSetInputMode(gWindow, GLFW_STICKY_KEYS, GLFW_TRUE);
+	gThreaded = !UHasArg(argc, argv, "--no-threads");
+	gPrintGLStats = UHasArg(argc, argv, "--gl-stats");
+	gFrameBudgetMs = UArgFloat(argc, argv, "--frame-budget", gFrameBudgetMs);
+	gOnDemand = UHasArg(argc, argv, "--on-demand");
+	gPrintPacingStats = UHasArg(argc, argv, "--pacing-stats");
+	if (UHasArg(argc, argv, "--swap-interval"))
+		glfwSwapInterval((int)UArgFloat(argc, argv, "--swap-interval", 1.0f));
+	gGpuMemory.SetBudget((size_t)(UArgFloat(argc, argv, "--gpu-budget", 256.0f) * 1024 * 1024), UGpuBudgetExceeded);
+
+	// the golden runs need the same work every time: one thread, full resolution, no vsync
+	const char* goldenDirectory = UArgString(argc, argv, "--golden", nullptr);
+	if (goldenDirectory)
+	{
+		gThreaded = false;
+		gFrameBudgetMs = 1e6f;
+		glfwSwapInterval(0);
+	}
+
+	// the framebuffer can be bigger than the window on high dpi screens
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(gWindow, &framebufferWidth, &framebufferHeight);
+	gFramebufferWidth = framebufferWidth;
+	gFramebufferHeight = framebufferHeight;
+	meshes.CreateMeshes();
+
+	// the fallback is small enough to build right away, the real program compiles while the textures load
+	if (!UCreateProgram(fallbackVertexShaderSource, fallbackFragmentShaderSource, gFallbackProgram))
+		return EXIT_FAILURE;
+
+	if (UHasArg(argc, argv, "--bench-transforms"))
+	{
+		UBenchmarkTransforms();
+		meshes.DestroyMeshes();
+		UDestroyProgram(gFallbackProgram);
+		glfwTerminate();
+		return EXIT_SUCCESS;
+	}
+
+	if (UHasArg(argc, argv, "--bench-normals"))
+	{
+		UBenchmarkNormalMatrix();
+		meshes.DestroyMeshes();
+		UDestroyProgram(gFallbackProgram);
+		glfwTerminate();
+		return EXIT_SUCCESS;
+	}
+
+	gShaderBuilder.Initialize();
+	gSceneProgram = gShaderBuilder.Submit("scene", vertexShaderSource, fragmentShaderSource);
+
+	if (!UCreateProgram(shadowVertexShaderSource, shadowFragmentShaderSource, gShadowProgram))
+		return EXIT_FAILURE;
+	gShadows.Initialize(SHADOW_RESOLUTIONS, SHADOW_DISTANCE);
+
+	if (!UCreateProgram(upscaleVertexShaderSource, upscaleFragmentShaderSource, gUpscaleProgram))
+		return EXIT_FAILURE;
+	gDynamicResolution.Initialize(gFrameBudgetMs);
+	gPacer.Initialize(UArgFloat(argc, argv, "--fps", 0.0f), UHasArg(argc, argv, "--late-input"));
+
+	// --views draws more than one camera, each draw is instanced once per view
+	const char* viewLayout = UArgString(argc, argv, "--views", "single");
+	float eyeSeparation = UArgFloat(argc, argv, "--eye-separation", 0.25f);
+	if (strcmp(viewLayout, "overview") == 0)
+		gViewSet.SetLayout(ViewSet::LAYOUT_OVERVIEW, eyeSeparation);
+	else if (strcmp(viewLayout, "stereo") == 0)
+		gViewSet.SetLayout(ViewSet::LAYOUT_STEREO, eyeSeparation);
+	else if (strcmp(viewLayout, "single") != 0)
+		std::cout << "ERROR::VIEWS::UNKNOWN_LAYOUT " << viewLayout << ", drawing the single view" << std::endl;
+
+	// per object transforms live in the batch, every mesh VAO gets the draw id attribute that indexes it
+	gTransforms.Initialize();
+	gTransforms.SetViewsPerDraw(gViewSet.Count());
+	meshes.SetVaoDeletedCallback(UDetachDrawIds);
+	gInstanceRing.Initialize(GL_SHADER_STORAGE_BUFFER, sizeof(InstanceData) * 1024);
+	gIndirectRing.Initialize(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawIndirectCommand) * 4096);
+	USetupSceneTransforms();
+	for (int i = 0; i < meshes.Pool().Count(); i++)
+		gTransforms.AttachDrawIds(meshes.Pool().At(i).vao);
+
+
+	// recording workers, leave a core each for the simulation and render threads, the texture loads use them too
+	int hardwareThreads = (int)std::thread::hardware_concurrency();
+	gWorkers.Initialize(gThreaded ? std::max(hardwareThreads - 3, 0) : 0);
+	gCommandBuffers.resize(gWorkers.ThreadCount());
+
+	gCpuMips = !UHasArg(argc, argv, "--no-cpu-mips");
+
+	// Load textures
+	// bind textures on corresponding texture units
+	glActiveTexture(GL_TEXTURE0);
+
+
+	// Load and bind desk texture
+	if (!UCreateTexture("Textures/table-wood.jpg", gTextureDesk)) {
+		std::cerr << "Failed to load desk texture" << std::endl;
+		// Handle error gracefully
+	}
+	// Load and bind mug texture
+	if (!UCreateTexture("Textures/cracked-white.jpg", gTextureMug)) {
+		std::cerr << "Failed to load mug texture" << std::endl;
+		// Handle error gracefully
+	}
+	// Load and bind botcap texture
+	if (!UCreateTexture("Textures/black-pin.jpg", gTextureBotCap)) {
+		std::cerr << "Failed to load botcap texture" << std::endl;
+		// Handle error gracefully
+	}
+	// Load and bind penbod texture
+	if (!UCreateTexture("Textures/pink-dot.jpg", gTexturePenBod)) {
+		std::cerr << "Failed to load penbod texture" << std::endl;
+		// Handle error gracefully
+	}
+	// Load and bund bottle texture
+	if (!UCreateTexture("Textures/sup-reme.jpg", gTextureBottl)) {
+		std::cerr << "failed to get the bottle texture bruh" << std::endl;
+	}
+	// Load and bund container texture
+	if (!UCreateTexture("Textures/aspire-logo.jpg", gTextureCon)) {
+		std::cerr << "failed to get the container texture" << std::endl;
+	}
+
+	
+	USetupMaterials();
+	if (const char* streamDirectory = UArgString(argc, argv, "--stream", nullptr))
+	{
+		if (!USetupStreaming(streamDirectory, argc, argv))
+			return EXIT_FAILURE;
+	}
+
+	// LOD chains for everything built in so far, --no-lod draws the full meshes
+	int lodLevels = UHasArg(argc, argv, "--no-lod") ? 0 : std::max((int)UArgFloat(argc, argv, "--lod-levels", 4.0f), 0);
+	float lodRatio = UArgFloat(argc, argv, "--lod-ratio", 0.5f);
+	float lodMaxError = UArgFloat(argc, argv, "--lod-max-error", 0.05f);
+	gLodPixelError = UArgFloat(argc, argv, "--lod-error", gLodPixelError);
+	if (lodLevels > 0)
+		meshes.BuildLods(gWorkers, lodLevels, lodRatio, lodMaxError);
+	gMeshletCulling = !UHasArg(argc, argv, "--no-meshlets");
+	gMeshletCones = !UHasArg(argc, argv, "--no-meshlet-cones");
+	if (const char* importFile = UArgString(argc, argv, "--import", nullptr))
+		UImportProp(importFile, UArgString(argc, argv, "--import-object", "mug"), lodLevels, lodRatio, lodMaxError);
+
+	// meshlets for the big built in meshes (the import has its own), --no-meshlets draws them whole
+	if (gMeshletCulling)
+	{
+		meshes.BuildMeshlets(gWorkers, std::max((int)UArgFloat(argc, argv, "--meshlet-min-triangles", 1024.0f), 1));
+		int meshletCount = 0;
+		for (int i = 0; i < meshes.Pool().Count(); i++)
+			meshletCount += (int)meshes.Pool().At(i).meshlets.size();
+		std::cout << "INFO: Meshlets built " << meshletCount << std::endl;
+	}
+	if (const char* lightmapFile = UArgString(argc, argv, "--lightmap", nullptr))
+		ULoadLightmap(lightmapFile);
+
+
+
+
+
+	if (goldenDirectory)
+	{
+		// straight on to cleanup afterwards
+		gExitCode = URunGoldenTests(goldenDirectory, argc, argv);
+		glfwSetWindowShouldClose(gWindow, GLFW_TRUE);
+	}
+
+	// first snapshot so the render side has a camera before the first tick
+	gFrameStates.WriteSlot().camera = gCamera;
+	gFrameStates.Publish();
+	gPublishedPosition = gCamera.Position;
+	gPublishedFront = gCamera.Front;
+	UInvalidate();
+
+	// the render thread takes the context from here on
+	glfwMakeContextCurrent(nullptr);
+
+	std::thread simulationThread;
+	std::thread renderThread;
+	if (gThreaded)
+	{
+		simulationThread = std::thread(USimulationThread);
+		renderThread = std::thread(URenderThread);
+
+		// the main thread just pumps window events, the callbacks feed the input queue. With a backlog it
+		// comes back every millisecond to push more of it through even if no new events arrive
+		while (!glfwWindowShouldClose(gWindow))
+		{
+			if (UFlushInput())
+				glfwWaitEvents();
+			else
+				glfwWaitEventsTimeout(0.001);
+		}
+
+		gQuit = true;
+		gInputSignal.Notify();
+		gRedrawSignal.Notify();
+		simulationThread.join();
+		renderThread.join();
+	}
+	else
+	{
+		// --no-threads: same fixed step simulation and the same snapshot, just all on this thread
+		glfwMakeContextCurrent(gWindow);
+		double accumulator = 0.0;
+		double lastTime = glfwGetTime();
+
+		while (!glfwWindowShouldClose(gWindow) && gExitCode == EXIT_SUCCESS)
+		{
+			// late input waits out the frame before sampling anything
+			if (gPacer.LateInput())
+				gPacer.Wait();
+
+			// on demand and idle: block for events, waking now and then for async shader builds
+			if (gOnDemand && !UAnyKeyHeld() && !gRedrawSignal.Pending())
+				glfwWaitEventsTimeout(0.1);
+			else
+				glfwPollEvents();
+			UFlushInput();
+
+			// don't try to catch up on the whole time spent blocked
+			double currentTime = glfwGetTime();
+			accumulator = std::min(accumulator + currentTime - lastTime, 0.25);
+			lastTime = currentTime;
+			while (accumulator >= SIMULATION_STEP)
+			{
+				UProcessInput((float)SIMULATION_STEP);
+				accumulator -= SIMULATION_STEP;
+			}
+
+			URenderFrame();
+		}
+		glfwMakeContextCurrent(nullptr);
+	}
+
+	glfwMakeContextCurrent(gWindow);
+
+	//destroying textures
+	gStreamer.Destroy();
+	meshes.DestroyMeshes();
+	UDestroyTexture(gTextureDesk);
+	UDestroyTexture(gTextureMug);
+	UDestroyTexture(gTextureBotCap);
+	UDestroyTexture(gTexturePenBod);
+	UDestroyTexture(gTextureBottl);
+	UDestroyTexture(gTextureCon);
+	UDestroyTexture(gLightmapTexture);
+
+	gWorkers.Destroy();
+	gShadows.Destroy();
+	UDestroyProgram(gShadowProgram);
+	gDynamicResolution.Destroy();
+	UDestroyProgram(gUpscaleProgram);
+	gPacer.Destroy();
+	if (gPrintPacingStats)
+		gPacer.Report();
+	gInstanceRing.Destroy();
+	gIndirectRing.Destroy();
+	gTransforms.Destroy();
+	gShaderBuilder.Destroy();
+	UDestroyProgram(gFallbackProgram);
+
+	// everything above should have given its GPU memory back by now
+	gGpuMemory.ReportLeaks();
+
+	glfwTerminate();
+	return gExitCode;
+}
+
+
+bool UInitialize(int argc, char* argv[], GLFWwindow** window)
+{
+	glfwSetCursorPosCallback(*window, UMousePositionCallback);
+	glfwSetScrollCallback(*window, UMouseScrollCallback);
+
+
+	if (!glfwInit())
+	{
+		std::cerr << "Failed to initialize GLFW" << std::endl;
+		return false;
+	}
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+	// the golden runs don't need to show anything
+	if (UHasArg(argc, argv, "--golden"))
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, nullptr, nullptr);
+	if (*window == nullptr)
+	{
+		std::cerr << "Failed to create GLFW window" << std::endl;
+		glfwTerminate();
+		return false;
+	}
+
+	glfwMakeContextCurrent(*window);
+	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		std::cerr << "Failed to initialize GLEW" << std::endl;
+		glfwTerminate();
+		return false;
+	}
+
+	if (glfwGetCurrentContext() == nullptr)
+	{
+		std::cerr << "Failed to create OpenGL context" << std::endl;
+		glfwTerminate();
+		return false;
+	}
+
+	std::cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
+	return true;
+
+}
+
+
+
+// one simulation tick: drain the input queue, move the camera for any held keys, publish the snapshot
+void UProcessInput(float deltaTime)
+{
+	InputEvent event;
+	while (gInputQueue.Pop(event))
+	{
+		gLatestInputTime = std::max(gLatestInputTime, event.time);
+
+		switch (event.type)
+		{
+		case InputEvent::KEY:
+			if (event.key >= 0 && event.key <= GLFW_KEY_LAST)
+				gHeldKeys[event.key] = event.action == GLFW_PRESS;
+			break;
+
+		case InputEvent::MOUSE_MOVE:
+			if (gFirstMouse)
+			{
+				gLastX = event.x;
+				gLastY = event.y;
+				gFirstMouse = false;
+			}
+			gCamera.ProcessMouseMovement(event.x - gLastX, gLastY - event.y);
+			gLastX = event.x;
+			gLastY = event.y;
+			break;
+
+		case InputEvent::SCROLL:
+			if (event.y > 0.0)
+				gCameraSpeed *= 2.1f;
+			else if (event.y < 0.0)
+				gCameraSpeed /= 1.1f;
+			break;
+
+		case InputEvent::MOUSE_BUTTON:
+			if (event.key == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_PRESS)
+			{
+				gPickSerial++;
+				gPickCursor = glm::vec2((float)event.x, (float)event.y);
+			}
+			break;
+		}
+	}
+
+	// WASD, a held key counts as input sampled this tick
+	float cameraOffset = gCameraSpeed * deltaTime;
+	if (UAnyKeyHeld())
+		gLatestInputTime = glfwGetTime();
+
+	if (gHeldKeys[GLFW_KEY_W])
+		gCamera.ProcessInput(FORWARD, cameraOffset);
+	if (gHeldKeys[GLFW_KEY_S])
+		gCamera.ProcessInput(BACKWARD, cameraOffset);
+	if (gHeldKeys[GLFW_KEY_A])
+		gCamera.ProcessInput(LEFT, cameraOffset);
+	if (gHeldKeys[GLFW_KEY_D])
+		gCamera.ProcessInput(RIGHT, cameraOffset);
+	if (gHeldKeys[GLFW_KEY_Q])
+		gCamera.ProcessInput(UP, cameraOffset);
+	if (gHeldKeys[GLFW_KEY_E])
+		gCamera.ProcessInput(DOWN, cameraOffset);
+	// not much change from what I had previously built
+
+	// only hand over a new snapshot when the camera moved or there's a click, that's what marks the frame dirty
+	gSimTick++;
+	if (gCamera.Position != gPublishedPosition || gCamera.Front != gPublishedFront || gPickSerial != gPublishedPickSerial)
+	{
+		FrameState& frame = gFrameStates.WriteSlot();
+		frame.camera = gCamera;
+		frame.simTick = gSimTick;
+		frame.inputTime = gLatestInputTime;
+		frame.pickSerial = gPickSerial;
+		frame.pickCursor = gPickCursor;
+		gFrameStates.Publish();
+
+		gPublishedPosition = gCamera.Position;
+		gPublishedFront = gCamera.Front;
+		gPublishedPickSerial = gPickSerial;
+		UInvalidate();
+	}
+}
+
+bool UAnyKeyHeld()
+{
+	for (bool held : gHeldKeys)
+	{
+		if (held)
+			return true;
+	}
+	return false;
+}
+
+// anything that changes what's on screen calls this
+void UInvalidate()
+{
+	gRedrawSignal.Notify();
+}
+
+
+
+// callbacks run on the main thread, they only record what happened and leave the rest to the simulation
+void UResizeWindow(GLFWwindow* window, int width, int height)
+{
+	gFramebufferWidth = width;
+	gFramebufferHeight = height;
+	UInvalidate();
+}
+
+// the window system lost the contents (uncovered, restored), needs a redraw even with nothing changed
+void UWindowRefreshCallback(GLFWwindow* window)
+{
+	UInvalidate();
+}
+
+void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+{
+	UQueueInput({ InputEvent::MOUSE_MOVE, 0, 0, xpos, ypos, glfwGetTime() });
+
+	// https://stackoverflow.com/questions/66823783/toggle-between-ortho-and-perspective-views-in-opengl
+}
+
+void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+{
+	UQueueInput({ InputEvent::SCROLL, 0, 0, xoffset, yoffset, glfwGetTime() });
+}
+
+// the cursor goes along as a fraction of the window, the framebuffer can be a different size on high dpi screens
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+	double x, y;
+	int width, height;
+	glfwGetCursorPos(window, &x, &y);
+	glfwGetWindowSize(window, &width, &height);
+	if (width <= 0 || height <= 0)
+		return;
+	UQueueInput({ InputEvent::MOUSE_BUTTON, button, action, x / width, y / height, glfwGetTime() });
+}
+
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+		glfwSetWindowShouldClose(window, true);
+
+	// live GPU memory breakdown
+	if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+		gGpuMemory.PrintBreakdown();
+
+	if (action != GLFW_REPEAT)
+		UQueueInput({ InputEvent::KEY, key, action, 0.0, 0.0, glfwGetTime() });
+}
+
+// when the simulation falls behind and the queue fills up nothing gets dropped, a lost key release would
+// leave the key held. The overflow waits in gInputBacklog in order, a mouse move folded into the one before
+// when they're back to back (they carry absolute positions, only the last one matters), everything else kept
+void UQueueInput(const InputEvent& event)
+{
+	if (UFlushInput() && gInputQueue.Push(event))
+	{
+		gInputSignal.Notify();
+		return;
+	}
+
+	if (event.type == InputEvent::MOUSE_MOVE && !gInputBacklog.empty() && gInputBacklog.back().type == InputEvent::MOUSE_MOVE)
+		gInputBacklog.back() = event;
+	else
+		gInputBacklog.push_back(event);
+	gInputSignal.Notify();
+}
+
+// moves as much of the backlog into the queue as fits, true once it's all through
+bool UFlushInput()
+{
+	size_t moved = 0;
+	while (moved < gInputBacklog.size() && gInputQueue.Push(gInputBacklog[moved]))
+		moved++;
+	gInputBacklog.erase(gInputBacklog.begin(), gInputBacklog.begin() + moved);
+	if (moved > 0)
+		gInputSignal.Notify();
+	return gInputBacklog.empty();
+}
+
+// fixed timestep loop, owns gCamera and publishes a snapshot of it every tick
+void USimulationThread()
+{
+	auto nextTick = std::chrono::steady_clock::now();
+	const auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIMULATION_STEP));
+
+	while (!gQuit)
+	{
+		UProcessInput((float)SIMULATION_STEP);
+
+		// on demand with nothing held down, sleep until the next input event instead of ticking
+		if (gOnDemand && !UAnyKeyHeld())
+		{
+			gInputSignal.WaitFor(std::chrono::milliseconds(250));
+			gInputSignal.Consume();
+			nextTick = std::chrono::steady_clock::now();
+			continue;
+		}
+
+		nextTick += step;
+		std::this_thread::sleep_until(nextTick);
+	}
+}
+
+// owns the GL context while the threads are running and draws whatever the newest snapshot is
+void URenderThread()
+{
+	glfwMakeContextCurrent(gWindow);
+
+	while (!gQuit)
+	{
+		// on demand, sleep until something invalidates the frame. the timeout keeps async shader builds polled
+		if (gOnDemand)
+			gRedrawSignal.WaitFor(std::chrono::milliseconds(100));
+		URenderFrame();
+	}
+
+	glfwMakeContextCurrent(nullptr);
+}
+
+void URenderFrame()
+{
+	// pick up any programs the driver finished since last frame, the scene looks different once one lands
+	if (gShaderBuilder.Poll())
+		UInvalidate();
+	if (gShaderBuilder.HasFailed(gSceneProgram))
+	{
+		gExitCode = EXIT_FAILURE;
+		glfwSetWindowShouldClose(gWindow, true);
+		glfwPostEmptyEvent();	// wake the main thread out of glfwWaitEvents
+		return;
+	}
+
+	// resizes come in on the main thread, the targets have to be resized where the context is
+	int width = gFramebufferWidth;
+	int height = gFramebufferHeight;
+	if (width == 0 || height == 0)
+	{
+		// minimized, nothing to draw into
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		return;
+	}
+	if (width != gViewportWidth || height != gViewportHeight)
+	{
+		gDynamicResolution.Resize(width, height);
+		gViewportWidth = width;
+		gViewportHeight = height;
+	}
+
+	if (gOnDemand && !gRedrawSignal.Consume())
+		return;
+
+	// late input: wait first, then build from the newest snapshot and present right away.
+	// otherwise the frame is built first and the wait goes just before the swap
+	if (gPacer.LateInput() && gThreaded)
+		gPacer.Wait();
+
+	const FrameState& frame = gFrameStates.Read();
+	URender(frame);
+
+	if (!gPacer.LateInput())
+		gPacer.Wait();
+	glfwSwapBuffers(gWindow);
+	gPacer.MarkPresent(frame.inputTime);
+}
+
+void URender(const FrameState& frame)
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+
+	gGLState.BeginFrame();
+	gDynamicResolution.BeginFrame();
+	gRenderStats = RenderStats();
+
+	// streamed geometry first, uploads and evictions bind things behind the state cache's back
+	if (gStreamer.ChunkCount() > 0 && gStreamer.Update(frame.camera.Position))
+	{
+		gGLState.Invalidate();
+		gStaticSceneVersion++;
+	}
+
+	// Enable z-depth
+	gGLState.Enable(GL_DEPTH_TEST);
+
+	// Sets the background color of the window to black, the scene target gets cleared with it
+	gGLState.ClearColor(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	// camera/view transformation, from the simulation's latest snapshot
+	view = frame.camera.GetViewMatrix();
+
+	// Creates an perspective projection
+	// aspect from the actual framebuffer, the render scale doesn't change it
+	float aspect = (GLfloat)gViewportWidth / (GLfloat)gViewportHeight;
+	projection = glm::perspective(glm::radians(60.0f), aspect, 0.1f, 100.0f);
+	gLodProjection = gViewportHeight / (2.0f * std::tan(glm::radians(60.0f) * 0.5f));
+	gViewSet.Update(frame.camera, glm::radians(60.0f), aspect, 0.1f, 100.0f);
+	if (frame.pickSerial != gHandledPickSerial)
+		UPick(frame);
+
+	// refit the shadow cascades, their caches only go stale when they actually have to move
+	gShadows.Update(frame.camera, glm::radians(60.0f), aspect, gDirLight.direction, gStaticSceneVersion);
+
+	// Set the shader to be used, the fallback until the scene program has finished compiling
+	GLuint programId = gShaderBuilder.Get(gSceneProgram, UProgramId(gFallbackProgram));
+	gGLState.UseProgram(programId);
+
+	gGLState.SetUniform3f(programId, "viewPos", frame.camera.Position);
+	gGLState.SetUniform1i(programId, "viewCount", gViewSet.Count());
+	for (int v = 0; v < gViewSet.Count(); v++)
+	{
+		std::string index = "[" + std::to_string(v) + "]";
+		gGLState.SetUniformMatrix4f(programId, ("viewProjections" + index).c_str(), gViewSet.Get(v).viewProjection);
+		gGLState.SetUniform4f(programId, ("viewRects" + index).c_str(), gViewSet.ClipRect(v));
+		gGLState.SetUniform3f(programId, ("viewPositions" + index).c_str(), gViewSet.Get(v).camera.Position);
+	}
+
+	gGLState.SetUniform1i(programId, "material.diffuse", 0);
+	gGLState.SetUniform1f(programId, "material.shininess", MATERIAL_SHININESS);
+
+
+	// directional light
+	// this is literally from the first assignment - https://learnopengl.com/Lighting/Light-casters
+	// directional - point came from a couple sources - https://www.reddit.com/r/opengl/comments/321c5r/gluniform3fv_vec3_myarray_and_confusion/
+	// https://glm.g-truc.net/0.9.2/api/a00001.html
+	// https://learnopengl.com/code_viewer.php?code=lighting%2Fmultiple_lights - just needed to slightly tweak based off the code found here
+
+	gGLState.SetUniform3f(programId, "dirLight.direction", gDirLight.direction);
+	gGLState.SetUniform3f(programId, "dirLight.ambient", gDirLight.ambient);
+	gGLState.SetUniform3f(programId, "dirLight.diffuse", gDirLight.diffuse);
+	gGLState.SetUniform3f(programId, "dirLight.specular", gDirLight.specular);
+	gGLState.SetUniform1f(programId, "dirLight.intensity", gDirLight.intensity);
+
+	// cascade maps live on texture units 1 to CASCADE_COUNT
+	for (int c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		std::string index = "[" + std::to_string(c) + "]";
+		gGLState.SetUniform1i(programId, ("shadowMaps" + index).c_str(), 1 + c);
+		gGLState.SetUniformMatrix4f(programId, ("lightSpace" + index).c_str(), gShadows.LightViewProjection(c));
+	}
+	gGLState.SetUniform1i(programId, "lightmap", 1 + ShadowCascades::CASCADE_COUNT);
+	gGLState.SetUniform3f(programId, "cascadeSplits", glm::vec3(gShadows.SplitDistance(0), gShadows.SplitDistance(1), gShadows.SplitDistance(2)));
+	gGLState.SetUniform3f(programId, "viewForward", frame.camera.Front);
+
+
+
+	// point lights, the table in gPointLights
+	for (int i = 0; i < POINT_LIGHT_COUNT; i++)
+	{
+		const PointLight& light = gPointLights[i];
+		std::string name = "pointLights[" + std::to_string(i) + "].";
+		gGLState.SetUniform3f(programId, (name + "position").c_str(), light.position);
+		gGLState.SetUniform3f(programId, (name + "ambient").c_str(), light.ambient);
+		gGLState.SetUniform3f(programId, (name + "diffuse").c_str(), light.diffuse);
+		gGLState.SetUniform3f(programId, (name + "specular").c_str(), light.specular);
+		gGLState.SetUniform1f(programId, (name + "constant").c_str(), light.constant);
+		gGLState.SetUniform1f(programId, (name + "linear").c_str(), light.linear);
+		gGLState.SetUniform1f(programId, (name + "quadratic").c_str(), light.quadratic);
+		gGLState.SetUniform1f(programId, (name + "intensity").c_str(), light.intensity);
+	}
+
+
+	gGLState.SetUniform1i(programId, "hasTextureTransparency", 0);
+
+	// instance data written straight into this frame's slice of the persistent instance ring,
+	// each draw picks its row with baseInstance
+	int objectCount = gTransforms.Count();
+	InstanceData* instances = (InstanceData*)gInstanceRing.BeginFrame(sizeof(InstanceData) * objectCount);
+	if (instances)
+		UWriteInstances(projection * view, instances, objectCount);
+	gInstanceRing.BindRange(0);
+
+	// record draw packets across the worker threads, one command buffer each, then merge and sort by key. The
+	// buffers are cleared here, a thread whose range comes out empty never runs the job to clear its own
+	for (CommandBuffer& commands : gCommandBuffers)
+		commands.Reset();
+	gWorkers.ParallelFor((int)gSceneDrawables.size(), [&view](int begin, int end, int threadIndex)
+	{
+		URecordObjects(gCommandBuffers[threadIndex], view, begin, end);
+	});
+
+	// each buffer numbered its indirect commands from 0, shift them past the buffers before it
+	gDrawPackets.clear();
+	gIndirectCommands.clear();
+	gRenderStats.meshletsTested = gRenderStats.meshletsCulled = 0;
+	for (CommandBuffer& commands : gCommandBuffers)
+	{
+		int base = (int)gIndirectCommands.size();
+		for (DrawPacket& packet : commands.Packets())
+		{
+			if (packet.indirect)
+				packet.indirectFirst += base;
+		}
+		gDrawPackets.insert(gDrawPackets.end(), commands.Packets().begin(), commands.Packets().end());
+		gIndirectCommands.insert(gIndirectCommands.end(), commands.Indirect().begin(), commands.Indirect().end());
+		gRenderStats.meshletsTested += commands.MeshletsTested();
+		gRenderStats.meshletsCulled += commands.MeshletsCulled();
+	}
+	URadixSortPackets(gDrawPackets, gSortScratch);
+
+	// no mapped ring, the packets fall back to the whole mesh
+	DrawIndirectCommand* indirect = (DrawIndirectCommand*)gIndirectRing.BeginFrame(sizeof(DrawIndirectCommand) * gIndirectCommands.size());
+	if (indirect)
+		std::copy(gIndirectCommands.begin(), gIndirectCommands.end(), indirect);
+	else
+	{
+		for (DrawPacket& packet : gDrawPackets)
+			packet.indirect = false;
+	}
+	gIndirectRing.Bind();
+
+	URenderShadows();
+	for (int c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+		gGLState.BindTexture(1 + c, gShadows.SampledMap(c));
+	gGLState.BindTexture(1 + ShadowCascades::CASCADE_COUNT, UTextureId(gLightmapTexture));
+
+	// the views keep to their own rectangles through the clip distances the scene vertex shader writes. Nothing
+	// else writes them (the fallback, shadows, the upscale), so they're only on around the scene's draws
+	gDynamicResolution.BeginScene();
+	bool clipViews = gViewSet.Count() > 1 && programId != UProgramId(gFallbackProgram);
+	for (int plane = 0; clipViews && plane < 4; plane++)
+		gGLState.Enable(GL_CLIP_DISTANCE0 + plane);
+	UExecuteCommands(gDrawPackets, programId);
+	for (int plane = 0; clipViews && plane < 4; plane++)
+		gGLState.Disable(GL_CLIP_DISTANCE0 + plane);
+	gInstanceRing.EndFrame();
+	gIndirectRing.EndFrame();
+
+	gDynamicResolution.Present(gGLState, UProgramId(gUpscaleProgram));
+
+	// --gl-stats: how much of last frame's state setting actually reached GL
+	gFrameCount++;
+	if (gPrintGLStats && gFrameCount % 240 == 0)
+	{
+		const GLStateCache::FrameStats& stats = gGLState.LastFrame();
+		std::cout << "INFO: GL state calls issued " << stats.issued << ", filtered " << stats.filtered << std::endl;
+		std::cout << "INFO: Render scale " << gDynamicResolution.Scale() << ", GPU " << gDynamicResolution.GpuMilliseconds() << " ms" << std::endl;
+		std::cout << "INFO: Draw calls " << gRenderStats.drawCalls << ", triangles " << gRenderStats.triangles << std::endl;
+		if (gRenderStats.meshletsTested > 0)
+			std::cout << "INFO: Meshlets culled " << gRenderStats.meshletsCulled << " of " << gRenderStats.meshletsTested << std::endl;
+		if (gRenderStats.objects > 0)
+			std::cout << "INFO: Point lights per object " << (float)gRenderStats.pointLights / gRenderStats.objects << " of " << POINT_LIGHT_COUNT << std::endl;
+		std::cout << "INFO: GPU memory " << gGpuMemory.TotalBytes() / 1024 << " KB" << std::endl;
+		if (gStreamer.ChunkCount() > 0)
+		{
+			const GeometryStreamer::Stats& streaming = gStreamer.LastFrame();
+			std::cout << "INFO: Streaming queued " << streaming.queued << ", loading " << streaming.loading << ", awaiting upload " << streaming.awaitingUpload
+				<< ", resident " << streaming.resident << " (" << streaming.residentBytes / 1024 << " KB), uploaded " << streaming.uploadedBytes / 1024
+				<< " KB in " << streaming.uploads << ", fallbacks " << streaming.fallbacks << ", evictions " << streaming.evictions
+				<< ", load " << streaming.loadMs << " ms, request to resident " << streaming.latencyMs << " ms" << std::endl;
+		}
+	}
+}
+
+// what a click landed on, through whichever view the cursor is over. The TLAS is rebuilt for every pick, the
+// BLASes only for meshes the picker hasn't seen yet
+void UPick(const FrameState& frame)
+{
+	gHandledPickSerial = frame.pickSerial;
+
+	int objectCount = std::min((int)gSceneDrawables.size(), gTransforms.Count());
+	std::vector<MeshHandle> objectMeshes(objectCount);
+	std::vector<glm::mat4> models(objectCount);
+	for (int object = 0; object < objectCount; object++)
+	{
+		const SceneDrawable& drawable = gSceneDrawables[object];
+		objectMeshes[object] = drawable.chunk >= 0 ? gStreamer.Resolve(drawable.chunk) : drawable.mesh;
+		models[object] = gTransforms.Model(object);
+	}
+	gPicker.Update(meshes.Pool(), objectMeshes, models);
+
+	glm::vec2 local;
+	const ViewSet::View& view = gViewSet.Get(gViewSet.ViewAt(frame.pickCursor, local));
+	ScenePicker::Hit hit = gPicker.Intersect(ScenePicker::CameraRay(view.camera, view.fovY, view.aspect, local));
+	if (hit.object < 0)
+	{
+		std::cout << "INFO: Picked nothing" << std::endl;
+		return;
+	}
+	std::cout << "INFO: Picked " << (hit.object < OBJECT_COUNT ? OBJECT_NAMES[hit.object] : "chunk") << " (object " << hit.object
+		<< "), triangle " << hit.triangle << ", distance " << hit.t << ", at " << hit.position.x << " " << hit.position.y << " "
+		<< hit.position.z << std::endl;
+}
+
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+{
+	int success = 0;
+	char infoLog[512];
+
+	programId = glCreateProgram();
+	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+
+	glShaderSource(vertexShaderId, 1, &vtxShaderSource, nullptr);
+	glShaderSource(fragmentShaderId, 1, &fragShaderSource, nullptr);
+
+	glCompileShader(vertexShaderId);
+	glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(vertexShaderId, 512, nullptr, infoLog);
+		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+		glDeleteShader(vertexShaderId); // Delete the shader object
+		return false;
+	}
+
+	glCompileShader(fragmentShaderId);
+	glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), nullptr, infoLog);
+		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+		glDeleteShader(vertexShaderId);   // Delete the shader objects
+		glDeleteShader(fragmentShaderId);
+		return false;
+	}
+
+	glAttachShader(programId, vertexShaderId);
+	glAttachShader(programId, fragmentShaderId);
+
+	glLinkProgram(programId);
+	glGetProgramiv(programId, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(programId, sizeof(infoLog), nullptr, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+		glDeleteShader(vertexShaderId);   // Delete the shader objects
+		glDeleteShader(fragmentShaderId);
+		return false;
+	}
+
+	glDetachShader(programId, vertexShaderId);   // Detach the shader objects
+	glDetachShader(programId, fragmentShaderId);
+	glDeleteShader(vertexShaderId);   // Delete the shader objects
+	glDeleteShader(fragmentShaderId);
+
+	return true;
+}
+
+void UDestroyShaderProgram(GLuint programId)
+{
+	glDeleteProgram(programId);
+}
+
+// the same, pooled
+bool UCreateProgram(const char* vtxShaderSource, const char* fragShaderSource, ProgramHandle& program)
+{
+	GLuint programId;
+	if (!UCreateShaderProgram(vtxShaderSource, fragShaderSource, programId))
+		return false;
+	program = gProgramPool.Create(programId);
+	return true;
+}
+
+void UDestroyProgram(ProgramHandle& program)
+{
+	if (const GLuint* programId = gProgramPool.Get(program))
+	{
+		UDestroyShaderProgram(*programId);
+		gProgramPool.Destroy(program);
+	}
+	program = 0;
+}
+
+// 0 for a stale handle, which GL treats as no program
+GLuint UProgramId(ProgramHandle program)
+{
+	const GLuint* programId = gProgramPool.Get(program);
+	return programId ? *programId : 0;
+}
+/*Generate and load the texture*/
+// the mips come from UBuildMipChain and are cached next to the image as <image>.mips, the compressed file is
+// hashed to check the cache and only decoded when it misses. --no-cpu-mips leaves them to glGenerateMipmap
+bool UCreateTexture(const char* filename, TextureHandle& texture)
+{
+	MappedFile source;
+	if (!source.Open(filename))
+		return false;
+
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long sourceHash = UHashBytes(source.Data(), source.Size());
+	std::string cacheName = std::string(filename) + ".mips";
+	MipChain chain;
+	bool cached = gCpuMips && UReadMipCache(cacheName.c_str(), sourceHash, chain);
+	if (!cached)
+	{
+		int width, height, channels;
+		unsigned char* image = stbi_load_from_memory((const stbi_uc*)source.Data(), (int)source.Size(), &width, &height, &channels, 0);
+		if (!image)
+			return false;
+		if (channels != 3 && channels != 4)
+		{
+			cout << "Not implemented to handle image with " << channels << " channels" << endl;
+			stbi_image_free(image);
+			return false;
+		}
+
+		if (gCpuMips)
+			UBuildMipChain(gWorkers, image, width, height, channels, chain);
+		else
+		{
+			chain.width = width;
+			chain.height = height;
+			chain.channels = channels;
+			chain.levels.emplace_back(image, image + (size_t)width * height * channels);
+		}
+		stbi_image_free(image);
+
+		if (gCpuMips && !UWriteMipCache(cacheName.c_str(), sourceHash, chain))
+			std::cout << "INFO: Couldn't write the mip cache " << cacheName << std::endl;
+	}
+	if (gCpuMips)
+	{
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "INFO: Mips for " << filename << (cached ? " read from cache" : " built") << " in " << ms << " ms" << std::endl;
+	}
+
+	GLuint textureId = gGpuMemory.GenTexture(GpuMemory::CATEGORY_TEXTURE, filename);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// set texture filtering parameters, trilinear now that the mips are worth sampling
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// RGB rows of the small levels aren't 4 byte aligned
+	GLenum internalFormat = chain.channels == 4 ? GL_RGBA8 : GL_RGB8;
+	GLenum format = chain.channels == 4 ? GL_RGBA : GL_RGB;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t level = 0; level < chain.levels.size(); level++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, chain.LevelWidth((int)level), chain.LevelHeight((int)level), 0, format,
+			GL_UNSIGNED_BYTE, chain.levels[level].data());
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	if (gCpuMips)
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)chain.levels.size() - 1);
+	else
+		glGenerateMipmap(GL_TEXTURE_2D);
+	gGpuMemory.SetTextureBytes(textureId, GpuMemory::TextureBytes(chain.width, chain.height, chain.channels, true));
+
+	glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+	texture = gTexturePool.Create(textureId);
+	return true;
+}
+void UDestroyTexture(TextureHandle& texture)
+{
+	if (GLuint* textureId = gTexturePool.Get(texture))
+	{
+		gGpuMemory.DeleteTexture(*textureId);
+		gTexturePool.Destroy(texture);
+	}
+	texture = 0;
+}
+
+// 0 for a stale handle, which unbinds
+GLuint UTextureId(TextureHandle texture)
+{
+	const GLuint* textureId = gTexturePool.Get(texture);
+	return textureId ? *textureId : 0;
+}
+// --gpu-budget <MB> (256), once per crossing
+void UGpuBudgetExceeded(size_t usedBytes, size_t budgetBytes)
+{
+	std::cout << "INFO: GPU memory over budget, " << usedBytes / (1024 * 1024) << " MB of " << budgetBytes / (1024 * 1024) << " MB" << std::endl;
+	gGpuMemory.PrintBreakdown();
+}
+
+// a mesh going away takes its VAO out of the draw id attachments
+void UDetachDrawIds(GLuint vao)
+{
+	gTransforms.DetachDrawIds(vao);
+}
+/*Load a texture into memory only, for the software renderer*/
+bool ULoadSoftwareTexture(const char* filename, SoftwareTexture& texture)
+{
+	int width, height, channels;
+	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+	if (!image)
+		return false;
+
+	if (channels != 3 && channels != 4)
+	{
+		cout << "Not implemented to handle image with " << channels << " channels" << endl;
+		stbi_image_free(image);
+		return false;
+	}
+
+	texture.width = width;
+	texture.height = height;
+	texture.channels = channels;
+	texture.texels.assign(image, image + (size_t)width * height * channels);
+	stbi_image_free(image);
+	return true;
+}
+
+// transforms for everything on the desk, same values URender used to build by hand every frame
+void USetupSceneTransforms()
+{
+	const glm::vec4 noRotation(0.0f, 0.0f, 0.0f, 1.0f);
+
+	gTransforms.Add(glm::vec3(0.0f, 0.0f, 0.0f), noRotation, glm::vec3(8.0f, 8.0f, 8.0f));		// desk
+	gTransforms.Add(glm::vec3(-3.0f, 0.0f, 3.0f), noRotation, glm::vec3(0.45f, 1.2f, 0.45f));		// mug
+	gTransforms.Add(glm::vec3(-1.52f, 0.04f, 2.07f), noRotation, glm::vec3(0.04f, 0.04f, 0.04f));	// pen top
+	gTransforms.Add(glm::vec3(0.0f, 0.9f, 2.0f), noRotation, glm::vec3(0.22f, 0.22f, 0.22f));		// bottle cap
+
+	// pen body lies on its side, -70 degrees around y then 90 around z
+	glm::vec4 penRotation = UQuatMultiply(
+		UQuatFromAxisAngle(glm::radians(-70.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+		UQuatFromAxisAngle(glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+	gTransforms.Add(glm::vec3(-1.0f, 0.03f, 3.5f), penRotation, glm::vec3(0.03f, 1.5f, 0.03f));	// pen body
+
+	gTransforms.Add(glm::vec3(0.0f, 0.0f, 2.0f), noRotation, glm::vec3(0.15f, 0.8f, 0.15f));		// bottle
+	gTransforms.Add(glm::vec3(1.0f, 0.15f, 3.0f), noRotation, glm::vec3(1.0f, 0.15f, 0.6f));		// container
+
+	gStaticSceneVersion++;
+	UInvalidate();
+}
+
+// material and mesh for every scene object. Colors are only used when the texture is off, both end up in
+// the object's instance data rather than uniforms
+void USetupMaterials()
+{
+	gSceneDrawables.resize(OBJECT_COUNT);
+	gMaterials[MATERIAL_DESK] = { gTextureDesk, true, glm::vec3(0.8f, 0.8f, 0.8f) };
+	gMaterials[MATERIAL_MUG] = { gTextureMug, true, glm::vec3(0.8f, 0.8f, 0.8f) };
+	gMaterials[MATERIAL_PEN_TOP] = { gTextureMug, true, glm::vec3(0.2f, 0.2f, 0.2f) };
+	gMaterials[MATERIAL_BOTTLE_CAP] = { gTextureBotCap, true, glm::vec3(0.2f, 0.2f, 0.2f) };
+	gMaterials[MATERIAL_PEN_BODY] = { gTexturePenBod, true, glm::vec3(0.8f, 0.8f, 0.8f) };
+	gMaterials[MATERIAL_BOTTLE] = { gTextureBottl, true, glm::vec3(0.8f, 0.8f, 0.8f) };
+	gMaterials[MATERIAL_CONTAINER] = { gTextureCon, true, glm::vec3(0.8f, 0.8f, 0.8f) };
+
+	gSceneDrawables[OBJECT_DESK] = { meshes.gPlaneMesh, MATERIAL_DESK };
+	gSceneDrawables[OBJECT_MUG] = { meshes.gCylinderMesh, MATERIAL_MUG };
+	gSceneDrawables[OBJECT_PEN_TOP] = { meshes.gSphereMesh, MATERIAL_PEN_TOP };
+	gSceneDrawables[OBJECT_BOTTLE_CAP] = { meshes.gPyramid4Mesh, MATERIAL_BOTTLE_CAP };
+	gSceneDrawables[OBJECT_PEN_BODY] = { meshes.gCylinderMesh, MATERIAL_PEN_BODY };
+	gSceneDrawables[OBJECT_BOTTLE] = { meshes.gCylinderMesh, MATERIAL_BOTTLE };
+	gSceneDrawables[OBJECT_CONTAINER] = { meshes.gBoxMesh, MATERIAL_CONTAINER };
+}
+
+// model, normal and MVP matrices for every object in one SIMD batch, then each object's material color,
+// flags and point light list next to them. Shared by URender and the software renderer
+void UWriteInstances(const glm::mat4& viewProjection, InstanceData* instances, int objectCount)
+{
+	gTransforms.Compose(viewProjection, instances, 0, objectCount);
+	gLightAssignment.SetLights(gPointLights, POINT_LIGHT_COUNT, gLightThreshold);
+	gRenderStats.objects = objectCount;
+	gRenderStats.pointLights = 0;
+	for (int object = 0; object < objectCount; object++)
+	{
+		const SceneDrawable& drawable = gSceneDrawables[object];
+		const Material& material = gMaterials[drawable.material];
+		InstanceData& instance = instances[object];
+		instance.color = glm::vec4(material.color, 1.0f);
+		instance.flags[0] = (material.hasTexture ? INSTANCE_TEXTURED : 0) | (drawable.lightmapped ? INSTANCE_LIGHTMAPPED : 0);
+
+		// the mesh's sphere moved into the world, a streamed chunk that isn't resident gets every light
+		const Meshes::GLMesh* mesh = meshes.Get(drawable.chunk >= 0 ? gStreamer.Resolve(drawable.chunk) : drawable.mesh);
+		if (gLightCulling && mesh && mesh->boundsRadius > 0.0f)
+		{
+			glm::vec3 center = glm::vec3(instance.model * glm::vec4(mesh->boundsCenter, 1.0f));
+			float radius = mesh->boundsRadius * gTransforms.MaxScale(object);
+			instance.flags[1] = (GLuint)gLightAssignment.Assign(center, radius, gMaxObjectLights, instance.flags[2]);
+		}
+		else
+			instance.flags[1] = LightAssignment::AllLights(POINT_LIGHT_COUNT, instance.flags[2]);
+		gRenderStats.pointLights += (int)instance.flags[1];
+	}
+}
+
+// worker side: packets for the objects in [begin, end). Only reads the scene tables, no GL
+void URecordObjects(CommandBuffer& commands, const glm::mat4& view, int begin, int end)
+{
+	const float farPlane = 100.0f;
+
+	for (int object = begin; object < end; object++)
+	{
+		const SceneDrawable& drawable = gSceneDrawables[object];
+		// with several views the closest one decides, every view gets the same LOD
+		float viewDepth = gViewSet.Count() > 1 ? gViewSet.NearestDepth(gTransforms.Position(object)) : -(view * glm::vec4(gTransforms.Position(object), 1.0f)).z;
+		MeshHandle meshHandle = drawable.chunk >= 0 ? gStreamer.Resolve(drawable.chunk) : drawable.mesh;
+
+		DrawPacket packet;
+		packet.indirect = false;
+		packet.key = UMakeSortKey(PROGRAM_SCENE, drawable.material, meshHandle, viewDepth, farPlane);
+		packet.program = PROGRAM_SCENE;
+		packet.material = (unsigned short)drawable.material;
+		packet.mesh = meshHandle;
+		packet.instance = object;
+
+		// a stale handle (the mesh was swapped out) just isn't drawn
+		const Meshes::GLMesh* mesh = meshes.Get(meshHandle);
+		if (!mesh)
+			continue;
+
+		// errors grow down the chain, take the last one that's still under a pixel budget on screen
+		const Meshes::GLMesh::Lod* lod = nullptr;
+		if (gLodProjection > 0.0f && viewDepth > 0.0f)
+		{
+			float allowed = gLodPixelError * viewDepth / (gLodProjection * gTransforms.MaxScale(object));
+			for (const Meshes::GLMesh::Lod& level : mesh->lods)
+			{
+				if (level.error <= allowed)
+					lod = &level;
+			}
+		}
+		if (lod)
+		{
+			packet.primitive = PRIMITIVE_TRIANGLES;
+			packet.indexed = true;
+			packet.first = lod->first;
+			packet.count = lod->count;
+			commands.Record(packet);
+			continue;
+		}
+		if (gMeshletCulling && !mesh->meshlets.empty())
+		{
+			URecordMeshlets(commands, *mesh, object, packet);
+			continue;
+		}
+
+		for (const Meshes::GLMesh::Range& range : mesh->ranges)
+		{
+			packet.primitive = range.primitive;
+			packet.indexed = range.indexed;
+			packet.first = range.first;
+			packet.count = range.count;
+			commands.Record(packet);
+		}
+	}
+}
 
-out vec3 FragPos;
-out vec3 Normal;
-out vec2 TexCoords;
+// LOD 0 as indirect commands for the meshlets that survive the cone and frustum tests, neighbouring survivors
+// share one command. The packet keeps the whole range in first/count for passes that don't cull
+void URecordMeshlets(CommandBuffer& commands, const Meshes::GLMesh& mesh, int object, DrawPacket& packet)
+{
+	glm::mat4 model = gTransforms.Model(object);
+	float scale = gTransforms.MaxScale(object);
+
+	// every view's eye in mesh space for the cones, a cluster only goes when it faces away from all of them
+	glm::mat4 inverseModel = glm::inverse(model);
+	glm::vec3 eyes[ViewSet::MAX_VIEWS];
+	for (int view = 0; view < gViewSet.Count(); view++)
+		eyes[view] = glm::vec3(inverseModel * glm::vec4(gViewSet.Get(view).camera.Position, 1.0f));
+
+	packet.primitive = PRIMITIVE_TRIANGLES;
+	packet.indexed = true;
+	packet.first = mesh.ranges[0].first;
+	packet.count = mesh.ranges[0].count;
+	packet.indirect = true;
+	packet.indirectFirst = (int)commands.Indirect().size();
+	packet.indirectCount = 0;
+
+	int culled = 0;
+	int lastEnd = -1;
+	for (const Meshes::GLMesh::Meshlet& meshlet : mesh.meshlets)
+	{
+		bool visible = !gMeshletCones;
+		for (int view = 0; view < gViewSet.Count() && !visible; view++)
+			visible = glm::dot(glm::normalize(meshlet.coneApex - eyes[view]), meshlet.coneAxis) < meshlet.coneCutoff;
+		if (visible)
+			visible = gViewSet.SphereVisible(glm::vec3(model * glm::vec4(meshlet.center, 1.0f)), meshlet.radius * scale);
+		if (!visible)
+		{
+			culled++;
+			continue;
+		}
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+		if (meshlet.first == lastEnd)
+			commands.ExtendIndirect(meshlet.count);
+		else
+		{
+			DrawIndirectCommand command;
+			command.count = meshlet.count;
+			command.instanceCount = gViewSet.Count();
+			command.firstIndex = meshlet.first;
+			command.baseVertex = 0;
+			command.baseInstance = object;
+			commands.RecordIndirect(command);
+			packet.indirectCount++;
+		}
+		lastEnd = meshlet.first + meshlet.count;
+	}
+	commands.CountMeshlets((int)mesh.meshlets.size(), culled);
+	commands.Record(packet);
+}
 
-void main()
+// GL thread: walk the sorted packets, the state cache drops whatever didn't change between neighbours
+void UExecuteCommands(const std::vector<DrawPacket>& packets, GLuint programId)
 {
-	FragPos = vec3(model * vec4(aPos, 1.0));
-	Normal = mat3(transpose(inverse(model))) * aNormal;
-	TexCoords = aTexCoords;
+	for (const DrawPacket& packet : packets)
+	{
+		// PROGRAM_SCENE is the only program so far, whichever build of it is live this frame
+		const Material& material = gMaterials[packet.material];
+		const Meshes::GLMesh* mesh = meshes.Get(packet.mesh);
+		if (!mesh)
+			continue;
+		gGLState.UseProgram(programId);
+		gGLState.BindVertexArray(mesh->vao);
+		gGLState.BindTexture(0, UTextureId(material.texture));
+		UIssueDraw(packet, gViewSet.Count());
+	}
 
-	gl_Position = projection * view * vec4(FragPos, 1.0);
+	gGLState.BindVertexArray(0);
 }
-); // https://learnopengl.com/code_viewer_gh.php?code=src/2.lighting/6.multiple_lights/6.multiple_lights.vs
 
-// this was essentially a mixture of multiple rescources, though my last resource fixed a lot of the issues I was having
+// views instances of the draw, one per ViewSet view. The indirect commands already carry theirs
+void UIssueDraw(const DrawPacket& packet, int views)
+{
+	static const GLenum primitiveModes[] = { GL_TRIANGLES, GL_TRIANGLE_FAN, GL_TRIANGLE_STRIP };
 
-/* Fragment Shader Source Code */
-const GLchar* fragmentShaderSource = GLSL(440,
-	out vec4 FragColor;
+	GLenum mode = primitiveModes[packet.primitive];
+	if (packet.indirect)
+	{
+		// everything culled, nothing to issue
+		if (packet.indirectCount == 0)
+			return;
+		gRenderStats.drawCalls++;
+		for (int i = 0; i < packet.indirectCount; i++)
+			gRenderStats.triangles += gIndirectCommands[packet.indirectFirst + i].count / 3;
+		glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, (void*)(gIndirectRing.SliceOffset() + packet.indirectFirst * sizeof(DrawIndirectCommand)),
+			packet.indirectCount, 0);
+		return;
+	}
+	gRenderStats.drawCalls++;
+	gRenderStats.triangles += UPrimitiveTriangleCount(packet.primitive, packet.count);
+	if (packet.indexed)
+		glDrawElementsInstancedBaseInstance(mode, packet.count, GL_UNSIGNED_INT, (void*)(packet.first * sizeof(GLuint)), views, packet.instance);
+	else
+		glDrawArraysInstancedBaseInstance(mode, packet.first, packet.count, views, packet.instance);
+}
 
-struct Material {
-	sampler2D diffuse;
-	sampler2D specular;
-	float shininess;
-};
+// draws the scene packets that are (or aren't) dynamic with whatever program and target are current
+void UDrawShadowCasters(bool dynamicCasters)
+{
+	for (const DrawPacket& packet : gDrawPackets)
+	{
+		const Meshes::GLMesh* mesh = meshes.Get(packet.mesh);
+		if (!mesh || gSceneDrawables[packet.instance].dynamic != dynamicCasters)
+			continue;
+		// meshlets were culled against the camera, not the light, casters draw the whole LOD 0 range
+		DrawPacket caster = packet;
+		caster.indirect = false;
+		gGLState.BindVertexArray(mesh->vao);
+		UIssueDraw(caster);
+	}
+}
 
-struct DirLight {
-	vec3 direction;
+// static casters only when a cascade's cache is stale, dynamic ones composited over the cache every frame
+void URenderShadows()
+{
+	bool anyDynamic = false;
+	for (const SceneDrawable& drawable : gSceneDrawables)
+		anyDynamic = anyDynamic || drawable.dynamic;
 
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
+	GLuint shadowProgramId = UProgramId(gShadowProgram);
+	gGLState.UseProgram(shadowProgramId);
+	gGLState.Enable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
 
-	float intensity;
-};
+	for (int c = 0; c < ShadowCascades::CASCADE_COUNT; c++)
+	{
+		bool staticPass = gShadows.NeedsStaticPass(c);
+		if (!staticPass && !anyDynamic)
+			continue;
 
-struct PointLight {
-	vec3 position;
+		gGLState.SetUniformMatrix4f(shadowProgramId, "lightViewProjection", gShadows.LightViewProjection(c));
+		if (staticPass)
+		{
+			gShadows.BeginStaticPass(c);
+			UDrawShadowCasters(false);
+		}
+		if (anyDynamic)
+		{
+			gShadows.BeginDynamicPass(c);
+			UDrawShadowCasters(true);
+		}
+	}
 
-	float constant;
-	float linear;
-	float quadratic;
+	gShadows.EndPasses();
+	gGLState.Disable(GL_POLYGON_OFFSET_FILL);
+}
 
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
+// --bench-transforms: tens of thousands of objects through glm one at a time vs each path of the batch
+void UBenchmarkTransforms()
+{
+	const int objectCount = 65536;
+	const int iterations = 20;
 
-	float intensity;
-};
+	TransformBatch batch;
+	std::vector<glm::vec3> positions(objectCount), scales(objectCount), axes(objectCount);
+	std::vector<float> angles(objectCount);
+	for (int i = 0; i < objectCount; i++)
+	{
+		float t = (float)i;
+		positions[i] = glm::vec3(sin(t) * 50.0f, cos(t * 0.3f) * 5.0f, t * 0.01f);
+		scales[i] = glm::vec3(0.5f + (i % 7) * 0.1f, 1.0f + (i % 3) * 0.25f, 0.45f);
+		axes[i] = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f + (i % 5) * 0.1f));
+		angles[i] = t * 0.37f;
+		batch.Add(positions[i], UQuatFromAxisAngle(angles[i], axes[i]), scales[i]);
+	}
 
-in vec3 FragPos;
-in vec3 Normal;
-in vec2 TexCoords;
+	glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f) * gCamera.GetViewMatrix();
+	std::vector<InstanceData> out(objectCount);
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[5];
-uniform Material material;
+	// baseline, what URender did per object plus the normal matrix the shader used to work out
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int it = 0; it < iterations; it++)
+	{
+		for (int i = 0; i < objectCount; i++)
+		{
+			glm::mat4 model = glm::translate(positions[i]) * glm::rotate(angles[i], axes[i]) * glm::scale(scales[i]);
+			glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
+			out[i].model = model;
+			out[i].mvp = viewProjection * model;
+			for (int c = 0; c < 3; c++)
+				out[i].normalMatrix[c] = glm::vec4(normalMatrix[c], 0.0f);
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	double baselineMs = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+	std::cout << "glm baseline: " << baselineMs << " ms for " << objectCount << " objects" << std::endl;
 
-uniform bool hasTexture;
-uniform bool hasTextureTransparency;
-uniform vec3 meshColor;
+	TransformBatch::Path paths[3] = { TransformBatch::PATH_SCALAR, TransformBatch::PATH_SSE, TransformBatch::PATH_AVX2 };
+	for (TransformBatch::Path path : paths)
+	{
+#ifndef USE_SSE
+		if (path != TransformBatch::PATH_SCALAR)
+			continue;
+#endif
+		if (path == TransformBatch::PATH_AVX2 && !UCpuHasAvx2())
+			continue;
 
-// function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+		batch.SetPath(path);
+		start = std::chrono::high_resolution_clock::now();
+		for (int it = 0; it < iterations; it++)
+			batch.Compose(viewProjection, out.data(), 0, objectCount);
+		end = std::chrono::high_resolution_clock::now();
 
+		double ms = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+		std::cout << "TransformBatch " << TransformBatch::PathName(path) << ": " << ms << " ms (" << baselineMs / ms << "x)" << std::endl;
+	}
+}
 
-void main()
+bool UHasArg(int argc, char* argv[], const char* flag)
 {
-	vec3 norm = normalize(Normal);
-	vec3 viewDir = normalize(viewPos - FragPos);
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], flag) == 0)
+			return true;
+	}
+	return false;
+}
 
+// value following a flag, e.g. --frame-budget 16.6
+float UArgFloat(int argc, char* argv[], const char* flag, float fallback)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], flag) == 0)
+			return (float)atof(argv[i + 1]);
+	}
+	return fallback;
+}
 
-	vec3 result = CalcDirLight(dirLight, norm, viewDir);
-	for (int i = 0; i < 5; i++)
+const char* UArgString(int argc, char* argv[], const char* flag, const char* fallback)
+{
+	for (int i = 1; i + 1 < argc; i++)
 	{
-		result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+		if (strcmp(argv[i], flag) == 0)
+			return argv[i + 1];
 	}
+	return fallback;
+}
 
-	if (hasTextureTransparency)
-		FragColor = vec4(result, texture(material.diffuse, TexCoords).a);
-	else
-		FragColor = vec4(result, 1.0);
+// scene setup shared by the CPU renderers: the same tables main fills in, minus everything that needs a
+// context. Fills in one frame of instance data and sorted packets for the given camera, exactly what URender builds
+void USetupOfflineScene(const Camera& camera, float aspect, SoftwareTexture* textures, std::vector<InstanceData>& instances, std::vector<DrawPacket>& packets)
+{
+	meshes.CreateMeshes(false);
+	USetupSceneTransforms();
+	USetupMaterials();
+#ifdef USE_SSE
+	gTransforms.SetPath(UCpuHasAvx2() ? TransformBatch::PATH_AVX2 : TransformBatch::PATH_SSE);
+#endif
+
+	for (int material = 0; material < MATERIAL_COUNT; material++)
+	{
+		if (!ULoadSoftwareTexture(MATERIAL_TEXTURE_FILES[material], textures[material]))
+			std::cerr << "Failed to load " << MATERIAL_TEXTURE_FILES[material] << std::endl;
+	}
 
+	glm::mat4 view = camera.GetViewMatrix();
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), aspect, 0.1f, 100.0f);
+	instances.resize(gTransforms.Count());
+	UWriteInstances(projection * view, instances.data(), (int)instances.size());
+
+	CommandBuffer commands;
+	URecordObjects(commands, view, 0, OBJECT_COUNT);
+	packets = commands.Packets();
+	URadixSortPackets(packets, gSortScratch);
 }
-// calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+
+// --software-render: draws the scene on the CPU without ever opening a window, then reports throughput for
+// 1, 2, 4... up to --threads pool threads. The last frame goes to --output (software.ppm by default)
+int USoftwareRender(int argc, char* argv[])
 {
-	vec3 lightDir = normalize(-light.direction);
-	// diffuse shading
-	float diff = max(dot(normal, lightDir), 0.0);
-	// specular shading
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	// combine results
+	int width = (int)UArgFloat(argc, argv, "--width", (float)WINDOW_WIDTH);
+	int height = (int)UArgFloat(argc, argv, "--height", (float)WINDOW_HEIGHT);
+	int frames = std::max((int)UArgFloat(argc, argv, "--frames", 30.0f), 1);
+	int maxThreads = std::max((int)UArgFloat(argc, argv, "--threads", (float)std::thread::hardware_concurrency()), 1);
+	const char* output = UArgString(argc, argv, "--output", "software.ppm");
+
+	SoftwareTexture textures[MATERIAL_COUNT];
+	std::vector<InstanceData> instances;
+	std::vector<DrawPacket> packets;
+	USetupOfflineScene(gCamera, (GLfloat)width / (GLfloat)height, textures, instances, packets);
+
+	SoftwareRasterizer rasterizer;
+	rasterizer.Resize(width, height);
+	rasterizer.SetMeshes(&meshes.Pool());
+	for (int material = 0; material < MATERIAL_COUNT; material++)
+		rasterizer.SetTexture(material, &textures[material]);
+	rasterizer.SetLights(gDirLight, gPointLights);
+
+	for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+	{
+		WorkerPool pool;
+		pool.Initialize(threads - 1);
 
-	vec3 texColor;
+		// warm up, sizes the bins
+		rasterizer.Render(packets, instances.data(), gCamera.Position, pool);
 
-	if (hasTexture)
-		texColor = vec3(texture(material.diffuse, TexCoords));
-	else
-		texColor = meshColor;
+		auto start = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; frame++)
+			rasterizer.Render(packets, instances.data(), gCamera.Position, pool);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		pool.Destroy();
 
-	vec3 ambient = light.ambient * texColor;
-	vec3 diffuse = light.diffuse * diff * texColor;
-	vec3 specular = light.specular * spec * vec3(0.5, 0.5, 0.5);
-	return (ambient + diffuse + specular) * light.intensity;
+		const SoftwareRasterizer::FrameStats& stats = rasterizer.LastFrame();
+		std::cout << "INFO: Software render, " << threads << " thread(s): " << seconds * 1000.0 / frames << " ms/frame, "
+			<< stats.triangles * frames / seconds / 1e6 << " Mtri/s, "
+			<< stats.fragments * frames / seconds / 1e6 << " Mpix/s" << std::endl;
+
+		if (threads == maxThreads)
+			break;
+	}
+
+	if (!rasterizer.WritePpm(output))
+	{
+		std::cout << "ERROR::SOFTWARE::WRITE_FAILED " << output << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "INFO: Software frame written to " << output << std::endl;
+	return EXIT_SUCCESS;
 }
 
-// calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+// --path-trace: offline reference render with the PathTracer, --spp passes of one sample per pixel on
+// --threads pool threads. --progressive N rewrites --output (pathtrace.ppm) every N passes. --scaling first
+// measures a couple of passes at 1, 2, 4... threads so the build machines can be compared
+int UPathTrace(int argc, char* argv[])
 {
-	vec3 lightDir = normalize(light.position - fragPos);
-	// diffuse shading
-	float diff = max(dot(normal, lightDir), 0.0);
-	// specular shading
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	// attenuation
-	float distance = length(light.position - fragPos);
-	float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+	int width = (int)UArgFloat(argc, argv, "--width", (float)WINDOW_WIDTH);
+	int height = (int)UArgFloat(argc, argv, "--height", (float)WINDOW_HEIGHT);
+	int samples = std::max((int)UArgFloat(argc, argv, "--spp", 64.0f), 1);
+	int bounces = std::max((int)UArgFloat(argc, argv, "--bounces", 3.0f), 0);
+	int progressive = (int)UArgFloat(argc, argv, "--progressive", 0.0f);
+	int maxThreads = std::max((int)UArgFloat(argc, argv, "--threads", (float)std::thread::hardware_concurrency()), 1);
+	const char* output = UArgString(argc, argv, "--output", "pathtrace.ppm");
+
+	SoftwareTexture textures[MATERIAL_COUNT];
+	std::vector<InstanceData> instances;
+	std::vector<DrawPacket> packets;
+	USetupOfflineScene(gCamera, (GLfloat)width / (GLfloat)height, textures, instances, packets);
+
+	PathTracer tracer;
+	tracer.Resize(width, height);
+	tracer.SetMeshes(&meshes.Pool());
+	for (int material = 0; material < MATERIAL_COUNT; material++)
+		tracer.SetTexture(material, &textures[material]);
+	tracer.SetLights(gDirLight, gPointLights);
+	tracer.SetCamera(gCamera, glm::radians(60.0f));
+
+	auto buildStart = std::chrono::steady_clock::now();
+	tracer.BuildScene(packets, instances.data());
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+	std::cout << "INFO: Path tracer BVH, " << tracer.Tree().TriangleCount() << " triangles, " << tracer.Tree().NodeCount() << " nodes, " << buildMs << " ms" << std::endl;
+
+	if (UHasArg(argc, argv, "--scaling"))
+	{
+		for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+		{
+			WorkerPool pool;
+			pool.Initialize(threads - 1);
+			long long rays = 0;
+			double seconds = 0.0;
+			for (int pass = 0; pass < 2; pass++)
+			{
+				tracer.RenderPass(pool, bounces);
+				rays += tracer.LastPass().rays;
+				seconds += tracer.LastPass().seconds;
+			}
+			pool.Destroy();
+			std::cout << "INFO: Path tracer scaling, " << threads << " thread(s): " << rays / seconds / 1e6 << " Mrays/s" << std::endl;
+
+			if (threads == maxThreads)
+				break;
+		}
+		tracer.Reset();
+	}
 
-	vec3 texColor;
+	WorkerPool pool;
+	pool.Initialize(maxThreads - 1);
+	long long totalRays = 0;
+	double totalSeconds = 0.0;
+	for (int pass = 0; pass < samples; pass++)
+	{
+		tracer.RenderPass(pool, bounces);
+		totalRays += tracer.LastPass().rays;
+		totalSeconds += tracer.LastPass().seconds;
 
-	if (hasTexture)
-		texColor = vec3(texture(material.diffuse, TexCoords));
-	else
-		texColor = meshColor;
+		if (progressive > 0 && tracer.Passes() % progressive == 0 && tracer.Passes() < samples)
+		{
+			tracer.WritePpm(output);
+			std::cout << "INFO: Path tracer " << tracer.Passes() << "/" << samples << " spp, " << totalRays / totalSeconds / 1e6 << " Mrays/s" << std::endl;
+		}
+	}
+	pool.Destroy();
 
-	// combine results
-	vec3 ambient = light.ambient * texColor;
-	vec3 diffuse = light.diffuse * diff * texColor;
-	vec3 specular = light.specular * spec;
-	ambient *= attenuation;
-	diffuse *= attenuation;
-	specular *= attenuation;
-	return (ambient + diffuse + specular) * light.intensity;
+	std::cout << "INFO: Path tracer, " << maxThreads << " thread(s), " << samples << " spp: " << totalSeconds << " s, "
+		<< totalRays / totalSeconds / 1e6 << " Mrays/s" << std::endl;
+
+	if (!tracer.WritePpm(output))
+	{
+		std::cout << "ERROR::PATH_TRACE::WRITE_FAILED " << output << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "INFO: Path traced frame written to " << output << std::endl;
+	return EXIT_SUCCESS;
 }
-);
 
-int main(int argc, char* argv[])
+// --golden <dir>: image and performance regression check through the normal URender path. Every golden pose
+// is rendered at full resolution, its image compared against <dir>/poseN.ppm with mean SSIM and its median
+// frame time, draw calls and triangles against <dir>/baseline.txt. Missing goldens, or all of them with
+// --update-golden, get recorded instead. Works on Mesa llvmpipe (LIBGL_ALWAYS_SOFTWARE=1) so no GPU is needed.
+// Fails when an image drops below --ssim (0.98), the frame time grows past --perf-tolerance (0.25 = 25%)
+// or the draw calls or triangles go up
+int URunGoldenTests(const char* directory, int argc, char* argv[])
 {
-	if (!UInitialize(argc, argv, &gWindow))
-		return EXIT_FAILURE;
+	struct GoldenPose
+	{
+		glm::vec3 position;
+		float yaw;
+		float pitch;
+	};
 
-	glfwSetCursorPosCallback(gWindow, UMousePositionCallback);
+	const GoldenPose poses[] = {
+		{ glm::vec3(0.0f, 1.0f, 8.0f), -90.0f, 0.0f },		// startup view
+		{ glm::vec3(-4.0f, 3.0f, 6.0f), -60.0f, -25.0f },	// over the mug
+		{ glm::vec3(3.0f, 2.0f, 5.0f), -120.0f, -20.0f },	// over the container
+		{ glm::vec3(0.0f, 1.5f, 3.5f), -90.0f, -35.0f }		// close on the pen and bottle
+	};
+	const int POSE_COUNT = sizeof(poses) / sizeof(poses[0]);
+	const int WARMUP_FRAMES = 5;
+	const int TIMED_FRAMES = 31;
 
-	// Set the mouse scroll callback
-	glfwSetScrollCallback(gWindow, UMouseScrollCallback);
-	glfwSetInputMode(gWindow, GLFW_STICKY_KEYS, GLFW_TRUE);
-	meshes.CreateMeshes();
+	float minSsim = UArgFloat(argc, argv, "--ssim", 0.98f);
+	float perfTolerance = UArgFloat(argc, argv, "--perf-tolerance", 0.25f);
+	bool update = UHasArg(argc, argv, "--update-golden");
+	std::string baselineName = std::string(directory) + "/baseline.txt";
 
-	if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+	// the goldens are of the real scene program, never the fallback
+	while (gShaderBuilder.Status(gSceneProgram) == ShaderBuilder::BUILD_PENDING)
+	{
+		gShaderBuilder.Poll();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (gShaderBuilder.HasFailed(gSceneProgram))
+	{
+		std::cout << "ERROR::GOLDEN::SCENE_PROGRAM_FAILED" << std::endl;
 		return EXIT_FAILURE;
+	}
 
+	int width = gFramebufferWidth;
+	int height = gFramebufferHeight;
+	gDynamicResolution.Resize(width, height);
+	gViewportWidth = width;
+	gViewportHeight = height;
+
+	// pose frameMs drawCalls triangles, one line per pose
+	double baselineMs[POSE_COUNT] = {};
+	int baselineDraws[POSE_COUNT] = {};
+	long long baselineTriangles[POSE_COUNT] = {};
+	bool hasBaseline[POSE_COUNT] = {};
+	if (!update)
+	{
+		if (FILE* file = fopen(baselineName.c_str(), "r"))
+		{
+			int pose, draws;
+			double ms;
+			long long triangles;
+			while (fscanf(file, "%d %lf %d %lld", &pose, &ms, &draws, &triangles) == 4)
+			{
+				if (pose < 0 || pose >= POSE_COUNT)
+					continue;
+				baselineMs[pose] = ms;
+				baselineDraws[pose] = draws;
+				baselineTriangles[pose] = triangles;
+				hasBaseline[pose] = true;
+			}
+			fclose(file);
+		}
+	}
 
-	// Load textures
-	// bind textures on corresponding texture units
-	glActiveTexture(GL_TEXTURE0);
+	bool failed = false;
+	bool rewriteBaseline = false;
+	double measuredMs[POSE_COUNT];
+	RenderStats measuredStats[POSE_COUNT];
 
+	for (int pose = 0; pose < POSE_COUNT; pose++)
+	{
+		FrameState frame;
+		frame.camera = Camera(poses[pose].position, glm::vec3(0.0f, 1.0f, 0.0f), poses[pose].yaw, poses[pose].pitch);
+		frame.simTick = 0;
+		frame.inputTime = 0.0;
+
+		// glFinish per frame so the time covers the GPU too, median against the odd hiccup
+		std::vector<double> times;
+		for (int i = 0; i < WARMUP_FRAMES + TIMED_FRAMES; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			URender(frame);
+			glFinish();
+			if (i >= WARMUP_FRAMES)
+				times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		std::sort(times.begin(), times.end());
+		measuredMs[pose] = times[times.size() / 2];
+		measuredStats[pose] = gRenderStats;
+
+		// the frame is still in the back buffer, GL has it bottom row first
+		std::vector<unsigned char> bottomUp((size_t)width * height * 3);
+		std::vector<unsigned char> image(bottomUp.size());
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glReadBuffer(GL_BACK);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, bottomUp.data());
+		size_t rowBytes = (size_t)width * 3;
+		for (int y = 0; y < height; y++)
+			memcpy(&image[(size_t)y * rowBytes], &bottomUp[(size_t)(height - 1 - y) * rowBytes], rowBytes);
+
+		std::string name = std::string(directory) + "/pose" + std::to_string(pose);
+		std::vector<unsigned char> golden;
+		int goldenWidth = 0;
+		int goldenHeight = 0;
+		if (update || !UReadPpm((name + ".ppm").c_str(), goldenWidth, goldenHeight, golden))
+		{
+			if (!UWritePpm((name + ".ppm").c_str(), width, height, image))
+			{
+				std::cout << "ERROR::GOLDEN::WRITE_FAILED " << name << ".ppm" << std::endl;
+				failed = true;
+			}
+			else
+				std::cout << "INFO: Golden pose " << pose << " recorded to " << name << ".ppm" << std::endl;
+		}
+		else if (goldenWidth != width || goldenHeight != height)
+		{
+			std::cout << "ERROR::GOLDEN::SIZE_MISMATCH pose " << pose << " is " << width << "x" << height
+				<< ", golden is " << goldenWidth << "x" << goldenHeight << std::endl;
+			failed = true;
+		}
+		else
+		{
+			float ssim = UImageSsim(image, golden, width, height);
+			if (ssim < minSsim)
+			{
+				// keep what came out next to the golden for a look
+				UWritePpm((name + ".actual.ppm").c_str(), width, height, image);
+				std::cout << "ERROR::GOLDEN::IMAGE_DRIFT pose " << pose << " SSIM " << ssim << " < " << minSsim
+					<< ", frame written to " << name << ".actual.ppm" << std::endl;
+				failed = true;
+			}
+			else
+				std::cout << "INFO: Golden pose " << pose << " SSIM " << ssim << std::endl;
+		}
 
-	// Load and bind desk texture
-	if (!UCreateTexture("Textures/table-wood.jpg", gTextureIdDesk)) {
-		std::cerr << "Failed to load desk texture" << std::endl;
-		// Handle error gracefully
+		std::cout << "INFO: Golden pose " << pose << " " << measuredMs[pose] << " ms, " << measuredStats[pose].drawCalls
+			<< " draw calls, " << measuredStats[pose].triangles << " triangles";
+		if (hasBaseline[pose])
+			std::cout << " (baseline " << baselineMs[pose] << " ms, " << baselineDraws[pose] << ", " << baselineTriangles[pose] << ")";
+		std::cout << std::endl;
+
+		if (!hasBaseline[pose])
+			rewriteBaseline = true;
+		else
+		{
+			if (measuredMs[pose] > baselineMs[pose] * (1.0 + perfTolerance))
+			{
+				std::cout << "ERROR::GOLDEN::FRAME_TIME_DRIFT pose " << pose << " " << measuredMs[pose] << " ms > "
+					<< baselineMs[pose] << " ms + " << perfTolerance * 100.0f << "%" << std::endl;
+				failed = true;
+			}
+			if (measuredStats[pose].drawCalls > baselineDraws[pose] || measuredStats[pose].triangles > baselineTriangles[pose])
+			{
+				std::cout << "ERROR::GOLDEN::WORKLOAD_DRIFT pose " << pose << " draw calls or triangles went up" << std::endl;
+				failed = true;
+			}
+		}
 	}
-	// Load and bind mug texture
-	if (!UCreateTexture("Textures/cracked-white.jpg", gTextureIdMug)) {
-		std::cerr << "Failed to load mug texture" << std::endl;
-		// Handle error gracefully
+
+	// only written when something was missing or asked for, a failing run never moves the baseline
+	if (rewriteBaseline && !failed)
+	{
+		FILE* file = fopen(baselineName.c_str(), "w");
+		if (!file)
+		{
+			std::cout << "ERROR::GOLDEN::WRITE_FAILED " << baselineName << std::endl;
+			return EXIT_FAILURE;
+		}
+		for (int pose = 0; pose < POSE_COUNT; pose++)
+			fprintf(file, "%d %f %d %lld\n", pose, measuredMs[pose], measuredStats[pose].drawCalls, measuredStats[pose].triangles);
+		fclose(file);
+		std::cout << "INFO: Golden baseline recorded to " << baselineName << std::endl;
 	}
-	// Load and bind botcap texture
-	if (!UCreateTexture("Textures/black-pin.jpg", gTextureIdBotCap)) {
-		std::cerr << "Failed to load botcap texture" << std::endl;
-		// Handle error gracefully
+
+	std::cout << (failed ? "ERROR::GOLDEN::FAILED" : "INFO: Golden tests passed") << std::endl;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// height of the streamed terrain, flat under the desk and rolling hills further out
+float UTerrainHeight(float x, float z)
+{
+	float hills = 0.8f * sin(x * 0.11f) * cos(z * 0.09f) + 0.3f * sin(x * 0.37f + z * 0.23f);
+	float t = glm::clamp((sqrt(x * x + z * z) - 12.0f) / 12.0f, 0.0f, 1.0f);
+	float blend = t * t * (3.0f - 2.0f * t);
+	return -1.5f + hills * 3.0f * blend;
+}
+
+// quads x quads grid over one square tile. Positions are relative to the tile's center so the full chunk and
+// its coarse fallback share the tile's transform
+void UBuildTerrainTile(float centerX, float centerZ, float size, int quads, std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+{
+	const float NORMAL_STEP = 0.05f;
+
+	vertices.clear();
+	indices.clear();
+	float step = size / quads;
+	for (int j = 0; j <= quads; j++)
+	{
+		for (int i = 0; i <= quads; i++)
+		{
+			float x = -0.5f * size + i * step;
+			float z = -0.5f * size + j * step;
+			float worldX = centerX + x;
+			float worldZ = centerZ + z;
+			glm::vec3 normal = glm::normalize(glm::vec3(
+				UTerrainHeight(worldX - NORMAL_STEP, worldZ) - UTerrainHeight(worldX + NORMAL_STEP, worldZ),
+				2.0f * NORMAL_STEP,
+				UTerrainHeight(worldX, worldZ - NORMAL_STEP) - UTerrainHeight(worldX, worldZ + NORMAL_STEP)));
+
+			GLfloat vertex[] = { x, UTerrainHeight(worldX, worldZ), z, normal.x, normal.y, normal.z, worldX * 0.25f, worldZ * 0.25f };
+			vertices.insert(vertices.end(), vertex, vertex + 8);
+		}
+	}
+
+	for (int j = 0; j < quads; j++)
+	{
+		for (int i = 0; i < quads; i++)
+		{
+			GLuint corner = j * (quads + 1) + i;
+			GLuint below = corner + quads + 1;
+			GLuint quad[] = { corner, below, corner + 1, corner + 1, below, below + 1 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+}
+
+// --stream <dir>: a --stream-grid square (16) of 8 unit terrain tiles around the desk, streamed from <dir>.
+// The tiles are baked into <dir> the first time, later runs only stream what's there. --stream-distance (40)
+// is the load radius, --stream-upload the KB uploaded per frame (512), --stream-budget the resident MB (8)
+// and --stream-threads the loader threads (2)
+bool USetupStreaming(const char* directory, int argc, char* argv[])
+{
+	const float TILE_SIZE = 8.0f;
+	const int TILE_QUADS = 32;
+	const int FALLBACK_QUADS = 2;
+
+	int grid = std::max((int)UArgFloat(argc, argv, "--stream-grid", 16.0f), 1);
+	gStreamer.Initialize(&meshes, &gTransforms,
+		std::max((int)UArgFloat(argc, argv, "--stream-threads", 2.0f), 1),
+		UArgFloat(argc, argv, "--stream-distance", 40.0f),
+		(size_t)(UArgFloat(argc, argv, "--stream-upload", 512.0f) * 1024),
+		(size_t)(UArgFloat(argc, argv, "--stream-budget", 8.0f) * 1024 * 1024));
+
+	const glm::vec4 noRotation(0.0f, 0.0f, 0.0f, 1.0f);
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	int baked = 0;
+	for (int tileZ = 0; tileZ < grid; tileZ++)
+	{
+		for (int tileX = 0; tileX < grid; tileX++)
+		{
+			float centerX = (tileX - 0.5f * grid + 0.5f) * TILE_SIZE;
+			float centerZ = (tileZ - 0.5f * grid + 0.5f) * TILE_SIZE;
+			std::string file = std::string(directory) + "/tile_" + std::to_string(tileX) + "_" + std::to_string(tileZ) + ".chunk";
+
+			if (FILE* existing = fopen(file.c_str(), "rb"))
+				fclose(existing);
+			else
+			{
+				UBuildTerrainTile(centerX, centerZ, TILE_SIZE, TILE_QUADS, vertices, indices);
+				if (!UWriteChunk(file.c_str(), vertices, indices))
+				{
+					std::cout << "ERROR::STREAMING::BAKE_FAILED " << file << std::endl;
+					return false;
+				}
+				baked++;
+			}
+
+			// the fallback is tiny and stays resident, it's what the tile looks like until the real one is in
+			UBuildTerrainTile(centerX, centerZ, TILE_SIZE, FALLBACK_QUADS, vertices, indices);
+			MeshHandle fallback = meshes.CreateMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+			gTransforms.AttachDrawIds(meshes.Get(fallback)->vao);
+
+			SceneDrawable drawable = { fallback, MATERIAL_DESK };
+			drawable.chunk = gStreamer.AddChunk(file, glm::vec3(centerX, UTerrainHeight(centerX, centerZ), centerZ), 0.75f * TILE_SIZE, fallback);
+			gSceneDrawables.push_back(drawable);
+			gTransforms.Add(glm::vec3(centerX, 0.0f, centerZ), noRotation, glm::vec3(1.0f));
+		}
 	}
-	// Load and bind penbod texture
-	if (!UCreateTexture("Textures/pink-dot.jpg", gTextureIdPenBod)) {
-		std::cerr << "Failed to load gTextureIdPenBod texture" << std::endl;
-		// Handle error gracefully
+
+	std::cout << "INFO: Streaming " << gStreamer.ChunkCount() << " chunks from " << directory << ", baked " << baked << std::endl;
+	gStaticSceneVersion++;
+	return true;
+}
+
+// --bench-normals: compares the old per-vertex inverse(model) against the CPU normal matrix, both the
+// CPU cost of building the matrices and the GPU vertex stage time on a heavily tessellated sphere
+void UBenchmarkNormalMatrix()
+{
+	// CPU side, a spread of non uniform TRS matrices like the ones URender builds
+	const int matrixCount = 1 << 20;
+	std::vector<glm::mat4> models(matrixCount);
+	for (int i = 0; i < matrixCount; i++)
+	{
+		float t = (float)i;
+		models[i] = glm::translate(glm::vec3(sin(t), cos(t), t * 0.001f))
+			* glm::rotate(t * 0.37f, glm::vec3(0.3f, 1.0f, 0.2f))
+			* glm::scale(glm::vec3(0.5f + (i % 7) * 0.1f, 1.2f, 0.45f));
 	}
-	// Load and bund bottle texture
-	if (!UCreateTexture("Textures/sup-reme.jpg", gTextureIdBottl)) {
-		std::cerr << "failed to get the bottle texture bruh" << std::endl;
+
+	float checksum = 0.0f;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < matrixCount; i++)
+		checksum += glm::mat3(glm::transpose(glm::inverse(models[i])))[1][1];
+	auto middle = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < matrixCount; i++)
+		checksum += UNormalMatrix(models[i])[1][1];
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double inverseNs = std::chrono::duration<double, std::nano>(middle - start).count() / matrixCount;
+	double cofactorNs = std::chrono::duration<double, std::nano>(end - middle).count() / matrixCount;
+	std::cout << "CPU normal matrix: glm inverse " << inverseNs << " ns, UNormalMatrix " << cofactorNs << " ns (checksum " << checksum << ")" << std::endl;
+
+	// GPU side, the old shader did the inverse in the vertex stage so render the same dense mesh both ways
+	const GLchar* inverseVertexShaderSource = GLSL(440,
+		layout(location = 0) in vec3 aPos;
+	layout(location = 1) in vec3 aNormal;
+	out vec3 Normal;
+	uniform mat4 model;
+	uniform mat4 view;
+	uniform mat4 projection;
+	void main()
+	{
+		Normal = mat3(transpose(inverse(model))) * aNormal;
+		gl_Position = projection * view * model * vec4(aPos, 1.0);
 	}
-	// Load and bund container texture
-	if (!UCreateTexture("Textures/aspire-logo.jpg", gTextureIdCon)) {
-		std::cerr << "failed to get the container texture" << std::endl;
+	);
+
+	const GLchar* uniformVertexShaderSource = GLSL(440,
+		layout(location = 0) in vec3 aPos;
+	layout(location = 1) in vec3 aNormal;
+	out vec3 Normal;
+	uniform mat4 model;
+	uniform mat3 normalMatrix;
+	uniform mat4 view;
+	uniform mat4 projection;
+	void main()
+	{
+		Normal = normalMatrix * aNormal;
+		gl_Position = projection * view * model * vec4(aPos, 1.0);
 	}
+	);
 
-	
-	// Sets the background color of the window to black (it will be implicitely used by glClear)
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	GLuint programIds[2];
+	if (!UCreateShaderProgram(inverseVertexShaderSource, fallbackFragmentShaderSource, programIds[0]) ||
+		!UCreateShaderProgram(uniformVertexShaderSource, fallbackFragmentShaderSource, programIds[1]))
+		return;
 
+	Meshes::GLMesh denseSphere;
+	meshes.UCreateTessellatedSphereMesh(denseSphere, 1024, 2048);
+	std::cout << "GPU vertex stage: " << denseSphere.nVertices << " vertices, " << denseSphere.nIndices / 3 << " triangles" << std::endl;
 
+	// small viewport so the fragment stage stays out of the measurement
+	glViewport(0, 0, 64, 64);
+	glEnable(GL_DEPTH_TEST);
 
+	glm::mat4 model = glm::translate(glm::vec3(0.0f, 0.0f, -3.0f)) * glm::scale(glm::vec3(1.0f, 0.6f, 0.8f));
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f);
 
+	const char* names[2] = { "inverse in shader", "CPU normal matrix" };
+	const int frames = 50;
+	GLuint query;
+	glGenQueries(1, &query);
 
-	while (!glfwWindowShouldClose(gWindow))
+	for (int p = 0; p < 2; p++)
 	{
-		// per-frame timing
-	   // --------------------
-		float currentFrame = glfwGetTime();
-		gDeltaTime = currentFrame - gLastFrame;
-		gLastFrame = currentFrame;
-		// input
-		// -----
-		UProcessInput(gWindow);
-
-		// Render this frame
-		URender();
-
-		glfwPollEvents();
+		glUseProgram(programIds[p]);
+		glUniformMatrix4fv(glGetUniformLocation(programIds[p], "model"), 1, GL_FALSE, glm::value_ptr(model));
+		glUniformMatrix3fv(glGetUniformLocation(programIds[p], "normalMatrix"), 1, GL_FALSE, glm::value_ptr(UNormalMatrix(model)));
+		glUniformMatrix4fv(glGetUniformLocation(programIds[p], "view"), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(glGetUniformLocation(programIds[p], "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		glBindVertexArray(denseSphere.vao);
+
+		GLuint64 totalNs = 0;
+		for (int f = 0; f < frames + 5; f++)
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			glDrawElements(GL_TRIANGLES, denseSphere.nIndices, GL_UNSIGNED_INT, (void*)0);
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			if (f >= 5) // first few frames are warm up
+				totalNs += elapsed;
+		}
+		std::cout << "GPU " << names[p] << ": " << totalNs / 1.0e6 / frames << " ms/frame" << std::endl;
 	}
 
-
-	//destroying textures
-	meshes.DestroyMeshes();
-	UDestroyTexture(gTextureIdDesk);
-	UDestroyTexture(gTextureIdMug);
-	UDestroyTexture(gTextureIdBotCap);
-	UDestroyTexture(gTextureIdPenBod);
-	UDestroyTexture(gTextureIdBottl);
-	UDestroyTexture(gTextureIdCon);
-
-	UDestroyShaderProgram(gProgramId);
-
-	glfwTerminate();
-	return EXIT_SUCCESS;
+	glDeleteQueries(1, &query);
+	glBindVertexArray(0);
+	meshes.UDestroyMesh(denseSphere);
+	UDestroyShaderProgram(programIds[0]);
+	UDestroyShaderProgram(programIds[1]);
 }
 
+// other non directly cited sources
+// https://gamedev.stackexchange.com/questions/181782/how-can-i-change-the-camera-to-work-from-an-y-up-system-to-a-z-up
+//  https://www.reddit.com/r/opengl/comments/xpplbw/cylinder_modern_opengl/
+// https://learnopengl.com/
+// https://www.reddit.com/r/GraphicsProgramming/comments/pq0z6k/just_started_learning_opengl_and_i_want_to_cry/ 
+// https://www.youtube.com/watch?v=Q7vm264YNrM ( this guy's youtube videos were amazing )
+// https://www.khronos.org/files/opengl45-quick-reference-card.pdf - Best cheat sheet I've found
+// http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-9-vbo-indexing/ 
+// Also should be noted I used SNHU tutorials 
+// this is the V2 created on 10.17.23
 
-bool UInitialize(int argc, char* argv[], GLFWwindow** window)
+// --import <file>: an OBJ or glTF model in place of --import-object's mesh (mug), scaled and moved to fit
+// inside the bounds of the mesh it replaces so the object's transform still puts it in the right spot.
+// A model that won't load leaves the built in mesh there. Gets the same LOD chain as the built in meshes
+bool UImportProp(const char* filename, const char* objectName, int lodLevels, float lodRatio, float lodMaxError)
 {
-	glfwSetCursorPosCallback(*window, UMousePositionCallback);
-	glfwSetScrollCallback(*window, UMouseScrollCallback);
-
-
-	if (!glfwInit())
+	int object = (int)(std::find_if(OBJECT_NAMES, OBJECT_NAMES + OBJECT_COUNT, [objectName](const char* name) { return strcmp(name, objectName) == 0; }) - OBJECT_NAMES);
+	if (object == OBJECT_COUNT)
 	{
-		std::cerr << "Failed to initialize GLFW" << std::endl;
+		std::cout << "ERROR::IMPORT::UNKNOWN_OBJECT " << objectName << std::endl;
 		return false;
 	}
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-#ifdef __APPLE__
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
 
-	* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, nullptr, nullptr);
-	if (*window == nullptr)
+	MeshImporter importer;
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	if (!importer.Load(filename, gWorkers, vertices, indices))
 	{
-		std::cerr << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
+		std::cout << "ERROR::IMPORT::LOAD_FAILED " << filename << ": " << importer.Error() << std::endl;
 		return false;
 	}
 
-	glfwMakeContextCurrent(*window);
-	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-
-	glewExperimental = GL_TRUE;
-	if (glewInit() != GLEW_OK)
+	const Meshes::GLMesh* original = meshes.Get(gSceneDrawables[object].mesh);
+	glm::vec3 targetLow(-1.0f), targetHigh(1.0f);
+	if (original && !original->vertices.empty())
 	{
-		std::cerr << "Failed to initialize GLEW" << std::endl;
-		glfwTerminate();
-		return false;
+		targetLow = glm::vec3(FLT_MAX);
+		targetHigh = glm::vec3(-FLT_MAX);
+		for (size_t i = 0; i < original->vertices.size(); i += 8)
+		{
+			targetLow = glm::min(targetLow, glm::make_vec3(&original->vertices[i]));
+			targetHigh = glm::max(targetHigh, glm::make_vec3(&original->vertices[i]));
+		}
+	}
+	glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+	for (size_t i = 0; i < vertices.size(); i += 8)
+	{
+		low = glm::min(low, glm::make_vec3(&vertices[i]));
+		high = glm::max(high, glm::make_vec3(&vertices[i]));
 	}
 
-	if (glfwGetCurrentContext() == nullptr)
+	// uniform so the model keeps its proportions, centered and standing on the bottom of the old bounds
+	glm::vec3 size = glm::max(high - low, glm::vec3(1e-6f));
+	glm::vec3 targetSize = targetHigh - targetLow;
+	float scale = std::min(targetSize.x / size.x, std::min(targetSize.y / size.y, targetSize.z / size.z));
+	glm::vec3 offset = glm::vec3(0.5f * (targetLow.x + targetHigh.x), targetLow.y, 0.5f * (targetLow.z + targetHigh.z)) -
+		scale * glm::vec3(0.5f * (low.x + high.x), low.y, 0.5f * (low.z + high.z));
+	for (size_t i = 0; i < vertices.size(); i += 8)
 	{
-		std::cerr << "Failed to create OpenGL context" << std::endl;
-		glfwTerminate();
-		return false;
+		vertices[i] = vertices[i] * scale + offset.x;
+		vertices[i + 1] = vertices[i + 1] * scale + offset.y;
+		vertices[i + 2] = vertices[i + 2] * scale + offset.z;
 	}
 
-	std::cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
+	auto lodStart = std::chrono::steady_clock::now();
+	std::vector<Meshes::GLMesh::Lod> lods;
+	if (lodLevels > 0)
+	{
+		MeshSimplifier simplifier;
+		simplifier.BuildLodChain(vertices, indices, indices.size(), lodLevels, lodRatio, lodMaxError, lods);
+	}
+	double lodMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lodStart).count();
+
+	// CreateMesh keeps no CPU copy for BuildMeshlets to work from later
+	std::vector<Meshes::GLMesh::Meshlet> meshlets;
+	if (gMeshletCulling)
+		UBuildMeshlets(vertices, indices, 0, lods.empty() ? indices.size() : lods[0].first, meshlets);
+
+	MeshHandle mesh = meshes.CreateMesh(vertices.data(), vertices.size(), indices.data(), indices.size(), lods, meshlets);
+	gTransforms.AttachDrawIds(meshes.Get(mesh)->vao);
+	gSceneDrawables[object].mesh = mesh;
+	gStaticSceneVersion++;
+
+	const MeshImporter::Stats& stats = importer.LastLoad();
+	std::cout << "INFO: Imported " << filename << " as the " << objectName << ", " << stats.triangles << " triangles, "
+		<< stats.vertices << " vertices in " << stats.ms << " ms" << std::endl;
+	for (size_t i = 0; i < lods.size(); i++)
+	{
+		std::cout << "INFO: LOD " << i + 1 << ": " << lods[i].count / 3 << " triangles, error " << lods[i].error
+			<< (i + 1 == lods.size() ? ", built in " + std::to_string(lodMs) + " ms" : "") << std::endl;
+	}
 	return true;
-
 }
 
-
-
-void UProcessInput(GLFWwindow* window)
+// --bench-import: load times at 1, 2, 4... up to --threads pool threads. Benchmarks --bench-file if given,
+// otherwise a generated --bench-quads square (1024, about 2M triangles) of terrain written out once as
+// import_bench.obj and import_bench.glb
+int UBenchmarkImport(int argc, char* argv[])
 {
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-		glfwSetWindowShouldClose(window, true);
-
-	// WASD
-	float cameraOffset = gCameraSpeed * gDeltaTime;
-
-	if (glfwGetKey(gWindow, GLFW_KEY_W) == GLFW_PRESS)
-		gCamera.ProcessInput(FORWARD, cameraOffset);
-	if (glfwGetKey(gWindow, GLFW_KEY_S) == GLFW_PRESS)
-		gCamera.ProcessInput(BACKWARD, cameraOffset);
-	if (glfwGetKey(gWindow, GLFW_KEY_A) == GLFW_PRESS)
-		gCamera.ProcessInput(LEFT, cameraOffset);
-	if (glfwGetKey(gWindow, GLFW_KEY_D) == GLFW_PRESS)
-		gCamera.ProcessInput(RIGHT, cameraOffset);
-	if (glfwGetKey(gWindow, GLFW_KEY_Q) == GLFW_PRESS)
-		gCamera.ProcessInput(UP, cameraOffset);
-	if (glfwGetKey(gWindow, GLFW_KEY_E) == GLFW_PRESS)
-		gCamera.ProcessInput(DOWN, cameraOffset);
-	// not much change from what I had previously built
-}
-
-
+	int maxThreads = std::max((int)UArgFloat(argc, argv, "--threads", (float)std::thread::hardware_concurrency()), 1);
+	std::vector<std::string> files;
+	if (const char* file = UArgString(argc, argv, "--bench-file", nullptr))
+		files.push_back(file);
+	else
+	{
+		int quads = std::max((int)UArgFloat(argc, argv, "--bench-quads", 1024.0f), 1);
+		files.push_back("import_bench.obj");
+		files.push_back("import_bench.glb");
+
+		std::vector<GLfloat> vertices;
+		std::vector<GLuint> indices;
+		UBuildTerrainTile(0.0f, 0.0f, 64.0f, quads, vertices, indices);
+		if (!UWriteObj(files[0].c_str(), vertices, indices) || !UWriteGlb(files[1].c_str(), vertices, indices))
+		{
+			std::cout << "ERROR::IMPORT::BENCH_WRITE_FAILED" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
 
-void UResizeWindow(GLFWwindow* window, int width, int height)
-{
-	glViewport(0, 0, width, height);
+	MeshImporter importer;
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	for (const std::string& file : files)
+	{
+		for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+		{
+			WorkerPool pool;
+			pool.Initialize(threads - 1);
+
+			// best of three, the first run also pulls the file into the page cache
+			double best = 1e30;
+			for (int run = 0; run < 3; run++)
+			{
+				if (!importer.Load(file.c_str(), pool, vertices, indices))
+				{
+					pool.Destroy();
+					std::cout << "ERROR::IMPORT::LOAD_FAILED " << file << ": " << importer.Error() << std::endl;
+					return EXIT_FAILURE;
+				}
+				best = std::min(best, importer.LastLoad().ms);
+			}
+			pool.Destroy();
+
+			const MeshImporter::Stats& stats = importer.LastLoad();
+			std::cout << "INFO: Import " << file << ", " << threads << " thread(s): " << best << " ms, "
+				<< stats.bytes / best / 1e3 << " MB/s, " << stats.triangles / best / 1e3 << " Mtri/s ("
+				<< stats.triangles << " triangles, " << stats.vertices << " vertices)" << std::endl;
+
+			if (threads == maxThreads)
+				break;
+		}
+	}
+	return EXIT_SUCCESS;
 }
 
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+// --bake-lightmap: the static objects' lighting into --output (lightmap.lmap) for --lightmap to draw. The
+// Lightmap packs --texels-per-unit (16) charts into at most --lightmap-size (2048) square, every texel gets
+// --bake-samples (64) bounce rays of up to --bounces (2) on --threads pool threads
+int UBakeLightmap(int argc, char* argv[])
 {
-	if (gFirstMouse)
+	Lightmap::Settings settings;
+	settings.texelsPerUnit = std::max(UArgFloat(argc, argv, "--texels-per-unit", 16.0f), 0.01f);
+	settings.samples = std::max((int)UArgFloat(argc, argv, "--bake-samples", 64.0f), 0);
+	settings.bounces = std::max((int)UArgFloat(argc, argv, "--bounces", 2.0f), 0);
+	settings.maxSize = std::max((int)UArgFloat(argc, argv, "--lightmap-size", 2048.0f), 16);
+	int threads = std::max((int)UArgFloat(argc, argv, "--threads", (float)std::thread::hardware_concurrency()), 1);
+	const char* output = UArgString(argc, argv, "--output", "lightmap.lmap");
+
+	SoftwareTexture textures[MATERIAL_COUNT];
+	std::vector<InstanceData> instances;
+	std::vector<DrawPacket> packets;
+	USetupOfflineScene(gCamera, (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, textures, instances, packets);
+
+	// anything that moves keeps its per pixel lights, and stays out of the baked shadows and bounces
+	std::vector<DrawPacket> staticPackets;
+	for (const DrawPacket& packet : packets)
 	{
-		gLastX = xpos;
-		gLastY = ypos;
-		gFirstMouse = false;
+		if (!gSceneDrawables[packet.instance].dynamic)
+			staticPackets.push_back(packet);
+	}
+	std::stable_sort(staticPackets.begin(), staticPackets.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.instance < b.instance; });
+
+	PathTracer tracer;
+	tracer.SetMeshes(&meshes.Pool());
+	for (int material = 0; material < MATERIAL_COUNT; material++)
+		tracer.SetTexture(material, &textures[material]);
+	tracer.SetLights(gDirLight, gPointLights);
+	tracer.BuildScene(staticPackets, instances.data());
+
+	WorkerPool pool;
+	pool.Initialize(threads - 1);
+	Lightmap lightmap;
+	bool baked = lightmap.Bake(pool, tracer, staticPackets, instances.data(), meshes.Pool(), settings);
+	pool.Destroy();
+	if (!baked)
+	{
+		std::cout << "ERROR::LIGHTMAP::DOES_NOT_FIT " << lightmap.LastBake().charts << " charts need more than --lightmap-size "
+			<< settings.maxSize << std::endl;
+		return EXIT_FAILURE;
 	}
 
-	float xoffset = xpos - gLastX;
-	float yoffset = gLastY - ypos; 
-
-	gLastX = xpos;
-	gLastY = ypos;
-
-	gCamera.ProcessMouseMovement(xoffset, yoffset);
-
-	// https://stackoverflow.com/questions/66823783/toggle-between-ortho-and-perspective-views-in-opengl
-}
+	const Lightmap::Stats& stats = lightmap.LastBake();
+	std::cout << "INFO: Lightmap " << lightmap.Size() << "x" << lightmap.Size() << ", " << stats.charts << " charts, " << stats.texels << " texels at "
+		<< stats.texelsPerUnit << " per unit, " << threads << " thread(s): " << stats.seconds << " s, " << stats.rays / stats.seconds / 1e6 << " Mrays/s" << std::endl;
 
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
-{
-	if (yoffset > 0.0)
-		gCameraSpeed *= 2.1f;
-	else if (yoffset < 0.0)
-		gCameraSpeed /= 1.1f;
+	if (!lightmap.Write(output))
+	{
+		std::cout << "ERROR::LIGHTMAP::WRITE_FAILED " << output << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "INFO: Lightmap written to " << output << std::endl;
+	return EXIT_SUCCESS;
 }
 
-void URender()
+// --lightmap <file>: the baked objects swap to their lightmapped meshes and the scene program reads their
+// lighting from the atlas. An object whose mesh no longer matches what was baked (--import) keeps its lights
+bool ULoadLightmap(const char* filename)
 {
-	glm::mat4 scale;
-	glm::mat4 rotation;
-	glm::mat4 translation;
-
-	glm::mat4 model;
-	glm::mat4 view;
-	glm::mat4 projection;
-
-	GLint modelLoc;
-	GLint viewLoc;
-	GLint projLoc;
-
-	// Enable z-depth
-	glEnable(GL_DEPTH_TEST);
-
-	// Clear the frame and z buffers
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// camera/view transformation
-	view = glm::lookAt(gCameraPos, gCameraPos + gCameraFront, gCameraUp);
-
-	// Creates an perspective projection
-	view = gCamera.GetViewMatrix();
-	projection = glm::perspective(glm::radians(60.0f), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-
-	// Set the shader to be used
-
-	glUseProgram(gProgramId);
-
-	glUniform3fv(glGetUniformLocation(gProgramId, "viewPos"), 1, glm::value_ptr(gCameraPos));
-
-	glUniform1i(glGetUniformLocation(gProgramId, "material.diffuse"), 0);
-	glUniform1f(glGetUniformLocation(gProgramId, "material.shininess"), 32.0f);
-
-
-	// directional light
-	// this is literally from the first assignment - https://learnopengl.com/Lighting/Light-casters
-	// directional - point came from a couple sources - https://www.reddit.com/r/opengl/comments/321c5r/gluniform3fv_vec3_myarray_and_confusion/
-	// https://glm.g-truc.net/0.9.2/api/a00001.html
-	// https://learnopengl.com/code_viewer.php?code=lighting%2Fmultiple_lights - just needed to slightly tweak based off the code found here
-
-	glUniform3fv(glGetUniformLocation(gProgramId, "dirLight.direction"), 1, glm::value_ptr(glm::vec3(-0.2f, -1.0f, -0.3f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "dirLight.ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "dirLight.diffuse"), 1, glm::value_ptr(glm::vec3(0.4f, 0.4f, 0.4f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "dirLight.specular"), 1, glm::value_ptr(glm::vec3(0.5f, 0.5f, 0.5f)));
-	glUniform1f(glGetUniformLocation(gProgramId, "dirLight.intensity"), 1.0f);
-
-
-
-	// point light 1
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[0].position"), 1, glm::value_ptr(glm::vec3(0.0f, 3.0f, 0.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[0].ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[0].diffuse"), 1, glm::value_ptr(glm::vec3(0.8f, 0.8f, 0.8f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[0].specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[0].constant"), 1.0f);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[0].linear"), 0.09);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[0].quadratic"), 0.032);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[0].intensity"), 1.0f);
-
-	// point light 2
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[1].position"), 1, glm::value_ptr(glm::vec3(-8.0f, 3.0f, -8.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[1].ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[1].diffuse"), 1, glm::value_ptr(glm::vec3(0.8f, 0.8f, 0.8f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[1].specular"), 1, glm::value_ptr(glm::vec3(0.8f, 0.8f, 0.0f)));
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[1].constant"), 1.0f);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[1].linear"), 0.09);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[1].quadratic"), 0.032);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[1].intensity"), 1.0f);
-
-	// point light 3
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[2].position"), 1, glm::value_ptr(glm::vec3(8.0f, 3.0f, -8.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[2].ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[2].diffuse"), 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, 0.8f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[2].specular"), 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, 0.8f)));
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[2].constant"), 1.0f);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[2].linear"), 0.09);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[2].quadratic"), 0.032);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[2].intensity"), 1.0f);
-
-	// point light 4
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[3].position"), 1, glm::value_ptr(glm::vec3(-8.0f, 3.0f, 8.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[3].ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[3].diffuse"), 1, glm::value_ptr(glm::vec3(0.0f, 0.8f, 0.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[3].specular"), 1, glm::value_ptr(glm::vec3(0.0f, 0.8f, 0.0f)));
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[3].constant"), 1.0f);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[3].linear"), 0.09);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[3].quadratic"), 0.032);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[3].intensity"), 1.0f);
-
-	// point light 5
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[4].position"), 1, glm::value_ptr(glm::vec3(8.0f, 3.0f, 8.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[4].ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[4].diffuse"), 1, glm::value_ptr(glm::vec3(0.8f, 0.0f, 0.0f)));
-	glUniform3fv(glGetUniformLocation(gProgramId, "pointLights[4].specular"), 1, glm::value_ptr(glm::vec3(0.8f, 0.0f, 0.0f)));
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[4].constant"), 1.0f);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[4].linear"), 0.09);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[4].quadratic"), 0.032);
-	glUniform1f(glGetUniformLocation(gProgramId, "pointLights[4].intensity"), 1.0f);
-
-
-	// Retrieves and passes transform matrices to the Shader program
-	modelLoc = glGetUniformLocation(gProgramId, "model");
-	viewLoc = glGetUniformLocation(gProgramId, "view");
-	projLoc = glGetUniformLocation(gProgramId, "projection");
-
-	glUniform1i(glGetUniformLocation(gProgramId, "hasTextureTransparency"), 0);
-
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-	//desk
-	glBindVertexArray(meshes.gPlaneMesh.vao);
-	scale = glm::scale(glm::vec3(8.0f, 8.0f, 8.0f));
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-	model = scale * translation;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdDesk);
-	glUniform1i(glGetUniformLocation(gProgramId, "hasTexture"), 1);
-	glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-	glBindVertexArray(0);
-
-	//gTextureIdMug
-	//mug
-	glBindVertexArray(meshes.gCylinderMesh.vao);
-	scale = glm::scale(glm::vec3(0.45f, 1.2f, 0.45f));
-	translation = glm::translate(glm::vec3(-3.0f, 0.0f, 3.0f));
-	model = translation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdMug);
-	glUniform1i(glGetUniformLocation(gProgramId, "hasTexture"), 1);
-	glUniform3fv(glGetUniformLocation(gProgramId, "meshColor"), 1, glm::value_ptr(glm::vec3(0.8f, 0.8f, 0.8f)));
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
-
-	//gTextureIdPenTop
-	//pen top
-	glBindVertexArray(meshes.gSphereMesh.vao);
-	scale = glm::scale(glm::vec3(0.04f, 0.04f, 0.04f));
-	translation = glm::translate(glm::vec3(-1.52f, 0.04f, 2.07f));
-	model = translation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdMug);
-	glUniform1i(glGetUniformLocation(gProgramId, "hasTexture"), 1);
-	glUniform3fv(glGetUniformLocation(gProgramId, "meshColor"), 1, glm::value_ptr(glm::vec3(0.2f, 0.2f, 0.2f)));
-	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-	glBindVertexArray(0);
+	Lightmap lightmap;
+	if (!lightmap.Read(filename))
+	{
+		std::cout << "ERROR::LIGHTMAP::READ_FAILED " << filename << std::endl;
+		return false;
+	}
 
-	//gTextureIdBotCap
-	//bottle cap
-	glBindVertexArray(meshes.gPyramid4Mesh.vao);
-	translation = glm::translate(glm::vec3(0.0f, 0.9f, 2.0f));
-	scale = glm::scale(glm::vec3(0.22f, 0.22f, 0.22f));
-	model = translation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdBotCap);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid4Mesh.nVertices);	glBindVertexArray(0);
-
-
-	//Pen body
-	//gTextureIdPenBod
-	glBindVertexArray(meshes.gCylinderMesh.vao);
-	scale = glm::scale(glm::vec3(0.03f, 1.5f, 0.03f));
-	rotation = glm::rotate(glm::radians(-70.0f), glm::vec3(0.0, 1.0f, 0.0f));
-	rotation = glm::rotate(rotation, glm::radians(90.0f), glm::vec3(0.0, 0.0f, 1.0f));
-	translation = glm::translate(glm::vec3(-1.0f, 0.03f, 3.5f));
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdPenBod);
-	glUniform1i(glGetUniformLocation(gProgramId, "hasTexture"), 1);
-	glUniform3fv(glGetUniformLocation(gProgramId, "meshColor"), 1, glm::value_ptr(glm::vec3(0.8f, 0.8f, 0.8f)));
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
-
-	//gTextureIdBottl
-	//bottle
-	glBindVertexArray(meshes.gCylinderMesh.vao);
-	scale = glm::scale(glm::vec3(0.15f, 0.8f, 0.15f));
-	translation = glm::translate(glm::vec3(0.0f, 0.0f, 2.0f));
-	model = translation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdBottl);
-	glUniform1i(glGetUniformLocation(gProgramId, "hasTexture"), 1);
-	glUniform3fv(glGetUniformLocation(gProgramId, "meshColor"), 1, glm::value_ptr(glm::vec3(0.8f, 0.8f, 0.8f)));
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
-
-	//container
-	glBindVertexArray(meshes.gBoxMesh.vao);
-	translation = glm::translate(glm::vec3(1.0f, 0.15f, 3.0f));
-	scale = glm::scale(glm::vec3(1.0f, 0.15f, 0.6f));
-	model = translation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glBindTexture(GL_TEXTURE_2D, gTextureIdCon);
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	int applied = 0;
+	for (const Lightmap::BakedObject& baked : lightmap.Objects())
+	{
+		if (baked.object < 0 || baked.object >= OBJECT_COUNT)
+			continue;
+		SceneDrawable& drawable = gSceneDrawables[baked.object];
+		const Meshes::GLMesh* source = meshes.Get(drawable.mesh);
+		int sourceTriangles = 0;
+		if (source)
+		{
+			for (const Meshes::GLMesh::Range& range : source->ranges)
+				sourceTriangles += UPrimitiveTriangleCount(range.primitive, range.count);
+		}
+		if (drawable.dynamic || drawable.chunk >= 0 || sourceTriangles != baked.sourceTriangles)
+		{
+			std::cout << "INFO: Lightmap skips object " << baked.object << ", it changed since the bake" << std::endl;
+			continue;
+		}
 
+		MeshHandle mesh = meshes.CreateLightmappedMesh(baked.vertices.data(), baked.vertices.size());
+		gTransforms.AttachDrawIds(meshes.Get(mesh)->vao);
+		drawable.mesh = mesh;
+		drawable.lightmapped = true;
+		applied++;
+	}
 
-	glfwSwapBuffers(gWindow);
+	// the bounces can go past 1, half floats keep them
+	int size = lightmap.Size();
+	UDestroyTexture(gLightmapTexture);
+	GLuint textureId = gGpuMemory.GenTexture(GpuMemory::CATEGORY_TEXTURE, "lightmap");
+	glBindTexture(GL_TEXTURE_2D, textureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, lightmap.Texels().data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gGpuMemory.SetTextureBytes(textureId, GpuMemory::TextureBytes(size, size, 6, false));
+	gLightmapTexture = gTexturePool.Create(textureId);
+
+	gStaticSceneVersion++;
+	std::cout << "INFO: Lightmap " << filename << ", " << size << "x" << size << ", " << applied << " object(s) baked" << std::endl;
+	return true;
 }
 
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// --bench-picking: --queries (4096) rays from the default camera on a grid over the window through the
+// ScenePicker, checked against brute force over every triangle first, then timed one at a time and batched
+// on 1, 2, 4... up to --threads pool threads
+int UBenchmarkPicking(int argc, char* argv[])
 {
-	int success = 0;
-	char infoLog[512];
+	int queries = std::max((int)UArgFloat(argc, argv, "--queries", 4096.0f), 1);
+	int maxThreads = std::max((int)UArgFloat(argc, argv, "--threads", (float)std::thread::hardware_concurrency()), 1);
 
-	programId = glCreateProgram();
-	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-	glShaderSource(vertexShaderId, 1, &vtxShaderSource, nullptr);
-	glShaderSource(fragmentShaderId, 1, &fragShaderSource, nullptr);
+	meshes.CreateMeshes(false);
+	USetupSceneTransforms();
+	USetupMaterials();
 
-	glCompileShader(vertexShaderId);
-	glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-	if (!success)
+	std::vector<MeshHandle> objectMeshes(OBJECT_COUNT);
+	std::vector<glm::mat4> models(OBJECT_COUNT);
+	for (int object = 0; object < OBJECT_COUNT; object++)
 	{
-		glGetShaderInfoLog(vertexShaderId, 512, nullptr, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-		glDeleteShader(vertexShaderId); // Delete the shader object
-		return false;
+		objectMeshes[object] = gSceneDrawables[object].mesh;
+		models[object] = gTransforms.Model(object);
 	}
-
-	glCompileShader(fragmentShaderId);
-	glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-	if (!success)
+	ScenePicker picker;
+	picker.Update(meshes.Pool(), objectMeshes, models);
+	const ScenePicker::Stats& stats = picker.LastUpdate();
+	std::cout << "INFO: Picking BLAS " << stats.meshes << " mesh(es), " << stats.triangles << " triangles, TLAS "
+		<< stats.objects << " objects, built in " << stats.buildMs << " ms" << std::endl;
+
+	int side = (int)std::ceil(std::sqrt((double)queries));
+	std::vector<ScenePicker::Ray> rays(queries);
+	for (int i = 0; i < queries; i++)
 	{
-		glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), nullptr, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-		glDeleteShader(vertexShaderId);   // Delete the shader objects
-		glDeleteShader(fragmentShaderId);
-		return false;
+		glm::vec2 cursor(((i % side) + 0.5f) / side, ((i / side) + 0.5f) / side);
+		rays[i] = ScenePicker::CameraRay(gCamera, glm::radians(60.0f), (float)WINDOW_WIDTH / WINDOW_HEIGHT, cursor);
 	}
 
-	glAttachShader(programId, vertexShaderId);
-	glAttachShader(programId, fragmentShaderId);
+	// brute force: every triangle of every object in world space
+	std::vector<std::vector<glm::vec3>> worldCorners(OBJECT_COUNT);
+	for (int object = 0; object < OBJECT_COUNT; object++)
+	{
+		const Meshes::GLMesh* mesh = meshes.Get(objectMeshes[object]);
+		if (!mesh || mesh->vertices.empty())
+			continue;
+		for (const Meshes::GLMesh::Range& range : mesh->ranges)
+		{
+			DrawPacket packet = {};
+			packet.primitive = range.primitive;
+			packet.indexed = range.indexed;
+			packet.first = range.first;
+			packet.count = range.count;
+			for (int triangle = 0; triangle < UPrimitiveTriangleCount(packet.primitive, packet.count); triangle++)
+			{
+				GLuint vertices[3];
+				UPacketTriangleVertices(packet, *mesh, triangle, vertices);
+				for (GLuint vertex : vertices)
+				{
+					const GLfloat* position = &mesh->vertices[vertex * 8];
+					worldCorners[object].push_back(glm::vec3(models[object] * glm::vec4(position[0], position[1], position[2], 1.0f)));
+				}
+			}
+		}
+	}
 
-	glLinkProgram(programId);
-	glGetProgramiv(programId, GL_LINK_STATUS, &success);
-	if (!success)
+	std::vector<ScenePicker::Hit> hits(queries);
+	int hitCount = 0, mismatches = 0;
+	for (int i = 0; i < queries; i++)
 	{
-		glGetProgramInfoLog(programId, sizeof(infoLog), nullptr, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-		glDeleteShader(vertexShaderId);   // Delete the shader objects
-		glDeleteShader(fragmentShaderId);
-		return false;
+		hits[i] = picker.Intersect(rays[i]);
+		hitCount += hits[i].object >= 0;
+
+		float closest = FLT_MAX;
+		int closestObject = -1;
+		for (int object = 0; object < OBJECT_COUNT; object++)
+		{
+			const std::vector<glm::vec3>& corners = worldCorners[object];
+			for (size_t c = 0; c < corners.size(); c += 3)
+			{
+				glm::vec3 edge1 = corners[c + 1] - corners[c], edge2 = corners[c + 2] - corners[c];
+				glm::vec3 p = glm::cross(rays[i].direction, edge2);
+				float determinant = glm::dot(edge1, p);
+				if (std::fabs(determinant) < 1e-12f)
+					continue;
+				glm::vec3 offset = rays[i].origin - corners[c];
+				glm::vec3 q = glm::cross(offset, edge1);
+				float u = glm::dot(offset, p) / determinant;
+				float v = glm::dot(rays[i].direction, q) / determinant;
+				float t = glm::dot(edge2, q) / determinant;
+				if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < closest)
+				{
+					closest = t;
+					closestObject = object;
+				}
+			}
+		}
+		// a ray through a shared edge can land on either object, only a different distance counts
+		if ((closestObject < 0) != (hits[i].object < 0) || (closestObject >= 0 && std::fabs(closest - hits[i].t) > 1e-3f * closest))
+			mismatches++;
 	}
+	std::cout << "INFO: Picking " << hitCount << " of " << queries << " rays hit, " << mismatches << " disagree with brute force" << std::endl;
 
-	glDetachShader(programId, vertexShaderId);   // Detach the shader objects
-	glDetachShader(programId, fragmentShaderId);
-	glDeleteShader(vertexShaderId);   // Delete the shader objects
-	glDeleteShader(fragmentShaderId);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < queries; i++)
+		hits[i] = picker.Intersect(rays[i]);
+	double single = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "INFO: Picking one at a time: " << single << " ms, " << single * 1000.0 / queries << " us/query" << std::endl;
 
-	glUseProgram(programId);
-	GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-	GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+	for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+	{
+		WorkerPool pool;
+		pool.Initialize(threads - 1);
 
+		double best = 1e30;
+		for (int run = 0; run < 3; run++)
+		{
+			start = std::chrono::steady_clock::now();
+			picker.IntersectBatch(rays.data(), hits.data(), queries, pool);
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		pool.Destroy();
+		std::cout << "INFO: Picking batched, " << threads << " thread(s): " << best << " ms, " << queries / best / 1000.0
+			<< " Mqueries/s" << std::endl;
 
-	return true;
+		if (threads == maxThreads)
+			break;
+	}
+	return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-void UDestroyShaderProgram(GLuint programId)
-{
-	glDeleteProgram(programId);
-}
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// --bench-streaming: the --stream grid without a GL context (meshes only keep their CPU side). A camera flies
+// across the grid over --frames (600) frames of --frame-ms (4) each and then holds still at the far edge.
+// Every frame every chunk has to resolve to a live mesh, and once the camera stops everything in range has
+// to turn resident and the loaders go idle
+int UBenchmarkStreaming(int argc, char* argv[])
 {
-	int width, height, channels;
-	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-	if (image)
+	const char* directory = UArgString(argc, argv, "--stream", nullptr);
+	if (!directory)
 	{
+		std::cout << "ERROR::STREAMING::NO_DIRECTORY --bench-streaming needs --stream <dir>" << std::endl;
+		return EXIT_FAILURE;
+	}
+	int frames = std::max((int)UArgFloat(argc, argv, "--frames", 600.0f), 1);
+	int frameMs = std::max((int)UArgFloat(argc, argv, "--frame-ms", 4.0f), 0);
 
+	meshes.CreateMeshes(false);
+	if (!USetupStreaming(directory, argc, argv))
+		return EXIT_FAILURE;
 
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-
-		// set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		// set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// the tiles are laid out around the origin, fly through the middle row from one edge to the other
+	float halfWidth = 0.0f;
+	for (int i = 0; i < (int)gSceneDrawables.size(); i++)
+	{
+		if (gSceneDrawables[i].chunk >= 0)
+			halfWidth = std::max(halfWidth, std::fabs(gTransforms.Position(i).x) + 4.0f);
+	}
 
-		if (channels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		else if (channels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else
+	size_t peakResident = 0;
+	int uploads = 0, staleHandles = 0, maxFallbacks = 0;
+	auto frame = [&](const glm::vec3& position)
+	{
+		gStreamer.Update(position);
+		const GeometryStreamer::Stats& stats = gStreamer.LastFrame();
+		uploads += stats.uploads;
+		peakResident = std::max(peakResident, stats.residentBytes);
+		maxFallbacks = std::max(maxFallbacks, stats.fallbacks);
+		for (const SceneDrawable& drawable : gSceneDrawables)
 		{
-			cout << "Not implemented to handle image with " << channels << " channels" << endl;
-			return false;
+			if (drawable.chunk >= 0 && !meshes.Get(gStreamer.Resolve(drawable.chunk)))
+				staleHandles++;
 		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(frameMs));
+	};
 
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		stbi_image_free(image);
-		glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-		glBindTexture(GL_TEXTURE_2D, 1);
-		glBindTexture(GL_TEXTURE_2D, 2);
+	for (int f = 0; f < frames; f++)
+		frame(glm::vec3(-halfWidth + 2.0f * halfWidth * f / std::max(frames - 1, 1), 2.0f, 0.0f));
 
-		return true;
+	// parked: give the loaders up to 10 seconds to catch up
+	glm::vec3 parked(halfWidth, 2.0f, 0.0f);
+	int settleFrames = 0;
+	bool settled = false;
+	for (; settleFrames < 10000 / std::max(frameMs, 1) && !settled; settleFrames++)
+	{
+		frame(parked);
+		const GeometryStreamer::Stats& stats = gStreamer.LastFrame();
+		settled = stats.fallbacks == 0 && stats.queued == 0 && stats.loading == 0 && stats.awaitingUpload == 0;
 	}
 
-	// Error loading the image
-	return false;
-}
-void UDestroyTexture(GLuint textureId)
-{
-	glDeleteTextures(1, &textureId);
-}
-
-// other non directly cited sources
-// https://gamedev.stackexchange.com/questions/181782/how-can-i-change-the-camera-to-work-from-an-y-up-system-to-a-z-up
-//  https://www.reddit.com/r/opengl/comments/xpplbw/cylinder_modern_opengl/
-// https://learnopengl.com/
-// https://www.reddit.com/r/GraphicsProgramming/comments/pq0z6k/just_started_learning_opengl_and_i_want_to_cry/ 
-// https://www.youtube.com/watch?v=Q7vm264YNrM ( this guy's youtube videos were amazing )
-// https://www.khronos.org/files/opengl45-quick-reference-card.pdf - Best cheat sheet I've found
-// http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-9-vbo-indexing/ 
-// Also should be noted I used SNHU tutorials 
-// this is the V2 created on 10.17.23
+	const GeometryStreamer::Stats& stats = gStreamer.LastFrame();
+	std::cout << "INFO: Streaming " << frames << " frames, " << uploads << " uploads, " << stats.evictions << " evictions, peak resident "
+		<< peakResident / 1024 << " KB, most fallbacks in a frame " << maxFallbacks << ", load " << stats.loadMs << " ms, request to resident "
+		<< stats.latencyMs << " ms" << std::endl;
+	std::cout << "INFO: Streaming " << (settled ? "settled" : "did not settle") << " after " << settleFrames << " parked frames, "
+		<< stats.resident << " resident, " << staleHandles << " stale handles" << std::endl;
 
+	gStreamer.Destroy();
+	meshes.DestroyMeshes();
+	return settled && staleHandles == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}